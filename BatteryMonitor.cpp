@@ -0,0 +1,200 @@
+//
+//  BatteryMonitor.cpp
+//
+//  NexDome X2 plugin for V3 firmware
+//  Shutter battery statistics, see BatteryMonitor.h
+
+#include <math.h>
+#include "BatteryMonitor.h"
+
+CBatteryMonitor::CBatteryMonitor()
+{
+    m_dCutoffVolts = BATTERY_DEFAULT_CUTOFF;
+    reset();
+}
+
+void CBatteryMonitor::reset()
+{
+    memset(m_History, 0, sizeof(m_History));
+    m_nHead = 0;
+    m_nCount = 0;
+    m_nSamples = 0;
+    m_bMoving = false;
+    m_dRestVolts = -1.0;
+    m_dRestBeforeMove = -1.0;
+    m_nUnsettledMoves = 0;
+    m_dMoveMinVolts = -1.0;
+    m_bWaitRest = false;
+    m_dMoveEndTime = 0;
+    m_dIdleStart = 0;
+    m_dMoveDrop = 0;
+    m_dMoveSag = 0;
+    m_nMoves = 0;
+    m_bStatsDirty = true;
+}
+
+void CBatteryMonitor::addSample(double dTime, double dVolts)
+{
+    double dDrop;
+
+    m_History[m_nHead].dTime = dTime;
+    m_History[m_nHead].fVolts = float(dVolts);
+    m_History[m_nHead].bMoving = m_bMoving;
+    m_nHead = (m_nHead + 1) % BATTERY_HISTORY_SIZE;
+    if(m_nCount < BATTERY_HISTORY_SIZE)
+        m_nCount++;
+    m_nSamples++;
+    m_bStatsDirty = true;
+
+    if(m_bMoving) {
+        if(m_dMoveMinVolts < 0 || dVolts < m_dMoveMinVolts)
+            m_dMoveMinVolts = dVolts;
+        return;
+    }
+
+    if(m_bWaitRest) {
+        if(dTime - m_dMoveEndTime < BATTERY_SETTLE_TIME)
+            return; // still recovering from the load
+        if(m_dRestBeforeMove > 0) {
+            // a negative drop means the panel charged more than the move used, keep it as 0.
+            dDrop = (m_dRestBeforeMove - dVolts) / m_nUnsettledMoves;
+            if(dDrop < 0)
+                dDrop = 0;
+            if(m_dMoveDrop == 0)
+                m_dMoveDrop = dDrop;
+            else
+                m_dMoveDrop += BATTERY_EWMA_ALPHA * (dDrop - m_dMoveDrop);
+        }
+        m_bWaitRest = false;
+        m_dIdleStart = dTime;
+    }
+    m_dRestVolts = dVolts;
+}
+
+void CBatteryMonitor::shutterMoveStarted(double dTime)
+{
+    (void)dTime;
+    if(m_bMoving)
+        return;
+    m_bMoving = true;
+    m_bStatsDirty = true;
+    // back to back moves (open then close) share the rest voltage measured before the first one.
+    if(!m_bWaitRest) {
+        m_dRestBeforeMove = m_dRestVolts;
+        m_nUnsettledMoves = 0;
+    }
+    m_dMoveMinVolts = -1.0;
+}
+
+void CBatteryMonitor::shutterMoveEnded(double dTime)
+{
+    double dSag;
+
+    if(!m_bMoving)
+        return;
+    m_bMoving = false;
+    m_bStatsDirty = true;
+    m_nMoves++;
+    m_nUnsettledMoves++;
+
+    if(m_dRestBeforeMove > 0 && m_dMoveMinVolts > 0) {
+        dSag = m_dRestBeforeMove - m_dMoveMinVolts;
+        if(dSag < 0)
+            dSag = 0;
+        if(m_dMoveSag == 0)
+            m_dMoveSag = dSag;
+        else
+            m_dMoveSag += BATTERY_EWMA_ALPHA * (dSag - m_dMoveSag);
+    }
+    m_bWaitRest = true;
+    m_dMoveEndTime = dTime;
+}
+
+// least squares slope of the idle samples since the last move settled, in V/h
+double CBatteryMonitor::idleRate()
+{
+    int i, nIdx, n = 0;
+    double dT0 = 0;
+    double dFirst = 0, dLast = 0;
+    double dSumT = 0, dSumV = 0, dSumTT = 0, dSumTV = 0;
+    double dT, dDenom;
+
+    for(i = 0; i < m_nCount; i++) {
+        nIdx = (m_nHead - m_nCount + i + BATTERY_HISTORY_SIZE) % BATTERY_HISTORY_SIZE;
+        if(m_History[nIdx].bMoving || m_History[nIdx].dTime < m_dIdleStart)
+            continue;
+        if(!n) {
+            dT0 = m_History[nIdx].dTime;
+            dFirst = dT0;
+        }
+        dLast = m_History[nIdx].dTime;
+        dT = m_History[nIdx].dTime - dT0;   // relative time keeps the sums well conditioned
+        dSumT += dT;
+        dSumV += m_History[nIdx].fVolts;
+        dSumTT += dT * dT;
+        dSumTV += dT * m_History[nIdx].fVolts;
+        n++;
+    }
+
+    if(n < 3 || dLast - dFirst < BATTERY_MIN_IDLE_SPAN)
+        return 0;
+    dDenom = n * dSumTT - dSumT * dSumT;
+    if(dDenom <= 0)
+        return 0;
+    return ((n * dSumTV - dSumT * dSumV) / dDenom) * 3600.0;
+}
+
+void CBatteryMonitor::getStats(BatteryStats &stats)
+{
+    if(m_bStatsDirty) {
+        computeStats();
+        m_bStatsDirty = false;
+    }
+    stats = m_Stats;
+}
+
+void CBatteryMonitor::computeStats()
+{
+    int i;
+    double dSum = 0;
+    double dUsable;
+    BatteryStats &stats = m_Stats;
+
+    memset(&stats, 0, sizeof(BatteryStats));
+    stats.dVolts = -1.0;
+    stats.nCyclesLeft = -1;
+    stats.dHoursToCutoff = -1.0;
+    stats.dCutoffVolts = m_dCutoffVolts;
+    stats.nSamples = m_nSamples;
+    stats.nMoves = m_nMoves;
+    stats.dMoveDrop = m_dMoveDrop;
+    stats.dMoveSag = m_dMoveSag;
+
+    if(!m_nCount)
+        return;
+
+    stats.dMinVolts = 1e9;
+    stats.dMaxVolts = -1e9;
+    for(i = 0; i < m_nCount; i++) {
+        dSum += m_History[i].fVolts;
+        if(m_History[i].fVolts < stats.dMinVolts)
+            stats.dMinVolts = m_History[i].fVolts;
+        if(m_History[i].fVolts > stats.dMaxVolts)
+            stats.dMaxVolts = m_History[i].fVolts;
+    }
+    stats.dMeanVolts = dSum / m_nCount;
+    i = (m_nHead - 1 + BATTERY_HISTORY_SIZE) % BATTERY_HISTORY_SIZE;
+    stats.dVolts = m_History[i].fVolts;
+    stats.dLastSampleTime = m_History[i].dTime;
+    stats.dIdleRate = idleRate();
+
+    if(m_dRestVolts < 0)
+        return;
+
+    // the next move has to start high enough that the sag doesn't take us below the cutoff
+    dUsable = m_dRestVolts - m_dMoveSag - m_dCutoffVolts;
+    if(m_dMoveDrop > 0)
+        stats.nCyclesLeft = dUsable > 0 ? int(floor(dUsable / (2.0 * m_dMoveDrop))) : 0;
+    if(stats.dIdleRate < 0)
+        stats.dHoursToCutoff = dUsable > 0 ? dUsable / -stats.dIdleRate : 0;
+}
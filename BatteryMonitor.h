@@ -0,0 +1,94 @@
+//
+//  BatteryMonitor.h
+//
+//  NexDome X2 plugin for V3 firmware
+//  Shutter battery statistics built from the ':BV' reports.
+//
+//  Every sample is timestamped and kept in a small history. The voltage at rest before and after
+//  each shutter move gives the charge used by a move, the lowest voltage seen during the move gives
+//  the sag under load, and a linear fit of the idle samples gives the idle drain (or charge) rate.
+//  From these we estimate how many open/close cycles are left before the battery would drop below
+//  the cutoff voltage in the middle of a move.
+//  Times are seconds on a monotonic clock (CStopWatch::GetMonotonicSeconds) so a clock step doesn't
+//  break the settle time or the drain rate.
+
+#ifndef __BATTERY_MONITOR__
+#define __BATTERY_MONITOR__
+
+#include <stdint.h>
+#include <string.h>
+
+#define BATTERY_HISTORY_SIZE        512
+#define BATTERY_DEFAULT_CUTOFF      11.5    // V, lowest voltage under load we accept
+#define BATTERY_SETTLE_TIME         30.0    // seconds after a move before the voltage is considered at rest
+#define BATTERY_MIN_IDLE_SPAN       600.0   // seconds of idle samples needed to compute a drain rate
+#define BATTERY_EWMA_ALPHA          0.3
+
+typedef struct {
+    double  dTime;
+    float   fVolts;
+    uint8_t bMoving;
+} BatterySample;
+
+typedef struct {
+    double  dVolts;             // last reported voltage, -1 if none yet
+    double  dLastSampleTime;    // time of the last :BV, on the clock used by the caller
+    double  dMinVolts;          // over the history
+    double  dMaxVolts;
+    double  dMeanVolts;
+    int     nSamples;           // total number of samples received
+    double  dIdleRate;          // V/h at rest, negative when discharging, 0 if unknown
+    double  dMoveDrop;          // V lost at rest per shutter move, 0 if unknown
+    double  dMoveSag;           // V drop under load during a move, 0 if unknown
+    int     nMoves;
+    int     nCyclesLeft;        // open + close cycles before reaching the cutoff, -1 if unknown
+    double  dHoursToCutoff;     // at the idle rate, -1 if unknown or not discharging
+    double  dCutoffVolts;
+} BatteryStats;
+
+
+class CBatteryMonitor
+{
+public:
+    CBatteryMonitor();
+
+    void    reset(void);
+    void    setCutoffVolts(double dVolts) { m_dCutoffVolts = dVolts; m_bStatsDirty = true; }
+    double  getCutoffVolts(void) { return m_dCutoffVolts; }
+
+    void    addSample(double dTime, double dVolts);
+    void    shutterMoveStarted(double dTime);
+    void    shutterMoveEnded(double dTime);
+    bool    isShutterMoving(void) { return m_bMoving; }
+
+    void    getStats(BatteryStats &stats);
+
+protected:
+    double  idleRate(void);
+    void    computeStats(void);
+
+    BatterySample   m_History[BATTERY_HISTORY_SIZE];
+    int             m_nHead;        // next slot to write
+    int             m_nCount;
+    int             m_nSamples;
+
+    double          m_dCutoffVolts;
+    bool            m_bMoving;
+    double          m_dRestVolts;       // last voltage at rest, -1 if unknown
+    double          m_dRestBeforeMove;
+    int             m_nUnsettledMoves;  // moves since m_dRestBeforeMove was measured
+    double          m_dMoveMinVolts;
+    bool            m_bWaitRest;        // a move ended, waiting for the voltage to settle
+    double          m_dMoveEndTime;
+    double          m_dIdleStart;       // idle samples older than this are not used for the drain rate
+
+    double          m_dMoveDrop;
+    double          m_dMoveSag;
+    int             m_nMoves;
+
+    // the history scan and the idle fit are only redone when a sample or a move changed them
+    BatteryStats    m_Stats;
+    bool            m_bStatsDirty;
+};
+
+#endif
@@ -0,0 +1,123 @@
+//
+//  DomeFollow.cpp
+//
+//  NexDome X2 plugin for V3 firmware
+//  Dome following planner, see DomeFollow.h
+
+#include "DomeFollow.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+CDomeFollowPlanner::CDomeFollowPlanner()
+{
+    memset(&m_Config, 0, sizeof(FollowConfig));
+    m_Config.dDomeRadius = 1.0;
+    m_Config.dGuard = FOLLOW_DEFAULT_GUARD;
+    m_Config.dLeadSeconds = FOLLOW_DEFAULT_LEAD;
+}
+
+double CDomeFollowPlanner::azDistance(double dFrom, double dTo)
+{
+    double dDistance = fmod(dTo - dFrom + 180.0, 360.0);
+
+    if(dDistance < 0)
+        dDistance += 360.0;
+    return dDistance - 180.0;
+}
+
+double CDomeFollowPlanner::halfWidth(double dSlitAlt) const
+{
+    double dClear = (m_Config.dSlitWidth - m_Config.dAperture) / 2.0;
+    double dRing = m_Config.dDomeRadius * cos(dSlitAlt * M_PI / 180.0);
+
+    if(dClear <= 0)
+        return -m_Config.dGuard;
+    // at the top the slit is wider than the ring the beam goes through, any azimuth works
+    if(dClear >= dRing)
+        return 180.0;
+    return asin(dClear / dRing) * 180.0 / M_PI - m_Config.dGuard;
+}
+
+bool CDomeFollowPlanner::isCovered(double dDomeAz, double dTargetAz, double dSlitAlt) const
+{
+    return fabs(azDistance(dDomeAz, dTargetAz)) <= halfWidth(dSlitAlt);
+}
+
+// the dome azimuths covering the path from nStart on, for as long as there are some
+void CDomeFollowPlanner::coverFrom(const std::vector<double> &dPath, const std::vector<double> &dHalf, int nStart, double &dLow, double &dHigh)
+{
+    int i;
+
+    dLow = dPath[nStart] - dHalf[nStart];
+    dHigh = dPath[nStart] + dHalf[nStart];
+    // slit narrower than the aperture here, center on it
+    if(dLow > dHigh) {
+        dLow = dHigh = dPath[nStart];
+        return;
+    }
+    for(i = nStart + 1; i < int(dPath.size()); i++) {
+        if(std::max(dLow, dPath[i] - dHalf[i]) > std::min(dHigh, dPath[i] + dHalf[i]))
+            break;
+        dLow = std::max(dLow, dPath[i] - dHalf[i]);
+        dHigh = std::min(dHigh, dPath[i] + dHalf[i]);
+    }
+}
+
+int CDomeFollowPlanner::plan(const double *pTargetAz, const double *pSlitAlt, int nCount, double dStepSeconds, double dDomeAz, std::vector<FollowMove> &moves) const
+{
+    std::vector<double> dPath(nCount);
+    std::vector<double> dHalf(nCount);
+    FollowMove move;
+    double dDome, dLow, dHigh, dTarget;
+    int nLead;
+    int i, j, k;
+
+    moves.clear();
+    if(nCount <= 0 || dStepSeconds <= 0)
+        return 0;
+
+    // unwrapped, so the window below never has to care about 0/360
+    dPath[0] = pTargetAz[0];
+    dHalf[0] = halfWidth(pSlitAlt[0]);
+    for(i = 1; i < nCount; i++) {
+        dPath[i] = dPath[i - 1] + azDistance(pTargetAz[i - 1], pTargetAz[i]);
+        dHalf[i] = halfWidth(pSlitAlt[i]);
+    }
+    dDome = dPath[0] + azDistance(pTargetAz[0], dDomeAz);
+    nLead = int(ceil(m_Config.dLeadSeconds / dStepSeconds));
+
+    for(i = 0; i < nCount; i++) {
+        k = std::min(i + nLead, nCount - 1);
+        if(fabs(dPath[i] - dDome) <= dHalf[i] && fabs(dPath[k] - dDome) <= dHalf[k])
+            continue;
+
+        coverFrom(dPath, dHalf, i, dLow, dHigh);
+        // the path turns faster than the lead, the dome already covers as much as it can from now
+        if(dDome >= dLow && dDome <= dHigh) {
+            for(j = i; fabs(dPath[j] - dDome) <= dHalf[j]; j++)
+                ;
+            coverFrom(dPath, dHalf, j, dLow, dHigh);
+        }
+
+        // clamp first, a move the controller would ignore is then stretched to the dead zone, even past dHigh/dLow
+        dTarget = std::min(std::max(dDome, dLow), dHigh);
+        if(fabs(dTarget - dDome) < m_Config.dDeadZone)
+            dTarget = dDome + (dTarget >= dDome ? m_Config.dDeadZone : -m_Config.dDeadZone);
+
+        move.dTime = i * dStepSeconds;
+        move.dAz = fmod(dTarget, 360.0);
+        if(move.dAz < 0)
+            move.dAz += 360.0;
+        move.dDistance = dTarget - dDome;
+        move.dSlitAlt = pSlitAlt[i];
+        moves.push_back(move);
+        dDome = dTarget;
+    }
+    return int(moves.size());
+}
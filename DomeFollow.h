@@ -0,0 +1,67 @@
+//
+//  DomeFollow.h
+//
+//  NexDome X2 plugin for V3 firmware
+//  When to move the dome, and where to, to keep a tracked object in the slit with as few moves as possible.
+//
+//  The path is the dome azimuth and slit altitude the object needs over time (CDomeGeometry::trajectory).
+//  The beam is clear as long as it's within half the slit width, less half the aperture, of the slit center.
+//  That's more degrees of azimuth the higher the slit. A move is started dLeadSeconds before the beam would
+//  reach the slit edge. The dome goes where it covers the path the longest, and if several azimuths cover
+//  it equally long, to the nearest one. Starting each move as late as possible and covering as long as
+//  possible gives the fewest moves (greedy interval cover).
+//  Moves shorter than the dead zone aren't done by the controller, they're stretched to the dead zone.
+//
+//  No dependency on the X2 headers.
+
+#ifndef __DOME_FOLLOW__
+#define __DOME_FOLLOW__
+
+#include <math.h>
+
+#include <vector>
+
+#define FOLLOW_DEFAULT_GUARD        0.5     // degrees kept between the beam and the slit edge
+#define FOLLOW_DEFAULT_LEAD         10.0    // seconds, about a short slew
+
+typedef struct {
+    double  dSlitWidth;     // same unit as the dome radius
+    double  dAperture;      // telescope aperture diameter, same unit
+    double  dDomeRadius;
+    double  dGuard;         // degrees
+    double  dDeadZone;      // degrees
+    double  dLeadSeconds;
+} FollowConfig;
+
+typedef struct {
+    double  dTime;          // seconds from the start of the path
+    double  dAz;            // [0, 360)
+    double  dDistance;      // signed degrees from where the dome was
+    double  dSlitAlt;       // the altitude the move was planned for
+} FollowMove;
+
+class CDomeFollowPlanner
+{
+public:
+    CDomeFollowPlanner();
+
+    void    setConfig(const FollowConfig &config) { m_Config = config; }
+    const FollowConfig &getConfig(void) const { return m_Config; }
+
+    // degrees of azimuth the beam can be off the slit center at this slit altitude, guard included. Can be < 0.
+    double  halfWidth(double dSlitAlt) const;
+    bool    isCovered(double dDomeAz, double dTargetAz, double dSlitAlt) const;
+
+    // nCount samples every dStepSeconds, the dome at dDomeAz at the start. Returns the number of moves.
+    int     plan(const double *pTargetAz, const double *pSlitAlt, int nCount, double dStepSeconds, double dDomeAz, std::vector<FollowMove> &moves) const;
+
+    // signed shortest angle from dFrom to dTo, [-180, 180)
+    static double azDistance(double dFrom, double dTo);
+
+protected:
+    static void coverFrom(const std::vector<double> &dPath, const std::vector<double> &dHalf, int nStart, double &dLow, double &dHigh);
+
+    FollowConfig    m_Config;
+};
+
+#endif
@@ -0,0 +1,203 @@
+//
+//  DomeGeometry.cpp
+//
+//  NexDome X2 plugin for V3 firmware
+//  Telescope to dome azimuth, see DomeGeometry.h
+
+#include "DomeGeometry.h"
+
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define DEG_TO_RAD  (M_PI / 180.0)
+#define RAD_TO_DEG  (180.0 / M_PI)
+
+CDomeGeometry::CDomeGeometry()
+{
+    DomeGeometryConfig config;
+
+    memset(&config, 0, sizeof(DomeGeometryConfig));
+    config.dDomeRadius = 1.0;
+    setConfig(config);
+}
+
+void CDomeGeometry::setConfig(const DomeGeometryConfig &config)
+{
+    m_Config = config;
+    m_dSinLat = sin(config.dLatitude * DEG_TO_RAD);
+    m_dCosLat = cos(config.dLatitude * DEG_TO_RAD);
+    m_dRadius2 = config.dDomeRadius * config.dDomeRadius;
+}
+
+// optical axis from C along v (unit vector) to the dome sphere
+static inline void rayPoint(double dCE, double dCN, double dCU, double dVE, double dVN, double dVU, double dRadius2, double &dXE, double &dXN, double &dXU)
+{
+    double dB = dCE * dVE + dCN * dVN + dCU * dVU;
+    double dC = dCE * dCE + dCN * dCN + dCU * dCU - dRadius2;
+    double dT = sqrt(dB * dB - dC) - dB;
+
+    dXE = dCE + dT * dVE;
+    dXN = dCN + dT * dVN;
+    dXU = dCU + dT * dVU;
+}
+
+static inline void pointAngles(double dXE, double dXN, double dXU, double &dDomeAz, double &dSlitAlt)
+{
+    dDomeAz = atan2(dXE, dXN) * RAD_TO_DEG;
+    dDomeAz += dDomeAz < 0 ? 360.0 : 0.0;
+    dSlitAlt = atan2(dXU, sqrt(dXE * dXE + dXN * dXN)) * RAD_TO_DEG;
+}
+
+static inline void intersectRay(double dCE, double dCN, double dCU, double dVE, double dVN, double dVU, double dRadius2, double &dDomeAz, double &dSlitAlt)
+{
+    double dXE, dXN, dXU;
+
+    rayPoint(dCE, dCN, dCU, dVE, dVN, dVU, dRadius2, dXE, dXN, dXU);
+    pointAngles(dXE, dXN, dXU, dDomeAz, dSlitAlt);
+}
+
+inline void CDomeGeometry::intersect(double dSinHa, double dCosHa, double dSinDec, double dCosDec, double dSide, double &dDomeAz, double &dSlitAlt) const
+{
+    double dXE, dXN, dXU;
+
+    slitPoint(dSinHa, dCosHa, dSinDec, dCosDec, dSide, dXE, dXN, dXU);
+    pointAngles(dXE, dXN, dXU, dDomeAz, dSlitAlt);
+}
+
+inline void CDomeGeometry::slitPoint(double dSinHa, double dCosHa, double dSinDec, double dCosDec, double dSide, double &dXE, double &dXN, double &dXU) const
+{
+    // where the telescope points
+    double dVE = -dCosDec * dSinHa;
+    double dVN = dSinDec * m_dCosLat - dCosDec * dCosHa * m_dSinLat;
+    double dVU = dSinDec * m_dSinLat + dCosDec * dCosHa * m_dCosLat;
+    // the declination axis is square to the RA axis, 90 degrees of hour angle ahead of the tube
+    double dOffset = dSide * m_Config.dOtaOffset;
+    double dCE = m_Config.dMountEast - dOffset * dCosHa;
+    double dCN = m_Config.dMountNorth + dOffset * dSinHa * m_dSinLat;
+    double dCU = m_Config.dMountUp - dOffset * dSinHa * m_dCosLat;
+
+    rayPoint(dCE, dCN, dCU, dVE, dVN, dVU, m_dRadius2, dXE, dXN, dXU);
+}
+
+bool CDomeGeometry::azimuthFromHaDec(double dHa, double dDec, int nOtaSide, double &dDomeAz, double &dSlitAlt) const
+{
+    double dMount2 = m_Config.dMountEast * m_Config.dMountEast + m_Config.dMountNorth * m_Config.dMountNorth + m_Config.dMountUp * m_Config.dMountUp;
+
+    dDomeAz = 0;
+    dSlitAlt = 0;
+    if(m_Config.dDomeRadius <= 0 || sqrt(dMount2) + fabs(m_Config.dOtaOffset) >= m_Config.dDomeRadius)
+        return false;
+    intersect(sin(dHa * DEG_TO_RAD), cos(dHa * DEG_TO_RAD), sin(dDec * DEG_TO_RAD), cos(dDec * DEG_TO_RAD), double(nOtaSide), dDomeAz, dSlitAlt);
+    return true;
+}
+
+bool CDomeGeometry::azimuthFromAltAz(double dAlt, double dAz, double &dDomeAz, double &dSlitAlt) const
+{
+    double dMount2 = m_Config.dMountEast * m_Config.dMountEast + m_Config.dMountNorth * m_Config.dMountNorth + m_Config.dMountUp * m_Config.dMountUp;
+
+    dDomeAz = 0;
+    dSlitAlt = 0;
+    if(m_Config.dDomeRadius <= 0 || sqrt(dMount2) >= m_Config.dDomeRadius)
+        return false;
+    intersectRay(m_Config.dMountEast, m_Config.dMountNorth, m_Config.dMountUp,
+                 cos(dAlt * DEG_TO_RAD) * sin(dAz * DEG_TO_RAD), cos(dAlt * DEG_TO_RAD) * cos(dAz * DEG_TO_RAD), sin(dAlt * DEG_TO_RAD),
+                 m_dRadius2, dDomeAz, dSlitAlt);
+    return true;
+}
+
+void CDomeGeometry::azimuthsFromHaDec(const double *pHa, const double *pDec, int nOtaSide, int nCount, double *pDomeAz, double *pSlitAlt) const
+{
+    double dSinHa[GEOMETRY_BLOCK], dCosHa[GEOMETRY_BLOCK], dSinDec[GEOMETRY_BLOCK], dCosDec[GEOMETRY_BLOCK];
+    double dXE[GEOMETRY_BLOCK], dXN[GEOMETRY_BLOCK], dXU[GEOMETRY_BLOCK];
+    double dSide = double(nOtaSide);
+    int nStart, nBlock, i;
+
+    for(nStart = 0; nStart < nCount; nStart += GEOMETRY_BLOCK) {
+        nBlock = nCount - nStart < GEOMETRY_BLOCK ? nCount - nStart : GEOMETRY_BLOCK;
+        for(i = 0; i < nBlock; i++) {
+            dSinHa[i] = sin(pHa[nStart + i] * DEG_TO_RAD);
+            dCosHa[i] = cos(pHa[nStart + i] * DEG_TO_RAD);
+            dSinDec[i] = sin(pDec[nStart + i] * DEG_TO_RAD);
+            dCosDec[i] = cos(pDec[nStart + i] * DEG_TO_RAD);
+        }
+        // the last block is padded so this pass always has the same, known, length
+        for(; i < GEOMETRY_BLOCK; i++) {
+            dSinHa[i] = dSinDec[i] = 0.0;
+            dCosHa[i] = dCosDec[i] = 1.0;
+        }
+        for(i = 0; i < GEOMETRY_BLOCK; i++)
+            slitPoint(dSinHa[i], dCosHa[i], dSinDec[i], dCosDec[i], dSide, dXE[i], dXN[i], dXU[i]);
+        for(i = 0; i < nBlock; i++) {
+            pDomeAz[nStart + i] = atan2(dXE[i], dXN[i]) * RAD_TO_DEG;
+            pDomeAz[nStart + i] += pDomeAz[nStart + i] < 0 ? 360.0 : 0.0;
+        }
+        if(pSlitAlt) {
+            for(i = 0; i < nBlock; i++)
+                pSlitAlt[nStart + i] = atan2(dXU[i], sqrt(dXE[i] * dXE[i] + dXN[i] * dXN[i])) * RAD_TO_DEG;
+        }
+    }
+}
+
+void CDomeGeometry::azimuthsFromAltAz(const double *pAlt, const double *pAz, int nCount, double *pDomeAz, double *pSlitAlt) const
+{
+    double dSlitAlt;
+    double dCosAlt;
+    int i;
+
+    for(i = 0; i < nCount; i++) {
+        dCosAlt = cos(pAlt[i] * DEG_TO_RAD);
+        intersectRay(m_Config.dMountEast, m_Config.dMountNorth, m_Config.dMountUp,
+                     dCosAlt * sin(pAz[i] * DEG_TO_RAD), dCosAlt * cos(pAz[i] * DEG_TO_RAD), sin(pAlt[i] * DEG_TO_RAD),
+                     m_dRadius2, pDomeAz[i], dSlitAlt);
+        if(pSlitAlt)
+            pSlitAlt[i] = dSlitAlt;
+    }
+}
+
+void CDomeGeometry::trajectory(double dRa, double dDec, int nOtaSide, double dLst, double dStepSeconds, int nCount, double *pDomeAz, double *pSlitAlt) const
+{
+    double dHa = (dLst - dRa) * DEG_TO_RAD;
+    double dStep = dStepSeconds * SIDEREAL_DEG_PER_SECOND * DEG_TO_RAD;
+    double dSinStep = sin(dStep);
+    double dCosStep = cos(dStep);
+    double dSinHa = sin(dHa);
+    double dCosHa = cos(dHa);
+    double dSinDec = sin(dDec * DEG_TO_RAD);
+    double dCosDec = cos(dDec * DEG_TO_RAD);
+    double dSide = double(nOtaSide);
+    double dSlitAlt;
+    double dTmp;
+    int i;
+
+    for(i = 0; i < nCount; i++) {
+        intersect(dSinHa, dCosHa, dSinDec, dCosDec, dSide, pDomeAz[i], dSlitAlt);
+        if(pSlitAlt)
+            pSlitAlt[i] = dSlitAlt;
+        // next hour angle, no trig
+        dTmp = dSinHa * dCosStep + dCosHa * dSinStep;
+        dCosHa = dCosHa * dCosStep - dSinHa * dSinStep;
+        dSinHa = dTmp;
+    }
+}
+
+void CDomeGeometry::haDecFromAltAz(double dAlt, double dAz, double &dHa, double &dDec) const
+{
+    double dSinAlt = sin(dAlt * DEG_TO_RAD);
+    double dCosAlt = cos(dAlt * DEG_TO_RAD);
+    double dCosAz = cos(dAz * DEG_TO_RAD);
+
+    dDec = asin(dSinAlt * m_dSinLat + dCosAlt * dCosAz * m_dCosLat) * RAD_TO_DEG;
+    dHa = atan2(-dCosAlt * sin(dAz * DEG_TO_RAD), dSinAlt * m_dCosLat - dCosAlt * dCosAz * m_dSinLat) * RAD_TO_DEG;
+}
+
+double CDomeGeometry::localSiderealTime(double dUnixTime, double dLongitude)
+{
+    // GMST from the days since J2000.0
+    double dDays = dUnixTime / 86400.0 + 2440587.5 - 2451545.0;
+    double dLst = fmod(280.46061837 + 360.98564736629 * dDays + dLongitude, 360.0);
+
+    return dLst < 0 ? dLst + 360.0 : dLst;
+}
@@ -0,0 +1,77 @@
+//
+//  DomeGeometry.h
+//
+//  NexDome X2 plugin for V3 firmware
+//  Where the slit has to be for the telescope to see out, from where the telescope points and where it sits in the dome.
+//
+//  Positions are in a local frame centered on the dome : x east, y north, z up, any length unit as long as
+//  it's the same for all of them. The mount position is the intersection of its axes. On a German equatorial
+//  mount the optical axis is off the RA axis by the OTA offset, along the declination axis, on one side of the
+//  pier or the other. The dome azimuth is where the optical axis leaves the dome sphere.
+//
+//  The batched calls take and fill plain arrays (structure of arrays). azimuthsFromHaDec works on blocks of
+//  GEOMETRY_BLOCK targets in separate passes : the sin/cos, then the intersection with the sphere (plain
+//  arithmetic, the pass the compiler can vectorize), then the atan2. The libm calls stay scalar. A trajectory (fixed RA/Dec, regular time steps) only needs one sin/cos
+//  at the start, the hour angle is advanced with a rotation.
+//
+//  No dependency on the X2 headers.
+
+#ifndef __DOME_GEOMETRY__
+#define __DOME_GEOMETRY__
+
+#include <math.h>
+
+#define SIDEREAL_DEG_PER_SECOND 0.004178074622      // 360.98564736629 / 86400
+#define GEOMETRY_BLOCK          256                 // targets per pass in the batched calls
+
+// which side of the pier the OTA is on, it changes at the meridian flip
+enum OtaSides {OTA_EAST_OF_PIER = -1, OTA_NO_OFFSET = 0, OTA_WEST_OF_PIER = 1};
+
+typedef struct {
+    double  dLatitude;      // degrees, north positive
+    double  dLongitude;     // degrees, east positive, only for the sidereal time
+    double  dDomeRadius;
+    double  dMountEast;     // mount axes intersection from the dome center
+    double  dMountNorth;
+    double  dMountUp;
+    double  dOtaOffset;     // optical axis from the RA axis along the declination axis, 0 for a fork or alt-az mount
+} DomeGeometryConfig;
+
+class CDomeGeometry
+{
+public:
+    CDomeGeometry();
+
+    void    setConfig(const DomeGeometryConfig &config);
+    const DomeGeometryConfig &getConfig(void) const { return m_Config; }
+
+    // dome azimuth and slit altitude in degrees, false if the telescope is outside the dome (bad config)
+    bool    azimuthFromHaDec(double dHa, double dDec, int nOtaSide, double &dDomeAz, double &dSlitAlt) const;
+    bool    azimuthFromAltAz(double dAlt, double dAz, double &dDomeAz, double &dSlitAlt) const;
+
+    // nCount targets at once, hour angles and declinations in degrees. pSlitAlt can be NULL.
+    void    azimuthsFromHaDec(const double *pHa, const double *pDec, int nOtaSide, int nCount, double *pDomeAz, double *pSlitAlt) const;
+    void    azimuthsFromAltAz(const double *pAlt, const double *pAz, int nCount, double *pDomeAz, double *pSlitAlt) const;
+
+    // one RA/Dec followed from dLst (degrees) every dStepSeconds, nCount samples
+    void    trajectory(double dRa, double dDec, int nOtaSide, double dLst, double dStepSeconds, int nCount, double *pDomeAz, double *pSlitAlt) const;
+
+    // telescope altitude/azimuth to hour angle/declination at the configured latitude, degrees
+    void    haDecFromAltAz(double dAlt, double dAz, double &dHa, double &dDec) const;
+
+    // local apparent sidereal time is close enough, degrees
+    static double localSiderealTime(double dUnixTime, double dLongitude);
+
+protected:
+    // the core, everything as sin/cos already computed. Inline so the batched loops vectorize.
+    inline void intersect(double dSinHa, double dCosHa, double dSinDec, double dCosDec, double dSide, double &dDomeAz, double &dSlitAlt) const;
+    // where the optical axis leaves the sphere, in the local frame
+    inline void slitPoint(double dSinHa, double dCosHa, double dSinDec, double dCosDec, double dSide, double &dXE, double &dXN, double &dXU) const;
+
+    DomeGeometryConfig  m_Config;
+    double  m_dSinLat;
+    double  m_dCosLat;
+    double  m_dRadius2;
+};
+
+#endif
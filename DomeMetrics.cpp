@@ -0,0 +1,335 @@
+//
+//  DomeMetrics.cpp
+//
+//  NexDome X2 plugin for V3 firmware
+//  Prometheus metrics, see DomeMetrics.h
+
+#include <stdlib.h>
+#include "DomeMetrics.h"
+
+#if defined(SB_WIN_BUILD)
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+// upper bounds of the duration histogram buckets (seconds), +Inf is implicit
+static const double kBucketBounds[METRICS_BUCKET_COUNT] = {0.5, 1, 2, 5, 10, 20, 30, 60, 120, 300};
+
+static const char *kDurationNames[DURATION_COUNT] = {"slew", "shutter_move", "connect"};
+static const char *kDurationHelp[DURATION_COUNT] = {"Rotator moves, from the goto/home/park command to the end of the move.",
+                                                    "Shutter moves, from the open/close command to the end of the move.",
+                                                    "Time taken by Connect, controller boot included."};
+
+CDomeMetrics::CDomeMetrics()
+{
+    m_nInstance = 0;
+    reset();
+}
+
+void CDomeMetrics::reset()
+{
+    memset(&m_Counters, 0, sizeof(MetricsCounters));
+    m_nCachedReads = 0;
+    memset(m_Verbs, 0, sizeof(m_Verbs));
+    m_nVerbs = 0;
+    memset(m_Histograms, 0, sizeof(m_Histograms));
+}
+
+int CDomeMetrics::setExportFile(const char *pszPath)
+{
+    if(!pszPath || !strlen(pszPath)) {
+        m_sExportPath.clear();
+        return 0;
+    }
+    m_sExportPath.assign(pszPath);
+    m_exportTimer.Reset();
+    return 0;
+}
+
+void CDomeMetrics::countCommand(const char *pszCmd)
+{
+    char szVerb[4];
+    int i;
+
+    m_Counters.nCommands++;
+    // "@PRR\r\n" or "@GSR,1234\r\n" -> PRR, GSR
+    if(!pszCmd || pszCmd[0] != '@' || strlen(pszCmd) < 4)
+        return;
+    memcpy(szVerb, pszCmd + 1, 3);
+    szVerb[3] = 0;
+
+    for(i = 0; i < m_nVerbs; i++) {
+        if(!strcmp(m_Verbs[i].szVerb, szVerb)) {
+            m_Verbs[i].nCount++;
+            return;
+        }
+    }
+    if(m_nVerbs >= METRICS_MAX_VERBS)
+        return;
+    memcpy(m_Verbs[m_nVerbs].szVerb, szVerb, 4);
+    m_Verbs[m_nVerbs].nCount = 1;
+    m_nVerbs++;
+}
+
+void CDomeMetrics::observeDuration(int nDuration, double dSeconds)
+{
+    MetricsHistogram *pHistogram;
+    int i;
+
+    if(nDuration < 0 || nDuration >= DURATION_COUNT || dSeconds < 0)
+        return;
+    pHistogram = &m_Histograms[nDuration];
+    for(i = 0; i < METRICS_BUCKET_COUNT; i++) {
+        if(dSeconds <= kBucketBounds[i]) {
+            pHistogram->nBuckets[i]++;
+            break;
+        }
+    }
+    pHistogram->nCount++;
+    pHistogram->dSum += dSeconds;
+    if(dSeconds > pHistogram->dMax)
+        pHistogram->dMax = dSeconds;
+}
+
+void CDomeMetrics::observeMutexWait(double dSeconds)
+{
+    m_Counters.nMutexAcquisitions++;
+    if(dSeconds > METRICS_CONTENDED_WAIT)
+        m_Counters.nMutexContended++;
+    m_Counters.dMutexWait += dSeconds;
+    if(dSeconds > m_Counters.dMutexWaitMax)
+        m_Counters.dMutexWaitMax = dSeconds;
+}
+
+void CDomeMetrics::setParserStats(const ParserStats &stats)
+{
+    m_Counters.nParserOverLength = stats.nOverLength;
+    m_Counters.nParserGarbage = stats.nGarbage;
+    m_Counters.nParserDropped = stats.nDropped;
+    m_Counters.nParserTruncated = stats.nTruncated;
+    m_Counters.nRxBacklogSamples = stats.nBacklogSamples;
+    m_Counters.nRxBacklogSum = stats.nBacklogSum;
+    m_Counters.nRxBacklogMax = stats.nBacklogMax;
+    memcpy(m_Counters.nRxBacklogBuckets, stats.nBacklogBuckets, sizeof(m_Counters.nRxBacklogBuckets));
+}
+
+bool CDomeMetrics::getVerbCounter(int nIndex, MetricsVerbCounter &verbCounter)
+{
+    if(nIndex < 0 || nIndex >= m_nVerbs)
+        return false;
+    verbCounter = m_Verbs[nIndex];
+    return true;
+}
+
+bool CDomeMetrics::getHistogram(int nDuration, MetricsHistogram &histogram)
+{
+    if(nDuration < 0 || nDuration >= DURATION_COUNT)
+        return false;
+    histogram = m_Histograms[nDuration];
+    return true;
+}
+
+void CDomeMetrics::exportIfDue(const DomeTelemetryData &state)
+{
+    if(m_sExportPath.empty() || m_exportTimer.GetElapsedSeconds() < METRICS_EXPORT_INTERVAL)
+        return;
+    exportNow(state);
+}
+
+int CDomeMetrics::exportNow(const DomeTelemetryData &state)
+{
+    std::string sOut;
+    std::string sTmpPath;
+    char szPid[32];
+    FILE *pFile;
+    size_t nWritten;
+
+    m_exportTimer.Reset();
+    if(m_sExportPath.empty())
+        return 0;
+
+    format(state, sOut);
+
+    snprintf(szPid, sizeof(szPid), ".%d.tmp", int(getpid()));
+    sTmpPath = m_sExportPath + szPid;
+    pFile = fopen(sTmpPath.c_str(), "w");
+    if(!pFile)
+        return -1;
+    nWritten = fwrite(sOut.data(), 1, sOut.size(), pFile);
+    if(fclose(pFile) != 0 || nWritten != sOut.size()) {
+        remove(sTmpPath.c_str());
+        return -1;
+    }
+#if defined(SB_WIN_BUILD)
+    remove(m_sExportPath.c_str());  // rename doesn't replace an existing file on Windows
+#endif
+    if(rename(sTmpPath.c_str(), m_sExportPath.c_str()) != 0) {
+        remove(sTmpPath.c_str());
+        return -1;
+    }
+    m_Counters.nExports++;
+    return 0;
+}
+
+static void appendMetric(std::string &sOut, const char *pszName, const char *pszType, const char *pszHelp)
+{
+    sOut += "# HELP ";
+    sOut += pszName;
+    sOut += " ";
+    sOut += pszHelp;
+    sOut += "\n# TYPE ";
+    sOut += pszName;
+    sOut += " ";
+    sOut += pszType;
+    sOut += "\n";
+}
+
+int CDomeMetrics::format(const DomeTelemetryData &state, std::string &sOut)
+{
+    char szLine[256];
+    char szLabel[32];
+    uint64_t nCumulative;
+    int i, j;
+
+    snprintf(szLabel, sizeof(szLabel), "dome=\"%d\"", m_nInstance);
+    sOut.reserve(4096);
+
+    appendMetric(sOut, "nexdome_commands_total", "counter", "Commands sent to the controller, by verb.");
+    for(i = 0; i < m_nVerbs; i++) {
+        snprintf(szLine, sizeof(szLine), "nexdome_commands_total{%s,verb=\"%s\"} %llu\n", szLabel, m_Verbs[i].szVerb, (unsigned long long)m_Verbs[i].nCount);
+        sOut += szLine;
+    }
+
+    appendMetric(sOut, "nexdome_command_timeouts_total", "counter", "Commands that got no reply.");
+    snprintf(szLine, sizeof(szLine), "nexdome_command_timeouts_total{%s} %llu\n", szLabel, (unsigned long long)m_Counters.nCommandTimeouts);
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_read_timeouts_total", "counter", "Serial reads that timed out.");
+    snprintf(szLine, sizeof(szLine), "nexdome_read_timeouts_total{%s} %llu\n", szLabel, (unsigned long long)m_Counters.nReadTimeouts);
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_retries_total", "counter", "Commands resent after their attempt timed out.");
+    snprintf(szLine, sizeof(szLine), "nexdome_retries_total{%s} %llu\n", szLabel, (unsigned long long)m_Counters.nRetries);
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_serial_bytes_total", "counter", "Bytes exchanged with the controller.");
+    snprintf(szLine, sizeof(szLine), "nexdome_serial_bytes_total{%s,direction=\"tx\"} %llu\n", szLabel, (unsigned long long)m_Counters.nBytesTx);
+    sOut += szLine;
+    snprintf(szLine, sizeof(szLine), "nexdome_serial_bytes_total{%s,direction=\"rx\"} %llu\n", szLabel, (unsigned long long)m_Counters.nBytesRx);
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_unsolicited_lines_total", "counter", "Lines sent by the controller on its own (positions, battery, rain, XBee).");
+    snprintf(szLine, sizeof(szLine), "nexdome_unsolicited_lines_total{%s} %llu\n", szLabel, (unsigned long long)m_Counters.nUnsolicited);
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_position_updates_total", "counter", "P and S position lines received.");
+    snprintf(szLine, sizeof(szLine), "nexdome_position_updates_total{%s,axis=\"rotator\"} %llu\n", szLabel, (unsigned long long)m_Counters.nPositionUpdates[POSITION_ROTATOR]);
+    sOut += szLine;
+    snprintf(szLine, sizeof(szLine), "nexdome_position_updates_total{%s,axis=\"shutter\"} %llu\n", szLabel, (unsigned long long)m_Counters.nPositionUpdates[POSITION_SHUTTER]);
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_position_updates_coalesced_total", "counter", "Position lines superseded by a newer one in the same batch.");
+    snprintf(szLine, sizeof(szLine), "nexdome_position_updates_coalesced_total{%s,axis=\"rotator\"} %llu\n", szLabel, (unsigned long long)m_Counters.nPositionsCoalesced[POSITION_ROTATOR]);
+    sOut += szLine;
+    snprintf(szLine, sizeof(szLine), "nexdome_position_updates_coalesced_total{%s,axis=\"shutter\"} %llu\n", szLabel, (unsigned long long)m_Counters.nPositionsCoalesced[POSITION_SHUTTER]);
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_parser_errors_total", "counter", "Serial lines dropped by the parser, by reason.");
+    snprintf(szLine, sizeof(szLine), "nexdome_parser_errors_total{%s,kind=\"overlength\"} %llu\n", szLabel, (unsigned long long)m_Counters.nParserOverLength);
+    sOut += szLine;
+    snprintf(szLine, sizeof(szLine), "nexdome_parser_errors_total{%s,kind=\"garbage\"} %llu\n", szLabel, (unsigned long long)m_Counters.nParserGarbage);
+    sOut += szLine;
+    snprintf(szLine, sizeof(szLine), "nexdome_parser_errors_total{%s,kind=\"dropped\"} %llu\n", szLabel, (unsigned long long)m_Counters.nParserDropped);
+    sOut += szLine;
+    snprintf(szLine, sizeof(szLine), "nexdome_parser_errors_total{%s,kind=\"truncated\"} %llu\n", szLabel, (unsigned long long)m_Counters.nParserTruncated);
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_sequence_gaps_total", "counter", "Position lines lost during a move, from the jumps in the P stream.");
+    snprintf(szLine, sizeof(szLine), "nexdome_sequence_gaps_total{%s} %llu\n", szLabel, (unsigned long long)m_Counters.nSequenceGaps);
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_rx_backlog_max_bytes", "gauge", "Most bytes seen waiting in the serial driver at a drain.");
+    snprintf(szLine, sizeof(szLine), "nexdome_rx_backlog_max_bytes{%s} %llu\n", szLabel, (unsigned long long)m_Counters.nRxBacklogMax);
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_rx_backlog_bytes", "histogram", "Bytes waiting in the serial driver, sampled at each drain.");
+    nCumulative = 0;
+    for(j = 0; j < PARSER_BACKLOG_BUCKETS; j++) {
+        nCumulative += m_Counters.nRxBacklogBuckets[j];
+        snprintf(szLine, sizeof(szLine), "nexdome_rx_backlog_bytes_bucket{%s,le=\"%d\"} %llu\n", szLabel, CResponseParser::getBacklogBound(j), (unsigned long long)nCumulative);
+        sOut += szLine;
+    }
+    snprintf(szLine, sizeof(szLine), "nexdome_rx_backlog_bytes_bucket{%s,le=\"+Inf\"} %llu\n", szLabel, (unsigned long long)m_Counters.nRxBacklogSamples);
+    sOut += szLine;
+    snprintf(szLine, sizeof(szLine), "nexdome_rx_backlog_bytes_sum{%s} %llu\n", szLabel, (unsigned long long)m_Counters.nRxBacklogSum);
+    sOut += szLine;
+    snprintf(szLine, sizeof(szLine), "nexdome_rx_backlog_bytes_count{%s} %llu\n", szLabel, (unsigned long long)m_Counters.nRxBacklogSamples);
+    sOut += szLine;
+
+    appendMetric(sOut, "nexdome_home_drift_samples_total", "counter", "Home sensor crossings during gotos measured for drift.");
+    snprintf(szLine, sizeof(szLine), "nexdome_home_drift_samples_total{%s} %llu\n", szLabel, (unsigned long long)m_Counters.nHomeDriftSamples);
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_home_resyncs_total", "counter", "Step count corrections from a home sensor crossing.");
+    snprintf(szLine, sizeof(szLine), "nexdome_home_resyncs_total{%s} %llu\n", szLabel, (unsigned long long)m_Counters.nHomeResyncs);
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_home_drift_degrees", "gauge", "Step count drift at the last home sensor crossing.");
+    snprintf(szLine, sizeof(szLine), "nexdome_home_drift_degrees{%s} %.3f\n", szLabel, m_Counters.dHomeDriftLast);
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_home_drift_max_degrees", "gauge", "Largest step count drift seen at a home sensor crossing.");
+    snprintf(szLine, sizeof(szLine), "nexdome_home_drift_max_degrees{%s} %.3f\n", szLabel, m_Counters.dHomeDriftMax);
+    sOut += szLine;
+
+    appendMetric(sOut, "nexdome_link_outages_total", "counter", "Times the watchdog found the link dead and reopened the port.");
+    snprintf(szLine, sizeof(szLine), "nexdome_link_outages_total{%s} %llu\n", szLabel, (unsigned long long)m_Counters.nLinkOutages);
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_link_down_seconds_total", "counter", "Time the link was down, outages that ended.");
+    snprintf(szLine, sizeof(szLine), "nexdome_link_down_seconds_total{%s} %.1f\n", szLabel, m_Counters.dLinkDown);
+    sOut += szLine;
+
+    appendMetric(sOut, "nexdome_io_mutex_acquisitions_total", "counter", "Acquisitions of the X2 I/O mutex.");
+    snprintf(szLine, sizeof(szLine), "nexdome_io_mutex_acquisitions_total{%s} %llu\n", szLabel, (unsigned long long)m_Counters.nMutexAcquisitions);
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_io_mutex_contended_total", "counter", "Acquisitions of the X2 I/O mutex that had to wait.");
+    snprintf(szLine, sizeof(szLine), "nexdome_io_mutex_contended_total{%s} %llu\n", szLabel, (unsigned long long)m_Counters.nMutexContended);
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_io_mutex_wait_seconds_total", "counter", "Time spent waiting for the X2 I/O mutex.");
+    snprintf(szLine, sizeof(szLine), "nexdome_io_mutex_wait_seconds_total{%s} %.6f\n", szLabel, m_Counters.dMutexWait);
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_io_mutex_wait_max_seconds", "gauge", "Longest wait for the X2 I/O mutex.");
+    snprintf(szLine, sizeof(szLine), "nexdome_io_mutex_wait_max_seconds{%s} %.6f\n", szLabel, m_Counters.dMutexWaitMax);
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_cached_reads_total", "counter", "Calls answered from the cached state without taking the I/O mutex.");
+    snprintf(szLine, sizeof(szLine), "nexdome_cached_reads_total{%s} %llu\n", szLabel, (unsigned long long)m_nCachedReads.load());
+    sOut += szLine;
+
+    appendMetric(sOut, "nexdome_azimuth_degrees", "gauge", "Dome azimuth.");
+    snprintf(szLine, sizeof(szLine), "nexdome_azimuth_degrees{%s} %.2f\n", szLabel, state.dAz);
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_elevation_degrees", "gauge", "Shutter opening.");
+    snprintf(szLine, sizeof(szLine), "nexdome_elevation_degrees{%s} %.2f\n", szLabel, state.dEl);
+    sOut += szLine;
+    if(state.dShutterVolts >= 0) {
+        appendMetric(sOut, "nexdome_shutter_battery_volts", "gauge", "Shutter battery voltage.");
+        snprintf(szLine, sizeof(szLine), "nexdome_shutter_battery_volts{%s} %.2f\n", szLabel, state.dShutterVolts);
+        sOut += szLine;
+    }
+    appendMetric(sOut, "nexdome_raining", "gauge", "1 when the rain sensor reports rain.");
+    snprintf(szLine, sizeof(szLine), "nexdome_raining{%s} %d\n", szLabel, state.nRainStatus == 0 ? 1 : 0);   // RAINING = 0
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_link_up", "gauge", "1 when connected to the controller.");
+    snprintf(szLine, sizeof(szLine), "nexdome_link_up{%s} %d\n", szLabel, state.bConnected ? 1 : 0);
+    sOut += szLine;
+    appendMetric(sOut, "nexdome_moving", "gauge", "1 while the rotator or the shutter is moving.");
+    snprintf(szLine, sizeof(szLine), "nexdome_moving{%s} %d\n", szLabel, state.bMoving ? 1 : 0);
+    sOut += szLine;
+
+    for(i = 0; i < DURATION_COUNT; i++) {
+        snprintf(szLine, sizeof(szLine), "nexdome_%s_duration_seconds", kDurationNames[i]);
+        appendMetric(sOut, szLine, "histogram", kDurationHelp[i]);
+        nCumulative = 0;
+        for(j = 0; j < METRICS_BUCKET_COUNT; j++) {
+            nCumulative += m_Histograms[i].nBuckets[j];
+            snprintf(szLine, sizeof(szLine), "nexdome_%s_duration_seconds_bucket{%s,le=\"%g\"} %llu\n", kDurationNames[i], szLabel, kBucketBounds[j], (unsigned long long)nCumulative);
+            sOut += szLine;
+        }
+        snprintf(szLine, sizeof(szLine), "nexdome_%s_duration_seconds_bucket{%s,le=\"+Inf\"} %llu\n", kDurationNames[i], szLabel, (unsigned long long)m_Histograms[i].nCount);
+        sOut += szLine;
+        snprintf(szLine, sizeof(szLine), "nexdome_%s_duration_seconds_sum{%s} %.3f\n", kDurationNames[i], szLabel, m_Histograms[i].dSum);
+        sOut += szLine;
+        snprintf(szLine, sizeof(szLine), "nexdome_%s_duration_seconds_count{%s} %llu\n", kDurationNames[i], szLabel, (unsigned long long)m_Histograms[i].nCount);
+        sOut += szLine;
+    }
+    return 0;
+}
@@ -0,0 +1,135 @@
+//
+//  DomeMetrics.h
+//
+//  NexDome X2 plugin for V3 firmware
+//  Driver counters, gauges and durations, exported in the Prometheus text exposition format.
+//
+//  The counters are plain integers updated inline by the driver. When an export file is set,
+//  the whole set is written every METRICS_EXPORT_INTERVAL seconds to a temporary file that is then
+//  renamed over the export file, so a textfile collector never reads a partial file.
+
+#ifndef __DOME_METRICS__
+#define __DOME_METRICS__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <atomic>
+#include <algorithm>
+
+#include "StopWatch.h"
+#include "DomeTelemetry.h"
+#include "ResponseParser.h"
+
+#define METRICS_EXPORT_INTERVAL     5.0     // seconds
+#define METRICS_MAX_VERBS           48
+#define METRICS_BUCKET_COUNT        10
+#define METRICS_CONTENDED_WAIT      0.001   // seconds
+
+enum DomeMetricsDurations {DURATION_SLEW = 0, DURATION_SHUTTER, DURATION_CONNECT, DURATION_COUNT};
+enum PositionAxis {POSITION_ROTATOR = 0, POSITION_SHUTTER};
+
+typedef struct {
+    char        szVerb[4];
+    uint64_t    nCount;
+} MetricsVerbCounter;
+
+typedef struct {
+    uint64_t    nBuckets[METRICS_BUCKET_COUNT];    // cumulative counts are computed at export time
+    uint64_t    nCount;
+    double      dSum;
+    double      dMax;
+} MetricsHistogram;
+
+typedef struct {
+    uint64_t    nCommands;
+    uint64_t    nCommandTimeouts;   // domeCommand gave up waiting for the reply
+    uint64_t    nReadTimeouts;      // readResponse hit its timeout
+    uint64_t    nRetries;           // commands resent by the retry policy
+    uint64_t    nBytesTx;
+    uint64_t    nBytesRx;
+    uint64_t    nUnsolicited;       // P, S, XBee, :BV, :Rain lines
+    uint64_t    nExports;
+    uint64_t    nMutexAcquisitions; // X2 I/O mutex
+    uint64_t    nMutexContended;    // acquisitions that waited more than METRICS_CONTENDED_WAIT
+    double      dMutexWait;         // seconds, total
+    double      dMutexWaitMax;
+    uint64_t    nCachedReads;       // calls answered from the cache without the I/O mutex
+    uint64_t    nPositionUpdates[2];    // P and S lines, by PositionAxis
+    uint64_t    nPositionsCoalesced[2]; // superseded by a newer one in the same batch, never converted
+    uint64_t    nParserOverLength;  // serial lines dropped by CResponseParser
+    uint64_t    nParserGarbage;
+    uint64_t    nParserDropped;
+    uint64_t    nParserTruncated;
+    uint64_t    nSequenceGaps;      // P lines lost during a move
+    uint64_t    nRxBacklogSamples;  // bytes waiting in the serial driver at each drain
+    uint64_t    nRxBacklogSum;
+    uint64_t    nRxBacklogMax;
+    uint64_t    nRxBacklogBuckets[PARSER_BACKLOG_BUCKETS];  // not cumulative, bounds from CResponseParser::getBacklogBound
+    uint64_t    nHomeDriftSamples;  // home sensor crossings measured against the reference edge
+    uint64_t    nHomeResyncs;       // step count corrected from a crossing
+    double      dHomeDriftLast;     // degrees, signed
+    double      dHomeDriftMax;      // degrees, largest |drift|
+    uint64_t    nLinkOutages;       // link declared dead by the watchdog
+    double      dLinkDown;          // seconds, outages that ended
+} MetricsCounters;
+
+
+class CDomeMetrics
+{
+public:
+    CDomeMetrics();
+
+    void    reset(void);
+    void    setInstance(int nInstance) { m_nInstance = nInstance; }
+    int     setExportFile(const char *pszPath);
+    void    getExportFile(std::string &sPath) { sPath.assign(m_sExportPath); }
+    bool    isExporting(void) { return !m_sExportPath.empty(); }
+
+    void    countCommand(const char *pszCmd);
+    void    countCommandTimeout(void) { m_Counters.nCommandTimeouts++; }
+    void    countReadTimeout(void) { m_Counters.nReadTimeouts++; }
+    void    countRetry(void) { m_Counters.nRetries++; }
+    void    addBytesTx(unsigned long nBytes) { m_Counters.nBytesTx += nBytes; }
+    void    addBytesRx(unsigned long nBytes) { m_Counters.nBytesRx += nBytes; }
+    void    countUnsolicited(void) { m_Counters.nUnsolicited++; }
+    void    observeDuration(int nDuration, double dSeconds);
+    void    observeMutexWait(double dSeconds);              // with the mutex held
+    void    countCachedRead(void) { m_nCachedReads++; }     // from any thread
+    void    setParserStats(const ParserStats &stats);
+    void    countSequenceGap(void) { m_Counters.nSequenceGaps++; }
+    void    countLinkOutage(void) { m_Counters.nLinkOutages++; }
+    void    addLinkDownTime(double dSeconds) { m_Counters.dLinkDown += dSeconds; }
+    void    observeHomeDrift(double dDegrees) { m_Counters.nHomeDriftSamples++; m_Counters.dHomeDriftLast = dDegrees; m_Counters.dHomeDriftMax = std::max(m_Counters.dHomeDriftMax, fabs(dDegrees)); }
+    void    countHomeResync(void) { m_Counters.nHomeResyncs++; }
+    void    countPositionUpdate(int nAxis, bool bCoalesced) { m_Counters.nPositionUpdates[nAxis]++; if(bCoalesced) m_Counters.nPositionsCoalesced[nAxis]++; }
+    // CTimingScope sink, pContext is the CDomeMetrics
+    static void durationSink(void *pContext, int nDuration, double dSeconds) { ((CDomeMetrics *)pContext)->observeDuration(nDuration, dSeconds); }
+
+    // statistics API
+    void    getCounters(MetricsCounters &counters) { counters = m_Counters; counters.nCachedReads = m_nCachedReads.load(); }
+    int     getVerbCount(void) { return m_nVerbs; }
+    bool    getVerbCounter(int nIndex, MetricsVerbCounter &verbCounter);
+    bool    getHistogram(int nDuration, MetricsHistogram &histogram);
+
+    // write the export file if it's time to, gauges come from the current dome state.
+    void    exportIfDue(const DomeTelemetryData &state);
+    int     exportNow(const DomeTelemetryData &state);
+
+protected:
+    int     format(const DomeTelemetryData &state, std::string &sOut);
+
+    MetricsCounters     m_Counters;
+    std::atomic<uint64_t> m_nCachedReads;
+    MetricsVerbCounter  m_Verbs[METRICS_MAX_VERBS];
+    int                 m_nVerbs;
+    MetricsHistogram    m_Histograms[DURATION_COUNT];
+
+    int                 m_nInstance;
+    std::string         m_sExportPath;
+    CStopWatch          m_exportTimer;
+};
+
+#endif
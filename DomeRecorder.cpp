@@ -0,0 +1,299 @@
+//
+//  DomeRecorder.cpp
+//
+//  NexDome X2 plugin for V3 firmware
+//  Memory mapped columnar time series, see DomeRecorder.h
+
+#include <atomic>
+#include "DomeRecorder.h"
+
+#ifdef DOME_RECORDER_SUPPORTED
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// block layout : header, then one column per field
+static uint32_t blockSize(uint32_t nSamplesPerBlock)
+{
+    uint32_t nSize;
+
+    nSize = sizeof(DomeRecordBlockHeader) + nSamplesPerBlock * (sizeof(double) + 4 * sizeof(int32_t) + 2 * sizeof(uint8_t));
+    return (nSize + 4095) & ~4095U;   // page aligned
+}
+
+static void blockView(uint8_t *pBlock, uint32_t nSamplesPerBlock, DomeRecordBlockView &view)
+{
+    uint8_t *pCol = pBlock + sizeof(DomeRecordBlockHeader);
+
+    view.pHeader = (const DomeRecordBlockHeader *)pBlock;
+    view.pdTime = (const double *)pCol;             pCol += nSamplesPerBlock * sizeof(double);
+    view.pnAzSteps = (const int32_t *)pCol;         pCol += nSamplesPerBlock * sizeof(int32_t);
+    view.pnElSteps = (const int32_t *)pCol;         pCol += nSamplesPerBlock * sizeof(int32_t);
+    view.pfVolts = (const float *)pCol;             pCol += nSamplesPerBlock * sizeof(float);
+    view.pfCmdLatencyMs = (const float *)pCol;      pCol += nSamplesPerBlock * sizeof(float);
+    view.pnShutterState = (const uint8_t *)pCol;    pCol += nSamplesPerBlock * sizeof(uint8_t);
+    view.pnRain = (const uint8_t *)pCol;
+}
+
+CDomeRecorder::CDomeRecorder()
+{
+    m_pMap = NULL;
+    m_nMapSize = 0;
+    m_pHeader = NULL;
+}
+
+CDomeRecorder::~CDomeRecorder()
+{
+    close();
+}
+
+int CDomeRecorder::open(const char *pszPath, uint32_t nBlockCount)
+{
+#ifdef DOME_RECORDER_SUPPORTED
+    int fd;
+    struct stat st;
+    void *pMap;
+    uint32_t nBlockSize;
+    bool bNewFile;
+
+    if(m_pMap)
+        close();
+
+    if(!nBlockCount)
+        nBlockCount = DOME_RECORDER_DEFAULT_BLOCKS;
+    nBlockSize = blockSize(DOME_RECORDER_SAMPLES_PER_BLOCK);
+    m_nMapSize = DOME_RECORDER_HEADER_SIZE + size_t(nBlockSize) * nBlockCount;
+
+    fd = ::open(pszPath, O_RDWR | O_CREAT, 0644);
+    if(fd < 0)
+        return RECORDER_OPEN_FAILED;
+
+    if(fstat(fd, &st) != 0) {
+        ::close(fd);
+        return RECORDER_OPEN_FAILED;
+    }
+    // reuse an existing file only if it has the same geometry, otherwise start over.
+    bNewFile = (size_t)st.st_size != m_nMapSize;
+    if(bNewFile && (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t)m_nMapSize) != 0)) {
+        ::close(fd);
+        return RECORDER_OPEN_FAILED;
+    }
+
+    pMap = mmap(NULL, m_nMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(pMap == MAP_FAILED)
+        return RECORDER_OPEN_FAILED;
+
+    m_pMap = (uint8_t *)pMap;
+    m_pHeader = (DomeRecordFileHeader *)m_pMap;
+
+    if(bNewFile || m_pHeader->nMagic != DOME_RECORDER_MAGIC || m_pHeader->nVersion != DOME_RECORDER_VERSION
+       || m_pHeader->nSamplesPerBlock != DOME_RECORDER_SAMPLES_PER_BLOCK || m_pHeader->nBlockCount != nBlockCount) {
+        memset(m_pMap, 0, DOME_RECORDER_HEADER_SIZE);
+        m_pHeader->nVersion = DOME_RECORDER_VERSION;
+        m_pHeader->nSamplesPerBlock = DOME_RECORDER_SAMPLES_PER_BLOCK;
+        m_pHeader->nBlockCount = nBlockCount;
+        m_pHeader->nBlockSize = nBlockSize;
+        m_pHeader->nCurrentBlock = 0;
+        m_pHeader->nBlocksWritten = 0;
+        m_pHeader->nSamplesWritten = 0;
+        startBlock(0);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_pHeader->nMagic = DOME_RECORDER_MAGIC;
+    }
+    return RECORDER_OK;
+#else
+    (void)pszPath;
+    (void)nBlockCount;
+    return RECORDER_NOT_SUPPORTED;
+#endif
+}
+
+void CDomeRecorder::close()
+{
+#ifdef DOME_RECORDER_SUPPORTED
+    if(!m_pMap)
+        return;
+    msync(m_pMap, m_nMapSize, MS_ASYNC);
+    munmap(m_pMap, m_nMapSize);
+    m_pMap = NULL;
+    m_pHeader = NULL;
+#endif
+}
+
+void CDomeRecorder::startBlock(uint32_t nBlock)
+{
+    DomeRecordBlockHeader *pBlockHeader;
+
+    pBlockHeader = (DomeRecordBlockHeader *)(m_pMap + DOME_RECORDER_HEADER_SIZE + size_t(m_pHeader->nBlockSize) * nBlock);
+    // invalidate the block before it's reused so a reader never mixes old and new samples
+    pBlockHeader->nCount = 0;
+    std::atomic_thread_fence(std::memory_order_release);
+    pBlockHeader->nBlockSeq = ++m_pHeader->nBlocksWritten;
+    pBlockHeader->dFirstTime = 0;
+    pBlockHeader->dLastTime = 0;
+    m_pHeader->nCurrentBlock = nBlock;
+}
+
+void CDomeRecorder::append(const DomeRecordSample &sample)
+{
+    uint8_t *pBlock;
+    DomeRecordBlockHeader *pBlockHeader;
+    DomeRecordBlockView view;
+    uint32_t n;
+
+    if(!m_pMap)
+        return;
+
+    pBlock = m_pMap + DOME_RECORDER_HEADER_SIZE + size_t(m_pHeader->nBlockSize) * m_pHeader->nCurrentBlock;
+    pBlockHeader = (DomeRecordBlockHeader *)pBlock;
+    if(pBlockHeader->nCount >= m_pHeader->nSamplesPerBlock) {
+        startBlock((m_pHeader->nCurrentBlock + 1) % m_pHeader->nBlockCount);
+        pBlock = m_pMap + DOME_RECORDER_HEADER_SIZE + size_t(m_pHeader->nBlockSize) * m_pHeader->nCurrentBlock;
+        pBlockHeader = (DomeRecordBlockHeader *)pBlock;
+    }
+
+    blockView(pBlock, m_pHeader->nSamplesPerBlock, view);
+    n = pBlockHeader->nCount;
+    ((double *)view.pdTime)[n] = sample.dTime;
+    ((int32_t *)view.pnAzSteps)[n] = sample.nAzSteps;
+    ((int32_t *)view.pnElSteps)[n] = sample.nElSteps;
+    ((float *)view.pfVolts)[n] = sample.fVolts;
+    ((float *)view.pfCmdLatencyMs)[n] = sample.fCmdLatencyMs;
+    ((uint8_t *)view.pnShutterState)[n] = sample.nShutterState;
+    ((uint8_t *)view.pnRain)[n] = sample.nRain;
+    if(!n)
+        pBlockHeader->dFirstTime = sample.dTime;
+    pBlockHeader->dLastTime = sample.dTime;
+
+    // publish the sample
+    std::atomic_thread_fence(std::memory_order_release);
+    pBlockHeader->nCount = n + 1;
+    m_pHeader->nSamplesWritten++;
+}
+
+
+CDomeRecordReader::CDomeRecordReader()
+{
+    m_pMap = NULL;
+    m_nMapSize = 0;
+    m_pHeader = NULL;
+}
+
+CDomeRecordReader::~CDomeRecordReader()
+{
+    close();
+}
+
+int CDomeRecordReader::open(const char *pszPath)
+{
+#ifdef DOME_RECORDER_SUPPORTED
+    int fd;
+    struct stat st;
+    void *pMap;
+
+    if(m_pMap)
+        close();
+
+    fd = ::open(pszPath, O_RDONLY);
+    if(fd < 0)
+        return RECORDER_OPEN_FAILED;
+    if(fstat(fd, &st) != 0 || st.st_size < DOME_RECORDER_HEADER_SIZE) {
+        ::close(fd);
+        return RECORDER_BAD_FILE;
+    }
+    m_nMapSize = (size_t)st.st_size;
+    pMap = mmap(NULL, m_nMapSize, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(pMap == MAP_FAILED)
+        return RECORDER_OPEN_FAILED;
+
+    m_pMap = (uint8_t *)pMap;
+    m_pHeader = (const DomeRecordFileHeader *)m_pMap;
+    if(m_pHeader->nMagic != DOME_RECORDER_MAGIC || m_pHeader->nVersion != DOME_RECORDER_VERSION
+       || m_pHeader->nBlockSize != blockSize(m_pHeader->nSamplesPerBlock)
+       || DOME_RECORDER_HEADER_SIZE + size_t(m_pHeader->nBlockSize) * m_pHeader->nBlockCount > m_nMapSize) {
+        close();
+        return RECORDER_BAD_FILE;
+    }
+    return RECORDER_OK;
+#else
+    (void)pszPath;
+    return RECORDER_NOT_SUPPORTED;
+#endif
+}
+
+void CDomeRecordReader::close()
+{
+#ifdef DOME_RECORDER_SUPPORTED
+    if(!m_pMap)
+        return;
+    munmap(m_pMap, m_nMapSize);
+    m_pMap = NULL;
+    m_pHeader = NULL;
+#endif
+}
+
+uint32_t CDomeRecordReader::getBlockCount()
+{
+    if(!m_pMap)
+        return 0;
+    if(m_pHeader->nBlocksWritten < m_pHeader->nBlockCount)
+        return (uint32_t)m_pHeader->nBlocksWritten;
+    return m_pHeader->nBlockCount;
+}
+
+bool CDomeRecordReader::getBlock(uint32_t nIndex, DomeRecordBlockView &view)
+{
+    uint32_t nBlock;
+    uint32_t nCount = getBlockCount();
+
+    if(nIndex >= nCount)
+        return false;
+
+    // the oldest block is the one after the block being written once the ring has wrapped
+    if(m_pHeader->nBlocksWritten <= m_pHeader->nBlockCount)
+        nBlock = nIndex;
+    else
+        nBlock = (m_pHeader->nCurrentBlock + 1 + nIndex) % m_pHeader->nBlockCount;
+
+    blockView(m_pMap + DOME_RECORDER_HEADER_SIZE + size_t(m_pHeader->nBlockSize) * nBlock, m_pHeader->nSamplesPerBlock, view);
+    return true;
+}
+
+uint64_t CDomeRecordReader::scan(double dStart, double dEnd, void (*pfnVisitor)(const DomeRecordSample &sample, void *pContext), void *pContext)
+{
+    DomeRecordBlockView view;
+    DomeRecordSample sample;
+    uint64_t nVisited = 0;
+    uint32_t nBlocks;
+    uint32_t i, j, nCount;
+
+    nBlocks = getBlockCount();
+    for(i = 0; i < nBlocks; i++) {
+        if(!getBlock(i, view))
+            break;
+        nCount = view.pHeader->nCount;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(!nCount || view.pHeader->dLastTime < dStart || view.pHeader->dFirstTime > dEnd)
+            continue;   // whole block outside of the range
+        for(j = 0; j < nCount; j++) {
+            if(view.pdTime[j] < dStart || view.pdTime[j] > dEnd)
+                continue;
+            if(pfnVisitor) {
+                sample.dTime = view.pdTime[j];
+                sample.nAzSteps = view.pnAzSteps[j];
+                sample.nElSteps = view.pnElSteps[j];
+                sample.fVolts = view.pfVolts[j];
+                sample.fCmdLatencyMs = view.pfCmdLatencyMs[j];
+                sample.nShutterState = view.pnShutterState[j];
+                sample.nRain = view.pnRain[j];
+                pfnVisitor(sample, pContext);
+            }
+            nVisited++;
+        }
+    }
+    return nVisited;
+}
@@ -0,0 +1,117 @@
+//
+//  DomeRecorder.h
+//
+//  NexDome X2 plugin for V3 firmware
+//  Time series recorder for the dome telemetry.
+//
+//  Samples are stored in a memory mapped file made of a fixed number of blocks used as a ring,
+//  so the file never grows past its initial size and the oldest block is recycled once full.
+//  Each block stores its samples column by column (all timestamps, then all az steps, ...) and
+//  keeps the first/last timestamp so a reader can skip whole blocks when scanning a time range.
+
+#ifndef __DOME_RECORDER__
+#define __DOME_RECORDER__
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#if defined(SB_LINUX_BUILD) || defined(SB_MAC_BUILD)
+#define DOME_RECORDER_SUPPORTED
+#endif
+
+#define DOME_RECORDER_MAGIC             0x4345523356444E00ULL   // "\0NDV3REC"
+#define DOME_RECORDER_VERSION           1
+#define DOME_RECORDER_HEADER_SIZE       4096
+#define DOME_RECORDER_SAMPLES_PER_BLOCK 4096
+#define DOME_RECORDER_DEFAULT_BLOCKS    256     // ~27MB, about 1M samples
+
+enum DomeRecorderErrors {RECORDER_OK = 0, RECORDER_NOT_SUPPORTED, RECORDER_OPEN_FAILED, RECORDER_BAD_FILE};
+
+// one sample, as seen by the writer and returned by the reader
+typedef struct {
+    double      dTime;          // unix time (seconds)
+    int32_t     nAzSteps;
+    int32_t     nElSteps;
+    float       fVolts;         // shutter battery, -1 if unknown
+    float       fCmdLatencyMs;  // latency of the command that produced this sample, 0 if none
+    uint8_t     nShutterState;
+    uint8_t     nRain;
+} DomeRecordSample;
+
+typedef struct {
+    uint64_t    nMagic;
+    uint32_t    nVersion;
+    uint32_t    nSamplesPerBlock;
+    uint32_t    nBlockCount;
+    uint32_t    nBlockSize;         // bytes, header included
+    uint32_t    nCurrentBlock;      // block being written
+    uint32_t    nReserved;
+    uint64_t    nBlocksWritten;     // total number of blocks started since creation
+    uint64_t    nSamplesWritten;
+} DomeRecordFileHeader;
+
+typedef struct {
+    uint64_t    nBlockSeq;          // sequence of the block in the ring, 0 = never used
+    double      dFirstTime;
+    double      dLastTime;
+    uint32_t    nCount;             // published last, readers only look at the first nCount samples
+    uint32_t    nReserved;
+} DomeRecordBlockHeader;
+
+// columns of one block, pointers into the mapped file
+typedef struct {
+    const DomeRecordBlockHeader *pHeader;
+    const double    *pdTime;
+    const int32_t   *pnAzSteps;
+    const int32_t   *pnElSteps;
+    const float     *pfVolts;
+    const float     *pfCmdLatencyMs;
+    const uint8_t   *pnShutterState;
+    const uint8_t   *pnRain;
+} DomeRecordBlockView;
+
+
+class CDomeRecorder
+{
+public:
+    CDomeRecorder();
+    ~CDomeRecorder();
+
+    int     open(const char *pszPath, uint32_t nBlockCount = DOME_RECORDER_DEFAULT_BLOCKS);
+    void    close(void);
+    bool    isOpen(void) { return m_pMap != NULL; }
+    void    append(const DomeRecordSample &sample);
+
+protected:
+    void    startBlock(uint32_t nBlock);
+
+    uint8_t                 *m_pMap;
+    size_t                  m_nMapSize;
+    DomeRecordFileHeader    *m_pHeader;
+};
+
+
+class CDomeRecordReader
+{
+public:
+    CDomeRecordReader();
+    ~CDomeRecordReader();
+
+    int         open(const char *pszPath);
+    void        close(void);
+
+    // blocks in chronological order, nIndex 0 is the oldest one still in the file.
+    uint32_t    getBlockCount(void);
+    bool        getBlock(uint32_t nIndex, DomeRecordBlockView &view);
+
+    // calls pfnVisitor on every sample in [dStart, dEnd], returns the number of samples visited.
+    uint64_t    scan(double dStart, double dEnd, void (*pfnVisitor)(const DomeRecordSample &sample, void *pContext), void *pContext);
+
+protected:
+    uint8_t                 *m_pMap;
+    size_t                  m_nMapSize;
+    const DomeRecordFileHeader  *m_pHeader;
+};
+
+#endif
@@ -0,0 +1,175 @@
+//
+//  DomeTelemetry.cpp
+//
+//  NexDome X2 plugin for V3 firmware
+//  Shared memory telemetry segment, see DomeTelemetry.h
+
+#include "DomeTelemetry.h"
+
+#ifdef DOME_TELEMETRY_SUPPORTED
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+CDomeTelemetry::CDomeTelemetry()
+{
+    m_pSegment = NULL;
+}
+
+CDomeTelemetry::~CDomeTelemetry()
+{
+    close();
+}
+
+int CDomeTelemetry::open(const char *pszName)
+{
+#ifdef DOME_TELEMETRY_SUPPORTED
+    int fd;
+    void *pMap;
+
+    if(m_pSegment)
+        close();
+
+    fd = shm_open(pszName, O_CREAT | O_RDWR, 0644);
+    if(fd < 0)
+        return TELEMETRY_OPEN_FAILED;
+
+    if(ftruncate(fd, sizeof(DomeTelemetrySegment)) != 0) {
+        ::close(fd);
+        return TELEMETRY_OPEN_FAILED;
+    }
+
+    pMap = mmap(NULL, sizeof(DomeTelemetrySegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(pMap == MAP_FAILED)
+        return TELEMETRY_OPEN_FAILED;
+
+    m_pSegment = (DomeTelemetrySegment *)pMap;
+    m_sName.assign(pszName);
+
+    // mark the segment as being updated while we (re)initialize the header.
+    m_pSegment->nSequence.store(m_pSegment->nSequence.load(std::memory_order_relaxed) | 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_pSegment->nMagic = DOME_TELEMETRY_MAGIC;
+    m_pSegment->nVersion = DOME_TELEMETRY_VERSION;
+    m_pSegment->nDataSize = sizeof(DomeTelemetryData);
+    m_pSegment->nWriterPid = (int32_t)getpid();
+    memset(&m_pSegment->data, 0, sizeof(DomeTelemetryData));
+    m_pSegment->data.dShutterVolts = -1.0;
+    m_pSegment->data.nBatteryCyclesLeft = -1;
+    m_pSegment->data.fBatteryHoursLeft = -1.0f;
+    m_pSegment->nSequence.store(m_pSegment->nSequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+
+    return TELEMETRY_OK;
+#else
+    return TELEMETRY_NOT_SUPPORTED;
+#endif
+}
+
+void CDomeTelemetry::close()
+{
+#ifdef DOME_TELEMETRY_SUPPORTED
+    if(!m_pSegment)
+        return;
+    // leave the segment in place so readers see the last state with bConnected = 0
+    m_pSegment->nWriterPid = 0;
+    munmap(m_pSegment, sizeof(DomeTelemetrySegment));
+    m_pSegment = NULL;
+#endif
+}
+
+void CDomeTelemetry::publish(const DomeTelemetryData &data)
+{
+    uint32_t nSeq;
+
+    if(!m_pSegment)
+        return;
+
+    nSeq = m_pSegment->nSequence.load(std::memory_order_relaxed);
+    m_pSegment->nSequence.store(nSeq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&m_pSegment->data, &data, sizeof(DomeTelemetryData));
+    m_pSegment->nSequence.store(nSeq + 2, std::memory_order_release);
+}
+
+
+CDomeTelemetryReader::CDomeTelemetryReader()
+{
+    m_pSegment = NULL;
+}
+
+CDomeTelemetryReader::~CDomeTelemetryReader()
+{
+    close();
+}
+
+int CDomeTelemetryReader::open(const char *pszName)
+{
+#ifdef DOME_TELEMETRY_SUPPORTED
+    int fd;
+    void *pMap;
+    struct stat st;
+
+    if(m_pSegment)
+        close();
+
+    fd = shm_open(pszName, O_RDONLY, 0);
+    if(fd < 0)
+        return TELEMETRY_OPEN_FAILED;
+
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(DomeTelemetrySegment)) {
+        ::close(fd);
+        return TELEMETRY_BAD_SEGMENT;
+    }
+
+    pMap = mmap(NULL, sizeof(DomeTelemetrySegment), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(pMap == MAP_FAILED)
+        return TELEMETRY_OPEN_FAILED;
+
+    m_pSegment = (DomeTelemetrySegment *)pMap;
+    if(m_pSegment->nMagic != DOME_TELEMETRY_MAGIC || m_pSegment->nVersion != DOME_TELEMETRY_VERSION || m_pSegment->nDataSize != sizeof(DomeTelemetryData)) {
+        close();
+        return TELEMETRY_BAD_SEGMENT;
+    }
+    return TELEMETRY_OK;
+#else
+    return TELEMETRY_NOT_SUPPORTED;
+#endif
+}
+
+void CDomeTelemetryReader::close()
+{
+#ifdef DOME_TELEMETRY_SUPPORTED
+    if(!m_pSegment)
+        return;
+    munmap(m_pSegment, sizeof(DomeTelemetrySegment));
+    m_pSegment = NULL;
+#endif
+}
+
+int CDomeTelemetryReader::read(DomeTelemetryData &data, uint32_t *pnSequence)
+{
+    uint32_t nSeqStart, nSeqEnd;
+    int i;
+
+    if(!m_pSegment)
+        return TELEMETRY_OPEN_FAILED;
+
+    for(i = 0; i < DOME_TELEMETRY_READ_RETRIES; i++) {
+        nSeqStart = m_pSegment->nSequence.load(std::memory_order_acquire);
+        if(nSeqStart & 1)
+            continue;   // writer is updating
+        memcpy(&data, (const void *)&m_pSegment->data, sizeof(DomeTelemetryData));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        nSeqEnd = m_pSegment->nSequence.load(std::memory_order_relaxed);
+        if(nSeqStart == nSeqEnd) {
+            if(pnSequence)
+                *pnSequence = nSeqStart;
+            return TELEMETRY_OK;
+        }
+    }
+    return TELEMETRY_BUSY;
+}
@@ -0,0 +1,95 @@
+//
+//  DomeTelemetry.h
+//
+//  NexDome X2 plugin for V3 firmware
+//  Live dome state published in a POSIX shared memory segment so local processes
+//  (weather monitor, safety daemon, dashboard, ...) can read it without touching the serial port.
+//
+//  The segment is protected by a sequence lock : the writer makes the sequence odd while updating
+//  and even when done, readers retry if the sequence was odd or changed during the copy.
+//  Readers never block the writer and a read is only a memory copy, no syscall.
+
+#ifndef __DOME_TELEMETRY__
+#define __DOME_TELEMETRY__
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+
+#if defined(SB_LINUX_BUILD) || defined(SB_MAC_BUILD)
+#define DOME_TELEMETRY_SUPPORTED
+#endif
+
+#define DOME_TELEMETRY_MAGIC        0x4E445633  // "NDV3"
+#define DOME_TELEMETRY_VERSION      2
+#define DOME_TELEMETRY_SHM_PREFIX   "/NexDomeV3."
+#define DOME_TELEMETRY_READ_RETRIES 1000
+
+enum DomeTelemetryErrors {TELEMETRY_OK = 0, TELEMETRY_NOT_SUPPORTED, TELEMETRY_OPEN_FAILED, TELEMETRY_BAD_SEGMENT, TELEMETRY_BUSY};
+
+// shared state, only fixed size types so the layout is the same for all readers.
+// Any change to this struct needs a DOME_TELEMETRY_VERSION bump.
+typedef struct {
+    double      dUpdateTime;        // unix time of the last update (seconds)
+    double      dAz;
+    double      dEl;
+    double      dShutterVolts;      // -1 if unknown
+    int32_t     nRotatorPos;        // steps
+    int32_t     nShutterPos;        // steps
+    int32_t     nStepsPerRev;
+    int32_t     nShutterState;      // NexDomeShutterState
+    int32_t     nRainStatus;        // RainSensorStates
+    uint8_t     bConnected;
+    uint8_t     bMoving;
+    uint8_t     bParked;
+    uint8_t     bShutterPresent;
+    int32_t     nBatteryCyclesLeft; // open/close cycles left before the cutoff voltage, -1 if unknown
+    float       fBatteryHoursLeft;  // at the idle drain rate, -1 if unknown
+} DomeTelemetryData;
+
+typedef struct {
+    uint32_t                nMagic;
+    uint32_t                nVersion;
+    uint32_t                nDataSize;
+    int32_t                 nWriterPid;
+    std::atomic<uint32_t>   nSequence;  // odd while the writer is updating
+    uint32_t                nReserved;
+    DomeTelemetryData       data;
+} DomeTelemetrySegment;
+
+
+// writer side, owned by CNexDomeV3
+class CDomeTelemetry
+{
+public:
+    CDomeTelemetry();
+    ~CDomeTelemetry();
+
+    int     open(const char *pszName);
+    void    close(void);
+    bool    isOpen(void) { return m_pSegment != NULL; }
+    void    publish(const DomeTelemetryData &data);
+
+protected:
+    DomeTelemetrySegment    *m_pSegment;
+    std::string             m_sName;
+};
+
+
+// reader side, for the other local processes
+class CDomeTelemetryReader
+{
+public:
+    CDomeTelemetryReader();
+    ~CDomeTelemetryReader();
+
+    int     open(const char *pszName);
+    void    close(void);
+    int     read(DomeTelemetryData &data, uint32_t *pnSequence = NULL);
+
+protected:
+    DomeTelemetrySegment    *m_pSegment;
+};
+
+#endif
@@ -0,0 +1,155 @@
+//
+//  DomeTrace.cpp
+//
+//  NexDome X2 plugin for V3 firmware
+//  Chrome trace-event spans, see DomeTrace.h
+
+#include <functional>
+#include <thread>
+#include "DomeTrace.h"
+
+static const char *kCategoryNames[TRACE_CATEGORY_COUNT] = {"dapi", "serial", "mutex"};
+static const char *kArgNames[TRACE_CATEGORY_COUNT][2] = {{NULL, NULL}, {"err", "attempts"}, {NULL, NULL}};
+
+CDomeTrace::CDomeTrace()
+{
+    m_pSpans = NULL;
+    m_nCapacity = 0;
+    m_nNext = 0;
+    m_nInstance = 0;
+}
+
+CDomeTrace::~CDomeTrace()
+{
+    enable(false);
+}
+
+int CDomeTrace::enable(bool bEnable, int nCapacity)
+{
+    int i;
+
+    if(m_pSpans) {
+        delete [] m_pSpans;
+        m_pSpans = NULL;
+        m_nCapacity = 0;
+    }
+    if(!bEnable)
+        return 0;
+    if(nCapacity <= 0)
+        return -1;
+
+    m_pSpans = new TraceSpan[nCapacity];
+    for(i = 0; i < nCapacity; i++) {
+        m_pSpans[i].nSeq = 0;
+        // touch every page now rather than on the first lap of the ring
+        memset(m_pSpans[i].szName, 0, TRACE_NAME_SIZE);
+    }
+    m_nCapacity = nCapacity;
+    m_nNext = 0;
+    m_clock.Reset();
+    return 0;
+}
+
+void CDomeTrace::setFile(const char *pszPath)
+{
+    if(!pszPath || !strlen(pszPath)) {
+        m_sTracePath.clear();
+        enable(false);
+        return;
+    }
+    m_sTracePath.assign(pszPath);
+    if(!m_pSpans)
+        enable(true);
+}
+
+uint32_t CDomeTrace::threadId()
+{
+    return uint32_t(std::hash<std::thread::id>()(std::this_thread::get_id()) & 0x7fffffff);
+}
+
+void CDomeTrace::addSpan(int nCategory, const char *pszName, const char *pszDetail, int64_t nBeginNs, int64_t nEndNs, int nArg0, int nArg1)
+{
+    uint64_t nIndex;
+    TraceSpan *pSpan;
+
+    if(!m_pSpans)
+        return;
+
+    nIndex = m_nNext.fetch_add(1);
+    pSpan = &m_pSpans[nIndex % m_nCapacity];
+    pSpan->nSeq.store(0, std::memory_order_relaxed);
+    pSpan->nBeginNs = nBeginNs;
+    pSpan->nEndNs = nEndNs;
+    pSpan->nThread = threadId();
+    pSpan->nCategory = nCategory;
+    pSpan->nArgs[0] = nArg0;
+    pSpan->nArgs[1] = nArg1;
+    strncpy(pSpan->szName, pszName ? pszName : "", TRACE_NAME_SIZE - 1);
+    pSpan->szName[TRACE_NAME_SIZE - 1] = 0;
+    strncpy(pSpan->szDetail, pszDetail ? pszDetail : "", TRACE_NAME_SIZE - 1);
+    pSpan->szDetail[TRACE_NAME_SIZE - 1] = 0;
+    pSpan->nSeq.store(nIndex + 1, std::memory_order_release);
+}
+
+int CDomeTrace::dump()
+{
+    if(m_sTracePath.empty())
+        return 0;
+    return dump(m_sTracePath.c_str());
+}
+
+int CDomeTrace::dump(const char *pszPath)
+{
+    FILE *pFile;
+    uint64_t nEnd;
+    uint64_t nIndex;
+    TraceSpan *pSpan;
+    TraceSpan span;
+    bool bFirst = true;
+    int i;
+
+    if(!m_pSpans)
+        return -1;
+
+    pFile = fopen(pszPath, "w");
+    if(!pFile)
+        return -1;
+
+    nEnd = m_nNext.load();
+    nIndex = nEnd > uint64_t(m_nCapacity) ? nEnd - m_nCapacity : 0;
+
+    fprintf(pFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for(; nIndex < nEnd; nIndex++) {
+        pSpan = &m_pSpans[nIndex % m_nCapacity];
+        if(pSpan->nSeq.load(std::memory_order_acquire) != nIndex + 1)
+            continue;   // overwritten or still being written
+        span.nBeginNs = pSpan->nBeginNs;
+        span.nEndNs = pSpan->nEndNs;
+        span.nThread = pSpan->nThread;
+        span.nCategory = pSpan->nCategory;
+        span.nArgs[0] = pSpan->nArgs[0];
+        span.nArgs[1] = pSpan->nArgs[1];
+        memcpy(span.szName, pSpan->szName, TRACE_NAME_SIZE);
+        memcpy(span.szDetail, pSpan->szDetail, TRACE_NAME_SIZE);
+        if(pSpan->nSeq.load(std::memory_order_acquire) != nIndex + 1)
+            continue;
+        if(span.nCategory < 0 || span.nCategory >= TRACE_CATEGORY_COUNT)
+            continue;
+
+        // names are command verbs and function names, nothing to escape.
+        fprintf(pFile, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,\"args\":{",
+                bFirst ? "" : ",\n", span.szName, kCategoryNames[span.nCategory],
+                span.nBeginNs / 1000.0, (span.nEndNs - span.nBeginNs) / 1000.0, m_nInstance, span.nThread);
+        fprintf(pFile, "\"detail\":\"%s\"", span.szDetail);
+        for(i = 0; i < 2; i++) {
+            if(kArgNames[span.nCategory][i])
+                fprintf(pFile, ",\"%s\":%d", kArgNames[span.nCategory][i], span.nArgs[i]);
+        }
+        fprintf(pFile, "}}");
+        bFirst = false;
+    }
+    fprintf(pFile, "\n]}\n");
+    if(fclose(pFile) != 0)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,102 @@
+//
+//  DomeTrace.h
+//
+//  NexDome X2 plugin for V3 firmware
+//  Span tracing of the dapi calls, the serial exchanges and the X2 mutex, dumped as Chrome trace-event JSON
+//  (chrome://tracing, Perfetto).
+//
+//  Spans go in a ring allocated once when tracing is enabled, recording a span is a few stores and
+//  an atomic increment so tracing doesn't change the timing we're looking at. When the ring is full
+//  the oldest spans are overwritten, the dump always has the last TRACE_DEFAULT_CAPACITY spans.
+
+#ifndef __DOME_TRACE__
+#define __DOME_TRACE__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+
+#include "StopWatch.h"
+
+#define TRACE_DEFAULT_CAPACITY  65536
+#define TRACE_NAME_SIZE         24
+
+enum TraceCategories {TRACE_DAPI = 0, TRACE_SERIAL, TRACE_MUTEX, TRACE_CATEGORY_COUNT};
+
+typedef struct {
+    std::atomic<uint64_t>   nSeq;       // index of the span + 1 once complete, 0 while being written
+    int64_t     nBeginNs;               // since the trace was enabled
+    int64_t     nEndNs;
+    uint32_t    nThread;
+    int         nCategory;
+    int         nArgs[2];
+    char        szName[TRACE_NAME_SIZE];
+    char        szDetail[TRACE_NAME_SIZE];
+} TraceSpan;
+
+
+class CDomeTrace
+{
+public:
+    CDomeTrace();
+    ~CDomeTrace();
+
+    // enable before any thread starts tracing, disable once they're done.
+    int         enable(bool bEnable, int nCapacity = TRACE_DEFAULT_CAPACITY);
+    bool        isEnabled(void) { return m_pSpans != NULL; }
+    void        setInstance(int nInstance) { m_nInstance = nInstance; }
+    void        setFile(const char *pszPath);
+    void        getFile(std::string &sPath) { sPath.assign(m_sTracePath); }
+
+    int64_t     now(void) { return m_clock.GetElapsedNanoseconds(); }
+    void        addSpan(int nCategory, const char *pszName, const char *pszDetail, int64_t nBeginNs, int64_t nEndNs, int nArg0 = 0, int nArg1 = 0);
+
+    uint64_t    getSpanCount(void) { return m_nNext.load(); }
+    int         dump(void);     // to the trace file, if any
+    int         dump(const char *pszPath);
+
+protected:
+    uint32_t    threadId(void);
+
+    TraceSpan               *m_pSpans;
+    int                     m_nCapacity;
+    std::atomic<uint64_t>   m_nNext;
+    CStopWatch              m_clock;
+    int                     m_nInstance;
+    std::string             m_sTracePath;
+};
+
+
+// Records a span from its construction to the end of the scope.
+// The args are read when the scope ends, point them at the error code or the attempt counter.
+class CTraceSpan
+{
+public:
+    CTraceSpan(CDomeTrace &trace, int nCategory, const char *pszName, const char *pszDetail = NULL, const int *pnArg0 = NULL, const int *pnArg1 = NULL)
+        : m_trace(trace), m_nCategory(nCategory), m_pszName(pszName), m_pszDetail(pszDetail), m_pnArg0(pnArg0), m_pnArg1(pnArg1)
+        {
+        m_nBeginNs = m_trace.isEnabled() ? m_trace.now() : 0;
+        }
+
+    ~CTraceSpan()
+        {
+        if(m_trace.isEnabled())
+            m_trace.addSpan(m_nCategory, m_pszName, m_pszDetail, m_nBeginNs, m_trace.now(), m_pnArg0 ? *m_pnArg0 : 0, m_pnArg1 ? *m_pnArg1 : 0);
+        }
+
+private:
+    CTraceSpan(const CTraceSpan &);
+    CTraceSpan &operator=(const CTraceSpan &);
+
+    CDomeTrace  &m_trace;
+    int         m_nCategory;
+    const char  *m_pszName;
+    const char  *m_pszDetail;
+    const int   *m_pnArg0;
+    const int   *m_pnArg1;
+    int64_t     m_nBeginNs;
+};
+
+#endif
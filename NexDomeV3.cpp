@@ -7,6 +7,34 @@
 
 #include "NexDomeV3.h"
 
+// verbs that don't follow the xRx (read) / xWx (write) naming
+static const CommandVerbInfo kCommandVerbs[] = {
+    {"FRR", CMD_CLASS_INFO,     true},
+    {"GAR", CMD_CLASS_MOTION,   false},
+    {"GSR", CMD_CLASS_MOTION,   false},
+    {"GHR", CMD_CLASS_MOTION,   false},
+    {"OPS", CMD_CLASS_MOTION,   false},
+    {"CLS", CMD_CLASS_MOTION,   false},
+    {"SWR", CMD_CLASS_MOTION,   false},
+    {"SWS", CMD_CLASS_MOTION,   false},
+    {"ZRR", CMD_CLASS_EEPROM,   false},
+    {"ZRS", CMD_CLASS_EEPROM,   false},
+    {"ZDR", CMD_CLASS_EEPROM,   false},
+    {"ZDS", CMD_CLASS_EEPROM,   false},
+    {"ZWR", CMD_CLASS_EEPROM,   false},
+    {"ZWS", CMD_CLASS_EEPROM,   false},
+    {NULL,  0,                  false}
+};
+
+// deadline, attempt timeout, attempts, backoff (ms)
+static const CommandPolicy kDefaultCommandPolicies[CMD_CLASS_COUNT] = {
+    {3000, 1000, 3, 100},   // CMD_CLASS_QUERY
+    {5000, 1500, 3, 250},   // CMD_CLASS_INFO, first command after the controller boot
+    {3000, 1000, 2, 100},   // CMD_CLASS_SETTING
+    {2000, 2000, 1, 0},     // CMD_CLASS_MOTION, never resent
+    {5000, 5000, 1, 0}      // CMD_CLASS_EEPROM
+};
+
 CNexDomeV3::CNexDomeV3()
 {
     // set some sane values
@@ -19,14 +47,33 @@ CNexDomeV3::CNexDomeV3()
     m_dShutterBatteryVolts = 0.0;
     
     m_dHomeAz = 0;
+    m_nHomeStepPos = 0;
+    m_nGotoStepPos = 0;
+    m_nGotoDir = 0;
+    m_dGotoSlitAlt = NAN;
     m_bHasBeenHomed  = false;
     
 	m_nCurrentRotatorPos = 0;
+    m_nCurrentShutterPos = 0;
+    m_nPendingRotatorPos = 0;
+    m_nPendingShutterPos = 0;
+    m_bRotatorPosPending = false;
+    m_bShutterPosPending = false;
+    m_nSeqLastPos = 0;
+    m_nSeqLastDelta = 0;
+    m_nSeqLines = 0;
+    m_nShutterState = IDLE;
 	
     m_dCurrentAzPosition = 0.0;
     m_dCurrentElPosition = 0.0;
+    m_dCachedAz = 0.0;
+    m_dCachedEl = 0.0;
+    m_dCacheTime = 0.0;
+    m_bFirmwareCached = false;
+    m_nFirmwareSeq = 0;
 
 	m_bDomeIsMoving = false;
+    m_bShutterIsMoving = false;
 
     m_bShutterOpened = false;
 	m_nCurrentShutterCmd = IDLE;
@@ -53,6 +100,37 @@ CNexDomeV3::CNexDomeV3()
 
 	m_cmdDelayCheckTimer.Reset();
 
+    m_bAbortPending = false;
+
+    memset(&m_Calibration, 0, sizeof(StepsPerRevCalibration));
+    m_nCalibrationRevolutions = CALIBRATION_REVOLUTIONS;
+    m_bCalibrationWrite = false;
+    m_nCalibrationGuess = CALIBRATION_DEFAULT_GUESS;
+    m_nCalibrationDir = 1;
+    m_nCalibrationTarget = 0;
+    m_nCalibrationLastPos = 0;
+    m_nCalibrationUnwrapped = 0;
+
+    memset(&m_Tuning, 0, sizeof(RotationTuning));
+    m_Tuning.nBest = -1;
+    m_bTuningApply = false;
+    m_nTuningDir = 1;
+    m_nTuningTarget = 0;
+    m_nTuningLastPos = 0;
+    m_nTuningOvershoot = 0;
+    m_nCalibrationTravel = 0;
+    m_bAbortWhileMoving = false;
+    m_bAbortAcked = false;
+    m_dLastAbortLatency = 0.0;
+    m_dMaxAbortLatency = 0.0;
+
+    m_bWatchdog = true;
+    m_nLinkState = LINK_UP;
+    m_nLinkFailures = 0;
+    memset(m_szPort, 0, SERIAL_BUFFER_SIZE);
+    memset(&m_LinkIntent, 0, sizeof(LinkIntent));
+    memset(&m_LinkStats, 0, sizeof(LinkStats));
+
 #ifdef PLUGIN_DEBUG
 #if defined(SB_WIN_BUILD)
     m_sLogfilePath = getenv("HOMEDRIVE");
@@ -80,6 +158,37 @@ CNexDomeV3::CNexDomeV3()
     m_sRainStatusfilePath = getenv("HOME");
     m_sRainStatusfilePath += "/NDV3_Rain.txt";
 #endif
+
+#if defined(SB_WIN_BUILD)
+    m_sRecorderfilePath = getenv("HOMEDRIVE");
+    m_sRecorderfilePath += getenv("HOMEPATH");
+    m_sRecorderfilePath += "\\NDV3_Telemetry.rec";
+#else
+    m_sRecorderfilePath = getenv("HOME");
+    m_sRecorderfilePath += "/NDV3_Telemetry.rec";
+#endif
+    memset(&m_lastRecordSample, 0, sizeof(DomeRecordSample));
+    m_fLastCmdLatencyMs = 0;
+    m_nMotionMetric = -1;
+    m_nSlewSteps = 0;
+    m_dSlewLastPoll = 0;
+    m_nFollowNext = 0;
+    m_dFollowEnd = 0;
+    m_bFollowing = false;
+    m_dFollowRa = 0;
+    m_dFollowDec = 0;
+    m_dSlaveRa = NAN;
+    m_dSlaveDec = NAN;
+    m_bHomeResync = true;
+    m_nHomeEdge[0] = m_nHomeEdge[1] = HOME_EDGE_UNKNOWN;
+    resetHomeEdges();
+    m_nHomeResyncDrift = 0;
+    m_bHomeResyncPending = false;
+    memset(&m_HomeDrift, 0, sizeof(HomeDriftStats));
+    m_bHomeCrossingPending = false;
+    m_nHomeCrossingPos = 0;
+    m_szHomeCrossing[0] = 0;
+    memcpy(m_CommandPolicies, kDefaultCommandPolicies, sizeof(m_CommandPolicies));
     
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     ltime = time(NULL);
@@ -95,6 +204,7 @@ CNexDomeV3::CNexDomeV3()
 
 CNexDomeV3::~CNexDomeV3()
 {
+    m_Trace.dump();
 #ifdef	PLUGIN_DEBUG
     // Close LogFile
     if (Logfile)
@@ -109,6 +219,7 @@ CNexDomeV3::~CNexDomeV3()
 int CNexDomeV3::Connect(const char *pszPort)
 {
     int nErr;
+    CTimingScope connectScope(CDomeMetrics::durationSink, &m_Metrics, DURATION_CONNECT);
     
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     ltime = time(NULL);
@@ -118,14 +229,21 @@ int CNexDomeV3::Connect(const char *pszPort)
     fflush(Logfile);
 #endif
 
+    m_bFirmwareCached = false;
+    m_nLinkState = LINK_UP;
+    m_nLinkFailures = 0;
+    strncpy(m_szPort, pszPort, SERIAL_BUFFER_SIZE - 1);
     // 115200 8N1
     nErr = m_pSerx->open(pszPort, 115200, SerXInterface::B_NOPARITY, "-DTR_CONTROL 1");
     if(nErr) {
         m_bIsConnected = false;
+        connectScope.Cancel();
         return nErr;
     }
     m_bIsConnected = true;
 	m_bDomeIsMoving = false;
+    m_bShutterIsMoving = false;
+    m_bHasBeenHomed = false;
     m_bParking = false;
     m_bUnParking = false;
 
@@ -140,29 +258,52 @@ int CNexDomeV3::Connect(const char *pszPort)
     // the arduino take over a second to start as it need to init the XBee
     if(m_pSleeper)
         m_pSleeper->sleep(2000);
-    
+
+    nErr = readControllerState();
+    if(nErr == FIRMWARE_NOT_SUPPORTED) {
+        // we're not properly connected
+        m_bIsConnected = false;
+        m_pSerx->close();
+    }
+    if(nErr) {
+        connectScope.Cancel();
+        return nErr;
+    }
+
+    publishTelemetry();
+    return SB_OK;
+}
+
+// firmware, steps per rev, home, shutter and dead zone. Connect and the watchdog once the port is open again.
+int CNexDomeV3::readControllerState()
+{
+    int nErr;
+    char szVersion[SERIAL_BUFFER_SIZE];
+
+    m_bFirmwareCached = false;
     m_pSerx->purgeTxRx();
+    m_Parser.reset();
+    m_bRotatorPosPending = false;
+    m_bShutterPosPending = false;
     
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     ltime = time(NULL);
     timestamp = asctime(localtime(&ltime));
     timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] CNexDomeV3::Connect Getting Firmware\n", timestamp);
+    fprintf(Logfile, "[%s] CNexDomeV3::readControllerState Getting Firmware\n", timestamp);
     fflush(Logfile);
 #endif
 
     // if this fails we're not properly connected.
-    nErr = getFirmwareVersion(m_szFirmwareVersion, SERIAL_BUFFER_SIZE);
+    nErr = getFirmwareVersion(szVersion, SERIAL_BUFFER_SIZE);
     if(nErr) {
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
         ltime = time(NULL);
         timestamp = asctime(localtime(&ltime));
         timestamp[strlen(timestamp) - 1] = 0;
-        fprintf(Logfile, "[%s] [CNexDomeV3::Connect] Error Getting Firmware.\n", timestamp);
+        fprintf(Logfile, "[%s] [CNexDomeV3::readControllerState] Error Getting Firmware.\n", timestamp);
         fflush(Logfile);
 #endif
-        m_bIsConnected = false;
-        m_pSerx->close();
         return FIRMWARE_NOT_SUPPORTED;
     }
 
@@ -170,12 +311,13 @@ int CNexDomeV3::Connect(const char *pszPort)
     ltime = time(NULL);
     timestamp = asctime(localtime(&ltime));
     timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] CNexDomeV3::Connect Got Firmware %s ( %f )\n", timestamp, m_szFirmwareVersion, m_fVersion);
+    fprintf(Logfile, "[%s] CNexDomeV3::readControllerState Got Firmware %s ( %f )\n", timestamp, szVersion, m_fVersion);
     fflush(Logfile);
 #endif
-    if(m_fVersion < 3.0f) {
+    if(m_fVersion < 3.0f)
         return FIRMWARE_NOT_SUPPORTED;
-    }
+    publishFirmwareVersion(szVersion);
+    m_bFirmwareCached = true;
 
     nErr = getDomeStepPerRev(m_nNbStepPerRev);
     if(m_bShutterPresent)
@@ -187,7 +329,7 @@ int CNexDomeV3::Connect(const char *pszPort)
         ltime = time(NULL);
         timestamp = asctime(localtime(&ltime));
         timestamp[strlen(timestamp) - 1] = 0;
-        fprintf(Logfile, "[%s] CNexDomeV3::Connect getDomeHomeAz nErr : %d\n", timestamp, nErr);
+        fprintf(Logfile, "[%s] CNexDomeV3::readControllerState getDomeHomeAz nErr : %d\n", timestamp, nErr);
         fflush(Logfile);
 #endif
         return nErr;
@@ -212,8 +354,7 @@ int CNexDomeV3::Connect(const char *pszPort)
     }
 
 	getRotatorDeadZone(m_nRotationDeadZone);
-
-    return SB_OK;
+    return PLUGIN_OK;
 }
 
 
@@ -223,11 +364,21 @@ void CNexDomeV3::Disconnect()
         abortCurrentCommand();
         m_pSerx->purgeTxRx();
         m_pSerx->close();
+        m_Parser.reset();
     }
+    else if(m_nLinkState == LINK_BOOTING)
+        m_pSerx->close();
+    // an outage in progress ends here, it's the user's call now
+    m_nLinkState = LINK_UP;
+    m_nLinkFailures = 0;
     m_bIsConnected = false;
+    m_bFirmwareCached = false;
 	m_bDomeIsMoving = false;
+    m_bShutterIsMoving = false;
     m_bParking = false;
     m_bUnParking = false;
+    publishTelemetry();
+    m_Trace.dump();
 
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     ltime = time(NULL);
@@ -239,13 +390,67 @@ void CNexDomeV3::Disconnect()
 }
 
 
-int CNexDomeV3::domeCommand(const char *pszCmd, char *pszResult, int nResultMaxLen)
+void CNexDomeV3::getCommandClass(const char *pszCmd, int &nClass, bool &bIdempotent)
+{
+    int i;
+
+    // "@PRR\r\n", "@GSR,1234\r\n", ...
+    nClass = CMD_CLASS_SETTING;
+    bIdempotent = false;
+    if(!pszCmd || pszCmd[0] != '@' || strlen(pszCmd) < 4)
+        return;
+
+    for(i = 0; kCommandVerbs[i].pszVerb; i++) {
+        if(!strncmp(pszCmd + 1, kCommandVerbs[i].pszVerb, 3)) {
+            nClass = kCommandVerbs[i].nClass;
+            bIdempotent = kCommandVerbs[i].bIdempotent;
+            return;
+        }
+    }
+    if(pszCmd[2] == 'R') {
+        nClass = CMD_CLASS_QUERY;
+        bIdempotent = true;
+    }
+    else if(pszCmd[2] == 'W') {
+        // writing the same value twice is harmless
+        nClass = CMD_CLASS_SETTING;
+        bIdempotent = true;
+    }
+}
+
+int CNexDomeV3::setCommandPolicy(int nClass, const CommandPolicy &policy)
+{
+    if(nClass < 0 || nClass >= CMD_CLASS_COUNT || policy.nDeadlineMs <= 0 || policy.nAttemptTimeoutMs <= 0 || policy.nMaxAttempts < 1)
+        return COMMAND_FAILED;
+    m_CommandPolicies[nClass] = policy;
+    return PLUGIN_OK;
+}
+
+int CNexDomeV3::getCommandPolicy(int nClass, CommandPolicy &policy)
+{
+    if(nClass < 0 || nClass >= CMD_CLASS_COUNT)
+        return COMMAND_FAILED;
+    policy = m_CommandPolicies[nClass];
+    return PLUGIN_OK;
+}
+
+int CNexDomeV3::domeCommand(const char *pszCmd, char *pszResult, int nResultMaxLen, const char *pszReplyToken)
 {
     int nErr = PLUGIN_OK;
     char szResp[SERIAL_BUFFER_SIZE];
     unsigned long  ulBytesWrite;
-    int nb_timeout;
-	 int dDelayMs;
+	int dDelayMs;
+    int nClass;
+    bool bIdempotent;
+    const CommandPolicy *pPolicy;
+    CStopWatch deadlineTimer;
+    CStopWatch attemptTimer;
+    int nAttempt;
+    int nAttempts = 0;
+    int nBackoffMs;
+    int nWaitMs;
+    char szVerb[4];
+    char szTraceCmd[TRACE_NAME_SIZE];
 
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     ltime = time(NULL);
@@ -255,52 +460,98 @@ int CNexDomeV3::domeCommand(const char *pszCmd, char *pszResult, int nResultMaxL
     fflush(Logfile);
 #endif
 
-	// do we need to wait ?
-	if(m_cmdDelayCheckTimer.GetElapsedSeconds()<CMD_WAIT_INTERVAL) {
-		dDelayMs = CMD_WAIT_INTERVAL - int(m_cmdDelayCheckTimer.GetElapsedSeconds() *1000);
-		if(dDelayMs>0)
-			m_pSleeper->sleep(dDelayMs);
-	}
-	
-    nErr = m_pSerx->writeFile((void *)pszCmd, strlen(pszCmd), ulBytesWrite);
-    m_pSerx->flushTx();
-	m_cmdDelayCheckTimer.Reset();
-    if(nErr)
-        return nErr;
-
-    nb_timeout = 0;
-    
-    while(true) {
-        if(nb_timeout>5) { // durring a movement we get a lot of extra stuff in there
-            nErr = ERR_RXTIMEOUT;
+    // verb as the span name, the command without '@' and the line end as its detail
+    strncpy(szVerb, pszCmd[0] == '@' ? pszCmd + 1 : pszCmd, 3);
+    szVerb[3] = 0;
+    strncpy(szTraceCmd, pszCmd[0] == '@' ? pszCmd + 1 : pszCmd, TRACE_NAME_SIZE - 1);
+    szTraceCmd[TRACE_NAME_SIZE - 1] = 0;
+    szTraceCmd[strcspn(szTraceCmd, "\r\n")] = 0;
+    CTraceSpan commandSpan(m_Trace, TRACE_SERIAL, szVerb, szTraceCmd, &nErr, &nAttempts);
+
+    getCommandClass(pszCmd, nClass, bIdempotent);
+    pPolicy = &m_CommandPolicies[nClass];
+    nBackoffMs = pPolicy->nBackoffMs;
+
+    for(nAttempt = 0; ; nAttempt++) {
+        // do we need to wait ?
+        dDelayMs = CMD_WAIT_INTERVAL - m_cmdDelayCheckTimer.GetElapsedMilliseconds();
+        if(dDelayMs>0)
+            m_pSleeper->sleep(dDelayMs);
+
+        nErr = m_pSerx->writeFile((void *)pszCmd, strlen(pszCmd), ulBytesWrite);
+        m_pSerx->flushTx();
+        m_cmdDelayCheckTimer.Reset();
+        m_cmdLatencyTimer.Reset();
+        nAttempts++;
+        m_Metrics.countCommand(pszCmd);
+        m_Metrics.addBytesTx(ulBytesWrite);
+        if(nErr) {
+            m_nLinkFailures++;
             return nErr;
         }
-        // read response
-        nErr = readResponse(szResp, SERIAL_BUFFER_SIZE);
-        if(nErr &&  nErr != ERR_DATAOUT) {
+
+        // read until we get the reply we want or the attempt times out,
+        // durring a movement we get a lot of extra stuff in there
+        attemptTimer.Reset();
+        while(true) {
+            nWaitMs = pPolicy->nAttemptTimeoutMs - attemptTimer.GetElapsedMilliseconds();
+            if(pPolicy->nDeadlineMs - deadlineTimer.GetElapsedMilliseconds() < nWaitMs)
+                nWaitMs = pPolicy->nDeadlineMs - deadlineTimer.GetElapsedMilliseconds();
+            if(nWaitMs <= 0)
+                break;
+
+            nErr = readResponse(szResp, SERIAL_BUFFER_SIZE, nWaitMs);
+            if(nErr == ERR_DATAOUT)
+                break;
+            if(nErr) {
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            ltime = time(NULL);
-            timestamp = asctime(localtime(&ltime));
-            timestamp[strlen(timestamp) - 1] = 0;
-            fprintf(Logfile, "[%s] [CNexDomeV3::domeCommand] ***** ERROR READING RESPONSE **** error = %d , response : '%s'\n", timestamp, nErr, szResp);
-            fflush(Logfile);
+                ltime = time(NULL);
+                timestamp = asctime(localtime(&ltime));
+                timestamp[strlen(timestamp) - 1] = 0;
+                fprintf(Logfile, "[%s] [CNexDomeV3::domeCommand] ***** ERROR READING RESPONSE **** error = %d , response : '%s'\n", timestamp, nErr, szResp);
+                fflush(Logfile);
 #endif
-            return nErr;
-        }
-        if(nErr == ERR_DATAOUT) {
-            m_pSleeper->sleep(50);
-            nb_timeout++;
-            continue;
+                return nErr;
+            }
+            nErr = processResponse(szResp, pszResult, nResultMaxLen);
+            if(nErr && nErr != CMD_PROC_DONE)
+                return nErr;
+
+            if(nErr == CMD_PROC_DONE && (!pszReplyToken || strstr(pszResult, pszReplyToken))) {
+                m_fLastCmdLatencyMs = float(m_cmdLatencyTimer.GetElapsedNanoseconds() / 1000000.0);
+                m_nLinkFailures = 0;
+                nErr = PLUGIN_OK;
+                return nErr;
+            }
         }
-		nErr = processResponse(szResp, pszResult, nResultMaxLen);
-		if(nErr && nErr != CMD_PROC_DONE)
-			return nErr;
 
-		if(nErr == CMD_PROC_DONE)
-			return PLUGIN_OK;
-        continue;
+        // no reply, only resend what is safe to resend and if there is time left for it.
+        if(!bIdempotent || nAttempt + 1 >= pPolicy->nMaxAttempts
+           || deadlineTimer.GetElapsedMilliseconds() + nBackoffMs >= pPolicy->nDeadlineMs)
+            break;
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        ltime = time(NULL);
+        timestamp = asctime(localtime(&ltime));
+        timestamp[strlen(timestamp) - 1] = 0;
+        fprintf(Logfile, "[%s] [CNexDomeV3::domeCommand] no reply to %s, retrying in %d ms\n", timestamp, pszCmd, nBackoffMs);
+        fflush(Logfile);
+#endif
+        m_Metrics.countRetry();
+        if(nBackoffMs > 0)
+            m_pSleeper->sleep(nBackoffMs);
+        nBackoffMs *= 2;
     }
 
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    ltime = time(NULL);
+    timestamp = asctime(localtime(&ltime));
+    timestamp[strlen(timestamp) - 1] = 0;
+    fprintf(Logfile, "[%s] [CNexDomeV3::domeCommand] ***** TIMEOUT **** no reply to %s after %d attempt(s)\n", timestamp, pszCmd, nAttempt + 1);
+    fflush(Logfile);
+#endif
+    m_Metrics.countCommandTimeout();
+    m_nLinkFailures++;
+    nErr = ERR_RXTIMEOUT;
     return nErr;
 }
 
@@ -309,14 +560,20 @@ int CNexDomeV3::readResponse(char *szRespBuffer, int nBufferLen, int nTimeout )
 {
     int nErr = PLUGIN_OK;
     unsigned long ulBytesRead = 0;
-    unsigned long ulTotalBytesRead = 0;
-    char *pszBufPtr;
+    int nbBytesWaiting = 0;
+    int nWaitMs;
+    char szChunk[SERIAL_BUFFER_SIZE];
+    CStopWatch timeoutTimer;
 
     memset(szRespBuffer, 0, (size_t) nBufferLen);
-    pszBufPtr = szRespBuffer;
 
-    do {
-        nErr = m_pSerx->readFile(pszBufPtr, 1, ulBytesRead, nTimeout);
+    // a previous read might already have brought in the line we need
+    while(!m_Parser.popMessage(szRespBuffer, nBufferLen)) {
+        nWaitMs = nTimeout - timeoutTimer.GetElapsedMilliseconds();
+        ulBytesRead = 0;
+        // wait for the first byte, then take everything that is already there in one read
+        if(nWaitMs > 0)
+            nErr = m_pSerx->readFile(szChunk, 1, ulBytesRead, nWaitMs);
         if(nErr) {
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
             ltime = time(NULL);
@@ -325,10 +582,11 @@ int CNexDomeV3::readResponse(char *szRespBuffer, int nBufferLen, int nTimeout )
             fprintf(Logfile, "[%s] [CNexDomeV3::readResponse] readFile error\n", timestamp);
             fflush(Logfile);
 #endif
+            m_nLinkFailures++;
             return nErr;
         }
 
-        if (ulBytesRead !=1) {// timeout
+        if (ulBytesRead !=1) {// timeout, a partial line stays in the parser for the next call
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
             ltime = time(NULL);
             timestamp = asctime(localtime(&ltime));
@@ -337,13 +595,25 @@ int CNexDomeV3::readResponse(char *szRespBuffer, int nBufferLen, int nTimeout )
             fflush(Logfile);
 #endif
             nErr = ERR_DATAOUT;
+            m_Metrics.countReadTimeout();
             break;
         }
-        ulTotalBytesRead += ulBytesRead;
-    } while (*pszBufPtr++ != 0x0a && ulTotalBytesRead < nBufferLen );
 
-    if(ulTotalBytesRead)
-        *(pszBufPtr-1) = 0; //remove the \n
+        m_pSerx->bytesWaitingRx(nbBytesWaiting);
+        m_Parser.sampleBacklog(nbBytesWaiting + 1);
+        if(nbBytesWaiting > int(sizeof(szChunk)) - 1)
+            nbBytesWaiting = int(sizeof(szChunk)) - 1;
+        if(nbBytesWaiting > 0) {
+            nErr = m_pSerx->readFile(szChunk + 1, (unsigned long)nbBytesWaiting, ulBytesRead, MAX_TIMEOUT);
+            if(nErr)
+                return nErr;
+            ulBytesRead++;
+        }
+        m_Parser.feed(szChunk, int(ulBytesRead));
+        m_linkRxTimer.Reset();
+        m_Metrics.addBytesRx(ulBytesRead);
+        m_Metrics.setParserStats(m_Parser.getStats());
+    }
 
     #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
                 ltime = time(NULL);
@@ -426,13 +696,8 @@ int CNexDomeV3::processResponse(char *szResp, char *pszResult, int nResultMaxLen
                 fprintf(Logfile, "[%s] [CNexDomeV3::processResponse] case 'P' rotator position update (cur az = %3.2f) : '%s'\n", timestamp, m_dCurrentAzPosition, szResp);
                 fflush(Logfile);
 #endif
-                m_nCurrentRotatorPos = atoi(szResp+1); // Pxxxxx
-                // convert steps to deg
-                m_dCurrentAzPosition = (double(m_nCurrentRotatorPos)/m_nNbStepPerRev) * 360.0;
-				while(m_dCurrentAzPosition >= 360)
-					m_dCurrentAzPosition = m_dCurrentAzPosition - 360;
-				while(m_dCurrentAzPosition < 0)
-					m_dCurrentAzPosition = m_dCurrentAzPosition + 360;
+                if(queuePositionUpdate(szResp)) // Pxxxxx
+                    applyPositionUpdates();
 
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
                 ltime = time(NULL);
@@ -451,7 +716,7 @@ int CNexDomeV3::processResponse(char *szResp, char *pszResult, int nResultMaxLen
 				nErr = CMD_PROC_DONE;
 			}
             else {
-                if(isdigit(szResp[1])) {
+                if(queuePositionUpdate(szResp)) { // Sxxxxx
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
                 ltime = time(NULL);
                 timestamp = asctime(localtime(&ltime));
@@ -459,10 +724,7 @@ int CNexDomeV3::processResponse(char *szResp, char *pszResult, int nResultMaxLen
                 fprintf(Logfile, "[%s] [CNexDomeV3::processResponse] case 'S' shutter state update : '%s'\n", timestamp, szResp);
                 fflush(Logfile);
 #endif
-                m_nCurrentShutterPos = atoi(szResp+1); // Sxxxxx
-                // convert steps to deg
-                if(m_nShutterSteps)
-                    m_dCurrentElPosition = (double(m_nCurrentShutterPos)/m_nShutterSteps) * 104.0;
+                applyPositionUpdates();
                 }
             }
 			break;
@@ -475,6 +737,7 @@ int CNexDomeV3::processResponse(char *szResp, char *pszResult, int nResultMaxLen
 			fprintf(Logfile, "[%s] [CNexDomeV3::processResponse] XBee status : '%s'\n", timestamp, szResp);
 			fflush(Logfile);
 #endif
+            m_Metrics.countUnsolicited();
 			if(strstr(szResp, "Online")) {
 				m_bShutterPresent = true;
 			}
@@ -488,6 +751,8 @@ int CNexDomeV3::processResponse(char *szResp, char *pszResult, int nResultMaxLen
             if(sResp.find(":BV") != -1) {
 				memcpy(szTmp, szResp+3, SERIAL_BUFFER_SIZE);
 				m_dShutterVolts = double(atoi(szTmp)) * 3.0 * (5.0 / 1023.0);
+                m_Metrics.countUnsolicited();
+                m_BatteryMonitor.addSample(CStopWatch::GetMonotonicSeconds(), m_dShutterVolts);
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
 				ltime = time(NULL);
 				timestamp = asctime(localtime(&ltime));
@@ -498,6 +763,7 @@ int CNexDomeV3::processResponse(char *szResp, char *pszResult, int nResultMaxLen
 			}
             else if(sResp.find(":RainStopped") != -1) {
 				m_nIsRaining = NOT_RAINING;
+                m_Metrics.countUnsolicited();
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
 				ltime = time(NULL);
 				timestamp = asctime(localtime(&ltime));
@@ -509,6 +775,7 @@ int CNexDomeV3::processResponse(char *szResp, char *pszResult, int nResultMaxLen
 			}
             else if(sResp.find(":Rain") != -1) {
 				m_nIsRaining = RAINING;
+                m_Metrics.countUnsolicited();
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
 				ltime = time(NULL);
 				timestamp = asctime(localtime(&ltime));
@@ -518,6 +785,24 @@ int CNexDomeV3::processResponse(char *szResp, char *pszResult, int nResultMaxLen
 #endif
                 writeRainStatus();
 			}
+            else if(m_bAbortPending && (sResp.find(":SWR") != std::string::npos || sResp.find(":SWS") != std::string::npos)) {
+                // ack from the fast abort, nobody is waiting on it.
+                if(sResp.find(":SWR") != std::string::npos) {
+                    if(!m_bAbortWhileMoving) {
+                        m_dLastAbortLatency = m_abortTimer.GetElapsedSeconds();
+                        if(m_dLastAbortLatency > m_dMaxAbortLatency)
+                            m_dMaxAbortLatency = m_dLastAbortLatency;
+                        m_bAbortPending = false;
+                    }
+                    else
+                        m_bAbortAcked = true;
+                }
+            }
+            else if(sResp.find(":SER") != std::string::npos) {
+                processRotatorReport(sResp.c_str());
+                strncpy(pszResult, szResp+1, nResultMaxLen);
+                nErr = CMD_PROC_DONE;
+            }
             else if(sResp.find(":left") != -1) {
                 strncpy(pszResult, szResp+1, nResultMaxLen);
                 nErr = CMD_PROC_DONE;
@@ -558,6 +843,7 @@ int CNexDomeV3::processResponse(char *szResp, char *pszResult, int nResultMaxLen
     fflush(Logfile);
 #endif
 
+    publishTelemetry();
 	return nErr;
 }
 
@@ -573,8 +859,11 @@ int CNexDomeV3::processAsyncResponses()
     if(!m_bIsConnected)
         return NOT_CONNECTED;
     
-    if(m_bDomeIsMoving)
+    // the move's drain also tracks its end
+    if(m_bDomeIsMoving || m_bShutterIsMoving) {
+        isDomeMoving();
         return nErr;
+    }
     
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     ltime = time(NULL);
@@ -585,10 +874,13 @@ int CNexDomeV3::processAsyncResponses()
 #endif
     do {
         m_pSerx->bytesWaitingRx(nbBytesWaiting);
+        nbBytesWaiting += m_Parser.getMessageCount();   // lines already decoded
         if(nbBytesWaiting) {
             nErr = readResponse(szResp, SERIAL_BUFFER_SIZE, 250);
-            if(nErr && nErr != ERR_DATAOUT)
+            if(nErr && nErr != ERR_DATAOUT) {
+                applyPositionUpdates();
                 return nErr;
+            }
 
             if(strlen(szResp)) {
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
@@ -598,13 +890,21 @@ int CNexDomeV3::processAsyncResponses()
                 fprintf(Logfile, "[%s] [CNexDomeV3::processAsyncResponses] szResp = '%s'\n", timestamp, szResp);
                 fflush(Logfile);
 #endif
-
+                // positions are applied once per batch, or before anything that could depend on them
+                if(queuePositionUpdate(szResp))
+                    continue;
+                applyPositionUpdates();
 				nErr = processResponse(szResp, szTmp, SERIAL_BUFFER_SIZE);
 				if(nErr && nErr != CMD_PROC_DONE)
 					return nErr;
             }
         }
     } while(nbBytesWaiting);
+
+    if(m_bRotatorPosPending || m_bShutterPosPending) {
+        applyPositionUpdates();
+        publishTelemetry();
+    }
     
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     ltime = time(NULL);
@@ -618,13 +918,59 @@ int CNexDomeV3::processAsyncResponses()
     return nErr;
 }
 
+int CNexDomeV3::drainAsync()
+{
+    int nErr;
+    int nbBytesWaiting = 0;
+    char szResp[SERIAL_BUFFER_SIZE];
+
+    if(m_nLinkState != LINK_UP)
+        return reconnectLink();
+
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+
+    if(m_bWatchdog && m_nLinkFailures >= LINK_MAX_FAILURES) {
+        linkLost();
+        return NOT_CONNECTED;
+    }
+
+    // these read their own :SER lines
+    if(m_Calibration.nState == CALIBRATION_RUNNING || m_Tuning.nState == TUNING_RUNNING)
+        return PLUGIN_OK;
+
+    nErr = m_pSerx->bytesWaitingRx(nbBytesWaiting);
+    if(nErr) {
+        m_nLinkFailures++;
+        return nErr;
+    }
+    m_Parser.sampleBacklog(nbBytesWaiting);
+    m_Metrics.setParserStats(m_Parser.getStats());
+    if(!nbBytesWaiting && !m_Parser.getMessageCount()) {
+        // quiet for a while, make sure there's still a controller at the other end
+        if(m_bWatchdog && m_linkRxTimer.GetElapsedSeconds() > LINK_SILENCE_PROBE) {
+            nErr = domeCommand("@PRR\r\n", szResp, SERIAL_BUFFER_SIZE, "PRR");
+            if(!nErr)
+                setRotatorPosition(atoi(szResp+3)); // PRRxxx
+            return nErr;
+        }
+        return PLUGIN_OK;
+    }
+
+    return processAsyncResponses();
+}
+
 int CNexDomeV3::getDomeAz(double &dDomeAz)
 {
     int nErr = PLUGIN_OK;
     char szResp[SERIAL_BUFFER_SIZE];
-    char szBuf[SERIAL_BUFFER_SIZE];
-    int nb_timeout;
     
+    // last known until the link is back
+    if(isLinkRecovering()) {
+        dDomeAz = m_dCurrentAzPosition;
+        return PLUGIN_OK;
+    }
+
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
@@ -637,7 +983,8 @@ int CNexDomeV3::getDomeAz(double &dDomeAz)
 #endif
 
     
-    if(m_bDomeIsMoving) {
+    // the P lines give the position while it moves. A goto declared complete on the beam check can still be moving.
+    if(m_bDomeIsMoving && isDomeMoving()) {
 		dDomeAz = m_dCurrentAzPosition;
         #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
             ltime = time(NULL);
@@ -649,15 +996,7 @@ int CNexDomeV3::getDomeAz(double &dDomeAz)
 		return nErr;
 	}
     
-    nErr = domeCommand("@PRR\r\n", szResp,  SERIAL_BUFFER_SIZE);
-
-    nb_timeout = 0;
-    memcpy(szBuf, szResp, SERIAL_BUFFER_SIZE);
-    while(!strstr(szBuf, "PRR") && nb_timeout < CMD_RESP_READ_TIMEOUTS) {
-        readResponse(szBuf, SERIAL_BUFFER_SIZE);
-        nErr = processResponse(szBuf, szResp, SERIAL_BUFFER_SIZE);
-        nb_timeout++;
-    }
+    nErr = domeCommand("@PRR\r\n", szResp, SERIAL_BUFFER_SIZE, "PRR");
 
     if(nErr == CMD_PROC_DONE)
         nErr = PLUGIN_OK;
@@ -667,11 +1006,6 @@ int CNexDomeV3::getDomeAz(double &dDomeAz)
         return PLUGIN_OK;
     }
     
-    if(nb_timeout >= CMD_RESP_READ_TIMEOUTS) {
-        dDomeAz = m_dCurrentAzPosition;
-        return PLUGIN_OK;
-    }
-
     #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
         ltime = time(NULL);
         timestamp = asctime(localtime(&ltime));
@@ -680,15 +1014,9 @@ int CNexDomeV3::getDomeAz(double &dDomeAz)
         fflush(Logfile);
     #endif
 
-    m_nCurrentRotatorPos = atoi(szResp+3); // PRRxxx
-
-    // convert steps to deg
-    dDomeAz = (double(m_nCurrentRotatorPos)/m_nNbStepPerRev) * 360.0;
-    
-    while(dDomeAz >= 360)
-        dDomeAz = dDomeAz - 360;
-
-    m_dCurrentAzPosition = dDomeAz;
+    setRotatorPosition(atoi(szResp+3)); // PRRxxx
+    dDomeAz = m_dCurrentAzPosition;
+    publishTelemetry();
 
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     ltime = time(NULL);
@@ -708,8 +1036,6 @@ int CNexDomeV3::getDomeEl(double &dDomeEl)
 {
     int nErr = PLUGIN_OK;
     char szResp[SERIAL_BUFFER_SIZE];
-    char szBuf[SERIAL_BUFFER_SIZE];
-    int nb_timeout;
     
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -723,7 +1049,7 @@ int CNexDomeV3::getDomeEl(double &dDomeEl)
 #endif
 
 
-	if(m_bDomeIsMoving) {
+	if(m_bShutterIsMoving) {
 		dDomeEl = m_dCurrentElPosition;
         #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
             ltime = time(NULL);
@@ -743,15 +1069,7 @@ int CNexDomeV3::getDomeEl(double &dDomeEl)
     dDomeEl = m_dCurrentElPosition;
     
     /// we might use this when firmware timeouts are fixed
-    nErr = domeCommand("@PRS\r\n", szResp,  SERIAL_BUFFER_SIZE);
-
-    nb_timeout = 0;
-    memcpy(szBuf, szResp, SERIAL_BUFFER_SIZE);
-    while(!strstr(szBuf, "PRS") && nb_timeout < CMD_RESP_READ_TIMEOUTS) {
-        readResponse(szBuf, SERIAL_BUFFER_SIZE);
-        nErr = processResponse(szBuf, szResp, SERIAL_BUFFER_SIZE);
-        nb_timeout++;
-    }
+    nErr = domeCommand("@PRS\r\n", szResp, SERIAL_BUFFER_SIZE, "PRS");
 
     if(nErr == CMD_PROC_DONE)
         nErr = PLUGIN_OK;
@@ -761,11 +1079,6 @@ int CNexDomeV3::getDomeEl(double &dDomeEl)
         return PLUGIN_OK;
     }
 
-    if(nb_timeout >= CMD_RESP_READ_TIMEOUTS) {
-        dDomeEl = m_dCurrentElPosition;
-        return PLUGIN_OK;
-    }
-
     // convert steps to deg
     m_nCurrentShutterPos = atoi(szResp+3); // PRSxxx
     if(m_nShutterSteps)
@@ -776,6 +1089,7 @@ int CNexDomeV3::getDomeEl(double &dDomeEl)
             dDomeEl = (double(m_nCurrentShutterPos)/m_nShutterSteps) * 104.0;
     }
     m_dCurrentElPosition = dDomeEl;
+    publishTelemetry();
 
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     ltime = time(NULL);
@@ -794,8 +1108,6 @@ int CNexDomeV3::getDomeHomeAz(double &dAz)
     
     int nErr = PLUGIN_OK;
     char szResp[SERIAL_BUFFER_SIZE];
-    char szBuf[SERIAL_BUFFER_SIZE];
-    int nb_timeout;
     int nStepPos;
 
     if(!m_bIsConnected)
@@ -806,15 +1118,7 @@ int CNexDomeV3::getDomeHomeAz(double &dAz)
         return nErr;
     }
     
-    nErr = domeCommand("@HRR\r\n", szResp,  SERIAL_BUFFER_SIZE);
-
-    nb_timeout = 0;
-    memcpy(szBuf, szResp, SERIAL_BUFFER_SIZE);
-    while(!strstr(szBuf, "HRR") && nb_timeout < CMD_RESP_READ_TIMEOUTS) {
-        readResponse(szBuf, SERIAL_BUFFER_SIZE);
-        nErr = processResponse(szBuf, szResp, SERIAL_BUFFER_SIZE);
-        nb_timeout++;
-    }
+    nErr = domeCommand("@HRR\r\n", szResp, SERIAL_BUFFER_SIZE, "HRR");
 
     if(nErr == CMD_PROC_DONE)
         nErr = PLUGIN_OK;
@@ -824,14 +1128,10 @@ int CNexDomeV3::getDomeHomeAz(double &dAz)
         return PLUGIN_OK;
     }
 
-    if(nb_timeout >= CMD_RESP_READ_TIMEOUTS) {
-        dAz = m_dHomeAz;
-        return nErr;
-    }
-
     // convert Az string to double
     nStepPos = atoi(szResp+3); // HRRxxx
-    dAz = (double(nStepPos)/m_nNbStepPerRev) * 360.0;
+    m_nHomeStepPos = wrapSteps(nStepPos, m_RotatorScale.getStepsPerRev());
+    dAz = m_RotatorScale.toDegrees(nStepPos);
     m_dHomeAz = dAz;
     
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
@@ -851,10 +1151,8 @@ int CNexDomeV3::getShutterState(int &nState)
 {
     int nErr = PLUGIN_OK;
     char szResp[SERIAL_BUFFER_SIZE];
-    char szBuf[SERIAL_BUFFER_SIZE];
     std::vector<std::string> shutterStateFields;
     int nOpen, nClosed;
-    int nb_timeout;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -868,7 +1166,7 @@ int CNexDomeV3::getShutterState(int &nState)
 #endif
 
     
-	if(m_bDomeIsMoving) {
+	if(m_bShutterIsMoving) {
 		nState = m_nShutterState;
 		return nErr;
 	}
@@ -878,15 +1176,7 @@ int CNexDomeV3::getShutterState(int &nState)
         return nErr;
     }
 
-    nErr = domeCommand("@SRS\r\n", szResp, SERIAL_BUFFER_SIZE);
-
-    nb_timeout = 0;
-    memcpy(szBuf, szResp, SERIAL_BUFFER_SIZE);
-    while(!strstr(szBuf, "SES") && nb_timeout < CMD_RESP_READ_TIMEOUTS) {
-        readResponse(szBuf, SERIAL_BUFFER_SIZE);
-        nErr = processResponse(szBuf, szResp, SERIAL_BUFFER_SIZE);
-        nb_timeout++;
-    }
+    nErr = domeCommand("@SRS\r\n", szResp, SERIAL_BUFFER_SIZE, "SES");
 
     #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
         ltime = time(NULL);
@@ -904,11 +1194,6 @@ int CNexDomeV3::getShutterState(int &nState)
         return PLUGIN_OK;
     }
     
-    if(nb_timeout >= CMD_RESP_READ_TIMEOUTS ){
-        nState = m_nShutterState;
-        return PLUGIN_OK;
-    }
-
     // need to parse :SES,-125,46000,0,0#
     nErr = parseFields(szResp, shutterStateFields, ',');
     if(nErr)
@@ -932,7 +1217,10 @@ int CNexDomeV3::getShutterState(int &nState)
     }
 
     m_nShutterState = nState;
-    
+    if(nState == OPEN || nState == CLOSED || nState == SHUTTER_ERROR)
+        m_BatteryMonitor.shutterMoveEnded(CStopWatch::GetMonotonicSeconds());
+    publishTelemetry();
+
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     ltime = time(NULL);
     timestamp = asctime(localtime(&ltime));
@@ -950,22 +1238,12 @@ int CNexDomeV3::getDomeStepPerRev(int &nStepPerRev)
 {
     int nErr = PLUGIN_OK;
     char szResp[SERIAL_BUFFER_SIZE];
-    char szBuf[SERIAL_BUFFER_SIZE];
-    int nb_timeout;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
 
-    nErr = domeCommand("@RRR\r\n", szResp, SERIAL_BUFFER_SIZE);
-
-    nb_timeout = 0;
-    memcpy(szBuf, szResp, SERIAL_BUFFER_SIZE);
-    while(!strstr(szBuf, "RRR") && nb_timeout < CMD_RESP_READ_TIMEOUTS) {
-        readResponse(szBuf, SERIAL_BUFFER_SIZE);
-        nErr = processResponse(szBuf, szResp, SERIAL_BUFFER_SIZE);
-        nb_timeout++;
-    }
+    nErr = domeCommand("@RRR\r\n", szResp, SERIAL_BUFFER_SIZE, "RRR");
 
     if(nErr == CMD_PROC_DONE)
         nErr = PLUGIN_OK;
@@ -974,11 +1252,6 @@ int CNexDomeV3::getDomeStepPerRev(int &nStepPerRev)
         nStepPerRev = m_nNbStepPerRev;
         return PLUGIN_OK;
     }
-
-    if(nb_timeout >= CMD_RESP_READ_TIMEOUTS) {
-        nStepPerRev = m_nNbStepPerRev;
-        return PLUGIN_OK;
-    }
     // RRR99498
     nStepPerRev = atoi(szResp+3);
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
@@ -989,6 +1262,7 @@ int CNexDomeV3::getDomeStepPerRev(int &nStepPerRev)
     fflush(Logfile);
 #endif
     m_nNbStepPerRev = nStepPerRev;
+    m_RotatorScale.setStepsPerRev(m_nNbStepPerRev);
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     ltime = time(NULL);
     timestamp = asctime(localtime(&ltime));
@@ -1005,7 +1279,10 @@ int CNexDomeV3::setDomeStepPerRev(int nStepPerRev)
     char szBuf[SERIAL_BUFFER_SIZE];
     char szResp[SERIAL_BUFFER_SIZE];
 
+    if(m_nNbStepPerRev && nStepPerRev != m_nNbStepPerRev)
+        resetHomeEdges();   // in steps of the old scale
     m_nNbStepPerRev = nStepPerRev;
+    m_RotatorScale.setStepsPerRev(m_nNbStepPerRev);
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -1027,8 +1304,6 @@ int CNexDomeV3::getShutterSteps(int &nStepPerRev)
 {
     int nErr = PLUGIN_OK;
     char szResp[SERIAL_BUFFER_SIZE];
-    char szBuf[SERIAL_BUFFER_SIZE];
-    int nb_timeout;
     
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -1038,14 +1313,7 @@ int CNexDomeV3::getShutterSteps(int &nStepPerRev)
         return nErr;
     }
 
-    nErr = domeCommand("@RRS\r\n", szResp, SERIAL_BUFFER_SIZE);
-    nb_timeout = 0;
-    memcpy(szBuf, szResp, SERIAL_BUFFER_SIZE);
-    while(!strstr(szBuf, "RRS") && nb_timeout < CMD_RESP_READ_TIMEOUTS) {
-        readResponse(szBuf, SERIAL_BUFFER_SIZE);
-        nErr = processResponse(szBuf, szResp, SERIAL_BUFFER_SIZE);
-        nb_timeout++;
-    }
+    nErr = domeCommand("@RRS\r\n", szResp, SERIAL_BUFFER_SIZE, "RRS");
     
     if(nErr == CMD_PROC_DONE)
         nErr = PLUGIN_OK;
@@ -1055,11 +1323,6 @@ int CNexDomeV3::getShutterSteps(int &nStepPerRev)
         return PLUGIN_OK;
     }
     
-    if(nb_timeout >= CMD_RESP_READ_TIMEOUTS) {
-        nStepPerRev = m_nShutterSteps;
-        return PLUGIN_OK;
-    }
-
     nStepPerRev = atoi(szResp+3);
     m_nShutterSteps = nStepPerRev;
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
@@ -1118,24 +1381,44 @@ int CNexDomeV3::getShutterVolts(double &dShutterVolts)
     return nErr;
 }
 
+void CNexDomeV3::getBatteryStats(BatteryStats &stats)
+{
+    if(m_bIsConnected && m_bShutterPresent)
+        processAsyncResponses();    // pick up any pending :BV
+    m_BatteryMonitor.getStats(stats);
+}
+
+void CNexDomeV3::setBatteryCutoff(double dVolts)
+{
+    m_BatteryMonitor.setCutoffVolts(dVolts);
+}
+
+void CNexDomeV3::setMetricsInstance(int nInstance)
+{
+    m_Metrics.setInstance(nInstance);
+    m_Trace.setInstance(nInstance);
+    // one recorder file per instance, NDV3_Telemetry.<index>.rec
+    if(!m_Recorder.isOpen()) {
+        size_t nPos = m_sRecorderfilePath.rfind("NDV3_Telemetry");
+        if(nPos != std::string::npos)
+            m_sRecorderfilePath.replace(nPos, std::string::npos, "NDV3_Telemetry." + std::to_string(nInstance) + ".rec");
+    }
+}
+
+int CNexDomeV3::setMetricsFile(const char *pszPath)
+{
+    return m_Metrics.setExportFile(pszPath);
+}
+
 int CNexDomeV3::getRotatorDeadZone(int &nDeadZoneSteps)
 {
     int nErr = PLUGIN_OK;
     char szResp[SERIAL_BUFFER_SIZE];
-    char szBuf[SERIAL_BUFFER_SIZE];
-    int nb_timeout;
     
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    nErr = domeCommand("@DRR\r\n", szResp, SERIAL_BUFFER_SIZE);
-    nb_timeout = 0;
-    memcpy(szBuf, szResp, SERIAL_BUFFER_SIZE);
-    while(!strstr(szBuf, "DRR") && nb_timeout < CMD_RESP_READ_TIMEOUTS) {
-        readResponse(szBuf, SERIAL_BUFFER_SIZE);
-        nErr = processResponse(szBuf, szResp, SERIAL_BUFFER_SIZE);
-        nb_timeout++;
-    }
+    nErr = domeCommand("@DRR\r\n", szResp, SERIAL_BUFFER_SIZE, "DRR");
     
     if(nErr == CMD_PROC_DONE)
         nErr = PLUGIN_OK;
@@ -1145,11 +1428,6 @@ int CNexDomeV3::getRotatorDeadZone(int &nDeadZoneSteps)
         return PLUGIN_OK;
     }
     
-    if(nb_timeout >= CMD_RESP_READ_TIMEOUTS) {
-        nDeadZoneSteps = 0;
-        return PLUGIN_OK;
-    }
-
     nDeadZoneSteps = atoi(szResp+3);
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     ltime = time(NULL);
@@ -1184,12 +1462,25 @@ int CNexDomeV3::setRotatorDeadZone(int &nDeadZoneSteps)
 }
 
 
+// the telescope sees out with the dome at nPos, for the goto in progress. False when we don't know where
+// the telescope points or how wide the slit is, the caller then falls back to GOTO_TOLERANCE.
+bool CNexDomeV3::isBeamClear(int nPos)
+{
+    const FollowConfig &config = m_FollowPlanner.getConfig();
+
+    if(isnan(m_dGotoSlitAlt) || config.dSlitWidth <= config.dAperture || !m_RotatorScale.isValid())
+        return false;
+    return m_RotatorScale.toDegrees(abs(m_RotatorScale.distance(nPos, m_nGotoStepPos))) <= m_FollowPlanner.halfWidth(m_dGotoSlitAlt);
+}
+
 bool CNexDomeV3::isDomeMoving()
 {
     int nErr = PLUGIN_OK;
     char szResp[SERIAL_BUFFER_SIZE];
+    char szTmp[SERIAL_BUFFER_SIZE];
 	int nbBytesWaiting = 0;
     int nbRespRead = 0;
+    bool bRotatorWasMoving;
     
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -1198,19 +1489,24 @@ bool CNexDomeV3::isDomeMoving()
         ltime = time(NULL);
         timestamp = asctime(localtime(&ltime));
         timestamp[strlen(timestamp) - 1] = 0;
-        fprintf(Logfile, "[%s] [CNexDomeV3::isDomeMoving] In : m_bDomeIsMoving = %s\n", timestamp, m_bDomeIsMoving?"Yes":"No");
+        fprintf(Logfile, "[%s] [CNexDomeV3::isDomeMoving] In : m_bDomeIsMoving = %s, m_bShutterIsMoving = %s\n", timestamp, m_bDomeIsMoving?"Yes":"No", m_bShutterIsMoving?"Yes":"No");
         fflush(Logfile);
     #endif
-    if(!m_bDomeIsMoving) {
+    // the shutter moves are drained here too, the rotator is what's returned
+    if(!m_bDomeIsMoving && !m_bShutterIsMoving) {
         return false;
     }
+    bRotatorWasMoving = m_bDomeIsMoving;
 
 	do {
 		m_pSerx->bytesWaitingRx(nbBytesWaiting);
+		nbBytesWaiting += m_Parser.getMessageCount();   // lines already decoded
 		if(nbBytesWaiting ) {
 			nErr = readResponse(szResp, SERIAL_BUFFER_SIZE, 250);
-			if(nErr && nErr != ERR_DATAOUT)
+			if(nErr && nErr != ERR_DATAOUT) {
+                applyPositionUpdates();
 				return m_bDomeIsMoving;
+            }
             nbRespRead++;
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
             ltime = time(NULL);
@@ -1227,55 +1523,69 @@ bool CNexDomeV3::isDomeMoving()
                 fprintf(Logfile, "[%s] [CNexDomeV3::isDomeMoving] szResp = %s\n", timestamp, szResp);
                 fflush(Logfile);
 #endif
+                // still moving after the at home :SER, the sensor went by on the way
+                if(m_bHomeCrossingPending && szResp[0] == 'P' && isdigit(szResp[1]))
+                    processHomeCrossing();
+                // a slew streams P lines back to back, only the last one of the batch matters
+                if(queuePositionUpdate(szResp))
+                    continue;
+                applyPositionUpdates();
 				switch(szResp[0]) {
 					case 'P' :
-                        if(isdigit(szResp[1])) {
-                            m_nCurrentRotatorPos = atoi(szResp+1); // Pxxxxx
-                            // convert steps to deg
-                            m_dCurrentAzPosition = (double(m_nCurrentRotatorPos)/m_nNbStepPerRev) * 360.0;
-                            while(m_dCurrentAzPosition >= 360)
-                                m_dCurrentAzPosition = m_dCurrentAzPosition - 360;
-                            while(m_dCurrentAzPosition < 0)
-                                m_dCurrentAzPosition = m_dCurrentAzPosition + 360;
-                        } else if (szResp[1]==':') {
+                        if (szResp[1]==':') {
                             if(strstr(szResp+2,"SER")) {
                                 m_bDomeIsMoving = false;
                             }
                             else if(strstr(szResp+2,"SES")) {
-                                m_bDomeIsMoving = false;
+                                endShutterMove();
                             }
                             break;
                         }
 						break;
-                    case 'S' :
-                        if(isdigit(szResp[1])) {
-                            m_nCurrentShutterPos = atoi(szResp+1);
-                            if(m_nShutterSteps)
-                                m_dCurrentElPosition = (double(m_nCurrentShutterPos)/m_nShutterSteps) * 104.0; // max apperture of the dome
-                        }
-                        break;
 					case ':' :
                         // :SER or:SES is sent at the end of the move-> parse :SER,0,0,55080,0,300#
 						if(strstr(szResp,"SER")) {
+                            if(m_bHomeCrossingPending)
+                                processHomeCrossing();
+                            // the sensor on the way or the dome stopped on it, the P lines that follow or not will tell
+                            if(isHomeCrossing(szResp, m_nHomeCrossingPos)) {
+                                strncpy(m_szHomeCrossing, szResp, SERIAL_BUFFER_SIZE-1);
+                                m_szHomeCrossing[SERIAL_BUFFER_SIZE-1] = 0;
+                                m_bHomeCrossingPending = true;
+                                m_homeCrossingTimer.Reset();
+                                break;
+                            }
+                            processRotatorReport(szResp);
 							m_bDomeIsMoving = false;
 						}
                         else if(strstr(szResp,"SES")) {
-                            m_bDomeIsMoving = false;
+                            endShutterMove();
                         }
-                        else if(strstr(szResp,":S")) {
-                            if(isdigit(szResp[2])) {
-                                m_nCurrentShutterPos = atoi(szResp+2);
-                                if(m_nShutterSteps)
-                                    m_dCurrentElPosition = (double(m_nCurrentShutterPos)/m_nShutterSteps) * 104.0; // max apperture of the dome
-                            }
+                        else if(strstr(szResp,":S") && isdigit(szResp[2])) {
+                            m_Metrics.countUnsolicited();
+                            m_nCurrentShutterPos = atoi(szResp+2);
+                            if(m_nShutterSteps)
+                                m_dCurrentElPosition = (double(m_nCurrentShutterPos)/m_nShutterSteps) * 104.0; // max apperture of the dome
                         }
+                        else    // :BV, rain, abort ack
+                            processResponse(szResp, szTmp, SERIAL_BUFFER_SIZE);
 						break;
+					case 'X' :
+                        processResponse(szResp, szTmp, SERIAL_BUFFER_SIZE);
+                        break;
 					default:
 						break;
 				}
 			}
 		}
 	} while(nbBytesWaiting);
+    applyPositionUpdates();
+    if(m_bHomeCrossingPending && m_homeCrossingTimer.GetElapsedSeconds() > HOME_CROSSING_SETTLE) {
+        // nothing after it, that was the report of the end of the move
+        m_bHomeCrossingPending = false;
+        processRotatorReport(m_szHomeCrossing);
+        m_bDomeIsMoving = false;
+    }
 
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
 	ltime = time(NULL);
@@ -1284,6 +1594,21 @@ bool CNexDomeV3::isDomeMoving()
 	fprintf(Logfile, "[%s] [CNexDomeV3::isDomeMoving] Out: m_bDomeIsMoving = %s\n", timestamp, m_bDomeIsMoving?"Yes":"No");
 	fflush(Logfile);
 #endif
+    if(bRotatorWasMoving && !m_bDomeIsMoving) {
+        endMotionMetric();
+        learnSlew();
+        applyHomeResync();
+        if(m_LinkIntent.bRehoming) {
+            // homed after the link came back, now the goto that was going on
+            m_LinkIntent.bRehoming = false;
+            if(isDomeAtHome())
+                m_bHasBeenHomed = true;
+            gotoAzimuth(m_LinkIntent.dGotoAz, m_LinkIntent.dGotoSlitAlt);
+        }
+    }
+    else if(m_bDomeIsMoving && m_nSlewSteps && !m_bHomeCrossingPending)
+        m_dSlewLastPoll = m_slewTimer.GetElapsedSeconds();
+    publishTelemetry();
     return m_bDomeIsMoving;
 }
 
@@ -1292,22 +1617,12 @@ bool CNexDomeV3::isDomeAtHome()
     bool bAtHome;
     int nErr = PLUGIN_OK;
     char szResp[SERIAL_BUFFER_SIZE];
-    char szBuf[SERIAL_BUFFER_SIZE];
     std::vector<std::string> rotatorStateFields;
-    int nb_timeout;
     
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    nErr = domeCommand("@SRR\r\n", szResp, SERIAL_BUFFER_SIZE);
-
-    nb_timeout = 0;
-    memcpy(szBuf, szResp, SERIAL_BUFFER_SIZE);
-    while(!strstr(szBuf, "SER") && nb_timeout < CMD_RESP_READ_TIMEOUTS) {
-        readResponse(szBuf, SERIAL_BUFFER_SIZE);
-        nErr = processResponse(szBuf, szResp, SERIAL_BUFFER_SIZE);
-        nb_timeout++;
-    }
+    nErr = domeCommand("@SRR\r\n", szResp, SERIAL_BUFFER_SIZE, "SER");
     
     if(nErr == CMD_PROC_DONE)
         nErr = PLUGIN_OK;
@@ -1316,10 +1631,6 @@ bool CNexDomeV3::isDomeAtHome()
         return false;
     }
     
-    if(nb_timeout >= CMD_RESP_READ_TIMEOUTS) {
-        return false;
-    }
-
      // need to parse :SER,0,1,99498,0,300#
     nErr = parseFields(szResp, rotatorStateFields, ',');
     if(nErr)
@@ -1331,7 +1642,7 @@ bool CNexDomeV3::isDomeAtHome()
     // SER could report at home when we're not, so check the current position in case we're home. Because firmware .....
     if(bAtHome) {
         getDomeAz(m_dCurrentAzPosition);
-        if ((ceil(m_dHomeAz) <= ceil(m_dCurrentAzPosition)) && (ceil(m_dHomeAz) >= ceil(m_dCurrentAzPosition))) {
+        if (m_RotatorScale.isWithin(m_nCurrentRotatorPos, m_nHomeStepPos, m_RotatorScale.toStepCount(AT_HOME_TOLERANCE))) {
             bAtHome = true;
         } else {
             bAtHome = false;
@@ -1350,30 +1661,141 @@ bool CNexDomeV3::isDomeAtHome()
   
 }
 
-int CNexDomeV3::syncDome(double dAz, double dEl)
+// :SER,<position>,1,... during a goto, away from its target, is the home sensor going by
+bool CNexDomeV3::isHomeCrossing(const char *pszResp, int &nPos)
 {
-    int nErr = PLUGIN_OK;
-    char szBuf[SERIAL_BUFFER_SIZE];
-    char szResp[SERIAL_BUFFER_SIZE];
-    int nTmp;
-    
-    if(!m_bIsConnected)
-        return NOT_CONNECTED;
+    std::vector<std::string> rotatorStateFields;
 
-    m_dCurrentAzPosition = dAz;
-    // convert Az to steps;
-    if(!m_nNbStepPerRev) {
-        getDomeStepPerRev(nTmp);
-    }
-    nTmp = int((dAz/360.0)*m_nNbStepPerRev);
-    snprintf(szBuf, SERIAL_BUFFER_SIZE, "@PWR,%d\r\n", nTmp);
-    nErr = domeCommand(szBuf, szResp, SERIAL_BUFFER_SIZE);
-    if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        ltime = time(NULL);
-        timestamp = asctime(localtime(&ltime));
-        timestamp[strlen(timestamp) - 1] = 0;
-        fprintf(Logfile, "[%s] [CNexDomeV3::syncDome] ERROR = %d\n", timestamp, nErr);
+    if(!m_nGotoDir || !m_RotatorScale.isValid())
+        return false;
+    if(parseFields(pszResp, rotatorStateFields, ',') || rotatorStateFields.size() < 3 || rotatorStateFields[2] != "1")
+        return false;
+    nPos = wrapSteps(atoi(rotatorStateFields[1].c_str()), m_RotatorScale.getStepsPerRev());
+    // a goto ending on the sensor
+    if(m_RotatorScale.isWithin(nPos, m_nGotoStepPos, m_RotatorScale.toStepCount(GOTO_SAME_POSITION)))
+        return false;
+    return true;
+}
+
+// Where the sensor fired, compared to the edge of that direction, is how far the step count drifted since the last home.
+void CNexDomeV3::processHomeCrossing()
+{
+    int nEdge;
+    int nDrift;
+    int nIndex;
+
+    m_bHomeCrossingPending = false;
+    m_HomeDrift.nCrossings++;
+    if(!m_bHomeResync || !m_bHasBeenHomed)
+        return;
+
+    nIndex = m_nGotoDir > 0 ? 0 : 1;
+    nEdge = m_RotatorScale.distance(m_nHomeStepPos, m_nHomeCrossingPos);
+    if(!m_bHomeEdgeKnown[nIndex]) {
+        m_nHomeEdge[nIndex] = nEdge;
+        m_bHomeEdgeKnown[nIndex] = true;
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        ltime = time(NULL);
+        timestamp = asctime(localtime(&ltime));
+        timestamp[strlen(timestamp) - 1] = 0;
+        fprintf(Logfile, "[%s] [CNexDomeV3::processHomeCrossing] direction %d, sensor edge at %d steps from home\n", timestamp, m_nGotoDir, nEdge);
+        fflush(Logfile);
+#endif
+        return;
+    }
+
+    nDrift = nEdge - m_nHomeEdge[nIndex];
+    m_HomeDrift.nMeasured++;
+    m_HomeDrift.nLastDrift = nDrift;
+    m_HomeDrift.nMaxDrift = std::max(m_HomeDrift.nMaxDrift, abs(nDrift));
+    m_HomeDrift.dMeanAbsDrift += (abs(nDrift) - m_HomeDrift.dMeanAbsDrift) / m_HomeDrift.nMeasured;
+    if(abs(nDrift) > m_RotatorScale.toStepCount(HOME_RESYNC_MAX_DRIFT))
+        m_HomeDrift.nRejected++;
+    // the last crossing of the goto is the one that counts
+    m_nHomeResyncDrift = nDrift;
+    m_bHomeResyncPending = abs(nDrift) >= m_RotatorScale.toStepCount(HOME_RESYNC_MIN_DRIFT) && abs(nDrift) <= m_RotatorScale.toStepCount(HOME_RESYNC_MAX_DRIFT);
+    m_Metrics.observeHomeDrift(m_RotatorScale.toDegrees(abs(nDrift)) * (nDrift < 0 ? -1 : 1));
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    ltime = time(NULL);
+    timestamp = asctime(localtime(&ltime));
+    timestamp[strlen(timestamp) - 1] = 0;
+    fprintf(Logfile, "[%s] [CNexDomeV3::processHomeCrossing] direction %d, drift %d steps%s, %d crossings, mean |drift| %3.1f, max %d, %d rejected\n", timestamp, m_nGotoDir, nDrift,
+            m_bHomeResyncPending ? " (corrected at the end of the goto)" : "", m_HomeDrift.nCrossings, m_HomeDrift.dMeanAbsDrift, m_HomeDrift.nMaxDrift, m_HomeDrift.nRejected);
+    fflush(Logfile);
+#endif
+}
+
+// the dome stopped, take the drift off the count. Not during the move, the controller would lose its target.
+void CNexDomeV3::applyHomeResync()
+{
+    int nErr;
+    int nPos;
+    char szBuf[SERIAL_BUFFER_SIZE];
+    char szResp[SERIAL_BUFFER_SIZE];
+
+    if(!m_bHomeResyncPending)
+        return;
+    m_bHomeResyncPending = false;
+
+    nPos = wrapSteps(m_nCurrentRotatorPos - m_nHomeResyncDrift, m_RotatorScale.getStepsPerRev());
+    snprintf(szBuf, SERIAL_BUFFER_SIZE, "@PWR,%d\r\n", nPos);
+    nErr = domeCommand(szBuf, szResp, SERIAL_BUFFER_SIZE);
+    if(nErr)
+        return;
+    setRotatorPosition(nPos);
+    m_HomeDrift.nResyncs++;
+    m_Metrics.countHomeResync();
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    ltime = time(NULL);
+    timestamp = asctime(localtime(&ltime));
+    timestamp[strlen(timestamp) - 1] = 0;
+    fprintf(Logfile, "[%s] [CNexDomeV3::applyHomeResync] step count corrected by %d to %d\n", timestamp, -m_nHomeResyncDrift, nPos);
+    fflush(Logfile);
+#endif
+}
+
+void CNexDomeV3::setHomeEdges(int nUp, int nDown)
+{
+    m_nHomeEdge[0] = nUp;
+    m_nHomeEdge[1] = nDown;
+    m_bHomeEdgeKnown[0] = nUp != HOME_EDGE_UNKNOWN;
+    m_bHomeEdgeKnown[1] = nDown != HOME_EDGE_UNKNOWN;
+}
+
+void CNexDomeV3::getHomeEdges(int &nUp, int &nDown)
+{
+    nUp = m_bHomeEdgeKnown[0] ? m_nHomeEdge[0] : HOME_EDGE_UNKNOWN;
+    nDown = m_bHomeEdgeKnown[1] ? m_nHomeEdge[1] : HOME_EDGE_UNKNOWN;
+}
+
+int CNexDomeV3::syncDome(double dAz, double dEl)
+{
+    int nErr = PLUGIN_OK;
+    char szBuf[SERIAL_BUFFER_SIZE];
+    char szResp[SERIAL_BUFFER_SIZE];
+    int nTmp;
+    
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+
+    // convert Az to steps;
+    if(!m_nNbStepPerRev) {
+        getDomeStepPerRev(nTmp);
+    }
+    nTmp = m_RotatorScale.toSteps(dAz);
+    setRotatorPosition(nTmp);
+    // the count no longer matches the sensor, leave it alone until the next home
+    m_bHasBeenHomed = false;
+    snprintf(szBuf, SERIAL_BUFFER_SIZE, "@PWR,%d\r\n", nTmp);
+    nErr = domeCommand(szBuf, szResp, SERIAL_BUFFER_SIZE);
+    if(nErr) {
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        ltime = time(NULL);
+        timestamp = asctime(localtime(&ltime));
+        timestamp[strlen(timestamp) - 1] = 0;
+        fprintf(Logfile, "[%s] [CNexDomeV3::syncDome] ERROR = %d\n", timestamp, nErr);
         fprintf(Logfile, "[%s] [CNexDomeV3::syncDome] nErr = '%d'\n", timestamp, nErr);
         fflush(Logfile);
 #endif
@@ -1398,6 +1820,7 @@ int CNexDomeV3::parkDome()
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
+    m_bFollowing = false;
     if(m_bHomeOnPark) {
         m_bParking = true;
         nErr = goHome();
@@ -1437,13 +1860,15 @@ int CNexDomeV3::unparkDome()
     return nErr;
 }
 
-int CNexDomeV3::gotoAzimuth(double dNewAz)
+int CNexDomeV3::gotoAzimuth(double dNewAz, double dSlitAlt)
 {
     int nErr = PLUGIN_OK;
     char szBuf[SERIAL_BUFFER_SIZE];
     char szResp[SERIAL_BUFFER_SIZE];
 	int nTmp;
 	int nNewStepPos;
+    int nDistance;
+    bool bRetarget;
 	std::vector<std::string> svFields;
 
     if(!m_bIsConnected)
@@ -1453,11 +1878,24 @@ int CNexDomeV3::gotoAzimuth(double dNewAz)
         getDomeStepPerRev(nTmp);
     }
 
-    while(dNewAz >= 360)
-        dNewAz = dNewAz - 360;
+    // the previous goto can still be moving if it was complete on the beam check, take its
+    // P lines and a :SER already sent before the new target, the controller just retargets otherwise.
+    // The new target is then always sent, only the :SER says the rotator stopped.
+    if(m_bDomeIsMoving)
+        isDomeMoving();
+    bRetarget = m_bDomeIsMoving;
 
-    // check if we're moving inside the dead zone.
-    nNewStepPos = int((dNewAz/360.0) * m_nNbStepPerRev);
+    m_dGotoSlitAlt = dSlitAlt;
+    dNewAz = fmod(dNewAz, 360.0);
+    if(dNewAz < 0)
+        dNewAz += 360.0;
+
+    // the firmware before 3.2 only takes whole degrees, target what it will actually do
+    if( m_fVersion >= 3.2)
+        nNewStepPos = m_RotatorScale.toSteps(dNewAz);
+    else
+        nNewStepPos = m_RotatorScale.toSteps(round(dNewAz));
+    nDistance = m_RotatorScale.distance(m_nCurrentRotatorPos, nNewStepPos);
 
 	#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
 			ltime = time(NULL);
@@ -1465,8 +1903,7 @@ int CNexDomeV3::gotoAzimuth(double dNewAz)
 			timestamp[strlen(timestamp) - 1] = 0;
 			fprintf(Logfile, "[%s] [CNexDomeV3::gotoAzimuth] m_dCurrentAzPosition        = %3.2f\n", timestamp, m_dCurrentAzPosition);
 			fprintf(Logfile, "[%s] [CNexDomeV3::gotoAzimuth] dNewAz                      = %3.2f\n", timestamp, dNewAz);
-            fprintf(Logfile, "[%s] [CNexDomeV3::gotoAzimuth] round(m_dCurrentAzPosition) = %d\n", timestamp, int(round(m_dCurrentAzPosition)));
-            fprintf(Logfile, "[%s] [CNexDomeV3::gotoAzimuth] round(dNewAz)               = %d\n", timestamp, int(round(dNewAz)));
+            fprintf(Logfile, "[%s] [CNexDomeV3::gotoAzimuth] nDistance                   = %d\n", timestamp, nDistance);
             fprintf(Logfile, "[%s] [CNexDomeV3::gotoAzimuth] m_nRotationDeadZone         = %d\n", timestamp, m_nRotationDeadZone);
             fprintf(Logfile, "[%s] [CNexDomeV3::gotoAzimuth] m_nCurrentRotatorPos        = %d\n", timestamp, m_nCurrentRotatorPos);
             fprintf(Logfile, "[%s] [CNexDomeV3::gotoAzimuth] nNewStepPos                 = %d\n", timestamp, nNewStepPos);
@@ -1474,8 +1911,8 @@ int CNexDomeV3::gotoAzimuth(double dNewAz)
 			fflush(Logfile);
 	#endif
 
-	if(int(round(dNewAz)) == int(round(m_dCurrentAzPosition))) {
-        m_dGotoAz = dNewAz;
+	if(!bRetarget && abs(nDistance) < m_RotatorScale.toStepCount(GOTO_SAME_POSITION)) {
+        m_nGotoStepPos = nNewStepPos;
 		m_bDomeIsMoving = false;
 		return nErr;
 	}
@@ -1483,11 +1920,12 @@ int CNexDomeV3::gotoAzimuth(double dNewAz)
     if( m_fVersion >= 3.2) {
         snprintf(szBuf, SERIAL_BUFFER_SIZE, "@GSR,%d\r\n", nNewStepPos);
     } else {
-        snprintf(szBuf, SERIAL_BUFFER_SIZE, "@GAR,%d\r\n", int(round(dNewAz)));
+        snprintf(szBuf, SERIAL_BUFFER_SIZE, "@GAR,%d\r\n", int(round(dNewAz)) % 360);
     }
     
-    if (nNewStepPos <= (m_nCurrentRotatorPos + m_nRotationDeadZone) && nNewStepPos >= (m_nCurrentRotatorPos - m_nRotationDeadZone) ) {
-        m_dGotoAz = dNewAz;
+    // check if we're moving inside the dead zone.
+    if (!bRetarget && abs(nDistance) <= m_nRotationDeadZone) {
+        m_nGotoStepPos = nNewStepPos;
 		m_bDomeIsMoving = false;
 		// send the command anyway to update the controller internal counters
         #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
@@ -1520,12 +1958,18 @@ int CNexDomeV3::gotoAzimuth(double dNewAz)
             fflush(Logfile);
     #endif
     m_bDomeIsMoving = true;
+    startMotionMetric(DURATION_SLEW);
+    m_nGotoDir = nDistance >= 0 ? 1 : -1;
+    m_bHomeCrossingPending = false;
+    m_nSlewSteps = bRetarget ? 0 : nDistance;  // not from a standstill, nothing to learn
+    m_dSlewLastPoll = 0;
+    m_slewTimer.Reset();
 	memcpy(szBuf, szResp, SERIAL_BUFFER_SIZE);
     processResponse(szBuf, szResp, SERIAL_BUFFER_SIZE);
     if(nErr == CMD_PROC_DONE)
         nErr = PLUGIN_OK;
     
-    m_dGotoAz = dNewAz;
+    m_nGotoStepPos = nNewStepPos;
 
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     ltime = time(NULL);
@@ -1537,6 +1981,73 @@ int CNexDomeV3::gotoAzimuth(double dNewAz)
     return nErr;
 }
 
+int CNexDomeV3::gotoHaDec(double dHa, double dDec, int nOtaSide)
+{
+    double dDomeAz;
+    double dSlitAlt;
+
+    if(!m_Geometry.azimuthFromHaDec(dHa, dDec, nOtaSide, dDomeAz, dSlitAlt))
+        return ERR_CMDFAILED;
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    ltime = time(NULL);
+    timestamp = asctime(localtime(&ltime));
+    timestamp[strlen(timestamp) - 1] = 0;
+    fprintf(Logfile, "[%s] [CNexDomeV3::gotoHaDec] HA %3.3f Dec %3.3f side %d -> az %3.2f slit alt %3.2f\n", timestamp, dHa, dDec, nOtaSide, dDomeAz, dSlitAlt);
+    fflush(Logfile);
+#endif
+    return gotoAzimuth(dDomeAz, dSlitAlt);
+}
+
+int CNexDomeV3::gotoAltAz(double dAlt, double dAz)
+{
+    double dDomeAz;
+    double dSlitAlt;
+    double dHa, dDec;
+
+    // German mount, the OTA side comes from the hour angle assuming the counterweights are down.
+    if(m_Geometry.getConfig().dOtaOffset != 0) {
+        m_Geometry.haDecFromAltAz(dAlt, dAz, dHa, dDec);
+        return gotoHaDec(dHa, dDec, dHa < 0 ? OTA_WEST_OF_PIER : OTA_EAST_OF_PIER);
+    }
+
+    if(!m_Geometry.azimuthFromAltAz(dAlt, dAz, dDomeAz, dSlitAlt))
+        return ERR_CMDFAILED;
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    ltime = time(NULL);
+    timestamp = asctime(localtime(&ltime));
+    timestamp[strlen(timestamp) - 1] = 0;
+    fprintf(Logfile, "[%s] [CNexDomeV3::gotoAltAz] alt %3.2f az %3.2f -> az %3.2f slit alt %3.2f\n", timestamp, dAlt, dAz, dDomeAz, dSlitAlt);
+    fflush(Logfile);
+#endif
+    return gotoAzimuth(dDomeAz, dSlitAlt);
+}
+
+void CNexDomeV3::setGeometry(const DomeGeometryConfig &config)
+{
+    FollowConfig followConfig = m_FollowPlanner.getConfig();
+
+    m_Geometry.setConfig(config);
+    followConfig.dDomeRadius = config.dDomeRadius;
+    m_FollowPlanner.setConfig(followConfig);
+}
+
+void CNexDomeV3::setSlit(double dSlitWidth, double dAperture)
+{
+    FollowConfig followConfig = m_FollowPlanner.getConfig();
+
+    followConfig.dSlitWidth = dSlitWidth;
+    followConfig.dAperture = dAperture;
+    m_FollowPlanner.setConfig(followConfig);
+}
+
+void CNexDomeV3::getSlit(double &dSlitWidth, double &dAperture)
+{
+    FollowConfig followConfig = m_FollowPlanner.getConfig();
+
+    dSlitWidth = followConfig.dSlitWidth;
+    dAperture = followConfig.dAperture;
+}
+
 int CNexDomeV3::openShutter()
 {
     int nErr = PLUGIN_OK;
@@ -1547,8 +2058,9 @@ int CNexDomeV3::openShutter()
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-	if(m_bDomeIsMoving) {
-        return SB_OK;
+    // the rotator can still be going, the shutter doesn't wait for it
+	if(m_bShutterIsMoving && m_nCurrentShutterCmd == OPENING) {
+        return PLUGIN_OK;
 	}
 
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
@@ -1574,13 +2086,16 @@ int CNexDomeV3::openShutter()
 #endif
     }
 
-    m_bDomeIsMoving = true;
+    m_bShutterIsMoving = true;
     memcpy(szBuf, szResp, SERIAL_BUFFER_SIZE);
     processResponse(szBuf, szResp, SERIAL_BUFFER_SIZE);
     if(nErr == CMD_PROC_DONE)
         nErr = PLUGIN_OK;
 
     m_nCurrentShutterCmd = OPENING;
+    m_shutterTimer.Reset();
+    if(!nErr)
+        m_BatteryMonitor.shutterMoveStarted(CStopWatch::GetMonotonicSeconds());
 
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     ltime = time(NULL);
@@ -1602,8 +2117,8 @@ int CNexDomeV3::closeShutter()
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-	if(m_bDomeIsMoving) {
-        return SB_OK;
+	if(m_bShutterIsMoving && m_nCurrentShutterCmd == CLOSING) {
+        return PLUGIN_OK;
 	}
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     ltime = time(NULL);
@@ -1630,7 +2145,7 @@ int CNexDomeV3::closeShutter()
         return nErr;
     }
 
-    m_bDomeIsMoving = true;
+    m_bShutterIsMoving = true;
     memcpy(szBuf, szResp, SERIAL_BUFFER_SIZE);
     processResponse(szBuf, szResp, SERIAL_BUFFER_SIZE);
     if(nErr == CMD_PROC_DONE)
@@ -1638,6 +2153,9 @@ int CNexDomeV3::closeShutter()
 
 
     m_nCurrentShutterCmd = CLOSING;
+    m_shutterTimer.Reset();
+    if(!nErr)
+        m_BatteryMonitor.shutterMoveStarted(CStopWatch::GetMonotonicSeconds());
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     ltime = time(NULL);
     timestamp = asctime(localtime(&ltime));
@@ -1653,12 +2171,10 @@ int CNexDomeV3::getFirmwareVersion(char *szVersion, int nStrMaxLen)
     int nErr = PLUGIN_OK;
     int i;
     char szResp[SERIAL_BUFFER_SIZE];
-    char szBuf[SERIAL_BUFFER_SIZE];
     char szTmp[SERIAL_BUFFER_SIZE];
     std::vector<std::string> firmwareFields;
     std::vector<std::string> versionFields;
     std::string strVersion;
-    int nb_timeout;
     
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -1667,14 +2183,7 @@ int CNexDomeV3::getFirmwareVersion(char *szVersion, int nStrMaxLen)
         return SB_OK;
 	}
 
-    nErr = domeCommand("@FRR\r\n", szResp, SERIAL_BUFFER_SIZE);
-    nb_timeout = 0;
-    memcpy(szBuf, szResp, SERIAL_BUFFER_SIZE);
-    while(!strstr(szBuf, "FR") && nb_timeout < (CMD_RESP_READ_TIMEOUTS*3)) {
-        readResponse(szBuf, SERIAL_BUFFER_SIZE);
-        nErr = processResponse(szBuf, szResp, SERIAL_BUFFER_SIZE);
-        nb_timeout++;
-    }
+    nErr = domeCommand("@FRR\r\n", szResp, SERIAL_BUFFER_SIZE, "FR");
 
     if(nErr == CMD_PROC_DONE)
         nErr = PLUGIN_OK;
@@ -1683,11 +2192,6 @@ int CNexDomeV3::getFirmwareVersion(char *szVersion, int nStrMaxLen)
         strncpy(szVersion, "Unknown", SERIAL_BUFFER_SIZE);
         return PLUGIN_OK;
     }
-
-    if(nb_timeout >= (CMD_RESP_READ_TIMEOUTS*3)) {
-        strncpy(szVersion, "Unknown", SERIAL_BUFFER_SIZE);
-        return PLUGIN_OK;
-    }
     if(szResp[2] == 'S' || szResp[2] == 'R') // V4
         strncpy(szTmp, szResp+3, SERIAL_BUFFER_SIZE);
     else // V3
@@ -1739,11 +2243,13 @@ int CNexDomeV3::getFirmwareVersion(char *szVersion, int nStrMaxLen)
 int CNexDomeV3::getFirmwareVersion(double &fVersion)
 {
     int nErr = PLUGIN_OK;
+    char szVersion[SERIAL_BUFFER_SIZE];
 
     if(m_fVersion == 0.0f) {
-        nErr = getFirmwareVersion(m_szFirmwareVersion, SERIAL_BUFFER_SIZE);
+        nErr = getFirmwareVersion(szVersion, SERIAL_BUFFER_SIZE);
         if(nErr)
             return nErr;
+        publishFirmwareVersion(szVersion);
     }
 
     fVersion = m_fVersion;
@@ -1760,11 +2266,13 @@ int CNexDomeV3::goHome()
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-	if(m_bDomeIsMoving) {
-        return SB_OK;
-    }
-    else if(isDomeAtHome()){
+    m_bFollowing = false;
+    // a goto complete on the beam check can still be going, the controller is sent home from there
+    if(m_bDomeIsMoving)
+        isDomeMoving();
+    if(!m_bDomeIsMoving && isDomeAtHome()){
             syncDome(m_dHomeAz,m_dCurrentElPosition);
+            m_bHasBeenHomed = true; // on the sensor, the count is set from it
         #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
             ltime = time(NULL);
             timestamp = asctime(localtime(&ltime));
@@ -1797,6 +2305,10 @@ int CNexDomeV3::goHome()
 
     memcpy(szBuf, szResp, SERIAL_BUFFER_SIZE);
     m_bDomeIsMoving = true;
+    startMotionMetric(DURATION_SLEW);
+    m_nGotoDir = 0;     // it stops on the sensor, that's no crossing
+    m_bHomeCrossingPending = false;
+    m_nSlewSteps = 0;   // the search for the sensor isn't a slew of known length
     processResponse(szBuf, szResp, SERIAL_BUFFER_SIZE);
     if(nErr == CMD_PROC_DONE)
         nErr = PLUGIN_OK;
@@ -1817,6 +2329,12 @@ int CNexDomeV3::isGoToComplete(bool &bComplete)
     int nErr = PLUGIN_OK;
     double dDomeAz = 0;
 
+    // still in progress as far as the caller is concerned, it's done again once the link is back.
+    // Unless it takes longer than LINK_MAX_OUTAGE.
+    if(isLinkRecovering()) {
+        bComplete = false;
+        return linkOutageStatus();
+    }
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
@@ -1829,6 +2347,18 @@ int CNexDomeV3::isGoToComplete(bool &bComplete)
     #endif
 
     if(isDomeMoving()) {
+        // the rest of the move doesn't matter to the telescope
+        if(isBeamClear(m_nCurrentRotatorPos)) {
+            bComplete = true;
+            #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+                ltime = time(NULL);
+                timestamp = asctime(localtime(&ltime));
+                timestamp[strlen(timestamp) - 1] = 0;
+                fprintf(Logfile, "[%s] [CNexDomeV3::isGoToComplete] Dome still moving, beam clear at %3.2f\n", timestamp, m_dCurrentAzPosition);
+                fflush(Logfile);
+            #endif
+            return nErr;
+        }
         bComplete = false;
         #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
             ltime = time(NULL);
@@ -1841,26 +2371,18 @@ int CNexDomeV3::isGoToComplete(bool &bComplete)
     }
 
 	getDomeAz(dDomeAz);
-    if(dDomeAz >0 && dDomeAz<1)
-        dDomeAz = 0;
-    
-    while(ceil(m_dGotoAz) >= 360)
-          m_dGotoAz = ceil(m_dGotoAz) - 360;
-
-    while(ceil(dDomeAz) >= 360)
-        dDomeAz = ceil(dDomeAz) - 360;
 
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     ltime = time(NULL);
     timestamp = asctime(localtime(&ltime));
     timestamp[strlen(timestamp) - 1] = 0;
     fprintf(Logfile, "[%s] [CNexDomeV3::isGoToComplete] DomeAz    = %3.2f\n", timestamp, dDomeAz);
-    fprintf(Logfile, "[%s] [CNexDomeV3::isGoToComplete] m_dGotoAz = %3.2f\n", timestamp, m_dGotoAz);
+    fprintf(Logfile, "[%s] [CNexDomeV3::isGoToComplete] m_nCurrentRotatorPos = %d, m_nGotoStepPos = %d\n", timestamp, m_nCurrentRotatorPos, m_nGotoStepPos);
     fflush(Logfile);
 #endif
 
     // we need to test "large" depending on the heading error , this is new in firmware 1.10 and up
-    if ((ceil(m_dGotoAz) <= ceil(dDomeAz)+3) && (ceil(m_dGotoAz) >= ceil(dDomeAz)-3)) {
+    if (isBeamClear(m_nCurrentRotatorPos) || m_RotatorScale.isWithin(m_nCurrentRotatorPos, m_nGotoStepPos, m_RotatorScale.toStepCount(GOTO_TOLERANCE))) {
         bComplete = true;
     }
     else {
@@ -1869,7 +2391,7 @@ int CNexDomeV3::isGoToComplete(bool &bComplete)
         ltime = time(NULL);
         timestamp = asctime(localtime(&ltime));
         timestamp[strlen(timestamp) - 1] = 0;
-        fprintf(Logfile, "[%s] [CNexDomeV3::isGoToComplete] ***** ERROR **** domeAz = %3.2f, m_dGotoAz = %3.2f\n", timestamp, dDomeAz, m_dGotoAz);
+        fprintf(Logfile, "[%s] [CNexDomeV3::isGoToComplete] ***** ERROR **** domeAz = %3.2f, goto az = %3.2f\n", timestamp, dDomeAz, m_RotatorScale.toDegrees(m_nGotoStepPos));
         fflush(Logfile);
 #endif
         nErr = ERR_CMDFAILED;
@@ -1891,6 +2413,10 @@ int CNexDomeV3::isOpenComplete(bool &bComplete)
     int nErr = PLUGIN_OK;
     int nState;
 
+    if(isLinkRecovering()) {
+        bComplete = false;
+        return linkOutageStatus();
+    }
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
@@ -1907,13 +2433,10 @@ int CNexDomeV3::isOpenComplete(bool &bComplete)
         return nErr;
     }
 
-    if(isDomeMoving()) {
-        if(m_nCurrentShutterCmd == IDLE) {
-            if(m_nShutterState == OPEN)
-                bComplete = true;
-            else
-                bComplete = false;
-        }
+    // only the shutter, the rotator can still be finishing a goto
+    isDomeMoving();
+    if(m_bShutterIsMoving) {
+        bComplete = false;
         return nErr;
     }
 
@@ -1959,6 +2482,10 @@ int CNexDomeV3::isCloseComplete(bool &bComplete)
     int nErr = PLUGIN_OK;
     int nState;
 
+    if(isLinkRecovering()) {
+        bComplete = false;
+        return linkOutageStatus();
+    }
     if(!m_bIsConnected)
         return NOT_CONNECTED;
     
@@ -1975,13 +2502,9 @@ int CNexDomeV3::isCloseComplete(bool &bComplete)
         return nErr;
     }
 
-    if(isDomeMoving()) {
-        if(m_nCurrentShutterCmd == CLOSED) {
-            if(m_nShutterState == OPEN)
-                bComplete = true;
-            else
-                bComplete = false;
-        }
+    isDomeMoving();
+    if(m_bShutterIsMoving) {
+        bComplete = false;
         return nErr;
     }
 
@@ -2028,6 +2551,10 @@ int CNexDomeV3::isParkComplete(bool &bComplete)
     double dDomeAz=0;
     bool bFoundHome;
     
+    if(isLinkRecovering()) {
+        bComplete = false;
+        return linkOutageStatus();
+    }
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
@@ -2084,7 +2611,7 @@ int CNexDomeV3::isParkComplete(bool &bComplete)
     }
     
     // we need to test "large" depending on the heading error
-    if ((ceil(m_dParkAz) <= ceil(dDomeAz)+3) && (ceil(m_dParkAz) >= ceil(dDomeAz)-3)) {
+    if (m_RotatorScale.isWithin(m_nCurrentRotatorPos, m_RotatorScale.toSteps(m_dParkAz), m_RotatorScale.toStepCount(GOTO_TOLERANCE))) {
         m_bParked = true;
         bComplete = true;
     }
@@ -2114,6 +2641,10 @@ int CNexDomeV3::isUnparkComplete(bool &bComplete)
     
     bComplete = false;
     
+    if(isLinkRecovering()) {
+        bComplete = false;
+        return linkOutageStatus();
+    }
     if(!m_bIsConnected)
         return NOT_CONNECTED;
     
@@ -2163,6 +2694,10 @@ int CNexDomeV3::isFindHomeComplete(bool &bComplete)
 {
     int nErr = PLUGIN_OK;
 
+    if(isLinkRecovering()) {
+        bComplete = false;
+        return linkOutageStatus();
+    }
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
@@ -2192,6 +2727,7 @@ int CNexDomeV3::isFindHomeComplete(bool &bComplete)
         if(m_bUnParking)
             m_bParked = false;
         bComplete = true;
+        m_bHasBeenHomed = true; // the controller set its count on the sensor
         // m_nHomingTries = 0;
 #ifdef PLUGIN_DEBUG
         ltime = time(NULL);
@@ -2228,119 +2764,1090 @@ int CNexDomeV3::isFindHomeComplete(bool &bComplete)
 int CNexDomeV3::abortCurrentCommand()
 {
     int nErr = PLUGIN_OK;
-    char szResp[SERIAL_BUFFER_SIZE];
+    unsigned long  ulBytesWrite;
+    // both stop commands go out in a single write, we don't wait for the rotator ack before stopping the shutter.
+    const char szAbortCmd[] = "@SWR\r\n@SWS\r\n";
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
+    m_bAbortWhileMoving = m_bDomeIsMoving;
     m_bParked = false;
 	m_bDomeIsMoving = false;
+    m_bShutterIsMoving = false;
     m_bParking = false;
     m_bUnParking = false;
 
-    nErr = domeCommand("@SWR\r\n", szResp, SERIAL_BUFFER_SIZE);
-    nErr = domeCommand("@SWS\r\n", szResp, SERIAL_BUFFER_SIZE);
-
-    getDomeAz(m_dGotoAz);
-
-    return nErr;
-}
-
-
-#pragma mark - Getter / Setter
-
-int CNexDomeV3::getNbTicksPerRev()
-{
-#ifdef PLUGIN_DEBUG
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] [CNexDomeV3::getNbTicksPerRev] m_bIsConnected = %s\n", timestamp, m_bIsConnected?"True":"False");
-    fflush(Logfile);
+    m_abortTimer.Reset();
+    nErr = m_pSerx->writeFile((void *)szAbortCmd, strlen(szAbortCmd), ulBytesWrite);
+    m_pSerx->flushTx();
+    m_cmdDelayCheckTimer.Reset();
+    m_Metrics.countCommand("@SWR");
+    m_Metrics.countCommand("@SWS");
+    m_Metrics.addBytesTx(ulBytesWrite);
+    m_nMotionMetric = -1;   // an aborted move is not a move duration
+    m_nSlewSteps = 0;
+    m_nGotoDir = 0;
+    m_bHomeResyncPending = false;   // measured with a goto that didn't end
+    m_bHomeCrossingPending = false;
+    m_bFollowing = false;
+    if(nErr) {
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        ltime = time(NULL);
+        timestamp = asctime(localtime(&ltime));
+        timestamp[strlen(timestamp) - 1] = 0;
+        fprintf(Logfile, "[%s] [CNexDomeV3::abortCurrentCommand] ERROR = %d\n", timestamp, nErr);
+        fflush(Logfile);
 #endif
+        return nErr;
+    }
 
-    if(m_bIsConnected)
-        getDomeStepPerRev(m_nNbStepPerRev);
+    // the acks and the :SER stop report are processed when the async responses are read,
+    // until then the last known position is the best we have.
+    m_bAbortPending = true;
+    m_bAbortAcked = false;
+    m_BatteryMonitor.shutterMoveEnded(CStopWatch::GetMonotonicSeconds());
+    m_nGotoStepPos = m_nCurrentRotatorPos;
+    m_dGotoSlitAlt = NAN;
+    publishTelemetry();
 
-#ifdef PLUGIN_DEBUG
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     ltime = time(NULL);
     timestamp = asctime(localtime(&ltime));
     timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] [CNexDomeV3::getNbTicksPerRev] m_nNbStepPerRev = %d\n", timestamp, m_nNbStepPerRev);
+    fprintf(Logfile, "[%s] [CNexDomeV3::abortCurrentCommand] abort sent, was moving = %s\n", timestamp, m_bAbortWhileMoving?"Yes":"No");
     fflush(Logfile);
 #endif
-
-    return m_nNbStepPerRev;
-}
-
-int CNexDomeV3::setNbTicksPerRev(int nSteps)
-{
-    int nErr = PLUGIN_OK;
-
-    if(m_bIsConnected)
-        nErr = setDomeStepPerRev(nSteps);
     return nErr;
 }
 
-double CNexDomeV3::getHomeAz()
+int CNexDomeV3::getAbortLatency(double &dLastSeconds, double &dMaxSeconds)
 {
-    if(m_bIsConnected)
-        getDomeHomeAz(m_dHomeAz);
-    return m_dHomeAz;
+    dLastSeconds = m_dLastAbortLatency;
+    dMaxSeconds = m_dMaxAbortLatency;
+    return PLUGIN_OK;
 }
 
-int CNexDomeV3::setHomeAz(double dAz)
+void CNexDomeV3::processRotatorReport(const char *pszResp)
 {
-    int nErr = PLUGIN_OK;
-    char szBuf[SERIAL_BUFFER_SIZE];
-    char szResp[SERIAL_BUFFER_SIZE];
-    int nTmp;
-    
-    m_dHomeAz = dAz;
+    std::vector<std::string> rotatorStateFields;
 
-    #ifdef PLUGIN_DEBUG
+    // :SER,<position>,<at home>,<steps per rev>,<home position>,<dead zone>#
+    if(parseFields(pszResp, rotatorStateFields, ','))
+        return;
+    if(rotatorStateFields.size()<3)
+        return;
+
+    setRotatorPosition(atoi(rotatorStateFields[1].c_str()));
+
+    if(m_bAbortPending && m_abortTimer.GetElapsedSeconds() > ABORT_RECONCILE_TIMEOUT) {
+        m_bAbortPending = false;
+    }
+    else if(m_bAbortPending && m_bAbortAcked) {
+        // first report after the :SWR ack, the rotator stopped. Earlier ones are poll replies.
+        m_dLastAbortLatency = m_abortTimer.GetElapsedSeconds();
+        if(m_dLastAbortLatency > m_dMaxAbortLatency)
+            m_dMaxAbortLatency = m_dLastAbortLatency;
+        m_nGotoStepPos = m_nCurrentRotatorPos;
+        m_bAbortPending = false;
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
         ltime = time(NULL);
         timestamp = asctime(localtime(&ltime));
         timestamp[strlen(timestamp) - 1] = 0;
-        fprintf(Logfile, "[%s] [CNexDomeV3::setHomeAz] m_dHomeAz = %3.2f\n", timestamp, m_dHomeAz);
+        fprintf(Logfile, "[%s] [CNexDomeV3::processRotatorReport] abort to stop latency = %3.3f s, stopped at %3.2f\n", timestamp, m_dLastAbortLatency, m_dCurrentAzPosition);
         fflush(Logfile);
-    #endif
+#endif
+    }
+}
 
-    if(!m_bIsConnected)
-        return NOT_CONNECTED;
-    nTmp = int((dAz/360.0)*m_nNbStepPerRev);
-    #ifdef PLUGIN_DEBUG
+
+// Pxxxxx and Sxxxxx, keep the value for applyPositionUpdates. Returns false for anything else.
+bool CNexDomeV3::queuePositionUpdate(const char *pszResp)
+{
+    if(!isdigit(pszResp[1]) && !(pszResp[1] == '-' && isdigit(pszResp[2])))
+        return false;
+
+    switch(pszResp[0]) {
+        case 'P' :
+            m_Metrics.countPositionUpdate(POSITION_ROTATOR, m_bRotatorPosPending);
+            m_nPendingRotatorPos = atoi(pszResp+1);
+            m_bRotatorPosPending = true;
+            checkPositionSequence(m_nPendingRotatorPos);
+            break;
+        case 'S' :
+            m_Metrics.countPositionUpdate(POSITION_SHUTTER, m_bShutterPosPending);
+            m_nPendingShutterPos = atoi(pszResp+1);
+            m_bShutterPosPending = true;
+            break;
+        default :
+            return false;
+    }
+    m_Metrics.countUnsolicited();
+    return true;
+}
+
+// No sequence numbers in the protocol. During a move the P lines come at a fixed rate and the step between
+// two of them only changes gradually, one much larger than the one before means lines were lost in between.
+void CNexDomeV3::checkPositionSequence(int nPos)
+{
+    int nDelta;
+
+    if(m_seqTimer.GetElapsedSeconds() > SEQ_GAP_IDLE)
+        m_nSeqLines = 0;
+    m_seqTimer.Reset();
+    nDelta = m_RotatorScale.isValid() ? abs(m_RotatorScale.distance(m_nSeqLastPos, nPos)) : abs(nPos - m_nSeqLastPos);
+    if(m_nSeqLines >= 3 && m_nSeqLastDelta >= SEQ_GAP_MIN_STEPS && nDelta > SEQ_GAP_RATIO * m_nSeqLastDelta) {
+        m_Metrics.countSequenceGap();
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
         ltime = time(NULL);
         timestamp = asctime(localtime(&ltime));
         timestamp[strlen(timestamp) - 1] = 0;
-        fprintf(Logfile, "[%s] [CNexDomeV3::setHomeAz] nTmp = %d\n", timestamp, nTmp);
+        fprintf(Logfile, "[%s] [CNexDomeV3::checkPositionSequence] gap from %d to %d, step was %d\n", timestamp, m_nSeqLastPos, nPos, m_nSeqLastDelta);
         fflush(Logfile);
-    #endif
-
-    snprintf(szBuf, SERIAL_BUFFER_SIZE, "@HWR,%d\r\n", nTmp);
-    nErr = domeCommand(szBuf, szResp, SERIAL_BUFFER_SIZE);
-    return nErr;
+#endif
+    }
+    if(m_nSeqLines)
+        m_nSeqLastDelta = nDelta;
+    m_nSeqLastPos = nPos;
+    m_nSeqLines++;
 }
 
-double CNexDomeV3::getParkAz()
+void CNexDomeV3::applyPositionUpdates()
 {
-    return m_dParkAz;
+    if(m_bRotatorPosPending) {
+        m_bRotatorPosPending = false;
+        setRotatorPosition(m_nPendingRotatorPos);
+    }
+    if(m_bShutterPosPending) {
+        m_bShutterPosPending = false;
+        m_nCurrentShutterPos = m_nPendingShutterPos;
+        if(m_nShutterSteps)
+            m_dCurrentElPosition = (double(m_nCurrentShutterPos)/m_nShutterSteps) * 104.0; // max apperture of the dome
+    }
 }
 
-int CNexDomeV3::setParkAz(double dAz)
+// steps are the reference, the degrees are derived from them here and nowhere else
+void CNexDomeV3::setRotatorPosition(int nSteps)
 {
-    m_dParkAz = dAz;
-    return PLUGIN_OK;
+    m_nCurrentRotatorPos = nSteps;
+    if(m_RotatorScale.isValid())
+        m_dCurrentAzPosition = m_RotatorScale.toDegrees(nSteps);
 }
 
-void CNexDomeV3::setShutterPresent(bool bPresent)
-{
-    
-    m_bShutterPresent = bPresent;
-    
-}
+#pragma mark - Link watchdog
 
-int CNexDomeV3::getShutterStepsRange()
+// Too many failed exchanges in a row : the adapter was unplugged or reset. Everything that was going on is
+// noted and the port closed, drainAsync then tries to open it again every LINK_RETRY_INTERVAL.
+void CNexDomeV3::linkLost()
+{
+    if(m_nLinkState != LINK_UP)
+        return;
+
+    m_LinkIntent.bParked = m_bParked;
+    m_LinkIntent.bParking = m_bParking;
+    m_LinkIntent.bUnParking = m_bUnParking;
+    m_LinkIntent.bGoto = m_bDomeIsMoving && m_nGotoDir != 0;
+    m_LinkIntent.dGotoAz = m_RotatorScale.toDegrees(m_nGotoStepPos);
+    m_LinkIntent.dGotoSlitAlt = m_dGotoSlitAlt;
+    m_LinkIntent.nShutterCmd = m_bShutterPresent && m_bShutterIsMoving ? m_nCurrentShutterCmd : IDLE;
+    m_LinkIntent.bRehoming = false;
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    ltime = time(NULL);
+    timestamp = asctime(localtime(&ltime));
+    timestamp[strlen(timestamp) - 1] = 0;
+    fprintf(Logfile, "[%s] [CNexDomeV3::linkLost] %d failures, goto = %s (%3.2f), parked = %s, shutter cmd = %d\n", timestamp, m_nLinkFailures,
+            m_LinkIntent.bGoto?"Yes":"No", m_LinkIntent.dGotoAz, m_LinkIntent.bParked?"Yes":"No", m_LinkIntent.nShutterCmd);
+    fflush(Logfile);
+#endif
+
+    m_pSerx->purgeTxRx();
+    m_pSerx->close();
+    m_Parser.reset();
+    m_bIsConnected = false;
+    m_bDomeIsMoving = false;
+    m_bShutterIsMoving = false;
+    m_bRotatorPosPending = false;
+    m_bShutterPosPending = false;
+    m_bAbortPending = false;
+    m_nLinkState = LINK_DOWN;
+    m_nLinkFailures = 0;
+    m_outageTimer.Reset();
+    m_LinkStats.nOutages++;
+    m_Metrics.countLinkOutage();
+    publishTelemetry();
+    // first attempt right away
+    reconnectLink();
+}
+
+// one step at a time, so the mutex is never held for the whole boot of the controller
+int CNexDomeV3::reconnectLink()
+{
+    int nErr;
+    double dOutage;
+
+    switch(m_nLinkState) {
+        case LINK_DOWN :
+            if(m_LinkStats.nReopens && m_linkRetryTimer.GetElapsedSeconds() < LINK_RETRY_INTERVAL)
+                return NOT_CONNECTED;
+            m_linkRetryTimer.Reset();
+            m_LinkStats.nReopens++;
+            nErr = m_pSerx->open(m_szPort, 115200, SerXInterface::B_NOPARITY, "-DTR_CONTROL 1");
+            if(nErr)
+                return nErr;
+            m_nLinkState = LINK_BOOTING;
+            return NOT_CONNECTED;
+
+        case LINK_BOOTING :
+            if(m_linkRetryTimer.GetElapsedSeconds() < LINK_BOOT_DELAY)
+                return NOT_CONNECTED;
+            m_bIsConnected = true;
+            nErr = readControllerState();
+            if(nErr) {
+                m_bIsConnected = false;
+                m_pSerx->close();
+                m_nLinkState = LINK_DOWN;
+                m_linkRetryTimer.Reset();
+                return nErr;
+            }
+            break;
+
+        default :
+            return PLUGIN_OK;
+    }
+
+    dOutage = m_outageTimer.GetElapsedSeconds();
+    m_LinkStats.dLastOutage = dOutage;
+    m_LinkStats.dTotalOutage += dOutage;
+    m_Metrics.addLinkDownTime(dOutage);
+    m_nLinkState = LINK_UP;
+    m_nLinkFailures = 0;
+    m_linkRxTimer.Reset();
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    ltime = time(NULL);
+    timestamp = asctime(localtime(&ltime));
+    timestamp[strlen(timestamp) - 1] = 0;
+    fprintf(Logfile, "[%s] [CNexDomeV3::reconnectLink] link back after %3.1f s\n", timestamp, dOutage);
+    fflush(Logfile);
+#endif
+
+    restoreLinkIntent();
+    publishTelemetry();
+    return PLUGIN_OK;
+}
+
+// The controller restarted with the port, it's not moving anymore.
+void CNexDomeV3::restoreLinkIntent()
+{
+    bool bCountKept;
+
+    m_bParked = m_LinkIntent.bParked;
+    // whatever the count is now, it wasn't set on the sensor
+    m_bHasBeenHomed = false;
+    bCountKept = restoreStepCount(m_nCurrentRotatorPos);
+
+    if(m_LinkIntent.nShutterCmd == OPENING)
+        openShutter();
+    else if(m_LinkIntent.nShutterCmd == CLOSING)
+        closeShutter();
+
+    m_bParking = m_LinkIntent.bParking;
+    m_bUnParking = m_LinkIntent.bUnParking;
+    if(m_LinkIntent.bGoto && !bCountKept) {
+        // isDomeMoving does the goto again once on the sensor
+        m_LinkIntent.bRehoming = true;
+        goHome();
+    }
+    else if(m_LinkIntent.bGoto)
+        gotoAzimuth(m_LinkIntent.dGotoAz, m_LinkIntent.dGotoSlitAlt);
+    else if(m_bParking || m_bUnParking)
+        goHome();   // park or unpark on the home sensor
+}
+
+// The arduino may have started counting again from where it booted. A count on the way of the goto that was
+// going on, or where the dome was standing, is its own. Otherwise, standing still, the last known count is still
+// right and is written back, checked with @PRR. Moving, nobody knows where it stopped.
+bool CNexDomeV3::restoreStepCount(int nLastPos)
+{
+    int nErr;
+    int nGotoDistance;
+    int nDistance;
+    double dDomeAz;
+    char szBuf[SERIAL_BUFFER_SIZE];
+    char szResp[SERIAL_BUFFER_SIZE];
+
+    if(getDomeAz(dDomeAz))
+        return false;
+    nDistance = m_RotatorScale.distance(nLastPos, m_nCurrentRotatorPos);
+    if(abs(nDistance) < m_RotatorScale.toStepCount(GOTO_SAME_POSITION))
+        return true;
+    if(m_LinkIntent.bGoto) {
+        nGotoDistance = m_RotatorScale.distance(nLastPos, m_nGotoStepPos);
+        if((nDistance > 0) == (nGotoDistance > 0) && abs(nDistance) <= abs(nGotoDistance) + m_RotatorScale.toStepCount(GOTO_TOLERANCE))
+            return true;
+    }
+    if(m_LinkIntent.bGoto || m_LinkIntent.bParking || m_LinkIntent.bUnParking)
+        return false;
+
+    snprintf(szBuf, SERIAL_BUFFER_SIZE, "@PWR,%d\r\n", nLastPos);
+    nErr = domeCommand(szBuf, szResp, SERIAL_BUFFER_SIZE);
+    if(nErr && nErr != CMD_PROC_DONE)
+        return false;
+    if(getDomeAz(dDomeAz))
+        return false;
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    ltime = time(NULL);
+    timestamp = asctime(localtime(&ltime));
+    timestamp[strlen(timestamp) - 1] = 0;
+    fprintf(Logfile, "[%s] [CNexDomeV3::restoreStepCount] count written back to %d, reads %d\n", timestamp, nLastPos, m_nCurrentRotatorPos);
+    fflush(Logfile);
+#endif
+    return m_nCurrentRotatorPos == nLastPos;
+}
+
+// a move still waiting on the link after LINK_MAX_OUTAGE has failed, and isn't done again when the link is back
+int CNexDomeV3::linkOutageStatus()
+{
+    if(m_outageTimer.GetElapsedSeconds() <= LINK_MAX_OUTAGE)
+        return PLUGIN_OK;
+    m_LinkIntent.bGoto = false;
+    m_LinkIntent.bParking = false;
+    m_LinkIntent.bUnParking = false;
+    m_LinkIntent.nShutterCmd = IDLE;
+    return NOT_CONNECTED;
+}
+
+void CNexDomeV3::getLinkStats(LinkStats &stats)
+{
+    stats = m_LinkStats;
+    stats.nState = m_nLinkState;
+    stats.dCurrentOutage = m_nLinkState == LINK_UP ? 0.0 : m_outageTimer.GetElapsedSeconds();
+}
+
+#pragma mark - Steps per rev calibration
+
+// The firmware sends a :SER with the at home flag set when the home sensor triggers during a move, with the step
+// position at that point. The position wraps at whatever steps per rev the controller is set to, so it is unwrapped
+// here from one :SER to the next (never more than a third of a turn apart) into a count of steps actually moved.
+// Going round in one direction that count moves by one revolution between two detections. The sensor doesn't
+// trigger at quite the same place going up and going down, so each direction is measured on its own.
+int CNexDomeV3::startStepsPerRevCalibration(int nRevolutions, bool bWrite)
+{
+    int nErr = PLUGIN_OK;
+    double dAz;
+
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+
+    if(m_bDomeIsMoving || m_bShutterIsMoving || m_Calibration.nState == CALIBRATION_RUNNING || m_Tuning.nState == TUNING_RUNNING)
+        return ERR_CMDFAILED;
+
+    memset(&m_Calibration, 0, sizeof(StepsPerRevCalibration));
+    m_nCalibrationRevolutions = nRevolutions < 1 ? 1 : nRevolutions;
+    m_bCalibrationWrite = bWrite;
+    m_nCalibrationGuess = m_nNbStepPerRev > 0 ? m_nNbStepPerRev : CALIBRATION_DEFAULT_GUESS;
+    m_nCalibrationDir = 1;
+    m_nCalibrationTravel = 0;
+    m_CalibrationDetections[0].clear();
+    m_CalibrationDetections[1].clear();
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    ltime = time(NULL);
+    timestamp = asctime(localtime(&ltime));
+    timestamp[strlen(timestamp) - 1] = 0;
+    fprintf(Logfile, "[%s] [CNexDomeV3::startStepsPerRevCalibration] %d revolutions per direction, current steps per rev = %d\n", timestamp, m_nCalibrationRevolutions, m_nCalibrationGuess);
+    fflush(Logfile);
+#endif
+
+    getDomeAz(dAz);
+    m_nCalibrationLastPos = m_nCurrentRotatorPos;
+    m_nCalibrationUnwrapped = 0;
+    m_Calibration.nState = CALIBRATION_RUNNING;
+    nErr = sendCalibrationMove();
+    if(nErr)
+        m_Calibration.nState = CALIBRATION_FAILED;
+    return nErr;
+}
+
+int CNexDomeV3::sendCalibrationMove()
+{
+    int nErr = PLUGIN_OK;
+    char szBuf[SERIAL_BUFFER_SIZE];
+    char szResp[SERIAL_BUFFER_SIZE];
+
+    // a third of a turn, so the firmware's shortest way is always the direction we want
+    m_nCalibrationTarget = wrapSteps(m_nCurrentRotatorPos + m_nCalibrationDir * (m_nCalibrationGuess / 3), m_nCalibrationGuess);
+    snprintf(szBuf, SERIAL_BUFFER_SIZE, "@GSR,%d\r\n", m_nCalibrationTarget);
+    nErr = domeCommand(szBuf, szResp, SERIAL_BUFFER_SIZE);
+    if(nErr)
+        return nErr;
+    m_bDomeIsMoving = true;
+    m_calibrationMoveTimer.Reset();
+    return PLUGIN_OK;
+}
+
+void CNexDomeV3::addCalibrationDetection(int nPos)
+{
+    std::vector<int> &detections = m_CalibrationDetections[m_nCalibrationDir > 0 ? 0 : 1];
+
+    // the sensor can report more than once on the way through, the first one is the edge
+    if(!detections.empty() && abs(nPos - detections.back()) < m_nCalibrationGuess / 4)
+        return;
+    detections.push_back(nPos);
+    m_Calibration.nDetections++;
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    ltime = time(NULL);
+    timestamp = asctime(localtime(&ltime));
+    timestamp[strlen(timestamp) - 1] = 0;
+    fprintf(Logfile, "[%s] [CNexDomeV3::addCalibrationDetection] home at %d going %s\n", timestamp, nPos, m_nCalibrationDir > 0 ? "up" : "down");
+    fflush(Logfile);
+#endif
+}
+
+int CNexDomeV3::updateStepsPerRevCalibration(bool &bComplete)
+{
+    int nErr = PLUGIN_OK;
+    char szResp[SERIAL_BUFFER_SIZE];
+    int nbBytesWaiting = 0;
+    int nPos;
+    bool bMoveDone = false;
+    std::vector<std::string> rotatorStateFields;
+    std::vector<int> *pDetections;
+
+    bComplete = true;
+    if(m_Calibration.nState != CALIBRATION_RUNNING)
+        return PLUGIN_OK;
+
+    if(!m_bIsConnected) {
+        m_Calibration.nState = CALIBRATION_FAILED;
+        return NOT_CONNECTED;
+    }
+    bComplete = false;
+
+    // same drain as isDomeMoving, but a :SER only ends the move when it's at the target
+    do {
+        m_pSerx->bytesWaitingRx(nbBytesWaiting);
+        nbBytesWaiting += m_Parser.getMessageCount();
+        if(!nbBytesWaiting)
+            break;
+        nErr = readResponse(szResp, SERIAL_BUFFER_SIZE, 250);
+        if(nErr && nErr != ERR_DATAOUT)
+            break;
+        if(!strlen(szResp) || queuePositionUpdate(szResp))
+            continue;
+        applyPositionUpdates();
+        // :SER,<position>,<at home>,<steps per rev>,<home position>,<dead zone>
+        if(!strstr(szResp, ":SER") || parseFields(szResp, rotatorStateFields, ',') || rotatorStateFields.size() < 3)
+            continue;
+        nPos = atoi(rotatorStateFields[1].c_str());
+        setRotatorPosition(nPos);
+        m_nCalibrationUnwrapped += stepDistance(m_nCalibrationLastPos, nPos, m_nCalibrationGuess);
+        m_nCalibrationLastPos = nPos;
+        if(rotatorStateFields[2] == "1")
+            addCalibrationDetection(m_nCalibrationUnwrapped);
+        if(abs(stepDistance(nPos, m_nCalibrationTarget, m_nCalibrationGuess)) <= m_nCalibrationGuess / 100)
+            bMoveDone = true;
+    } while(true);
+    applyPositionUpdates();
+    publishTelemetry();
+
+    if(!bMoveDone) {
+        if(m_calibrationMoveTimer.GetElapsedSeconds() < CALIBRATION_MOVE_TIMEOUT)
+            return PLUGIN_OK;
+        abortCurrentCommand();
+        m_bDomeIsMoving = false;
+        m_Calibration.nState = CALIBRATION_FAILED;
+        bComplete = true;
+        return ERR_CMDFAILED;
+    }
+    m_bDomeIsMoving = false;
+
+    m_nCalibrationTravel += m_nCalibrationGuess / 3;
+    pDetections = &m_CalibrationDetections[m_nCalibrationDir > 0 ? 0 : 1];
+    if(int(pDetections->size()) > m_nCalibrationRevolutions) {
+        if(m_nCalibrationDir < 0) {
+            finishStepsPerRevCalibration();
+            bComplete = true;
+            return PLUGIN_OK;
+        }
+        m_nCalibrationDir = -1;
+        m_nCalibrationTravel = 0;
+    }
+    else if(m_nCalibrationTravel > (m_nCalibrationRevolutions + 2) * m_nCalibrationGuess) {
+        // been round more than enough times, the sensor isn't reporting
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        ltime = time(NULL);
+        timestamp = asctime(localtime(&ltime));
+        timestamp[strlen(timestamp) - 1] = 0;
+        fprintf(Logfile, "[%s] [CNexDomeV3::updateStepsPerRevCalibration] only %d home detections after %d steps\n", timestamp, int(pDetections->size()), m_nCalibrationTravel);
+        fflush(Logfile);
+#endif
+        m_Calibration.nState = CALIBRATION_FAILED;
+        bComplete = true;
+        return ERR_CMDFAILED;
+    }
+
+    nErr = sendCalibrationMove();
+    if(nErr) {
+        m_Calibration.nState = CALIBRATION_FAILED;
+        bComplete = true;
+    }
+    return nErr;
+}
+
+void CNexDomeV3::finishStepsPerRevCalibration()
+{
+    std::vector<double> revolutions;
+    double dMean = 0;
+    double dVariance = 0;
+    size_t i, nDir;
+
+    for(nDir = 0; nDir < 2; nDir++) {
+        for(i = 1; i < m_CalibrationDetections[nDir].size(); i++)
+            revolutions.push_back(fabs(double(m_CalibrationDetections[nDir][i] - m_CalibrationDetections[nDir][i-1])));
+    }
+    for(i = 0; i < revolutions.size(); i++)
+        dMean += revolutions[i];
+    dMean /= revolutions.size();
+    for(i = 0; i < revolutions.size(); i++)
+        dVariance += (revolutions[i] - dMean) * (revolutions[i] - dMean);
+    if(revolutions.size() > 1)
+        dVariance /= (revolutions.size() - 1);
+
+    m_Calibration.nStepsPerRev = int(round(dMean));
+    m_Calibration.nSamples = int(revolutions.size());
+    m_Calibration.dStdDev = sqrt(dVariance);
+    // never better than the step itself
+    m_Calibration.dUncertainty = std::max(0.5, 1.96 * m_Calibration.dStdDev / sqrt(double(revolutions.size())));
+    // where the sensor triggers going up compared to going down
+    m_Calibration.nHysteresis = stepDistance(m_CalibrationDetections[1][0], m_CalibrationDetections[0].back(), m_Calibration.nStepsPerRev);
+    m_Calibration.nState = CALIBRATION_DONE;
+
+    if(m_bCalibrationWrite && m_Calibration.dUncertainty <= CALIBRATION_MAX_UNCERTAINTY * m_Calibration.nStepsPerRev) {
+        if(setDomeStepPerRev(m_Calibration.nStepsPerRev) == PLUGIN_OK)
+            m_Calibration.bWritten = true;
+    }
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    ltime = time(NULL);
+    timestamp = asctime(localtime(&ltime));
+    timestamp[strlen(timestamp) - 1] = 0;
+    fprintf(Logfile, "[%s] [CNexDomeV3::finishStepsPerRevCalibration] steps per rev = %d +/- %3.1f (%d revolutions, std dev %3.1f, hysteresis %d), written = %s\n", timestamp,
+            m_Calibration.nStepsPerRev, m_Calibration.dUncertainty, m_Calibration.nSamples, m_Calibration.dStdDev, m_Calibration.nHysteresis, m_Calibration.bWritten?"Yes":"No");
+    fflush(Logfile);
+#endif
+}
+
+void CNexDomeV3::abortStepsPerRevCalibration()
+{
+    if(m_Calibration.nState != CALIBRATION_RUNNING)
+        return;
+    abortCurrentCommand();
+    m_bDomeIsMoving = false;
+    m_Calibration.nState = CALIBRATION_IDLE;
+}
+
+
+#pragma mark - Rotation tuning
+
+// candidates are the current settings scaled by these, slowest first
+static const double tuningSpeedFactors[] = {1.0, 1.25, 1.5, 2.0};
+static const double tuningAccelerationFactors[] = {1.0, 1.5, 2.0};
+// degrees, short ones are dominated by the acceleration, the long one by the speed. Alternate directions.
+static const double tuningSlews[] = {10.0, 45.0, 120.0};
+#define TUNING_NB_SLEWS int(sizeof(tuningSlews) / sizeof(tuningSlews[0]))
+
+// Every candidate runs the same test slews, timed from the goto to the :SER that ends it. A candidate is rejected
+// when the position stops changing (stall), goes further than GOTO_TOLERANCE past the target (overshoot), doesn't
+// end on the target, or the home sensor triggers away from the home position (lost steps). Once a candidate is
+// rejected the faster ones with at least the same acceleration aren't tried.
+int CNexDomeV3::startRotationTuning(bool bApply)
+{
+    int nErr = PLUGIN_OK;
+    int nSpeed = 0;
+    int nAcceleration = 0;
+    size_t i, j;
+    TuningCandidate *pCandidate;
+
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+
+    if(m_bDomeIsMoving || m_bShutterIsMoving || m_Tuning.nState == TUNING_RUNNING || m_Calibration.nState == CALIBRATION_RUNNING)
+        return ERR_CMDFAILED;
+
+    getRotationSpeed(nSpeed);
+    getRotationAcceleration(nAcceleration);
+    if(!nSpeed || !nAcceleration || !m_RotatorScale.isValid())
+        return ERR_CMDFAILED;
+
+    memset(&m_Tuning, 0, sizeof(RotationTuning));
+    m_Tuning.nBest = -1;
+    m_Tuning.nOriginalSpeed = nSpeed;
+    m_Tuning.nOriginalAcceleration = nAcceleration;
+    m_bTuningApply = bApply;
+    for(i = 0; i < sizeof(tuningSpeedFactors) / sizeof(tuningSpeedFactors[0]); i++) {
+        for(j = 0; j < sizeof(tuningAccelerationFactors) / sizeof(tuningAccelerationFactors[0]); j++) {
+            if(m_Tuning.nCandidates == TUNING_MAX_CANDIDATES)
+                break;
+            pCandidate = &m_Tuning.candidates[m_Tuning.nCandidates++];
+            pCandidate->nSpeed = int(round(nSpeed * tuningSpeedFactors[i]));
+            pCandidate->nAcceleration = int(round(nAcceleration * tuningAccelerationFactors[j]));
+        }
+    }
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    ltime = time(NULL);
+    timestamp = asctime(localtime(&ltime));
+    timestamp[strlen(timestamp) - 1] = 0;
+    fprintf(Logfile, "[%s] [CNexDomeV3::startRotationTuning] %d candidates from speed = %d, acceleration = %d\n", timestamp, m_Tuning.nCandidates, nSpeed, nAcceleration);
+    fflush(Logfile);
+#endif
+
+    m_Tuning.nState = TUNING_RUNNING;
+    nErr = startTuningCandidate();
+    if(nErr)
+        abortRotationTuning();
+    return nErr;
+}
+
+int CNexDomeV3::startTuningCandidate()
+{
+    int nErr = PLUGIN_OK;
+    TuningCandidate *pCandidate;
+
+    // skip the ones already ruled out
+    while(m_Tuning.nCurrent < m_Tuning.nCandidates && m_Tuning.candidates[m_Tuning.nCurrent].bTested)
+        m_Tuning.nCurrent++;
+    if(m_Tuning.nCurrent == m_Tuning.nCandidates) {
+        finishRotationTuning();
+        return PLUGIN_OK;
+    }
+
+    pCandidate = &m_Tuning.candidates[m_Tuning.nCurrent];
+    nErr = setRotationSpeed(pCandidate->nSpeed);
+    nErr |= setRotationAcceleration(pCandidate->nAcceleration);
+    if(nErr)
+        return nErr;
+    m_Tuning.nSlew = 0;
+    return sendTuningSlew();
+}
+
+int CNexDomeV3::sendTuningSlew()
+{
+    int nErr = PLUGIN_OK;
+
+    m_nTuningDir = (m_Tuning.nSlew % 2) ? -1 : 1;
+    nErr = gotoAzimuth(m_dCurrentAzPosition + m_nTuningDir * tuningSlews[m_Tuning.nSlew]);
+    if(nErr)
+        return nErr;
+    m_nTuningTarget = m_nGotoStepPos;
+    m_nSlewSteps = 0;   // not at the normal settings, keep it out of the slew model
+    m_nTuningLastPos = m_nCurrentRotatorPos;
+    m_nTuningOvershoot = 0;
+    m_tuningSlewTimer.Reset();
+    m_tuningProgressTimer.Reset();
+    return PLUGIN_OK;
+}
+
+int CNexDomeV3::updateRotationTuning(bool &bComplete)
+{
+    int nErr = PLUGIN_OK;
+    char szResp[SERIAL_BUFFER_SIZE];
+    int nbBytesWaiting = 0;
+    int nPos;
+    int nTolerance;
+    bool bSlewDone = false;
+    bool bLostSteps = false;
+    std::vector<std::string> rotatorStateFields;
+    TuningCandidate *pCandidate;
+
+    bComplete = true;
+    if(m_Tuning.nState != TUNING_RUNNING)
+        return PLUGIN_OK;
+
+    if(!m_bIsConnected) {
+        m_Tuning.nState = TUNING_FAILED;
+        return NOT_CONNECTED;
+    }
+
+    nTolerance = m_RotatorScale.toStepCount(GOTO_TOLERANCE);
+    pCandidate = &m_Tuning.candidates[m_Tuning.nCurrent];
+
+    do {
+        m_pSerx->bytesWaitingRx(nbBytesWaiting);
+        nbBytesWaiting += m_Parser.getMessageCount();
+        if(!nbBytesWaiting)
+            break;
+        nErr = readResponse(szResp, SERIAL_BUFFER_SIZE, 250);
+        if(nErr && nErr != ERR_DATAOUT)
+            break;
+        if(!strlen(szResp))
+            continue;
+        // every P line counts here, the coalesced one could hide the overshoot
+        if(szResp[0] == 'P' && queuePositionUpdate(szResp)) {
+            nPos = atoi(szResp + 1);
+            if(nPos != m_nTuningLastPos) {
+                m_nTuningLastPos = nPos;
+                m_tuningProgressTimer.Reset();
+            }
+            m_nTuningOvershoot = std::max(m_nTuningOvershoot, m_nTuningDir * m_RotatorScale.distance(m_nTuningTarget, nPos));
+            continue;
+        }
+        if(queuePositionUpdate(szResp))
+            continue;
+        applyPositionUpdates();
+        if(!strstr(szResp, ":SER"))
+            continue;
+        processRotatorReport(szResp);
+        bSlewDone = true;
+        // :SER,<position>,<at home>,... with the at home flag away from home means the step count is off
+        if(!parseFields(szResp, rotatorStateFields, ',') && rotatorStateFields.size() >= 3 && rotatorStateFields[2] == "1"
+           && !m_RotatorScale.isWithin(m_nCurrentRotatorPos, m_nHomeStepPos, nTolerance)) {
+            bLostSteps = true;
+            bSlewDone = false;  // the sensor report, the slew isn't over
+            break;
+        }
+        if(!m_RotatorScale.isWithin(m_nCurrentRotatorPos, m_nTuningTarget, nTolerance))
+            bSlewDone = false;  // an intermediate report
+    } while(true);
+    applyPositionUpdates();
+    publishTelemetry();
+
+    pCandidate->nOvershoot = std::max(pCandidate->nOvershoot, m_nTuningOvershoot);
+    bComplete = false;
+
+    if(bLostSteps || (!bSlewDone && (m_tuningProgressTimer.GetElapsedSeconds() > TUNING_STALL_TIMEOUT || m_tuningSlewTimer.GetElapsedSeconds() > TUNING_MOVE_TIMEOUT))) {
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        ltime = time(NULL);
+        timestamp = asctime(localtime(&ltime));
+        timestamp[strlen(timestamp) - 1] = 0;
+        fprintf(Logfile, "[%s] [CNexDomeV3::updateRotationTuning] speed = %d, acceleration = %d : %s\n", timestamp, pCandidate->nSpeed, pCandidate->nAcceleration, bLostSteps?"lost steps":"stalled");
+        fflush(Logfile);
+#endif
+        abortCurrentCommand();
+        m_bDomeIsMoving = false;
+        pCandidate->bStalled = true;
+        endTuningCandidate(false);
+    }
+    else if(bSlewDone) {
+        m_bDomeIsMoving = false;
+        pCandidate->dSlewSeconds += m_tuningSlewTimer.GetElapsedSeconds();
+        if(m_nTuningOvershoot > nTolerance)
+            endTuningCandidate(false);
+        else if(++m_Tuning.nSlew == TUNING_NB_SLEWS)
+            endTuningCandidate(true);
+        else if((nErr = sendTuningSlew()))
+            abortRotationTuning();
+    }
+
+    bComplete = (m_Tuning.nState != TUNING_RUNNING);
+    return nErr;
+}
+
+void CNexDomeV3::endTuningCandidate(bool bStable)
+{
+    int nErr;
+    int i;
+    TuningCandidate *pCandidate = &m_Tuning.candidates[m_Tuning.nCurrent];
+
+    pCandidate->bTested = true;
+    pCandidate->bStable = bStable;
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    ltime = time(NULL);
+    timestamp = asctime(localtime(&ltime));
+    timestamp[strlen(timestamp) - 1] = 0;
+    fprintf(Logfile, "[%s] [CNexDomeV3::endTuningCandidate] speed = %d, acceleration = %d, slews = %3.2f s, overshoot = %d steps, stable = %s\n", timestamp,
+            pCandidate->nSpeed, pCandidate->nAcceleration, pCandidate->dSlewSeconds, pCandidate->nOvershoot, bStable?"Yes":"No");
+    fflush(Logfile);
+#endif
+
+    if(!bStable) {
+        for(i = m_Tuning.nCurrent + 1; i < m_Tuning.nCandidates; i++) {
+            if(m_Tuning.candidates[i].nSpeed >= pCandidate->nSpeed && m_Tuning.candidates[i].nAcceleration >= pCandidate->nAcceleration)
+                m_Tuning.candidates[i].bTested = true;
+        }
+    }
+    m_Tuning.nCurrent++;
+    nErr = startTuningCandidate();
+    if(nErr)
+        abortRotationTuning();
+}
+
+void CNexDomeV3::finishRotationTuning()
+{
+    int i;
+
+    for(i = 0; i < m_Tuning.nCandidates; i++) {
+        if(!m_Tuning.candidates[i].bStable)
+            continue;
+        if(m_Tuning.nBest < 0 || m_Tuning.candidates[i].dSlewSeconds < m_Tuning.candidates[m_Tuning.nBest].dSlewSeconds)
+            m_Tuning.nBest = i;
+    }
+
+    if(m_Tuning.nBest >= 0 && m_bTuningApply) {
+        setRotationSpeed(m_Tuning.candidates[m_Tuning.nBest].nSpeed);
+        setRotationAcceleration(m_Tuning.candidates[m_Tuning.nBest].nAcceleration);
+        m_Tuning.bApplied = true;
+    }
+    else {
+        setRotationSpeed(m_Tuning.nOriginalSpeed);
+        setRotationAcceleration(m_Tuning.nOriginalAcceleration);
+    }
+    m_bDomeIsMoving = false;
+    m_Tuning.nCurrent = m_Tuning.nCandidates;
+    m_Tuning.nState = m_Tuning.nBest >= 0 ? TUNING_DONE : TUNING_FAILED;
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    ltime = time(NULL);
+    timestamp = asctime(localtime(&ltime));
+    timestamp[strlen(timestamp) - 1] = 0;
+    if(m_Tuning.nBest >= 0)
+        fprintf(Logfile, "[%s] [CNexDomeV3::finishRotationTuning] best speed = %d, acceleration = %d, applied = %s\n", timestamp,
+                m_Tuning.candidates[m_Tuning.nBest].nSpeed, m_Tuning.candidates[m_Tuning.nBest].nAcceleration, m_Tuning.bApplied?"Yes":"No");
+    else
+        fprintf(Logfile, "[%s] [CNexDomeV3::finishRotationTuning] no stable candidate\n", timestamp);
+    fflush(Logfile);
+#endif
+}
+
+void CNexDomeV3::abortRotationTuning()
+{
+    if(m_Tuning.nState != TUNING_RUNNING)
+        return;
+    if(m_bDomeIsMoving)
+        abortCurrentCommand();
+    m_bDomeIsMoving = false;
+    setRotationSpeed(m_Tuning.nOriginalSpeed);
+    setRotationAcceleration(m_Tuning.nOriginalAcceleration);
+    m_Tuning.nState = TUNING_IDLE;
+}
+
+
+#pragma mark - Following
+
+int CNexDomeV3::startFollowing(double dRa, double dDec, int nOtaSide, double dLst, double dHours)
+{
+    FollowConfig config = m_FollowPlanner.getConfig();
+    std::vector<double> dTargetAz;
+    std::vector<double> dSlitAlt;
+    double dDomeAz;
+    double dAlt;
+    int nCount;
+    int nTmp;
+
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+
+    if(!m_nNbStepPerRev)
+        getDomeStepPerRev(nTmp);
+    if(!m_RotatorScale.isValid() || !m_Geometry.azimuthFromHaDec(dLst - dRa, dDec, nOtaSide, dDomeAz, dAlt))
+        return ERR_CMDFAILED;
+
+    // moves inside the dead zone aren't done by the controller
+    config.dDomeRadius = m_Geometry.getConfig().dDomeRadius;
+    config.dDeadZone = m_RotatorScale.toDegrees(m_nRotationDeadZone);
+    m_FollowPlanner.setConfig(config);
+
+    nCount = int(dHours * 3600.0 / FOLLOW_STEP_SECONDS) + 1;
+    dTargetAz.resize(nCount);
+    dSlitAlt.resize(nCount);
+    m_Geometry.trajectory(dRa, dDec, nOtaSide, dLst, FOLLOW_STEP_SECONDS, nCount, &dTargetAz[0], &dSlitAlt[0]);
+    m_FollowPlanner.plan(&dTargetAz[0], &dSlitAlt[0], nCount, FOLLOW_STEP_SECONDS, m_dCurrentAzPosition, m_followMoves);
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    ltime = time(NULL);
+    timestamp = asctime(localtime(&ltime));
+    timestamp[strlen(timestamp) - 1] = 0;
+    fprintf(Logfile, "[%s] [CNexDomeV3::startFollowing] RA %3.3f Dec %3.3f side %d, %d moves over %3.1f hours\n", timestamp, dRa, dDec, nOtaSide, int(m_followMoves.size()), dHours);
+    fflush(Logfile);
+#endif
+
+    m_nFollowNext = 0;
+    m_dFollowEnd = (nCount - 1) * FOLLOW_STEP_SECONDS;
+    m_dFollowRa = dRa;
+    m_dFollowDec = dDec;
+    m_bFollowing = true;
+    m_followTimer.Reset();
+    return PLUGIN_OK;
+}
+
+int CNexDomeV3::updateFollowing(bool &bFollowing)
+{
+    int nErr = PLUGIN_OK;
+    double dElapsed;
+    int nDue;
+
+    bFollowing = false;
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+    if(!m_bFollowing)
+        return nErr;
+
+    bFollowing = true;
+    // the next move waits for the current one
+    if(isDomeMoving())
+        return nErr;
+
+    dElapsed = m_followTimer.GetElapsedSeconds();
+    // if we're late only the last due move matters
+    nDue = m_nFollowNext;
+    while(nDue < int(m_followMoves.size()) && m_followMoves[nDue].dTime <= dElapsed)
+        nDue++;
+    if(nDue > m_nFollowNext) {
+        m_nFollowNext = nDue;
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        ltime = time(NULL);
+        timestamp = asctime(localtime(&ltime));
+        timestamp[strlen(timestamp) - 1] = 0;
+        fprintf(Logfile, "[%s] [CNexDomeV3::updateFollowing] move %d at %3.1f s to %3.2f, slit alt %3.2f\n", timestamp, nDue - 1, dElapsed, m_followMoves[nDue - 1].dAz, m_followMoves[nDue - 1].dSlitAlt);
+        fflush(Logfile);
+#endif
+        nErr = gotoAzimuth(m_followMoves[nDue - 1].dAz, m_followMoves[nDue - 1].dSlitAlt);
+    }
+
+    if(dElapsed >= m_dFollowEnd) {
+        m_bFollowing = false;
+        bFollowing = false;
+    }
+    return nErr;
+}
+
+int CNexDomeV3::slaveToAltAz(double dAlt, double dAz)
+{
+    int nErr;
+    double dHa, dDec, dRa, dLst;
+    int nOtaSide = OTA_NO_OFFSET;
+    bool bFollowing;
+
+    m_Geometry.haDecFromAltAz(dAlt, dAz, dHa, dDec);
+    dLst = CDomeGeometry::localSiderealTime(double(time(NULL)), m_Geometry.getConfig().dLongitude);
+    dRa = fmod(dLst - dHa + 360.0, 360.0);
+    if(m_Geometry.getConfig().dOtaOffset != 0)
+        nOtaSide = dHa < 0 ? OTA_WEST_OF_PIER : OTA_EAST_OF_PIER;
+
+    if(m_bFollowing && fabs(CDomeFollowPlanner::azDistance(m_dFollowRa, dRa)) < FOLLOW_SAME_TARGET && fabs(m_dFollowDec - dDec) < FOLLOW_SAME_TARGET)
+        return PLUGIN_OK;   // already in the plan
+
+    if(fabs(CDomeFollowPlanner::azDistance(m_dSlaveRa, dRa)) < FOLLOW_SAME_TARGET && fabs(m_dSlaveDec - dDec) < FOLLOW_SAME_TARGET) {
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        ltime = time(NULL);
+        timestamp = asctime(localtime(&ltime));
+        timestamp[strlen(timestamp) - 1] = 0;
+        fprintf(Logfile, "[%s] [CNexDomeV3::slaveToAltAz] tracking RA %3.3f Dec %3.3f, following\n", timestamp, dRa, dDec);
+        fflush(Logfile);
+#endif
+        nErr = startFollowing(dRa, dDec, nOtaSide, dLst);
+        if(!nErr)
+            return updateFollowing(bFollowing);
+    }
+
+    m_dSlaveRa = dRa;
+    m_dSlaveDec = dDec;
+    m_bFollowing = false;
+    return gotoAltAz(dAlt, dAz);
+}
+
+
+#pragma mark - Getter / Setter
+
+int CNexDomeV3::getNbTicksPerRev()
+{
+#ifdef PLUGIN_DEBUG
+    ltime = time(NULL);
+    timestamp = asctime(localtime(&ltime));
+    timestamp[strlen(timestamp) - 1] = 0;
+    fprintf(Logfile, "[%s] [CNexDomeV3::getNbTicksPerRev] m_bIsConnected = %s\n", timestamp, m_bIsConnected?"True":"False");
+    fflush(Logfile);
+#endif
+
+    if(m_bIsConnected)
+        getDomeStepPerRev(m_nNbStepPerRev);
+
+#ifdef PLUGIN_DEBUG
+    ltime = time(NULL);
+    timestamp = asctime(localtime(&ltime));
+    timestamp[strlen(timestamp) - 1] = 0;
+    fprintf(Logfile, "[%s] [CNexDomeV3::getNbTicksPerRev] m_nNbStepPerRev = %d\n", timestamp, m_nNbStepPerRev);
+    fflush(Logfile);
+#endif
+
+    return m_nNbStepPerRev;
+}
+
+int CNexDomeV3::setNbTicksPerRev(int nSteps)
+{
+    int nErr = PLUGIN_OK;
+
+    if(m_bIsConnected)
+        nErr = setDomeStepPerRev(nSteps);
+    return nErr;
+}
+
+double CNexDomeV3::getHomeAz()
+{
+    if(m_bIsConnected)
+        getDomeHomeAz(m_dHomeAz);
+    return m_dHomeAz;
+}
+
+int CNexDomeV3::setHomeAz(double dAz)
+{
+    int nErr = PLUGIN_OK;
+    char szBuf[SERIAL_BUFFER_SIZE];
+    char szResp[SERIAL_BUFFER_SIZE];
+    int nTmp;
+    
+    m_dHomeAz = dAz;
+
+    #ifdef PLUGIN_DEBUG
+        ltime = time(NULL);
+        timestamp = asctime(localtime(&ltime));
+        timestamp[strlen(timestamp) - 1] = 0;
+        fprintf(Logfile, "[%s] [CNexDomeV3::setHomeAz] m_dHomeAz = %3.2f\n", timestamp, m_dHomeAz);
+        fflush(Logfile);
+    #endif
+
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+    nTmp = m_RotatorScale.toSteps(dAz);
+    m_nHomeStepPos = nTmp;
+    m_bHasBeenHomed = false;    // counting from the old home position until the next home
+    #ifdef PLUGIN_DEBUG
+        ltime = time(NULL);
+        timestamp = asctime(localtime(&ltime));
+        timestamp[strlen(timestamp) - 1] = 0;
+        fprintf(Logfile, "[%s] [CNexDomeV3::setHomeAz] nTmp = %d\n", timestamp, nTmp);
+        fflush(Logfile);
+    #endif
+
+    snprintf(szBuf, SERIAL_BUFFER_SIZE, "@HWR,%d\r\n", nTmp);
+    nErr = domeCommand(szBuf, szResp, SERIAL_BUFFER_SIZE);
+    return nErr;
+}
+
+double CNexDomeV3::getParkAz()
+{
+    return m_dParkAz;
+}
+
+int CNexDomeV3::setParkAz(double dAz)
+{
+    m_dParkAz = dAz;
+    return PLUGIN_OK;
+}
+
+void CNexDomeV3::setShutterPresent(bool bPresent)
+{
+    
+    m_bShutterPresent = bPresent;
+    
+}
+
+int CNexDomeV3::getShutterStepsRange()
 {
 	if(m_bIsConnected)
 		getShutterSteps(m_nShutterSteps);
@@ -2365,6 +3872,52 @@ double CNexDomeV3::getCurrentAz()
     return m_dCurrentAzPosition;
 }
 
+bool CNexDomeV3::getCachedAzEl(double &dAz, double &dEl, double dMaxAge)
+{
+    double dCacheTime;
+
+    dCacheTime = m_dCacheTime.load(std::memory_order_acquire);
+    if(dCacheTime == 0 || CStopWatch::GetMonotonicSeconds() - dCacheTime > dMaxAge)
+        return false;
+    // az and el are read separately, they can be one update apart.
+    dAz = m_dCachedAz.load(std::memory_order_relaxed);
+    dEl = m_dCachedEl.load(std::memory_order_relaxed);
+    m_Metrics.countCachedRead();
+    return true;
+}
+
+bool CNexDomeV3::getCachedFirmwareVersion(char *szVersion, int nStrMaxLen)
+{
+    char szCopy[SERIAL_BUFFER_SIZE];
+    unsigned int nSeq;
+
+    // seqlock, the drain thread can rewrite the version (reconnect) while we copy it.
+    do {
+        nSeq = m_nFirmwareSeq.load(std::memory_order_acquire);
+        if(!m_bFirmwareCached.load(std::memory_order_acquire))
+            return false;
+        memcpy(szCopy, m_szFirmwareVersion, SERIAL_BUFFER_SIZE);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while((nSeq & 1) || nSeq != m_nFirmwareSeq.load(std::memory_order_relaxed));
+
+    strncpy(szVersion, szCopy, nStrMaxLen);
+    szVersion[nStrMaxLen - 1] = 0;
+    m_Metrics.countCachedRead();
+    return true;
+}
+
+// single writer, always called with the I/O mutex held
+void CNexDomeV3::publishFirmwareVersion(const char *szVersion)
+{
+    unsigned int nSeq = m_nFirmwareSeq.load(std::memory_order_relaxed);
+
+    m_nFirmwareSeq.store(nSeq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    strncpy(m_szFirmwareVersion, szVersion, SERIAL_BUFFER_SIZE);
+    m_szFirmwareVersion[SERIAL_BUFFER_SIZE - 1] = 0;
+    m_nFirmwareSeq.store(nSeq + 2, std::memory_order_release);
+}
+
 double CNexDomeV3::getCurrentEl()
 {
     if(m_bIsConnected)
@@ -2398,21 +3951,11 @@ int CNexDomeV3::getRotationSpeed(int &nSpeed)
 {
     int nErr = PLUGIN_OK;
     char szResp[SERIAL_BUFFER_SIZE];
-    char szBuf[SERIAL_BUFFER_SIZE];
-    int nb_timeout;
     
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    nErr = domeCommand("@VRR\r\n", szResp, SERIAL_BUFFER_SIZE);
-
-    nb_timeout = 0;
-    memcpy(szBuf, szResp, SERIAL_BUFFER_SIZE);
-    while(!strstr(szBuf, "VRR") && nb_timeout < CMD_RESP_READ_TIMEOUTS) {
-        readResponse(szBuf, SERIAL_BUFFER_SIZE);
-        nErr = processResponse(szBuf, szResp, SERIAL_BUFFER_SIZE);
-        nb_timeout++;
-    }
+    nErr = domeCommand("@VRR\r\n", szResp, SERIAL_BUFFER_SIZE, "VRR");
 
     if(nErr == CMD_PROC_DONE)
         nErr = PLUGIN_OK;
@@ -2422,11 +3965,6 @@ int CNexDomeV3::getRotationSpeed(int &nSpeed)
         return PLUGIN_OK;
     }
     
-    if(nb_timeout >= CMD_RESP_READ_TIMEOUTS) {
-        nSpeed = 0;
-        return PLUGIN_OK;
-    }
-
     // need to parse
     nSpeed = atoi(szResp+3);
 #ifdef PLUGIN_DEBUG
@@ -2459,21 +3997,11 @@ int CNexDomeV3::getRotationAcceleration(int &nAcceleration)
 {
     int nErr = PLUGIN_OK;
     char szResp[SERIAL_BUFFER_SIZE];
-    char szBuf[SERIAL_BUFFER_SIZE];
-    int nb_timeout;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    nErr = domeCommand("@ARR\r\n", szResp, SERIAL_BUFFER_SIZE);
-
-    nb_timeout = 0;
-    memcpy(szBuf, szResp, SERIAL_BUFFER_SIZE);
-    while(!strstr(szBuf, "ARR") && nb_timeout < CMD_RESP_READ_TIMEOUTS) {
-        readResponse(szBuf, SERIAL_BUFFER_SIZE);
-        nErr = processResponse(szBuf, szResp, SERIAL_BUFFER_SIZE);
-        nb_timeout++;
-    }
+    nErr = domeCommand("@ARR\r\n", szResp, SERIAL_BUFFER_SIZE, "ARR");
 
     if(nErr == CMD_PROC_DONE)
         nErr = PLUGIN_OK;
@@ -2483,11 +4011,6 @@ int CNexDomeV3::getRotationAcceleration(int &nAcceleration)
         return PLUGIN_OK;
     }
     
-    if(nb_timeout >= CMD_RESP_READ_TIMEOUTS) {
-        nAcceleration = 0;
-        return PLUGIN_OK;
-    }
-
     nAcceleration = atoi(szResp+3);
 #ifdef PLUGIN_DEBUG
     ltime = time(NULL);
@@ -2519,8 +4042,6 @@ int CNexDomeV3::getShutterSpeed(int &nSpeed)
 {
     int nErr = PLUGIN_OK;
     char szResp[SERIAL_BUFFER_SIZE];
-    char szBuf[SERIAL_BUFFER_SIZE];
-    int nb_timeout;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -2530,15 +4051,7 @@ int CNexDomeV3::getShutterSpeed(int &nSpeed)
         return nErr;
     }
 
-    nErr = domeCommand("@VRS\r\n", szResp, SERIAL_BUFFER_SIZE);
-
-    nb_timeout = 0;
-    memcpy(szBuf, szResp, SERIAL_BUFFER_SIZE);
-    while(!strstr(szBuf, "VRS") && nb_timeout < CMD_RESP_READ_TIMEOUTS) {
-        readResponse(szBuf, SERIAL_BUFFER_SIZE);
-        nErr = processResponse(szBuf, szResp, SERIAL_BUFFER_SIZE);
-        nb_timeout++;
-    }
+    nErr = domeCommand("@VRS\r\n", szResp, SERIAL_BUFFER_SIZE, "VRS");
 
     if(nErr == CMD_PROC_DONE)
         nErr = PLUGIN_OK;
@@ -2548,11 +4061,6 @@ int CNexDomeV3::getShutterSpeed(int &nSpeed)
         return PLUGIN_OK;
     }
     
-    if(nb_timeout >= CMD_RESP_READ_TIMEOUTS) {
-        nSpeed = 0;
-        return PLUGIN_OK;
-    }
-
     nSpeed = atoi(szResp+3);
 #ifdef PLUGIN_DEBUG
     ltime = time(NULL);
@@ -2588,8 +4096,6 @@ int CNexDomeV3::getShutterAcceleration(int &nAcceleration)
 {
     int nErr = PLUGIN_OK;
     char szResp[SERIAL_BUFFER_SIZE];
-    char szBuf[SERIAL_BUFFER_SIZE];
-    int nb_timeout;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -2599,15 +4105,7 @@ int CNexDomeV3::getShutterAcceleration(int &nAcceleration)
         return nErr;
     }
 
-    nErr = domeCommand("@ARS\r\n", szResp, SERIAL_BUFFER_SIZE);
-
-    nb_timeout = 0;
-    memcpy(szBuf, szResp, SERIAL_BUFFER_SIZE);
-    while(!strstr(szBuf, "ARS") && nb_timeout < CMD_RESP_READ_TIMEOUTS) {
-        readResponse(szBuf, SERIAL_BUFFER_SIZE);
-        nErr = processResponse(szBuf, szResp, SERIAL_BUFFER_SIZE);
-        nb_timeout++;
-    }
+    nErr = domeCommand("@ARS\r\n", szResp, SERIAL_BUFFER_SIZE, "ARS");
 
     if(nErr == CMD_PROC_DONE)
         nErr = PLUGIN_OK;
@@ -2617,11 +4115,6 @@ int CNexDomeV3::getShutterAcceleration(int &nAcceleration)
         return PLUGIN_OK;
     }
     
-    if(nb_timeout >= CMD_RESP_READ_TIMEOUTS) {
-        nAcceleration = 0;
-        return PLUGIN_OK;
-    }
-
     nAcceleration = atoi(szResp+3);
 #ifdef PLUGIN_DEBUG
     ltime = time(NULL);
@@ -2741,6 +4234,194 @@ void CNexDomeV3::getRainStatusFileName(std::string &fName)
     fName.assign(m_sRainStatusfilePath);
 }
 
+int CNexDomeV3::enableTelemetry(bool bEnable, const char *pszName)
+{
+    int nErr = PLUGIN_OK;
+
+    if(!bEnable) {
+        m_Telemetry.close();
+        return nErr;
+    }
+
+    if(m_Telemetry.open(pszName) != TELEMETRY_OK) {
+#ifdef PLUGIN_DEBUG
+        ltime = time(NULL);
+        timestamp = asctime(localtime(&ltime));
+        timestamp[strlen(timestamp) - 1] = 0;
+        fprintf(Logfile, "[%s] [CNexDomeV3::enableTelemetry] Error opening shared memory segment '%s'\n", timestamp, pszName);
+        fflush(Logfile);
+#endif
+        return COMMAND_FAILED;
+    }
+    publishTelemetry();
+    return nErr;
+}
+
+int CNexDomeV3::enableRecorder(bool bEnable)
+{
+    int nErr = PLUGIN_OK;
+
+    if(!bEnable) {
+        m_Recorder.close();
+        return nErr;
+    }
+
+    if(m_Recorder.open(m_sRecorderfilePath.c_str()) != RECORDER_OK) {
+#ifdef PLUGIN_DEBUG
+        ltime = time(NULL);
+        timestamp = asctime(localtime(&ltime));
+        timestamp[strlen(timestamp) - 1] = 0;
+        fprintf(Logfile, "[%s] [CNexDomeV3::enableRecorder] Error opening recorder file '%s'\n", timestamp, m_sRecorderfilePath.c_str());
+        fflush(Logfile);
+#endif
+        return COMMAND_FAILED;
+    }
+    memset(&m_lastRecordSample, 0, sizeof(DomeRecordSample));
+    publishTelemetry();
+    return nErr;
+}
+
+void CNexDomeV3::getRecorderFileName(std::string &fName)
+{
+    fName.assign(m_sRecorderfilePath);
+}
+
+void CNexDomeV3::publishTelemetry()
+{
+    DomeTelemetryData telemetryData;
+    DomeRecordSample recordSample;
+    BatteryStats batteryStats;
+    double dNow;
+
+    updateStateCache();
+
+    if(!m_Telemetry.isOpen() && !m_Recorder.isOpen() && !m_Metrics.isExporting())
+        return;
+
+    dNow = getUnixTime();
+
+    if(m_Recorder.isOpen() && m_bIsConnected) {
+        recordSample.dTime = dNow;
+        recordSample.nAzSteps = m_nCurrentRotatorPos;
+        recordSample.nElSteps = m_nCurrentShutterPos;
+        recordSample.fVolts = m_bShutterPresent ? float(m_dShutterVolts) : -1.0f;
+        recordSample.fCmdLatencyMs = m_fLastCmdLatencyMs;
+        recordSample.nShutterState = (uint8_t)m_nShutterState;
+        recordSample.nRain = (uint8_t)m_nIsRaining;
+        // this is called for every response, only keep the samples that carry something new
+        if(recordSample.fCmdLatencyMs != 0
+           || recordSample.nAzSteps != m_lastRecordSample.nAzSteps
+           || recordSample.nElSteps != m_lastRecordSample.nElSteps
+           || recordSample.fVolts != m_lastRecordSample.fVolts
+           || recordSample.nShutterState != m_lastRecordSample.nShutterState
+           || recordSample.nRain != m_lastRecordSample.nRain
+           || m_recordHeartbeatTimer.GetElapsedSeconds() >= RECORDER_HEARTBEAT) {
+            m_Recorder.append(recordSample);
+            m_recordHeartbeatTimer.Reset();
+            m_lastRecordSample = recordSample;
+            m_fLastCmdLatencyMs = 0;
+        }
+    }
+
+    if(!m_Telemetry.isOpen() && !m_Metrics.isExporting())
+        return;
+
+    memset(&telemetryData, 0, sizeof(DomeTelemetryData));
+    telemetryData.dUpdateTime = dNow;
+    telemetryData.dAz = m_dCurrentAzPosition;
+    telemetryData.dEl = m_dCurrentElPosition;
+    telemetryData.dShutterVolts = m_bShutterPresent ? m_dShutterVolts : -1.0;
+    telemetryData.nRotatorPos = m_nCurrentRotatorPos;
+    telemetryData.nShutterPos = m_nCurrentShutterPos;
+    telemetryData.nStepsPerRev = m_nNbStepPerRev;
+    telemetryData.nShutterState = m_nShutterState;
+    telemetryData.nRainStatus = m_nIsRaining;
+    telemetryData.bConnected = m_bIsConnected;
+    telemetryData.bMoving = m_bDomeIsMoving || m_bShutterIsMoving;
+    telemetryData.bParked = m_bParked;
+    telemetryData.bShutterPresent = m_bShutterPresent;
+    m_BatteryMonitor.getStats(batteryStats);
+    telemetryData.nBatteryCyclesLeft = batteryStats.nCyclesLeft;
+    telemetryData.fBatteryHoursLeft = float(batteryStats.dHoursToCutoff);
+    m_Telemetry.publish(telemetryData);
+    m_Metrics.exportIfDue(telemetryData);
+}
+
+// called with the I/O mutex held, every time we've processed something from the controller
+void CNexDomeV3::updateStateCache()
+{
+    if(!m_bIsConnected) {
+        m_dCacheTime.store(0, std::memory_order_release);
+        return;
+    }
+    m_dCachedAz.store(m_dCurrentAzPosition, std::memory_order_relaxed);
+    m_dCachedEl.store(m_dCurrentElPosition, std::memory_order_relaxed);
+    m_dCacheTime.store(CStopWatch::GetMonotonicSeconds(), std::memory_order_release);
+}
+
+void CNexDomeV3::startMotionMetric(int nDuration)
+{
+    m_nMotionMetric = nDuration;
+    m_motionTimer.Reset();
+}
+
+void CNexDomeV3::endMotionMetric()
+{
+    if(m_nMotionMetric < 0)
+        return;
+    m_Metrics.observeDuration(m_nMotionMetric, m_motionTimer.GetElapsedSeconds());
+    m_nMotionMetric = -1;
+}
+
+// the :SES at the end of an open or a close
+void CNexDomeV3::endShutterMove()
+{
+    if(!m_bShutterIsMoving)
+        return;
+    m_bShutterIsMoving = false;
+    m_Metrics.observeDuration(DURATION_SHUTTER, m_shutterTimer.GetElapsedSeconds());
+}
+
+// The :SER came in somewhere between the last poll that saw the dome moving and this one, take the middle.
+void CNexDomeV3::learnSlew()
+{
+    double dSeconds;
+
+    if(!m_nSlewSteps)
+        return;
+    dSeconds = (m_dSlewLastPoll + m_slewTimer.GetElapsedSeconds()) / 2.0;
+    m_SlewModel.addSlew(m_nSlewSteps, dSeconds);
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    ltime = time(NULL);
+    timestamp = asctime(localtime(&ltime));
+    timestamp[strlen(timestamp) - 1] = 0;
+    fprintf(Logfile, "[%s] [CNexDomeV3::learnSlew] %d steps in %3.3f s\n", timestamp, m_nSlewSteps, dSeconds);
+    fflush(Logfile);
+#endif
+    m_nSlewSteps = 0;
+}
+
+int CNexDomeV3::getSlewPollHint()
+{
+    double dPredicted;
+    double dSigma;
+    double dRemaining;
+
+    if(!m_bDomeIsMoving || !m_nSlewSteps || !m_SlewModel.predict(m_nSlewSteps, dPredicted, dSigma))
+        return -1;
+    // a little early, then SLEW_POLL_MIN_MS until it's over
+    dRemaining = dPredicted - dSigma - m_slewTimer.GetElapsedSeconds();
+    if(dRemaining * 1000.0 < SLEW_POLL_MIN_MS)
+        return SLEW_POLL_MIN_MS;
+    return int(dRemaining * 1000.0);
+}
+
+// wall clock, only for dating samples. Intervals are measured with CStopWatch.
+double CNexDomeV3::getUnixTime()
+{
+    return std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
 void CNexDomeV3::writeRainStatus()
 {
 #ifdef PLUGIN_DEBUG
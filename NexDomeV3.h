@@ -15,6 +15,7 @@
 #include <math.h>
 #include <string.h>
 #include <time.h>
+#include <limits.h>
 #include <ctype.h>
 #ifdef SB_MAC_BUILD
 #include <unistd.h>
@@ -24,6 +25,8 @@
 #include <vector>
 #include <sstream>
 #include <iostream>
+#include <atomic>
+#include <algorithm>
 
 // SB includes
 #include "../../licensedinterfaces/sberrorx.h"
@@ -32,6 +35,16 @@
 #include "../../licensedinterfaces/loggerinterface.h"
 
 #include "StopWatch.h"
+#include "DomeTelemetry.h"
+#include "DomeRecorder.h"
+#include "BatteryMonitor.h"
+#include "DomeMetrics.h"
+#include "DomeTrace.h"
+#include "ResponseParser.h"
+#include "StepModel.h"
+#include "SlewModel.h"
+#include "DomeGeometry.h"
+#include "DomeFollow.h"
 
 #define DRIVER_VERSION      1.6
 
@@ -40,10 +53,59 @@
 #define PLUGIN_LOG_BUFFER_SIZE 256
 
 #define CMD_WAIT_INTERVAL	50
-#define CMD_RESP_READ_TIMEOUTS  8
 
 #define RAIN_CHECK_INTERVAL 10
 
+#define ABORT_RECONCILE_TIMEOUT 30  // seconds, after that a :SER is not considered the end of the abort anymore
+
+#define RECORDER_HEARTBEAT  10.0    // seconds between samples when nothing changes
+#define STATE_CACHE_MAX_AGE 1.0     // seconds a cached position can be returned without talking to the controller
+
+// degrees, turned into steps with the rotator scale
+#define GOTO_TOLERANCE          3.0     // goto and park are complete within this of the target
+#define AT_HOME_TOLERANCE       1.0     // the :SER at home flag is only trusted this close to the home position
+#define GOTO_SAME_POSITION      0.5     // a goto closer than this isn't sent
+
+// steps per revolution calibration
+#define CALIBRATION_REVOLUTIONS     3       // per direction
+#define CALIBRATION_DEFAULT_GUESS   55080   // when the controller has no value yet
+#define CALIBRATION_MOVE_TIMEOUT    120     // seconds without reaching the end of a move
+#define CALIBRATION_MAX_UNCERTAINTY 0.001   // fraction of a revolution, above that the result isn't written
+
+// rotation speed / acceleration tuning
+#define TUNING_MAX_CANDIDATES   12
+#define TUNING_STALL_TIMEOUT    3.0     // seconds without the position changing during a test slew
+#define TUNING_MOVE_TIMEOUT     120     // seconds for one test slew
+
+// slew duration model
+#define SLEW_POLL_MIN_MS        20      // shortest poll hint, once the move should be over
+
+// home re-sync on the home sensor crossings during gotos
+#define HOME_RESYNC_MIN_DRIFT   0.05    // degrees, less isn't worth a correction
+#define HOME_RESYNC_MAX_DRIFT   2.0     // degrees, more is a bad report rather than drift. Below GOTO_TOLERANCE.
+#define HOME_EDGE_UNKNOWN       INT_MIN // not learned yet
+#define HOME_CROSSING_SETTLE    1.0     // seconds without a P line after an at home :SER, it was the end of the move
+
+// unsolicited traffic is drained on a fixed cadence by the host (X2 thread or daemon loop)
+#define ASYNC_DRAIN_INTERVAL    100     // ms
+
+// link watchdog, run from drainAsync
+#define LINK_MAX_FAILURES       3       // failed exchanges in a row before the link is declared dead
+#define LINK_SILENCE_PROBE      10.0    // seconds without a byte from the controller before it's probed
+#define LINK_RETRY_INTERVAL     2.0     // seconds between two attempts at reopening the port
+#define LINK_BOOT_DELAY         2.0     // seconds, the arduino restarts when the port is opened
+#define LINK_MAX_OUTAGE         120.0   // seconds, a move waiting on the link longer than this has failed
+
+// a P line further from the previous one than this times the step before is a gap in the stream
+#define SEQ_GAP_RATIO           1.8
+#define SEQ_GAP_MIN_STEPS       8       // steps per line, below that the dome is still accelerating
+#define SEQ_GAP_IDLE            1.0     // seconds without a P line, the next one starts a new move
+
+// following a target
+#define FOLLOW_STEP_SECONDS     10.0    // path sampling
+#define FOLLOW_DEFAULT_HOURS    2.0     // planned ahead, start again after that
+#define FOLLOW_SAME_TARGET      0.05    // degrees, slaving requests this close are the same RA/Dec
+
 // #define PLUGIN_DEBUG 2
 
 // error codes
@@ -54,6 +116,92 @@ enum HomeStatuses {NEVER_HOMED = 0, HOMED, ATHOME};
 // RG-11
 enum RainSensorStates {RAINING= 0, NOT_RAINING};
 
+// each command belongs to a class with its own reply deadline and retry policy
+enum CommandClasses {CMD_CLASS_QUERY = 0, CMD_CLASS_INFO, CMD_CLASS_SETTING, CMD_CLASS_MOTION, CMD_CLASS_EEPROM, CMD_CLASS_COUNT};
+
+enum CalibrationStates {CALIBRATION_IDLE = 0, CALIBRATION_RUNNING, CALIBRATION_DONE, CALIBRATION_FAILED};
+
+typedef struct {
+    int     nState;             // CalibrationStates
+    int     nStepsPerRev;       // estimate, 0 until done
+    double  dStdDev;            // steps, spread of the single revolution measurements
+    double  dUncertainty;       // steps, 95% interval on the estimate
+    int     nSamples;           // revolutions measured, both directions
+    int     nDetections;        // home sensor detections so far
+    int     nHysteresis;        // steps between the home detection point going up and going down
+    bool    bWritten;           // sent to the controller with @RWR
+} StepsPerRevCalibration;
+
+enum TuningStates {TUNING_IDLE = 0, TUNING_RUNNING, TUNING_DONE, TUNING_FAILED};
+
+typedef struct {
+    int     nSpeed;
+    int     nAcceleration;
+    bool    bTested;
+    bool    bStable;            // no stall, no overshoot, every test slew ended on target
+    bool    bStalled;
+    int     nOvershoot;         // steps, worst one past the target
+    double  dSlewSeconds;       // all the test slews, command to :SER
+} TuningCandidate;
+
+typedef struct {
+    int     nState;             // TuningStates
+    int     nCandidates;
+    int     nCurrent;           // candidate being tested
+    int     nSlew;              // test slew of that candidate
+    int     nBest;              // fastest stable candidate, -1 if none
+    int     nOriginalSpeed;
+    int     nOriginalAcceleration;
+    bool    bApplied;           // best one left in the controller, otherwise the original settings are back
+    TuningCandidate candidates[TUNING_MAX_CANDIDATES];
+} RotationTuning;
+
+typedef struct {
+    int     nCrossings;     // home sensor crossed during a goto
+    int     nMeasured;      // crossings with a reference edge for the direction, the others set it
+    int     nResyncs;       // step counter corrected
+    int     nRejected;      // drift above HOME_RESYNC_MAX_DRIFT, not corrected
+    int     nLastDrift;     // steps, counter minus where it should have been
+    int     nMaxDrift;      // largest |drift|
+    double  dMeanAbsDrift;  // steps
+} HomeDriftStats;
+
+enum LinkStates {LINK_UP = 0, LINK_DOWN, LINK_BOOTING};
+
+typedef struct {
+    int     nState;             // LinkStates
+    int     nOutages;
+    int     nReopens;           // attempts at reopening the port, all outages
+    double  dLastOutage;        // seconds, the last one that ended
+    double  dTotalOutage;       // seconds, ended ones
+    double  dCurrentOutage;     // seconds, 0 when up
+} LinkStats;
+
+// what was going on when the link died, done again once it's back
+typedef struct {
+    bool    bParked;
+    bool    bParking;
+    bool    bUnParking;
+    bool    bGoto;
+    double  dGotoAz;
+    double  dGotoSlitAlt;
+    int     nShutterCmd;        // OPENING, CLOSING or IDLE
+    bool    bRehoming;          // the count was lost during the goto, homing before doing it again
+} LinkIntent;
+
+typedef struct {
+    int     nDeadlineMs;        // whole command, retries included
+    int     nAttemptTimeoutMs;  // wait for the reply to one attempt
+    int     nMaxAttempts;       // only idempotent commands are sent more than once
+    int     nBackoffMs;         // pause before the first retry, doubled for each new retry
+} CommandPolicy;
+
+typedef struct {
+    const char  *pszVerb;
+    int         nClass;
+    bool        bIdempotent;
+} CommandVerbInfo;
+
 class CNexDomeV3
 {
 public:
@@ -71,7 +219,8 @@ public:
     int syncDome(double dAz, double dEl);
     int parkDome(void);
     int unparkDome(void);
-    int gotoAzimuth(double dNewAz);
+    // with the slit altitude the telescope needs, the goto is complete as soon as the beam clears the slit
+    int gotoAzimuth(double dNewAz, double dSlitAlt = NAN);
     int openShutter();
     int closeShutter();
     int getFirmwareVersion(char *szVersion, int nStrMaxLen);
@@ -87,6 +236,55 @@ public:
     int isFindHomeComplete(bool &bComplete);
 
     int abortCurrentCommand();
+    int getAbortLatency(double &dLastSeconds, double &dMaxSeconds);
+
+    // ms to wait before polling the current goto again, from the learned slew durations.
+    // -1 when there's no prediction (not in a goto, or not enough slews learned yet).
+    int getSlewPollHint();
+    std::string getSlewModel() { return m_SlewModel.serialize(); }
+    bool setSlewModel(const std::string &sModel) { return m_SlewModel.deserialize(sModel); }
+    int getSlewModelSamples() { return m_SlewModel.getSamples(); }
+
+    // slaving, the dome azimuth comes from where the telescope points and the observatory geometry
+    void setGeometry(const DomeGeometryConfig &config);
+    // slit width and telescope aperture in the dome radius unit, for the beam check and following
+    void setSlit(double dSlitWidth, double dAperture);
+    void getSlit(double &dSlitWidth, double &dAperture);
+    const CDomeGeometry &getGeometry() { return m_Geometry; }
+    int gotoHaDec(double dHa, double dDec, int nOtaSide);
+    int gotoAltAz(double dAlt, double dAz);
+
+    // keeps an RA/Dec in the slit with the fewest moves, planned ahead from the geometry and the slit.
+    // Call updateFollowing every few seconds, it starts the moves when they're due.
+    int startFollowing(double dRa, double dDec, int nOtaSide, double dLst, double dHours = FOLLOW_DEFAULT_HOURS);
+    int updateFollowing(bool &bFollowing);
+    void stopFollowing() { m_bFollowing = false; }
+    int getFollowMoveCount() { return int(m_followMoves.size()); }
+    // slaving from the telescope alt/az. A goto, or following once the same RA/Dec is asked twice (tracking).
+    int slaveToAltAz(double dAlt, double dAz);
+
+    // turns through the home sensor in both directions and measures the steps between detections.
+    // Call updateStepsPerRevCalibration every second or so until bComplete, like the isXxxComplete functions.
+    int startStepsPerRevCalibration(int nRevolutions = CALIBRATION_REVOLUTIONS, bool bWrite = false);
+    int updateStepsPerRevCalibration(bool &bComplete);
+    void abortStepsPerRevCalibration();
+    void getStepsPerRevCalibration(StepsPerRevCalibration &calibration) { calibration = m_Calibration; }
+
+    // times test slews at increasing speed and acceleration and keeps the fastest one that doesn't stall or overshoot.
+    // Polled the same way as the calibration, the slews are timed to the poll so call it often.
+    int startRotationTuning(bool bApply = false);
+    int updateRotationTuning(bool &bComplete);
+    void abortRotationTuning();
+    void getRotationTuning(RotationTuning &tuning) { tuning = m_Tuning; }
+
+    // the step counter is checked against the home sensor every time a goto crosses it, and corrected at
+    // the end of the goto. Only once homed since connecting, the count means nothing before.
+    // The sensor edge of each direction, in steps from the home position, is learned on the first crossing
+    // after a home and kept by the host across sessions. HOME_EDGE_UNKNOWN until then.
+    void setHomeResync(bool bEnable) { m_bHomeResync = bEnable; }
+    void setHomeEdges(int nUp, int nDown);
+    void getHomeEdges(int &nUp, int &nDown);
+    void getHomeDriftStats(HomeDriftStats &stats) { stats = m_HomeDrift; }
 
     // getter/setter
     int getNbTicksPerRev();
@@ -107,9 +305,26 @@ public:
 
     double getCurrentAz();
     double getCurrentEl();
+    // lock free, safe to call without holding the I/O mutex. false if the cache is older than dMaxAge or we're not connected
+    bool   getCachedAzEl(double &dAz, double &dEl, double dMaxAge = STATE_CACHE_MAX_AGE);
+    bool   getCachedFirmwareVersion(char *szVersion, int nStrMaxLen);
 
     int getCurrentShutterState();
     int getShutterVolts(double &dShutterVolts);
+    void getBatteryStats(BatteryStats &stats);
+    void setBatteryCutoff(double dVolts);
+
+    int  setCommandPolicy(int nClass, const CommandPolicy &policy);
+    int  getCommandPolicy(int nClass, CommandPolicy &policy);
+
+    void setMetricsInstance(int nInstance);
+    int  setMetricsFile(const char *pszPath);
+    CDomeMetrics &getMetrics() { return m_Metrics; }
+
+    // Chrome trace of the dapi calls, serial exchanges and mutex waits, empty path disables it.
+    void setTraceFile(const char *pszPath) { m_Trace.setFile(pszPath); }
+    int  dumpTrace() { return m_Trace.dump(); }
+    CDomeTrace &getTrace() { return m_Trace; }
     
     int getRainSensorStatus(int &nStatus);
 
@@ -139,13 +354,38 @@ public:
 
     void enableRainStatusFile(bool bEnable);
     void getRainStatusFileName(std::string &fName);
-    
+
+    // what the controller sent on its own (positions, :SER, :BV, rain, XBee), moving or not
+    int  drainAsync();
+
+    // with the watchdog on, drainAsync also reopens a dead link and restores what was going on
+    void enableWatchdog(bool bEnable) { m_bWatchdog = bEnable; }
+    bool isLinkRecovering(void) { return m_nLinkState != LINK_UP; }
+    void getLinkStats(LinkStats &stats);
+
+    int  enableTelemetry(bool bEnable, const char *pszName);
+    int  enableRecorder(bool bEnable);
+    void getRecorderFileName(std::string &fName);
+
 protected:
     
-	int             domeCommand(const char *cmd, char *result, int resultMaxLen);
+	int             domeCommand(const char *cmd, char *result, int resultMaxLen, const char *pszReplyToken = NULL);
+    void            getCommandClass(const char *pszCmd, int &nClass, bool &bIdempotent);
     int             readResponse(char *respBuffer, int nBufferLen, int nTimeout = MAX_TIMEOUT);
 	int				processResponse(char *szResp, char *pszResult, int nResultMaxLen);
     int             processAsyncResponses();
+    void            processRotatorReport(const char *pszResp);
+    bool            queuePositionUpdate(const char *pszResp);
+    void            applyPositionUpdates();
+    void            checkPositionSequence(int nPos);
+    void            setRotatorPosition(int nSteps);
+    int             sendCalibrationMove();
+    void            addCalibrationDetection(int nPos);
+    void            finishStepsPerRevCalibration();
+    int             startTuningCandidate();
+    int             sendTuningSlew();
+    void            endTuningCandidate(bool bStable);
+    void            finishRotationTuning();
     
     int             getDomeAz(double &dDomeAz);
     int             getDomeEl(double &dDomeEl);
@@ -159,9 +399,28 @@ protected:
     int             setShutterSteps(int &nStepPerRev);
 
     bool            isDomeMoving();
+    bool            isHomeCrossing(const char *pszResp, int &nPos);
+    void            processHomeCrossing();
+    void            applyHomeResync();
+    void            resetHomeEdges() { m_bHomeEdgeKnown[0] = m_bHomeEdgeKnown[1] = false; }
+    int             readControllerState();
+    void            publishFirmwareVersion(const char *szVersion);
+    void            linkLost();
+    int             reconnectLink();
+    void            restoreLinkIntent();
+    bool            restoreStepCount(int nLastPos);
+    int             linkOutageStatus();
+    bool            isBeamClear(int nPos);
     bool            isDomeAtHome();
     
     void            writeRainStatus();
+    void            publishTelemetry();
+    void            updateStateCache();
+    double          getUnixTime();
+    void            startMotionMetric(int nDuration);
+    void            endMotionMetric();
+    void            endShutterMove();
+    void            learnSlew();
     
     int             parseFields(const char *pszResp, std::vector<std::string> &svFields, char cSeparator);
 
@@ -177,25 +436,30 @@ protected:
     bool            m_bIsConnected;
     bool            m_bParked;
     bool            m_bShutterOpened;
-	bool			m_bDomeIsMoving;
+	bool			m_bDomeIsMoving;    // the rotator, a goto can be complete before it stops
+    bool            m_bShutterIsMoving;
     bool            m_bHasBeenHomed;
     
     int             m_nNbStepPerRev;
+    CStepScale      m_RotatorScale;     // only steps <-> degrees conversion, follows m_nNbStepPerRev
     double          m_dShutterBatteryVolts;
     double          m_dHomeAz;
+    int             m_nHomeStepPos;
     double          m_dParkAz;
     
     bool            m_bShutterPresent;
     int             m_nShutterSteps;
 	int				m_nCurrentShutterCmd;
 
-    double          m_dCurrentAzPosition;
+    double          m_dCurrentAzPosition;   // always m_RotatorScale.toDegrees(m_nCurrentRotatorPos)
     int             m_nCurrentRotatorPos;
     
     double          m_dCurrentElPosition;
     int             m_nCurrentShutterPos;
 
-    double          m_dGotoAz;
+    int             m_nGotoStepPos;
+    int             m_nGotoDir;         // 1 or -1 during a goto, 0 otherwise (homing)
+    double          m_dGotoSlitAlt;     // NAN if we don't know where the telescope points
 
     double          m_fVersion;
 
@@ -217,9 +481,117 @@ protected:
     bool            m_bSaveRainStatus;
     
 	CStopWatch		m_cmdDelayCheckTimer;
+    CommandPolicy   m_CommandPolicies[CMD_CLASS_COUNT];
+
+    // fast abort, acks and final position are reconciled from the async traffic
+    bool            m_bAbortPending;
+    bool            m_bAbortWhileMoving;
+    bool            m_bAbortAcked;
+    CStopWatch      m_abortTimer;
+    double          m_dLastAbortLatency;
+    double          m_dMaxAbortLatency;
     std::string     m_sRainStatusfilePath;
     FILE            *RainStatusfile;
 
+    CDomeTelemetry  m_Telemetry;
+
+    // time series recorder, a sample is only added on change or every RECORDER_HEARTBEAT seconds
+    CDomeRecorder   m_Recorder;
+    std::string     m_sRecorderfilePath;
+    DomeRecordSample m_lastRecordSample;
+    CStopWatch      m_recordHeartbeatTimer;
+    CStopWatch      m_cmdLatencyTimer;
+    float           m_fLastCmdLatencyMs;
+
+    CBatteryMonitor m_BatteryMonitor;
+
+    CDomeMetrics    m_Metrics;
+    int             m_nMotionMetric;    // DomeMetricsDurations of the move in progress, -1 if none
+    CStopWatch      m_motionTimer;
+    CStopWatch      m_shutterTimer;     // DURATION_SHUTTER of the open or close in progress
+
+    CSlewModel      m_SlewModel;
+    int             m_nSlewSteps;       // steps of the goto being timed, signed, 0 if none
+    double          m_dSlewLastPoll;    // seconds into it when it was last seen still moving
+    CStopWatch      m_slewTimer;
+
+    bool            m_bHomeResync;
+    int             m_nHomeEdge[2];     // steps from the home position where the sensor fires, [0] going up, [1] down
+    bool            m_bHomeEdgeKnown[2];
+    int             m_nHomeResyncDrift; // to take off the counter at the end of the goto
+    bool            m_bHomeResyncPending;
+    HomeDriftStats  m_HomeDrift;
+    bool            m_bHomeCrossingPending; // at home :SER away from the target, a crossing if the move goes on
+    int             m_nHomeCrossingPos;
+    char            m_szHomeCrossing[SERIAL_BUFFER_SIZE];
+    CStopWatch      m_homeCrossingTimer;
+
+    bool            m_bWatchdog;
+    int             m_nLinkState;
+    int             m_nLinkFailures;    // in a row
+    char            m_szPort[SERIAL_BUFFER_SIZE];
+    CStopWatch      m_linkRxTimer;      // since the last byte from the controller
+    CStopWatch      m_linkRetryTimer;
+    CStopWatch      m_outageTimer;
+    LinkIntent      m_LinkIntent;
+    LinkStats       m_LinkStats;
+
+    CDomeGeometry   m_Geometry;
+    CDomeFollowPlanner  m_FollowPlanner;
+    std::vector<FollowMove> m_followMoves;
+    int             m_nFollowNext;      // first move not started yet
+    double          m_dFollowEnd;       // seconds, end of the planned path
+    bool            m_bFollowing;
+    CStopWatch      m_followTimer;
+    double          m_dFollowRa;
+    double          m_dFollowDec;
+    double          m_dSlaveRa;         // last slaving request, NAN if none
+    double          m_dSlaveDec;
+
+    CDomeTrace      m_Trace;
+    CResponseParser m_Parser;       // serial stream to lines, keeps partial lines across reads
+
+    // P and S lines of the batch being drained, only the newest of each is converted
+    int             m_nPendingRotatorPos;
+    int             m_nPendingShutterPos;
+    bool            m_bRotatorPosPending;
+    bool            m_bShutterPosPending;
+    // P stream continuity
+    int             m_nSeqLastPos;
+    int             m_nSeqLastDelta;
+    int             m_nSeqLines;
+    CStopWatch      m_seqTimer;
+
+    // steps per rev calibration
+    StepsPerRevCalibration m_Calibration;
+    int             m_nCalibrationRevolutions;
+    bool            m_bCalibrationWrite;
+    int             m_nCalibrationGuess;
+    int             m_nCalibrationDir;      // 1 or -1
+    int             m_nCalibrationTarget;   // in the controller's wrapped steps
+    int             m_nCalibrationLastPos;
+    int             m_nCalibrationUnwrapped; // steps moved since the start, signed, doesn't wrap
+    int             m_nCalibrationTravel;   // steps moved in the current direction
+    CStopWatch      m_calibrationMoveTimer;
+    std::vector<int> m_CalibrationDetections[2];    // [0] going up, [1] going down
+
+    // rotation tuning
+    RotationTuning  m_Tuning;
+    bool            m_bTuningApply;
+    int             m_nTuningDir;           // direction of the current test slew, 1 or -1
+    int             m_nTuningTarget;
+    int             m_nTuningLastPos;
+    int             m_nTuningOvershoot;     // furthest past the target so far on this slew, steps
+    CStopWatch      m_tuningSlewTimer;
+    CStopWatch      m_tuningProgressTimer;  // since the position last changed
+
+    // copy of the position for the callers that don't hold the I/O mutex, refreshed with the telemetry
+    std::atomic<double> m_dCachedAz;
+    std::atomic<double> m_dCachedEl;
+    std::atomic<double> m_dCacheTime;   // CStopWatch::GetMonotonicSeconds() of the last refresh, 0 if invalid
+    std::atomic<bool>   m_bFirmwareCached;
+    std::atomic<unsigned int> m_nFirmwareSeq;  // odd while m_szFirmwareVersion is being rewritten
+
 #ifdef PLUGIN_DEBUG
     std::string m_sLogfilePath;
     // timestamp for logs
@@ -0,0 +1,283 @@
+//
+//  ResponseParser.cpp
+//
+//  NexDome X2 plugin for V3 firmware
+//  Serial stream parser, see ResponseParser.h
+
+#include "ResponseParser.h"
+
+#include <ctype.h>
+
+#include <algorithm>
+
+// the widest the compiler is allowed to use, SSE2 is always there on x86_64
+#if defined __AVX2__
+#include <immintrin.h>
+#define PARSER_SCAN_AVX2
+#elif defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PARSER_SCAN_SSE2
+#endif
+
+#if defined _MSC_VER && (defined PARSER_SCAN_AVX2 || defined PARSER_SCAN_SSE2)
+#include <intrin.h>
+#endif
+
+#if defined PARSER_SCAN_AVX2 || defined PARSER_SCAN_SSE2
+static inline int lowestBitSet(unsigned int nMask)
+{
+#if defined _MSC_VER
+    unsigned long nIndex;
+    _BitScanForward(&nIndex, nMask);
+    return int(nIndex);
+#else
+    return __builtin_ctz(nMask);
+#endif
+}
+
+// bit n set when pBlock[n] isn't a plain printable byte.
+// As signed bytes "< 0x20" also catches the 8 bit ones, 0x7f and '#' are tested on their own.
+#if defined PARSER_SCAN_AVX2
+#define PARSER_SCAN_BLOCK   32
+static inline unsigned int specialMask(const unsigned char *pBlock)
+{
+    __m256i vBytes = _mm256_loadu_si256((const __m256i *)pBlock);
+    __m256i vSpecial = _mm256_or_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(0x20), vBytes),
+                                       _mm256_or_si256(_mm256_cmpeq_epi8(vBytes, _mm256_set1_epi8(0x7f)),
+                                                       _mm256_cmpeq_epi8(vBytes, _mm256_set1_epi8('#'))));
+    return (unsigned int)_mm256_movemask_epi8(vSpecial);
+}
+#else
+#define PARSER_SCAN_BLOCK   16
+static inline unsigned int specialMask(const unsigned char *pBlock)
+{
+    __m128i vBytes = _mm_loadu_si128((const __m128i *)pBlock);
+    __m128i vSpecial = _mm_or_si128(_mm_cmplt_epi8(vBytes, _mm_set1_epi8(0x20)),
+                                    _mm_or_si128(_mm_cmpeq_epi8(vBytes, _mm_set1_epi8(0x7f)),
+                                                 _mm_cmpeq_epi8(vBytes, _mm_set1_epi8('#'))));
+    return (unsigned int)_mm_movemask_epi8(vSpecial);
+}
+#endif
+#endif
+
+// upper bounds of the backlog buckets, bytes. Linux tty and FTDI buffers are 4 KiB.
+static const int kBacklogBounds[PARSER_BACKLOG_BUCKETS] = {0, 16, 64, 256, 1024, 2048, 4096};
+
+CResponseParser::CResponseParser()
+{
+    resetStats();
+    reset();
+    m_bVectorScan = true;
+}
+
+void CResponseParser::reset()
+{
+    m_nLineLen = 0;
+    m_bOverLength = false;
+    m_bGarbage = false;
+    m_nQueueHead = 0;
+    m_nQueued = 0;
+}
+
+// The firmware never puts a ':' past the first byte, and a position report is only digits.
+// Either means the end of a line and the start of the next one are missing.
+bool CResponseParser::isTruncated()
+{
+    int i;
+
+    if(m_szLine[0] == 'P' || m_szLine[0] == 'S') {
+        i = (m_szLine[1] == '-') ? 2 : 1;
+        if(i >= m_nLineLen || !isdigit((unsigned char)m_szLine[i]))
+            return false;   // PRR, SES, ... replies
+        for(; i < m_nLineLen; i++) {
+            if(!isdigit((unsigned char)m_szLine[i]))
+                return true;
+        }
+        return false;
+    }
+    // :SER,<position>,<at home>,<steps per rev>,<home position>,<dead zone>
+    if(m_nLineLen >= 4 && !memcmp(m_szLine, ":SER", 4) && std::count(m_szLine, m_szLine + m_nLineLen, ',') < 5)
+        return true;
+    return memchr(m_szLine + 1, ':', size_t(m_nLineLen - 1)) != NULL;
+}
+
+void CResponseParser::endLine()
+{
+    int nSlot;
+
+    if(m_bOverLength)
+        m_Stats.nOverLength++;
+    else if(m_bGarbage)
+        m_Stats.nGarbage++;
+    else if(m_nLineLen) {
+        if(m_nQueued == PARSER_QUEUE_SIZE) {
+            // keep the newest, a stale position report is the least useful thing to hold on to
+            m_nQueueHead = (m_nQueueHead + 1) % PARSER_QUEUE_SIZE;
+            m_nQueued--;
+            m_Stats.nDropped++;
+        }
+        nSlot = (m_nQueueHead + m_nQueued) % PARSER_QUEUE_SIZE;
+        memcpy(m_Queue[nSlot], m_szLine, size_t(m_nLineLen));
+        m_Queue[nSlot][m_nLineLen] = 0;
+        m_nQueued++;
+        m_Stats.nMessages++;
+        if(isTruncated())
+            m_Stats.nTruncated++;
+    }
+    m_nLineLen = 0;
+    m_bOverLength = false;
+    m_bGarbage = false;
+}
+
+void CResponseParser::sampleBacklog(int nBytes)
+{
+    int i;
+
+    if(nBytes < 0)
+        return;
+    m_Stats.nBacklogSamples++;
+    m_Stats.nBacklogSum += uint64_t(nBytes);
+    if(uint64_t(nBytes) > m_Stats.nBacklogMax)
+        m_Stats.nBacklogMax = uint64_t(nBytes);
+    for(i = 0; i < PARSER_BACKLOG_BUCKETS; i++) {
+        if(nBytes <= kBacklogBounds[i]) {
+            m_Stats.nBacklogBuckets[i]++;
+            break;
+        }
+    }
+}
+
+int CResponseParser::getBacklogBound(int nBucket)
+{
+    if(nBucket < 0 || nBucket >= PARSER_BACKLOG_BUCKETS)
+        return -1;
+    return kBacklogBounds[nBucket];
+}
+
+const char *CResponseParser::getScanKernel()
+{
+#if defined PARSER_SCAN_AVX2
+    return "avx2";
+#elif defined PARSER_SCAN_SSE2
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+const unsigned char *CResponseParser::findSpecialScalar(const unsigned char *pStart, const unsigned char *pEnd)
+{
+    for(; pStart < pEnd; pStart++) {
+        if(*pStart < 0x20 || *pStart > 0x7e || *pStart == '#')
+            break;
+    }
+    return pStart;
+}
+
+const unsigned char *CResponseParser::findSpecial(const unsigned char *pStart, const unsigned char *pEnd)
+{
+#if defined PARSER_SCAN_AVX2 || defined PARSER_SCAN_SSE2
+    unsigned int nMask;
+
+    while(pEnd - pStart >= PARSER_SCAN_BLOCK) {
+        nMask = specialMask(pStart);
+        if(nMask)
+            return pStart + lowestBitSet(nMask);
+        pStart += PARSER_SCAN_BLOCK;
+    }
+#endif
+    return findSpecialScalar(pStart, pEnd);
+}
+
+void CResponseParser::appendRun(const unsigned char *pStart, const unsigned char *pEnd)
+{
+    int nLen = int(pEnd - pStart);
+
+    if(nLen > PARSER_MAX_LINE - 1 - m_nLineLen) {
+        nLen = PARSER_MAX_LINE - 1 - m_nLineLen;
+        m_bOverLength = true;
+    }
+    if(nLen > 0) {
+        memcpy(m_szLine + m_nLineLen, pStart, size_t(nLen));
+        m_nLineLen += nLen;
+    }
+}
+
+void CResponseParser::handleSpecial(const unsigned char *pSpecial)
+{
+    switch(*pSpecial) {
+        case '\n' :
+        case '\r' :
+        case '#' :
+            endLine();
+            break;
+        default :
+            m_bGarbage = true;
+            appendRun(pSpecial, pSpecial + 1);
+            break;
+    }
+}
+
+int CResponseParser::feed(const char *pData, int nLen)
+{
+    const unsigned char *pByte = (const unsigned char *)pData;
+    const unsigned char *pEnd;
+    const unsigned char *pSpecial;
+#if defined PARSER_SCAN_AVX2 || defined PARSER_SCAN_SSE2
+    const unsigned char *pRun;
+    unsigned int nMask;
+    int nBit;
+#endif
+
+    if(!pData || nLen <= 0)
+        return m_nQueued;
+
+    pEnd = pByte + nLen;
+    m_Stats.nBytes += uint64_t(nLen);
+
+#if defined PARSER_SCAN_AVX2 || defined PARSER_SCAN_SSE2
+    // one mask per block, then walk its bits : every terminator of a burst of short lines in one pass
+    if(m_bVectorScan) {
+        for(; pEnd - pByte >= PARSER_SCAN_BLOCK; pByte += PARSER_SCAN_BLOCK) {
+            nMask = specialMask(pByte);
+            pRun = pByte;
+            while(nMask) {
+                nBit = lowestBitSet(nMask);
+                nMask &= nMask - 1;
+                appendRun(pRun, pByte + nBit);
+                handleSpecial(pByte + nBit);
+                pRun = pByte + nBit + 1;
+            }
+            appendRun(pRun, pByte + PARSER_SCAN_BLOCK);
+        }
+    }
+#endif
+
+    // the tail of the chunk, or everything when not vectorized
+    while(pByte < pEnd) {
+        pSpecial = findSpecialScalar(pByte, pEnd);
+        appendRun(pByte, pSpecial);
+        if(pSpecial == pEnd)
+            break;
+        handleSpecial(pSpecial);
+        pByte = pSpecial + 1;
+    }
+    return m_nQueued;
+}
+
+bool CResponseParser::popMessage(char *pszMessage, int nMaxLen)
+{
+    size_t nLen;
+
+    if(!m_nQueued || !pszMessage || nMaxLen <= 0)
+        return false;
+    // not strncpy, padding the whole buffer costs more than parsing the line
+    nLen = strlen(m_Queue[m_nQueueHead]);
+    if(nLen > size_t(nMaxLen - 1))
+        nLen = size_t(nMaxLen - 1);
+    memcpy(pszMessage, m_Queue[m_nQueueHead], nLen);
+    pszMessage[nLen] = 0;
+    m_nQueueHead = (m_nQueueHead + 1) % PARSER_QUEUE_SIZE;
+    m_nQueued--;
+    return true;
+}
@@ -0,0 +1,93 @@
+//
+//  ResponseParser.h
+//
+//  NexDome X2 plugin for V3 firmware
+//  Resumable push parser for the controller serial stream.
+//
+//  Feed it whatever the port returned, in chunks of any size, and pop the complete lines. A partial line
+//  stays in the parser until the rest of it arrives, so a read timeout in the middle of a line loses nothing.
+//  Lines end on '\n', '\r' or '#' (":PRR1234#"), the terminators are not part of the decoded message and
+//  the empty lines they produce ("#\r\n") are skipped.
+//  Lines longer than PARSER_MAX_LINE - 1 and lines with bytes that can't come from the firmware (line noise
+//  when the arduino reboots) are dropped and counted.
+//  Lines that look like two messages run together (bytes lost in between, RX overrun) are passed on as they
+//  are but counted as truncated. The host samples the RX backlog (bytes waiting in the serial driver) at each
+//  drain into a histogram, to relate the losses to the backlog.
+//
+//  Chunks are scanned for terminators 16 or 32 bytes at a time with SSE2 or AVX2 (whatever the compiler
+//  targets) and the text between them copied in bulk. The scalar loop is the fallback and does the tail.
+//
+//  No dependency on the X2 headers, so it can be fuzzed and benchmarked on its own (tools/ndv3parser.cpp).
+
+#ifndef __RESPONSE_PARSER__
+#define __RESPONSE_PARSER__
+
+#include <stdint.h>
+#include <string.h>
+
+#define PARSER_MAX_LINE     256     // including the terminating 0, same as SERIAL_BUFFER_SIZE
+#define PARSER_QUEUE_SIZE   128     // decoded lines waiting to be popped, enough for a full SERIAL_BUFFER_SIZE read of 2 byte lines
+#define PARSER_BACKLOG_BUCKETS  7   // +Inf is implicit
+
+typedef struct {
+    uint64_t    nBytes;
+    uint64_t    nMessages;
+    uint64_t    nOverLength;    // lines longer than PARSER_MAX_LINE - 1, dropped
+    uint64_t    nGarbage;       // lines with non printable bytes, dropped
+    uint64_t    nDropped;       // decoded lines lost because nobody popped them
+    uint64_t    nTruncated;     // lines cut short or run into the next one, passed on
+    uint64_t    nBacklogSamples;
+    uint64_t    nBacklogSum;    // bytes
+    uint64_t    nBacklogMax;    // bytes, high-water mark
+    uint64_t    nBacklogBuckets[PARSER_BACKLOG_BUCKETS];    // not cumulative, bounds from getBacklogBound
+} ParserStats;
+
+
+class CResponseParser
+{
+public:
+    CResponseParser();
+
+    void    reset(void);        // forget the partial line and the queued ones, keep the stats
+    void    resetStats(void) { memset(&m_Stats, 0, sizeof(ParserStats)); }
+
+    // returns the number of lines ready to be popped
+    int     feed(const char *pData, int nLen);
+    // oldest line first, truncated to nMaxLen - 1. false if there is none.
+    bool    popMessage(char *pszMessage, int nMaxLen);
+    int     getMessageCount(void) { return m_nQueued; }
+    bool    hasPartialLine(void) { return m_nLineLen > 0 || m_bOverLength || m_bGarbage; }
+
+    const ParserStats &getStats(void) { return m_Stats; }
+
+    // bytes waiting in the serial driver when the host drains it
+    void    sampleBacklog(int nBytes);
+    static int getBacklogBound(int nBucket);
+
+    // byte at a time scanning, for comparisons
+    void    setVectorScan(bool bVector) { m_bVectorScan = bVector; }
+    static const char *getScanKernel(void);     // "avx2", "sse2" or "scalar"
+    // first byte in [pStart, pEnd) that isn't a plain printable one : terminator, '#', control or 8 bit
+    static const unsigned char *findSpecial(const unsigned char *pStart, const unsigned char *pEnd);
+    static const unsigned char *findSpecialScalar(const unsigned char *pStart, const unsigned char *pEnd);
+
+protected:
+    void    endLine(void);
+    void    appendRun(const unsigned char *pStart, const unsigned char *pEnd);
+    void    handleSpecial(const unsigned char *pSpecial);
+    bool    isTruncated(void);
+
+    char        m_szLine[PARSER_MAX_LINE];
+    int         m_nLineLen;
+    bool        m_bOverLength;
+    bool        m_bGarbage;
+    bool        m_bVectorScan;
+
+    char        m_Queue[PARSER_QUEUE_SIZE][PARSER_MAX_LINE];
+    int         m_nQueueHead;   // oldest
+    int         m_nQueued;
+
+    ParserStats m_Stats;
+};
+
+#endif
@@ -0,0 +1,171 @@
+//
+//  SlewModel.cpp
+//
+//  NexDome X2 plugin for V3 firmware
+//  Slew duration model, see SlewModel.h
+
+#include "SlewModel.h"
+
+void CSlewModel::features(int nSteps, double *pX)
+{
+    double dKSteps = fabs(double(nSteps)) / 1000.0;
+
+    pX[0] = 1.0;
+    pX[1] = dKSteps;
+    pX[2] = sqrt(dKSteps);
+}
+
+void CSlewModel::addSlew(int nSteps, double dSeconds)
+{
+    SlewModelSums &sums = m_Sums[nSteps >= 0 ? 0 : 1];
+    double dX[SLEW_MODEL_TERMS];
+    int i, j;
+
+    if(!nSteps || dSeconds <= 0)
+        return;
+
+    features(nSteps, dX);
+    for(i = 0; i < SLEW_MODEL_TERMS; i++) {
+        for(j = 0; j < SLEW_MODEL_TERMS; j++)
+            sums.dXX[i][j] = SLEW_MODEL_FORGET * sums.dXX[i][j] + dX[i] * dX[j];
+        sums.dXT[i] = SLEW_MODEL_FORGET * sums.dXT[i] + dX[i] * dSeconds;
+    }
+    sums.dTT = SLEW_MODEL_FORGET * sums.dTT + dSeconds * dSeconds;
+    sums.dW = SLEW_MODEL_FORGET * sums.dW + 1.0;
+    sums.nSamples++;
+}
+
+// normal equations, Gaussian elimination with partial pivoting. A little ridge on the diagonal keeps it
+// solvable when every slew had the same length, the fit is then only good around that length.
+bool CSlewModel::solve(const SlewModelSums &sums, double *pCoefs)
+{
+    double dA[SLEW_MODEL_TERMS][SLEW_MODEL_TERMS + 1];
+    double dRidge = 0;
+    double dFactor;
+    double dTmp;
+    int i, j, k, nPivot;
+
+    for(i = 0; i < SLEW_MODEL_TERMS; i++)
+        dRidge += sums.dXX[i][i];
+    dRidge *= 1e-9;
+    for(i = 0; i < SLEW_MODEL_TERMS; i++) {
+        for(j = 0; j < SLEW_MODEL_TERMS; j++)
+            dA[i][j] = sums.dXX[i][j] + (i == j ? dRidge : 0);
+        dA[i][SLEW_MODEL_TERMS] = sums.dXT[i];
+    }
+
+    for(k = 0; k < SLEW_MODEL_TERMS; k++) {
+        nPivot = k;
+        for(i = k + 1; i < SLEW_MODEL_TERMS; i++) {
+            if(fabs(dA[i][k]) > fabs(dA[nPivot][k]))
+                nPivot = i;
+        }
+        if(fabs(dA[nPivot][k]) < 1e-12)
+            return false;
+        if(nPivot != k) {
+            for(j = k; j <= SLEW_MODEL_TERMS; j++) {
+                dTmp = dA[k][j];
+                dA[k][j] = dA[nPivot][j];
+                dA[nPivot][j] = dTmp;
+            }
+        }
+        for(i = k + 1; i < SLEW_MODEL_TERMS; i++) {
+            dFactor = dA[i][k] / dA[k][k];
+            for(j = k; j <= SLEW_MODEL_TERMS; j++)
+                dA[i][j] -= dFactor * dA[k][j];
+        }
+    }
+    for(i = SLEW_MODEL_TERMS - 1; i >= 0; i--) {
+        pCoefs[i] = dA[i][SLEW_MODEL_TERMS];
+        for(j = i + 1; j < SLEW_MODEL_TERMS; j++)
+            pCoefs[i] -= dA[i][j] * pCoefs[j];
+        pCoefs[i] /= dA[i][i];
+    }
+    return true;
+}
+
+bool CSlewModel::predict(int nSteps, double &dSeconds, double &dSigma) const
+{
+    const SlewModelSums &sums = m_Sums[nSteps >= 0 ? 0 : 1];
+    double dCoefs[SLEW_MODEL_TERMS];
+    double dX[SLEW_MODEL_TERMS];
+    double dResidual;
+    int i;
+
+    dSeconds = 0;
+    dSigma = 0;
+    if(sums.nSamples < SLEW_MODEL_MIN_SAMPLES || !solve(sums, dCoefs))
+        return false;
+
+    features(nSteps, dX);
+    dResidual = sums.dTT;
+    for(i = 0; i < SLEW_MODEL_TERMS; i++) {
+        dSeconds += dCoefs[i] * dX[i];
+        dResidual -= dCoefs[i] * sums.dXT[i];
+    }
+    if(dSeconds < 0)
+        dSeconds = 0;
+    if(dResidual > 0 && sums.dW > 0)
+        dSigma = sqrt(dResidual / sums.dW);
+    return true;
+}
+
+std::string CSlewModel::serialize() const
+{
+    char szNumber[64];
+    std::string sModel;
+    int nDir, i, j;
+
+    snprintf(szNumber, sizeof(szNumber), "%d", SLEW_MODEL_VERSION);
+    sModel.assign(szNumber);
+    for(nDir = 0; nDir < 2; nDir++) {
+        snprintf(szNumber, sizeof(szNumber), " %d %.9g %.9g", m_Sums[nDir].nSamples, m_Sums[nDir].dW, m_Sums[nDir].dTT);
+        sModel.append(szNumber);
+        for(i = 0; i < SLEW_MODEL_TERMS; i++) {
+            snprintf(szNumber, sizeof(szNumber), " %.9g", m_Sums[nDir].dXT[i]);
+            sModel.append(szNumber);
+            // symmetric, the upper triangle is enough
+            for(j = i; j < SLEW_MODEL_TERMS; j++) {
+                snprintf(szNumber, sizeof(szNumber), " %.9g", m_Sums[nDir].dXX[i][j]);
+                sModel.append(szNumber);
+            }
+        }
+    }
+    return sModel;
+}
+
+bool CSlewModel::deserialize(const std::string &sModel)
+{
+    SlewModelSums sums[2];
+    const char *pszPos = sModel.c_str();
+    char *pszEnd;
+    int nDir, i, j;
+
+    memset(sums, 0, sizeof(sums));
+    if(strtol(pszPos, &pszEnd, 10) != SLEW_MODEL_VERSION || pszEnd == pszPos)
+        return false;
+    pszPos = pszEnd;
+
+    for(nDir = 0; nDir < 2; nDir++) {
+        sums[nDir].nSamples = int(strtol(pszPos, &pszEnd, 10));
+        if(pszEnd == pszPos)
+            return false;
+        pszPos = pszEnd;
+        sums[nDir].dW = strtod(pszPos, &pszEnd);
+        pszPos = pszEnd;
+        sums[nDir].dTT = strtod(pszPos, &pszEnd);
+        pszPos = pszEnd;
+        for(i = 0; i < SLEW_MODEL_TERMS; i++) {
+            sums[nDir].dXT[i] = strtod(pszPos, &pszEnd);
+            pszPos = pszEnd;
+            for(j = i; j < SLEW_MODEL_TERMS; j++) {
+                sums[nDir].dXX[i][j] = sums[nDir].dXX[j][i] = strtod(pszPos, &pszEnd);
+                if(pszEnd == pszPos)
+                    return false;
+                pszPos = pszEnd;
+            }
+        }
+    }
+    memcpy(m_Sums, sums, sizeof(m_Sums));
+    return true;
+}
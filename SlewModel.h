@@ -0,0 +1,61 @@
+//
+//  SlewModel.h
+//
+//  NexDome X2 plugin for V3 firmware
+//  How long a slew of a given number of steps takes on this dome, learned from the slews it has done.
+//
+//  Each direction has its own weighted least squares fit of t = c0 + c1 * d + c2 * sqrt(d), d in thousands of
+//  steps. A trapezoidal move is close to sqrt(d) when it never reaches full speed and linear when it cruises,
+//  c0 is the command and :SER overhead. Older slews are forgotten geometrically so a change of speed or
+//  acceleration, or a heavier dome in winter, takes over after a few dozen slews.
+//  Only the sums are kept, serialize/deserialize turn them into one line for the ini file.
+//
+//  No dependency on the X2 headers.
+
+#ifndef __SLEW_MODEL__
+#define __SLEW_MODEL__
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#define SLEW_MODEL_TERMS        3
+#define SLEW_MODEL_FORGET       0.97    // weight of the past at each new slew
+#define SLEW_MODEL_MIN_SAMPLES  3       // per direction before predicting
+#define SLEW_MODEL_VERSION      1
+
+typedef struct {
+    double  dXX[SLEW_MODEL_TERMS][SLEW_MODEL_TERMS];   // sum of w * x * x'
+    double  dXT[SLEW_MODEL_TERMS];                      // sum of w * x * t
+    double  dTT;                                        // sum of w * t * t
+    double  dW;                                         // sum of w
+    int     nSamples;                                   // slews seen, not weighted
+} SlewModelSums;
+
+class CSlewModel
+{
+public:
+    CSlewModel() { reset(); }
+
+    void    reset(void) { memset(m_Sums, 0, sizeof(m_Sums)); }
+
+    // nSteps signed, the sign gives the direction
+    void    addSlew(int nSteps, double dSeconds);
+    // false until the direction has SLEW_MODEL_MIN_SAMPLES slews. dSigma is the rms error of the fit.
+    bool    predict(int nSteps, double &dSeconds, double &dSigma) const;
+    int     getSamples(void) const { return m_Sums[0].nSamples + m_Sums[1].nSamples; }
+
+    std::string serialize(void) const;
+    bool    deserialize(const std::string &sModel);
+
+protected:
+    static void features(int nSteps, double *pX);
+    static bool solve(const SlewModelSums &sums, double *pCoefs);
+
+    SlewModelSums   m_Sums[2];  // [0] increasing steps, [1] decreasing
+};
+
+#endif
@@ -0,0 +1,64 @@
+//
+//  StepModel.h
+//
+//  NexDome X2 plugin for V3 firmware
+//  Rotator positions are kept in controller steps, degrees only exist at the API boundary.
+//
+//  CStepScale is the only place steps and degrees are converted, with the scale factors computed once
+//  when the steps per revolution are known. Comparisons (goto complete, at home, dead zone) are done on
+//  wrapped steps with stepDistance so they all agree on where the dome is.
+
+#ifndef __STEP_MODEL__
+#define __STEP_MODEL__
+
+#include <math.h>
+#include <stdlib.h>
+
+// [0, nStepsPerRev)
+constexpr int wrapSteps(int nSteps, int nStepsPerRev)
+{
+    return nStepsPerRev <= 0 ? nSteps : ((nSteps % nStepsPerRev) + nStepsPerRev) % nStepsPerRev;
+}
+
+// shortest signed move from nFrom to nTo, in [-nStepsPerRev/2, nStepsPerRev/2)
+constexpr int stepDistance(int nFrom, int nTo, int nStepsPerRev)
+{
+    return nStepsPerRev <= 0 ? nTo - nFrom : wrapSteps(nTo - nFrom + nStepsPerRev / 2, nStepsPerRev) - nStepsPerRev / 2;
+}
+
+static_assert(wrapSteps(-1, 100) == 99, "wrapSteps");
+static_assert(wrapSteps(250, 100) == 50, "wrapSteps");
+static_assert(stepDistance(95, 5, 100) == 10, "stepDistance");
+static_assert(stepDistance(5, 95, 100) == -10, "stepDistance");
+
+class CStepScale
+{
+public:
+    CStepScale() : m_nStepsPerRev(0), m_dDegPerStep(0), m_dStepsPerDeg(0) {}
+
+    void    setStepsPerRev(int nStepsPerRev)
+    {
+        m_nStepsPerRev = nStepsPerRev > 0 ? nStepsPerRev : 0;
+        m_dDegPerStep = m_nStepsPerRev ? 360.0 / m_nStepsPerRev : 0;
+        m_dStepsPerDeg = m_nStepsPerRev / 360.0;
+    }
+    int     getStepsPerRev(void) const { return m_nStepsPerRev; }
+    bool    isValid(void) const { return m_nStepsPerRev > 0; }
+
+    // [0, 360)
+    double  toDegrees(int nSteps) const { return wrapSteps(nSteps, m_nStepsPerRev) * m_dDegPerStep; }
+    // nearest step, wrapped
+    int     toSteps(double dAz) const { return wrapSteps(int(floor(dAz * m_dStepsPerDeg + 0.5)), m_nStepsPerRev); }
+    // an angle as a number of steps, for tolerances
+    int     toStepCount(double dDegrees) const { return int(ceil(fabs(dDegrees) * m_dStepsPerDeg)); }
+
+    int     distance(int nFrom, int nTo) const { return stepDistance(nFrom, nTo, m_nStepsPerRev); }
+    bool    isWithin(int nPos, int nTarget, int nToleranceSteps) const { return abs(distance(nPos, nTarget)) <= nToleranceSteps; }
+
+protected:
+    int     m_nStepsPerRev;
+    double  m_dDegPerStep;
+    double  m_dStepsPerDeg;
+};
+
+#endif
@@ -3,9 +3,10 @@
 // Code by Richard S. Wright Jr.
 // March 23, 1999
 // 
-// This function uses the High performance counter on Win32 and
-// gettimeofday on Mac OS X/Linux. gettimeofday is actually pretty
-// good on the Mac (about 10ms).
+// Originally used the High performance counter on Win32 and
+// gettimeofday on Mac OS X/Linux. Now uses std::chrono::steady_clock
+// everywhere, gettimeofday follows the wall clock and jumps when NTP
+// steps or slews it, which corrupted every timeout based on it.
 
 /* Copyright (c) 2005-2009, Richard S. Wright Jr.
 All rights reserved.
@@ -38,11 +39,9 @@ ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF S
 #ifndef STOPWATCH_HEADER
 #define STOPWATCH_HEADER
 
-#ifdef WIN32
-#include <windows.h>
-#else
-#include <sys/time.h>
-#endif
+#include <stdint.h>
+#include <stddef.h>
+#include <chrono>
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -50,55 +49,91 @@ ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF S
 // purposes (or, even low resolution timings)
 // Pretty self-explanitory.... 
 // Reset(), or GetElapsedSeconds().
+// The clock is monotonic, only use it for intervals, never for dates.
 class CStopWatch
 	{
 	public:
 		CStopWatch(void)	// Constructor
 			{
-			#ifdef WIN32
-			QueryPerformanceFrequency(&m_CounterFrequency);
-			QueryPerformanceCounter(&m_LastCount);
-			#else
-            gettimeofday(&m_LastCount, 0);
-			#endif
+			Reset();
 			}
 
 		// Resets timer (difference) to zero
 		inline void Reset(void) 
 			{
-			#ifdef WIN32
-			QueryPerformanceCounter(&m_LastCount);
-			#else
-			gettimeofday(&m_LastCount, 0);
-			#endif
+			m_LastCount = std::chrono::steady_clock::now();
 			}					
 		
 		// Get elapsed time in seconds
-		float GetElapsedSeconds(void)
+		double GetElapsedSeconds(void)
 			{
-			// Get the current count
-			#ifdef WIN32
-			LARGE_INTEGER lCurrent;
-			QueryPerformanceCounter(&lCurrent);
-
-			return float((lCurrent.QuadPart - m_LastCount.QuadPart) /
-										double(m_CounterFrequency.QuadPart));
-			#else
-            timeval lcurrent;
-            gettimeofday(&lcurrent, 0);
-            float fSeconds = (float)(lcurrent.tv_sec - m_LastCount.tv_sec);
-            float fFraction = (float)(lcurrent.tv_usec - m_LastCount.tv_usec) * 0.000001f;
-            return fSeconds + fFraction;
-			#endif
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_LastCount).count();
 			}	
+
+		// Get elapsed time in milliseconds, for the serial timeouts
+		int GetElapsedMilliseconds(void)
+			{
+			return int(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_LastCount).count());
+			}
+
+		// Get elapsed time in nanoseconds
+		int64_t GetElapsedNanoseconds(void)
+			{
+			return int64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_LastCount).count());
+			}
+
+		// Seconds on the monotonic clock, for timestamps that are only compared with each other
+		static double GetMonotonicSeconds(void)
+			{
+			return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+			}
 	
 	protected:
-	#ifdef WIN32
-		LARGE_INTEGER m_CounterFrequency;
-		LARGE_INTEGER m_LastCount;
-	#else
-        timeval m_LastCount;
-	#endif
+		std::chrono::steady_clock::time_point m_LastCount;
+	};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Times its own lifetime and hands the result to a sink when it goes out of scope,
+// so every return path of the timed block is covered.
+// Call Cancel() on the paths that shouldn't be reported.
+class CTimingScope
+	{
+	public:
+		typedef void (*TimingSink)(void *pContext, int nId, double dSeconds);
+
+		CTimingScope(TimingSink pSink, void *pContext, int nId)
+			: m_pSink(pSink), m_pContext(pContext), m_nId(nId), m_pdSeconds(NULL) {}
+
+		// store the elapsed seconds in dSeconds
+		CTimingScope(double &dSeconds)
+			: m_pSink(NULL), m_pContext(NULL), m_nId(0), m_pdSeconds(&dSeconds) {}
+
+		~CTimingScope(void)
+			{
+			double dSeconds;
+
+			if(!m_pSink && !m_pdSeconds)
+				return;
+			dSeconds = m_Timer.GetElapsedSeconds();
+			if(m_pdSeconds)
+				*m_pdSeconds = dSeconds;
+			if(m_pSink)
+				m_pSink(m_pContext, m_nId, dSeconds);
+			}
+
+		inline void Cancel(void) { m_pSink = NULL; m_pdSeconds = NULL; }
+		double GetElapsedSeconds(void) { return m_Timer.GetElapsedSeconds(); }
+
+	private:
+		CTimingScope(const CTimingScope &);
+		CTimingScope &operator=(const CTimingScope &);
+
+		CStopWatch	m_Timer;
+		TimingSink	m_pSink;
+		void		*m_pContext;
+		int			m_nId;
+		double		*m_pdSeconds;
 	};
 
 
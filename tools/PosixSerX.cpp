@@ -0,0 +1,193 @@
+//
+//  PosixSerX.cpp
+//
+//  NexDome V3 tools
+//  termios based SerXInterface, see PosixSerX.h
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+
+#include "PosixSerX.h"
+
+CPosixSerX::CPosixSerX()
+{
+    m_fd = -1;
+}
+
+CPosixSerX::~CPosixSerX()
+{
+    close();
+}
+
+int CPosixSerX::open(const char* pszPort, const unsigned long& dwBaudRate, const Parity& parity, const char* pszSession)
+{
+    struct termios tty;
+    speed_t speed;
+
+    (void)pszSession;
+    if(m_fd >= 0)
+        close();
+
+    m_fd = ::open(pszPort, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if(m_fd < 0)
+        return ERR_COMMOPENING;
+
+    if(tcgetattr(m_fd, &tty) == 0) {
+        switch(dwBaudRate) {
+            case 9600   : speed = B9600; break;
+            case 19200  : speed = B19200; break;
+            case 38400  : speed = B38400; break;
+            case 57600  : speed = B57600; break;
+            default     : speed = B115200; break;
+        }
+        cfmakeraw(&tty);
+        cfsetispeed(&tty, speed);
+        cfsetospeed(&tty, speed);
+        tty.c_cflag |= (CLOCAL | CREAD);
+        tty.c_cflag &= ~(PARENB | PARODD | CSTOPB);
+        if(parity == B_ODDPARITY)
+            tty.c_cflag |= (PARENB | PARODD);
+        else if(parity == B_EVENPARITY)
+            tty.c_cflag |= PARENB;
+        tty.c_cc[VMIN] = 0;
+        tty.c_cc[VTIME] = 0;
+        tcsetattr(m_fd, TCSANOW, &tty);
+    }
+    return SB_OK;
+}
+
+int CPosixSerX::close()
+{
+    if(m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+    return SB_OK;
+}
+
+int CPosixSerX::flushTx()
+{
+    if(m_fd < 0)
+        return ERR_COMMNOLINK;
+    if(isatty(m_fd))
+        tcdrain(m_fd);
+    return SB_OK;
+}
+
+int CPosixSerX::purgeTxRx()
+{
+    char szBuf[256];
+
+    if(m_fd < 0)
+        return ERR_COMMNOLINK;
+    if(isatty(m_fd)) {
+        tcflush(m_fd, TCIOFLUSH);
+    }
+    else {
+        // not a tty (socketpair), drain what's there
+        struct pollfd pfd = {m_fd, POLLIN, 0};
+        while(poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+            if(::read(m_fd, szBuf, sizeof(szBuf)) <= 0)
+                break;
+        }
+    }
+    return SB_OK;
+}
+
+int CPosixSerX::waitForBytesRx(const int& nNumber, const int& nTimeOutSec)
+{
+    int nWaiting = 0;
+    int nWaitedMs = 0;
+
+    while(nWaitedMs < nTimeOutSec * 1000) {
+        bytesWaitingRx(nWaiting);
+        if(nWaiting >= nNumber)
+            return SB_OK;
+        usleep(10000);
+        nWaitedMs += 10;
+    }
+    return ERR_RXTIMEOUT;
+}
+
+int CPosixSerX::readFile(void* lpBuffer, const unsigned long dwTotalNumberOfBytesToRead, unsigned long& dwTotalNumberOfBytesRead, const unsigned long& dwTimeOut)
+{
+    struct pollfd pfd;
+    ssize_t nRead;
+    int nRet;
+
+    dwTotalNumberOfBytesRead = 0;
+    if(m_fd < 0)
+        return ERR_COMMNOLINK;
+
+    while(dwTotalNumberOfBytesRead < dwTotalNumberOfBytesToRead) {
+        pfd.fd = m_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        nRet = poll(&pfd, 1, (int)dwTimeOut);
+        if(nRet < 0 && errno == EINTR)
+            continue;
+        if(nRet < 0)
+            return ERR_COMMNOLINK;
+        if(nRet == 0)
+            break; // timeout, caller checks the byte count
+        nRead = ::read(m_fd, (char *)lpBuffer + dwTotalNumberOfBytesRead, dwTotalNumberOfBytesToRead - dwTotalNumberOfBytesRead);
+        if(nRead < 0 && (errno == EAGAIN || errno == EINTR))
+            continue;
+        if(nRead <= 0)
+            return ERR_COMMNOLINK;
+        dwTotalNumberOfBytesRead += (unsigned long)nRead;
+    }
+    return SB_OK;
+}
+
+int CPosixSerX::writeFile(void* lpBuffer, const unsigned long& dwNumberOfBytesToWrite, unsigned long& lpNumberOfBytesWritten)
+{
+    ssize_t nWritten;
+
+    lpNumberOfBytesWritten = 0;
+    if(m_fd < 0)
+        return ERR_COMMNOLINK;
+
+    while(lpNumberOfBytesWritten < dwNumberOfBytesToWrite) {
+        nWritten = ::write(m_fd, (char *)lpBuffer + lpNumberOfBytesWritten, dwNumberOfBytesToWrite - lpNumberOfBytesWritten);
+        if(nWritten < 0 && (errno == EAGAIN || errno == EINTR))
+            continue;
+        if(nWritten < 0)
+            return ERR_COMMNOLINK;
+        lpNumberOfBytesWritten += (unsigned long)nWritten;
+    }
+    return SB_OK;
+}
+
+int CPosixSerX::bytesWaitingTx(int &nBytesWaitingTx)
+{
+    nBytesWaitingTx = 0;
+    if(m_fd < 0)
+        return ERR_COMMNOLINK;
+#ifdef TIOCOUTQ
+    ioctl(m_fd, TIOCOUTQ, &nBytesWaitingTx);
+#endif
+    return SB_OK;
+}
+
+int CPosixSerX::bytesWaitingRx(int &nBytesWaitingRx)
+{
+    nBytesWaitingRx = 0;
+    if(m_fd < 0)
+        return ERR_COMMNOLINK;
+    if(ioctl(m_fd, FIONREAD, &nBytesWaitingRx) != 0)
+        return ERR_COMMNOLINK;
+    return SB_OK;
+}
+
+
+void CPosixSleeper::sleep(const int& milliSecondsToSleep)
+{
+    if(milliSecondsToSleep > 0)
+        usleep((useconds_t)milliSecondsToSleep * 1000);
+}
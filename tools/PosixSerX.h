@@ -0,0 +1,46 @@
+//
+//  PosixSerX.h
+//
+//  NexDome V3 tools
+//  SerXInterface and SleeperInterface implementations on top of termios, so CNexDomeV3
+//  can be used outside of TheSkyX by the standalone tools (daemon, recorder, tuner, ...).
+
+#ifndef __POSIX_SERX__
+#define __POSIX_SERX__
+
+#include "../../../licensedinterfaces/sberrorx.h"
+#include "../../../licensedinterfaces/serxinterface.h"
+#include "../../../licensedinterfaces/sleeperinterface.h"
+
+class CPosixSerX : public SerXInterface
+{
+public:
+    CPosixSerX();
+    virtual ~CPosixSerX();
+
+    virtual int open(const char* pszPort, const unsigned long& dwBaudRate = 9600, const Parity& parity = B_NOPARITY, const char* pszSession = 0);
+    virtual int close();
+    virtual bool isConnected() const { return m_fd >= 0; }
+    virtual int flushTx();
+    virtual int purgeTxRx();
+    virtual int waitForBytesRx(const int& nNumber, const int& nTimeOutSec);
+    virtual int readFile(void* lpBuffer, const unsigned long dwTotalNumberOfBytesToRead, unsigned long& dwTotalNumberOfBytesRead, const unsigned long& dwTimeOut = 1000);
+    virtual int writeFile(void* lpBuffer, const unsigned long& dwNumberOfBytesToWrite, unsigned long& lpNumberOfBytesWritten);
+    virtual int bytesWaitingTx(int &nBytesWaitingTx);
+    virtual int bytesWaitingRx(int &nBytesWaitingRx);
+
+    // the port is also usable with an already opened descriptor (pty, socketpair), used by the emulator based tests.
+    void        attachFd(int fd) { m_fd = fd; }
+    int         getFd() { return m_fd; }
+
+protected:
+    int         m_fd;
+};
+
+class CPosixSleeper : public SleeperInterface
+{
+public:
+    virtual void sleep(const int& milliSecondsToSleep);
+};
+
+#endif
@@ -0,0 +1,213 @@
+//
+//  ndv3contention.cpp
+//
+//  NexDome V3 tools
+//  Measures how the read-only position calls contend with the serial I/O for the driver mutex.
+//
+//  A poller thread does what TheSkyX's slaving thread does (a serial round trip under the mutex every
+//  DEFAULT_POLL_MS) while reader threads ask for the position like the UI thread does. The test runs
+//  twice, first with every read taking the mutex and querying the controller, then with the reads served
+//  from the cached state (getCachedAzEl) and only taking the mutex when the cache is stale.
+//
+//  usage : ndv3contention [-t seconds per run] [-r readers] serial_port
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../NexDomeV3.h"
+#include "PosixSerX.h"
+
+#define DEFAULT_RUN_TIME    10      // seconds
+#define DEFAULT_READERS     2
+#define DEFAULT_POLL_MS     250
+#define READER_PERIOD_MS    50
+#define CONTENDED_WAIT      0.001   // seconds
+
+typedef struct {
+    std::vector<double> readLatencies;  // seconds, all readers
+    double      dWaitTotal;
+    double      dWaitMax;
+    uint64_t    nAcquisitions;
+    uint64_t    nContended;
+    uint64_t    nCommands;
+} RunResults;
+
+class CContentionTest
+{
+public:
+    CContentionTest() : m_nReaders(DEFAULT_READERS), m_nRunTime(DEFAULT_RUN_TIME) {}
+
+    int     connect(const char *pszPort);
+    void    disconnect() { m_NexDome.Disconnect(); }
+    void    setReaders(int nReaders) { m_nReaders = nReaders; }
+    void    setRunTime(int nSeconds) { m_nRunTime = nSeconds; }
+    void    run(bool bCached, RunResults &results);
+
+protected:
+    void    lockIO();
+    void    poller();
+    void    reader(bool bCached, std::vector<double> &latencies);
+
+    CNexDomeV3          m_NexDome;
+    CPosixSerX          m_SerX;
+    CPosixSleeper       m_Sleeper;
+    std::mutex          m_IOMutex;      // stands in for the X2 mutex
+    std::atomic<bool>   m_bRunning;
+
+    // only updated with m_IOMutex held
+    double              m_dWaitTotal;
+    double              m_dWaitMax;
+    uint64_t            m_nAcquisitions;
+    uint64_t            m_nContended;
+
+    int                 m_nReaders;
+    int                 m_nRunTime;
+};
+
+int CContentionTest::connect(const char *pszPort)
+{
+    m_NexDome.setSerxPointer(&m_SerX);
+    m_NexDome.setSleeprPinter(&m_Sleeper);
+    return m_NexDome.Connect(pszPort);
+}
+
+void CContentionTest::lockIO()
+{
+    CStopWatch waitTimer;
+    double dWait;
+
+    m_IOMutex.lock();
+    dWait = waitTimer.GetElapsedSeconds();
+    m_nAcquisitions++;
+    m_dWaitTotal += dWait;
+    if(dWait > CONTENDED_WAIT)
+        m_nContended++;
+    if(dWait > m_dWaitMax)
+        m_dWaitMax = dWait;
+}
+
+void CContentionTest::poller()
+{
+    while(m_bRunning) {
+        lockIO();
+        m_NexDome.getCurrentAz();
+        m_IOMutex.unlock();
+        std::this_thread::sleep_for(std::chrono::milliseconds(DEFAULT_POLL_MS));
+    }
+}
+
+void CContentionTest::reader(bool bCached, std::vector<double> &latencies)
+{
+    CStopWatch callTimer;
+    double dAz, dEl;
+
+    while(m_bRunning) {
+        callTimer.Reset();
+        // same logic as X2Dome::dapiGetAzEl
+        if(!bCached || !m_NexDome.getCachedAzEl(dAz, dEl)) {
+            lockIO();
+            dAz = m_NexDome.getCurrentAz();
+            dEl = m_NexDome.getCurrentEl();
+            m_IOMutex.unlock();
+        }
+        latencies.push_back(callTimer.GetElapsedSeconds());
+        std::this_thread::sleep_for(std::chrono::milliseconds(READER_PERIOD_MS));
+    }
+    (void)dAz;
+    (void)dEl;
+}
+
+void CContentionTest::run(bool bCached, RunResults &results)
+{
+    std::vector<std::thread> threads;
+    std::vector< std::vector<double> > latencies(m_nReaders);
+    MetricsCounters countersBefore, countersAfter;
+    int i;
+
+    m_NexDome.getMetrics().getCounters(countersBefore);
+    m_dWaitTotal = 0;
+    m_dWaitMax = 0;
+    m_nAcquisitions = 0;
+    m_nContended = 0;
+    m_bRunning = true;
+
+    threads.push_back(std::thread(&CContentionTest::poller, this));
+    for(i = 0; i < m_nReaders; i++)
+        threads.push_back(std::thread(&CContentionTest::reader, this, bCached, std::ref(latencies[i])));
+    std::this_thread::sleep_for(std::chrono::seconds(m_nRunTime));
+    m_bRunning = false;
+    for(i = 0; i < int(threads.size()); i++)
+        threads[i].join();
+
+    m_NexDome.getMetrics().getCounters(countersAfter);
+    results.readLatencies.clear();
+    for(i = 0; i < m_nReaders; i++)
+        results.readLatencies.insert(results.readLatencies.end(), latencies[i].begin(), latencies[i].end());
+    std::sort(results.readLatencies.begin(), results.readLatencies.end());
+    results.dWaitTotal = m_dWaitTotal;
+    results.dWaitMax = m_dWaitMax;
+    results.nAcquisitions = m_nAcquisitions;
+    results.nContended = m_nContended;
+    results.nCommands = countersAfter.nCommands - countersBefore.nCommands;
+}
+
+static double percentile(const std::vector<double> &sorted, double dPercent)
+{
+    if(sorted.empty())
+        return 0;
+    return sorted[std::min(sorted.size() - 1, size_t(dPercent / 100.0 * sorted.size()))];
+}
+
+static void printResults(const char *pszName, const RunResults &results)
+{
+    printf("%-7s reads %6zu  p50 %8.3f ms  p99 %8.3f ms  max %8.3f ms | mutex %6llu acq %6llu contended  wait %8.3f s  max %8.3f ms | %llu commands\n",
+           pszName, results.readLatencies.size(),
+           percentile(results.readLatencies, 50) * 1000.0, percentile(results.readLatencies, 99) * 1000.0,
+           results.readLatencies.empty() ? 0 : results.readLatencies.back() * 1000.0,
+           (unsigned long long)results.nAcquisitions, (unsigned long long)results.nContended,
+           results.dWaitTotal, results.dWaitMax * 1000.0, (unsigned long long)results.nCommands);
+}
+
+int main(int argc, char *argv[])
+{
+    CContentionTest test;
+    RunResults locked, cached;
+    int nOpt;
+    int nErr;
+
+    while((nOpt = getopt(argc, argv, "t:r:")) != -1) {
+        switch(nOpt) {
+            case 't' : test.setRunTime(atoi(optarg)); break;
+            case 'r' : test.setReaders(atoi(optarg)); break;
+            default :
+                fprintf(stderr, "usage : %s [-t seconds per run] [-r readers] serial_port\n", argv[0]);
+                return 1;
+        }
+    }
+    if(optind >= argc) {
+        fprintf(stderr, "usage : %s [-t seconds per run] [-r readers] serial_port\n", argv[0]);
+        return 1;
+    }
+
+    nErr = test.connect(argv[optind]);
+    if(nErr) {
+        fprintf(stderr, "Error connecting to %s : %d\n", argv[optind], nErr);
+        return 1;
+    }
+
+    test.run(false, locked);
+    test.run(true, cached);
+    test.disconnect();
+
+    printResults("locked", locked);
+    printResults("cached", cached);
+    return 0;
+}
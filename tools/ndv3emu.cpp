@@ -0,0 +1,469 @@
+//
+//  ndv3emu.cpp
+//
+//  NexDome V3 tools
+//  Rotator controller emulator on a pseudo terminal, to run the plugin and the tools without a dome.
+//
+//  Slews follow a trapezoidal profile at the speed and acceleration set with @VWR / @AWR, stream P lines and
+//  end with a :SER. The home sensor reports a :SER with the at home flag when it's crossed, at a slightly
+//  different place going up and going down, and the dome can really take a different number of steps per
+//  revolution than the controller is set to (-t), for the calibration.
+//  Setting a speed above -S makes the controller go silent partway through the next slew (stall), an
+//  acceleration above -O makes it overshoot the target by (acceleration - limit) * 2 steps before settling.
+//  @OPS / @CLS take EMU_SHUTTER_TIME and end with a :SES.
+//
+//  The name of the pseudo terminal is printed on stdout, give it to the plugin or the tools as the serial port.
+//  With -l it's also linked there. SIGUSR1 unplugs the adapter : the pseudo terminal is closed, and a new one
+//  opened (and linked) EMU_UNPLUG_TIME later, the controller restarted with it. With -r it counts from 0 again.
+//
+//  usage : ndv3emu [-s steps per rev] [-t true steps per rev] [-v speed] [-a acceleration] [-S stall speed]
+//                  [-O overshoot acceleration] [-H home position] [-y hysteresis] [-x time scale] [-p P line ms]
+//                  [-l link] [-r]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+
+#include <algorithm>
+#include <string>
+
+#define EMU_DEFAULT_STEPS_PER_REV   55080
+#define EMU_DEFAULT_SPEED           2000    // steps/s
+#define EMU_DEFAULT_ACCELERATION    1500    // steps/s^2
+#define EMU_DEFAULT_HYSTERESIS      120     // steps
+#define EMU_DEFAULT_P_PERIOD        20      // ms between P lines during a slew
+#define EMU_SETTLE_TIME             0.3     // seconds, overshoot and back
+#define EMU_STALL_POINT             0.3     // fraction of the slew time where a stalled slew stops reporting
+#define EMU_TICK_MS                 2
+#define EMU_MAX_LINE                256
+#define EMU_UNPLUG_TIME             1       // seconds
+#define EMU_SHUTTER_TIME            5.0     // seconds to open or close
+#define EMU_SHUTTER_STEPS           46000
+
+static volatile sig_atomic_t g_bQuit = 0;
+static volatile sig_atomic_t g_bUnplug = 0;
+
+static void onSignal(int nSig)
+{
+    (void)nSig;
+    g_bQuit = 1;
+}
+
+static void onUnplug(int nSig)
+{
+    (void)nSig;
+    g_bUnplug = 1;
+}
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+class CRotatorEmulator
+{
+public:
+    CRotatorEmulator();
+
+    int     open();
+    void    run();
+
+    int     m_nStepsPerRev;     // what the controller is set to, positions wrap at this
+    int     m_nTrueStepsPerRev; // what the dome takes to go round
+    int     m_nSpeed;
+    int     m_nAcceleration;
+    int     m_nStallSpeed;      // 0 for none
+    int     m_nOvershootAcceleration;
+    int     m_nHomePos;
+    int     m_nHysteresis;
+    double  m_dTimeScale;
+    int     m_nPPeriodMs;
+    std::string m_sLink;        // symlink to the pseudo terminal, empty for none
+    bool    m_bResetCount;      // the step count is lost when the controller restarts
+
+protected:
+    void    unplug();
+    void    handleCommand(const std::string &sCmd);
+    void    startSlew(int nDistance);
+    void    updateSlew();
+    void    checkHomeSensor(double dFrom, double dTo);
+    void    send(const char *pszFormat, ...);
+    int     reportedPos() { return wrapCounter(m_dPos); }
+    int     wrapCounter(double dTruePos) { return ((int(floor(dTruePos + m_dCounterOffset + 0.5)) % m_nStepsPerRev) + m_nStepsPerRev) % m_nStepsPerRev; }
+    bool    isAtHome();
+
+    int         m_nMasterFd;
+    std::string m_sRxBuf;
+
+    double  m_dPos;             // true steps, doesn't wrap
+    double  m_dCounterOffset;   // what the controller counts minus m_dPos, @PWR changes it
+    bool    m_bMoving;
+    bool    m_bHoming;          // the count is set to the home position on the sensor
+    bool    m_bShutterOpen;     // where it is, or going
+    bool    m_bShutterMoving;
+    double  m_dShutterEnd;
+    double  m_dStartTime;
+    double  m_dStartPos;
+    double  m_dDistance;        // steps, positive
+    int     m_nDir;
+    double  m_dAccelTime;       // profile of the current slew
+    double  m_dCruiseTime;
+    double  m_dPeakSpeed;
+    double  m_dOvershoot;
+    bool    m_bStalled;
+    double  m_dLastPLine;
+};
+
+CRotatorEmulator::CRotatorEmulator()
+{
+    m_nStepsPerRev = EMU_DEFAULT_STEPS_PER_REV;
+    m_nTrueStepsPerRev = 0;
+    m_nSpeed = EMU_DEFAULT_SPEED;
+    m_nAcceleration = EMU_DEFAULT_ACCELERATION;
+    m_nStallSpeed = 0;
+    m_nOvershootAcceleration = 0;
+    m_nHomePos = 0;
+    m_nHysteresis = EMU_DEFAULT_HYSTERESIS;
+    m_dTimeScale = 1.0;
+    m_nPPeriodMs = EMU_DEFAULT_P_PERIOD;
+    m_bResetCount = false;
+
+    m_nMasterFd = -1;
+    m_dPos = 1000;
+    m_dCounterOffset = 0;
+    m_bMoving = false;
+    m_bHoming = false;
+    m_bShutterOpen = false;
+    m_bShutterMoving = false;
+    m_dShutterEnd = 0;
+    m_dStartTime = 0;
+    m_dStartPos = 0;
+    m_dDistance = 0;
+    m_nDir = 1;
+    m_dAccelTime = 0;
+    m_dCruiseTime = 0;
+    m_dPeakSpeed = 0;
+    m_dOvershoot = 0;
+    m_bStalled = false;
+    m_dLastPLine = 0;
+}
+
+int CRotatorEmulator::open()
+{
+    struct termios tio;
+
+    if(!m_nTrueStepsPerRev)
+        m_nTrueStepsPerRev = m_nStepsPerRev;
+
+    m_nMasterFd = posix_openpt(O_RDWR | O_NOCTTY);
+    if(m_nMasterFd < 0 || grantpt(m_nMasterFd) || unlockpt(m_nMasterFd))
+        return -1;
+    // raw, the plugin sees exactly what the firmware would send
+    tcgetattr(m_nMasterFd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(m_nMasterFd, TCSANOW, &tio);
+    printf("%s\n", ptsname(m_nMasterFd));
+    fflush(stdout);
+    if(m_sLink.size()) {
+        unlink(m_sLink.c_str());
+        if(symlink(ptsname(m_nMasterFd), m_sLink.c_str()))
+            return -1;
+    }
+    return 0;
+}
+
+// the controller loses the move in progress, not its position unless -r
+void CRotatorEmulator::unplug()
+{
+    close(m_nMasterFd);
+    if(m_sLink.size())
+        unlink(m_sLink.c_str());
+    m_bMoving = false;
+    if(m_bResetCount)
+        m_dCounterOffset = -m_dPos;
+    m_sRxBuf.clear();
+    sleep(EMU_UNPLUG_TIME);
+    if(open())
+        g_bQuit = 1;
+}
+
+void CRotatorEmulator::send(const char *pszFormat, ...)
+{
+    char szBuf[EMU_MAX_LINE];
+    va_list args;
+    int nLen;
+
+    va_start(args, pszFormat);
+    nLen = vsnprintf(szBuf, EMU_MAX_LINE, pszFormat, args);
+    va_end(args);
+    if(nLen > 0)
+        (void)write(m_nMasterFd, szBuf, size_t(std::min(nLen, EMU_MAX_LINE - 1)));
+}
+
+bool CRotatorEmulator::isAtHome()
+{
+    int nTruePos = ((int(floor(m_dPos + 0.5)) % m_nTrueStepsPerRev) + m_nTrueStepsPerRev) % m_nTrueStepsPerRev;
+    return abs(nTruePos - m_nHomePos) < m_nHysteresis;
+}
+
+void CRotatorEmulator::run()
+{
+    struct pollfd pfd;
+    char szBuf[EMU_MAX_LINE];
+    ssize_t nRead;
+    size_t nPos;
+
+    while(!g_bQuit) {
+        if(g_bUnplug) {
+            g_bUnplug = 0;
+            unplug();
+            continue;
+        }
+        pfd.fd = m_nMasterFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if(poll(&pfd, 1, EMU_TICK_MS) < 0 && errno != EINTR)
+            break;
+
+        if(m_bMoving)
+            updateSlew();
+        if(m_bShutterMoving && now() >= m_dShutterEnd) {
+            m_bShutterMoving = false;
+            send(":SES,%d,%d,%d,%d#\n", m_bShutterOpen ? EMU_SHUTTER_STEPS : 0, EMU_SHUTTER_STEPS, m_bShutterOpen?1:0, m_bShutterOpen?0:1);
+        }
+
+        if(!(pfd.revents & POLLIN))
+            continue;
+        nRead = read(m_nMasterFd, szBuf, sizeof(szBuf));
+        if(nRead <= 0)
+            continue;
+        m_sRxBuf.append(szBuf, size_t(nRead));
+        while((nPos = m_sRxBuf.find('\n')) != std::string::npos) {
+            std::string sLine = m_sRxBuf.substr(0, nPos);
+            m_sRxBuf.erase(0, nPos + 1);
+            while(sLine.size() && (sLine[sLine.size()-1] == '\r' || sLine[sLine.size()-1] == ' '))
+                sLine.erase(sLine.size()-1);
+            if(sLine.size() > 1 && sLine[0] == '@')
+                handleCommand(sLine);
+        }
+        if(m_sRxBuf.size() > EMU_MAX_LINE)
+            m_sRxBuf.clear();
+    }
+}
+
+void CRotatorEmulator::handleCommand(const std::string &sCmd)
+{
+    std::string sVerb = sCmd.substr(1, 3);
+    size_t nComma = sCmd.find(',');
+    int nArg = nComma != std::string::npos ? atoi(sCmd.c_str() + nComma + 1) : 0;
+    int nTarget;
+
+    if(sVerb == "FRR")
+        send(":FRR3.2.0#\n");
+    else if(sVerb == "RRR")
+        send(":RRR%d#\n", m_nStepsPerRev);
+    else if(sVerb == "HRR")
+        send(":HRR%d#\n", m_nHomePos);
+    else if(sVerb == "DRR")
+        send(":DRR300#\n");
+    else if(sVerb == "PRR")
+        send(":PRR%d#\n", reportedPos());
+    else if(sVerb == "PRS")
+        send(":PRS0#\n");
+    else if(sVerb == "SRR")
+        send(":SER,%d,%d,%d,%d,300#\n", reportedPos(), isAtHome()?1:0, m_nStepsPerRev, m_nHomePos);
+    else if(sVerb == "SRS") {
+        if(m_bShutterMoving)
+            send(":SES,%d,%d,0,0#\n", EMU_SHUTTER_STEPS / 2, EMU_SHUTTER_STEPS);
+        else
+            send(":SES,%d,%d,%d,%d#\n", m_bShutterOpen ? EMU_SHUTTER_STEPS : 0, EMU_SHUTTER_STEPS, m_bShutterOpen?1:0, m_bShutterOpen?0:1);
+    }
+    else if(sVerb == "VRR")
+        send(":VRR%d#\n", m_nSpeed);
+    else if(sVerb == "ARR")
+        send(":ARR%d#\n", m_nAcceleration);
+    else if(sVerb == "SWR") {
+        // stops where it is, a stalled controller wakes up
+        m_bMoving = false;
+        m_bHoming = false;
+        send(":SWR#\n:SER,%d,%d,%d,%d,300#\n", reportedPos(), isAtHome()?1:0, m_nStepsPerRev, m_nHomePos);
+    }
+    else {
+        if(sVerb == "RWR" && nArg > 0)
+            m_nStepsPerRev = nArg;
+        else if(sVerb == "VWR" && nArg > 0)
+            m_nSpeed = nArg;
+        else if(sVerb == "AWR" && nArg > 0)
+            m_nAcceleration = nArg;
+        else if(sVerb == "PWR")
+            m_dCounterOffset += nArg - reportedPos();
+        else if(sVerb == "HWR")
+            m_nHomePos = nArg;
+        else if(sVerb == "OPS" || sVerb == "CLS") {
+            // the shutter moves on its own, whatever the rotator does
+            m_bShutterOpen = sVerb == "OPS";
+            m_bShutterMoving = true;
+            m_dShutterEnd = now() + EMU_SHUTTER_TIME / m_dTimeScale;
+        }
+        else if(sVerb == "SWS")
+            m_bShutterMoving = false;
+        send(":%s#\n", sVerb.c_str());
+        // the shortest way to the target, like the firmware
+        if(sVerb == "GSR" || sVerb == "GAR") {
+            if(sVerb == "GSR")
+                nTarget = nArg;
+            else
+                nTarget = int(nArg * double(m_nStepsPerRev) / 360.0);
+            nTarget = ((nTarget - reportedPos() + m_nStepsPerRev / 2) % m_nStepsPerRev + m_nStepsPerRev) % m_nStepsPerRev - m_nStepsPerRev / 2;
+            startSlew(nTarget);
+            m_bHoming = false;
+        }
+        else if(sVerb == "GHR") {
+            // to the sensor, whatever the count says
+            nTarget = m_nHomePos - ((int(floor(m_dPos + 0.5)) % m_nTrueStepsPerRev) + m_nTrueStepsPerRev) % m_nTrueStepsPerRev;
+            nTarget = ((nTarget + m_nTrueStepsPerRev / 2) % m_nTrueStepsPerRev + m_nTrueStepsPerRev) % m_nTrueStepsPerRev - m_nTrueStepsPerRev / 2;
+            startSlew(nTarget);
+            m_bHoming = true;
+        }
+    }
+}
+
+void CRotatorEmulator::startSlew(int nDistance)
+{
+    double dAccelDistance;
+
+    m_dStartTime = now();
+    m_dStartPos = m_dPos;
+    m_dDistance = fabs(double(nDistance));
+    m_nDir = nDistance >= 0 ? 1 : -1;
+    m_dPeakSpeed = m_nSpeed;
+    m_dAccelTime = m_dPeakSpeed / m_nAcceleration;
+    dAccelDistance = 0.5 * m_nAcceleration * m_dAccelTime * m_dAccelTime;
+    if(2 * dAccelDistance > m_dDistance) {
+        // triangular, never reaches full speed
+        m_dAccelTime = sqrt(m_dDistance / m_nAcceleration);
+        m_dPeakSpeed = m_nAcceleration * m_dAccelTime;
+        m_dCruiseTime = 0;
+    }
+    else
+        m_dCruiseTime = (m_dDistance - 2 * dAccelDistance) / m_dPeakSpeed;
+    m_dOvershoot = m_nOvershootAcceleration && m_nAcceleration > m_nOvershootAcceleration ? (m_nAcceleration - m_nOvershootAcceleration) * 2.0 : 0;
+    m_bStalled = m_nStallSpeed && m_nSpeed > m_nStallSpeed;
+    m_bMoving = true;
+}
+
+void CRotatorEmulator::updateSlew()
+{
+    double dT = (now() - m_dStartTime) * m_dTimeScale;
+    double dTotal = 2 * m_dAccelTime + m_dCruiseTime;
+    double dDone;
+    double dDecel;
+    double dOldPos = m_dPos;
+
+    if(m_bStalled && dT > dTotal * EMU_STALL_POINT)
+        return;
+
+    if(dT >= dTotal + (m_dOvershoot > 0 ? EMU_SETTLE_TIME : 0)) {
+        m_dPos = m_dStartPos + m_nDir * m_dDistance;
+        checkHomeSensor(dOldPos, m_dPos);
+        m_bMoving = false;
+        if(m_bHoming)
+            m_dCounterOffset = m_nHomePos - m_dPos;
+        m_bHoming = false;
+        send("P%d\n:SER,%d,%d,%d,%d,300#\n", reportedPos(), reportedPos(), isAtHome()?1:0, m_nStepsPerRev, m_nHomePos);
+        return;
+    }
+
+    if(dT < m_dAccelTime)
+        dDone = 0.5 * m_nAcceleration * dT * dT;
+    else if(dT < m_dAccelTime + m_dCruiseTime)
+        dDone = 0.5 * m_dPeakSpeed * m_dAccelTime + m_dPeakSpeed * (dT - m_dAccelTime);
+    else if(dT < dTotal) {
+        dDecel = dTotal - dT;
+        dDone = m_dDistance - 0.5 * m_nAcceleration * dDecel * dDecel;
+    }
+    else
+        dDone = m_dDistance + m_dOvershoot * sin(M_PI * (dT - dTotal) / EMU_SETTLE_TIME);
+    m_dPos = m_dStartPos + m_nDir * dDone;
+    checkHomeSensor(dOldPos, m_dPos);
+
+    if((now() - m_dLastPLine) * 1000.0 >= m_nPPeriodMs) {
+        send("P%d\n", reportedPos());
+        m_dLastPLine = now();
+    }
+}
+
+void CRotatorEmulator::checkHomeSensor(double dFrom, double dTo)
+{
+    double dLow = std::min(dFrom, dTo);
+    double dHigh = std::max(dFrom, dTo);
+    double dEdge;
+    long nRev;
+
+    if(dFrom == dTo)
+        return;
+    // the sensor triggers at the home position going up and a bit before it going down
+    for(nRev = long(floor((dLow - m_nHomePos) / m_nTrueStepsPerRev)) - 1; nRev <= long(floor((dHigh - m_nHomePos) / m_nTrueStepsPerRev)) + 1; nRev++) {
+        dEdge = m_nHomePos + double(nRev) * m_nTrueStepsPerRev - (dTo > dFrom ? 0 : m_nHysteresis);
+        if(dEdge > dLow && dEdge <= dHigh)
+            send(":SER,%d,1,%d,%d,300#\n", wrapCounter(dEdge), m_nStepsPerRev, m_nHomePos);
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    CRotatorEmulator emulator;
+    int nOpt;
+
+    while((nOpt = getopt(argc, argv, "s:t:v:a:S:O:H:y:x:p:l:r")) != -1) {
+        switch(nOpt) {
+            case 's' : emulator.m_nStepsPerRev = atoi(optarg); break;
+            case 't' : emulator.m_nTrueStepsPerRev = atoi(optarg); break;
+            case 'v' : emulator.m_nSpeed = atoi(optarg); break;
+            case 'a' : emulator.m_nAcceleration = atoi(optarg); break;
+            case 'S' : emulator.m_nStallSpeed = atoi(optarg); break;
+            case 'O' : emulator.m_nOvershootAcceleration = atoi(optarg); break;
+            case 'H' : emulator.m_nHomePos = atoi(optarg); break;
+            case 'y' : emulator.m_nHysteresis = atoi(optarg); break;
+            case 'x' : emulator.m_dTimeScale = atof(optarg); break;
+            case 'p' : emulator.m_nPPeriodMs = atoi(optarg); break;
+            case 'l' : emulator.m_sLink.assign(optarg); break;
+            case 'r' : emulator.m_bResetCount = true; break;
+            default :
+                fprintf(stderr, "usage : %s [-s steps per rev] [-t true steps per rev] [-v speed] [-a acceleration] [-S stall speed]\n"
+                                "        [-O overshoot acceleration] [-H home position] [-y hysteresis] [-x time scale] [-p P line ms]\n"
+                                "        [-l link] [-r]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(emulator.m_nStepsPerRev <= 0 || emulator.m_nSpeed <= 0 || emulator.m_nAcceleration <= 0 || emulator.m_dTimeScale <= 0) {
+        fprintf(stderr, "ndv3emu : steps per rev, speed, acceleration and time scale must be positive\n");
+        return 1;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGUSR1, onUnplug);
+
+    if(emulator.open()) {
+        fprintf(stderr, "ndv3emu : can't open a pseudo terminal : %s\n", strerror(errno));
+        return 1;
+    }
+    emulator.run();
+    if(emulator.m_sLink.size())
+        unlink(emulator.m_sLink.c_str());
+    return 0;
+}
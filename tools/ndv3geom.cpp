@@ -0,0 +1,398 @@
+//
+//  ndv3geom.cpp
+//
+//  NexDome V3 tools
+//  Dome azimuth from the telescope pointing with CDomeGeometry, no controller needed.
+//
+//  point : dome azimuth and slit altitude for one hour angle/declination (-H -D) or one altitude/azimuth (-A -Z).
+//  check : the batched calls and the trajectory have to match the one point call, and a mount in the center of
+//          the dome with no OTA offset has to give the telescope azimuth back, also through haDecFromAltAz.
+//  bench : a night of 1s samples as one trajectory call, as one azimuthsFromHaDec call and point by point.
+//  follow: targets from HA -h/2 to +h/2 at several declinations, followed with CDomeFollowPlanner (path
+//          sampled every -t seconds like the driver does) and with naive slaving (a goto to the target
+//          every -U seconds when it's more than the dead zone away). Moves per hour, motor on time per
+//          hour with a trapezoidal move (-V degrees/s, -C degrees/s^2), and the time the beam is blocked
+//          checked every second, a move only counts once it's over.
+//
+//  Geometry : -l latitude -r dome radius -e -n -u mount east/north/up from the dome center -o OTA offset
+//             -w OTA side (-1 east of pier, 1 west of pier), lengths in any one unit.
+//
+//  usage : ndv3geom point [geometry] (-H hour angle -D declination | -A altitude -Z azimuth)
+//          ndv3geom check [geometry]
+//          ndv3geom bench [geometry] [-c samples]
+//          ndv3geom follow [geometry] [-s slit width] [-a aperture] [-d dead zone] [-L lead seconds] [-t step seconds]
+//                          [-U update seconds] [-V speed] [-C acceleration] [-h hours]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "../DomeGeometry.h"
+#include "../DomeFollow.h"
+#include "../StopWatch.h"
+
+#define GEOM_DEFAULT_LATITUDE   45.5
+#define GEOM_DEFAULT_RADIUS     1.12    // m, NexDome 2.2 m
+#define GEOM_DEFAULT_SAMPLES    36000   // 10 hours at 1s
+#define GEOM_BENCH_RUNS         20
+#define GEOM_CHECK_TOLERANCE    1e-7    // degrees
+#define FOLLOW_SLIT_WIDTH       0.56    // m
+#define FOLLOW_APERTURE         0.2     // m
+#define FOLLOW_DEAD_ZONE        0.5     // degrees
+#define FOLLOW_PLAN_STEP        10.0    // seconds, FOLLOW_STEP_SECONDS in the driver
+#define FOLLOW_NAIVE_UPDATE     5.0     // seconds
+#define FOLLOW_SPEED            13.0    // degrees/s, 2000 steps/s at 55080 steps/rev
+#define FOLLOW_ACCELERATION     9.8     // degrees/s^2
+#define FOLLOW_HOURS            6.0
+
+typedef struct {
+    double  dSpeed;
+    double  dAcceleration;
+    double  dNaiveUpdate;
+    double  dStep;
+    double  dHours;
+} FollowSimulation;
+
+typedef struct {
+    int     nMoves;
+    double  dMotorSeconds;
+    double  dBlockedSeconds;
+} FollowResult;
+
+static double azDiff(double dA, double dB)
+{
+    double dDiff = fmod(dA - dB + 540.0, 360.0) - 180.0;
+    return fabs(dDiff);
+}
+
+static int check(const CDomeGeometry &geometry, int nOtaSide)
+{
+    DomeGeometryConfig config = geometry.getConfig();
+    CDomeGeometry centered;
+    std::vector<double> dHa, dDec, dAz, dAlt, dTrajAz, dTrajAlt;
+    double dDomeAz, dSlitAlt, dMax = 0, dMaxAlt = 0, dMaxCentered = 0;
+    double dAlt1, dAz1, dHa1, dDec1;
+    int nErrors = 0;
+    int i;
+
+    if(!geometry.azimuthFromHaDec(0, 0, nOtaSide, dDomeAz, dSlitAlt)) {
+        printf("telescope outside the dome\n");
+        return 1;
+    }
+
+    // batched vs one point at a time
+    for(i = 0; i < 2000; i++) {
+        dHa.push_back(-180.0 + 360.0 * (double)rand() / RAND_MAX);
+        dDec.push_back(-89.0 + 178.0 * (double)rand() / RAND_MAX);
+    }
+    dAz.resize(dHa.size());
+    dAlt.resize(dHa.size());
+    geometry.azimuthsFromHaDec(&dHa[0], &dDec[0], nOtaSide, int(dHa.size()), &dAz[0], &dAlt[0]);
+    for(i = 0; i < int(dHa.size()); i++) {
+        geometry.azimuthFromHaDec(dHa[i], dDec[i], nOtaSide, dDomeAz, dSlitAlt);
+        dMax = std::max(dMax, azDiff(dAz[i], dDomeAz));
+        dMaxAlt = std::max(dMaxAlt, fabs(dAlt[i] - dSlitAlt));
+    }
+    printf("batched vs point      : az %.2e alt %.2e\n", dMax, dMaxAlt);
+    nErrors += dMax > GEOM_CHECK_TOLERANCE || dMaxAlt > GEOM_CHECK_TOLERANCE;
+
+    // trajectory vs one point at a time, 10 hours at 1s
+    dTrajAz.resize(GEOM_DEFAULT_SAMPLES);
+    dTrajAlt.resize(GEOM_DEFAULT_SAMPLES);
+    geometry.trajectory(30.0, 20.0, nOtaSide, 330.0, 1.0, GEOM_DEFAULT_SAMPLES, &dTrajAz[0], &dTrajAlt[0]);
+    dMax = dMaxAlt = 0;
+    for(i = 0; i < GEOM_DEFAULT_SAMPLES; i++) {
+        geometry.azimuthFromHaDec(300.0 + i * SIDEREAL_DEG_PER_SECOND, 20.0, nOtaSide, dDomeAz, dSlitAlt);
+        dMax = std::max(dMax, azDiff(dTrajAz[i], dDomeAz));
+        dMaxAlt = std::max(dMaxAlt, fabs(dTrajAlt[i] - dSlitAlt));
+    }
+    printf("trajectory vs point   : az %.2e alt %.2e\n", dMax, dMaxAlt);
+    nErrors += dMax > GEOM_CHECK_TOLERANCE || dMaxAlt > GEOM_CHECK_TOLERANCE;
+
+    // centered mount, the dome azimuth is the telescope azimuth
+    config.dMountEast = config.dMountNorth = config.dMountUp = config.dOtaOffset = 0;
+    centered.setConfig(config);
+    for(i = 0; i < 2000; i++) {
+        dAlt1 = 89.0 * (double)rand() / RAND_MAX;
+        dAz1 = 360.0 * (double)rand() / RAND_MAX;
+        centered.azimuthFromAltAz(dAlt1, dAz1, dDomeAz, dSlitAlt);
+        dMaxCentered = std::max(dMaxCentered, std::max(azDiff(dDomeAz, dAz1), fabs(dSlitAlt - dAlt1)));
+    }
+    printf("centered alt/az       : %.2e\n", dMaxCentered);
+    nErrors += dMaxCentered > GEOM_CHECK_TOLERANCE;
+
+    // alt/az to HA/Dec and back
+    dMaxCentered = 0;
+    for(i = 0; i < 2000; i++) {
+        dAlt1 = 89.0 * (double)rand() / RAND_MAX;
+        dAz1 = 360.0 * (double)rand() / RAND_MAX;
+        centered.haDecFromAltAz(dAlt1, dAz1, dHa1, dDec1);
+        centered.azimuthFromHaDec(dHa1, dDec1, OTA_NO_OFFSET, dDomeAz, dSlitAlt);
+        dMaxCentered = std::max(dMaxCentered, std::max(azDiff(dDomeAz, dAz1), fabs(dSlitAlt - dAlt1)));
+    }
+    printf("alt/az to HA/Dec      : %.2e\n", dMaxCentered);
+    nErrors += dMaxCentered > GEOM_CHECK_TOLERANCE;
+
+    // centered, the meridian at the equator is south at 90 - latitude
+    centered.azimuthFromHaDec(0, 0, OTA_NO_OFFSET, dDomeAz, dSlitAlt);
+    printf("centered HA 0 Dec 0   : az %.6f alt %.6f\n", dDomeAz, dSlitAlt);
+    nErrors += azDiff(dDomeAz, config.dLatitude >= 0 ? 180.0 : 0.0) > GEOM_CHECK_TOLERANCE || fabs(dSlitAlt - (90.0 - fabs(config.dLatitude))) > GEOM_CHECK_TOLERANCE;
+
+    printf("%s\n", nErrors ? "FAILED" : "OK");
+    return nErrors ? 1 : 0;
+}
+
+static int bench(const CDomeGeometry &geometry, int nOtaSide, int nSamples)
+{
+    std::vector<double> dHa(nSamples), dDec(nSamples, 20.0), dAz(nSamples), dAlt(nSamples);
+    CStopWatch timer;
+    double dTrajectory, dBatched, dPoint;
+    double dSum = 0;
+    int nRun, i;
+
+    for(i = 0; i < nSamples; i++)
+        dHa[i] = 300.0 + i * SIDEREAL_DEG_PER_SECOND;
+
+    timer.Reset();
+    for(nRun = 0; nRun < GEOM_BENCH_RUNS; nRun++) {
+        geometry.trajectory(30.0, 20.0, nOtaSide, 330.0, 1.0, nSamples, &dAz[0], &dAlt[0]);
+        dSum += dAz[nRun];
+    }
+    dTrajectory = timer.GetElapsedSeconds() / GEOM_BENCH_RUNS;
+
+    timer.Reset();
+    for(nRun = 0; nRun < GEOM_BENCH_RUNS; nRun++) {
+        geometry.azimuthsFromHaDec(&dHa[0], &dDec[0], nOtaSide, nSamples, &dAz[0], &dAlt[0]);
+        dSum += dAz[nRun];
+    }
+    dBatched = timer.GetElapsedSeconds() / GEOM_BENCH_RUNS;
+
+    timer.Reset();
+    for(nRun = 0; nRun < GEOM_BENCH_RUNS; nRun++) {
+        for(i = 0; i < nSamples; i++)
+            geometry.azimuthFromHaDec(dHa[i], dDec[i], nOtaSide, dAz[i], dAlt[i]);
+        dSum += dAz[nRun];
+    }
+    dPoint = timer.GetElapsedSeconds() / GEOM_BENCH_RUNS;
+
+    printf("%d samples\n", nSamples);
+    printf("trajectory        : %8.3f ms  %6.1f ns/sample\n", dTrajectory * 1e3, dTrajectory * 1e9 / nSamples);
+    printf("azimuthsFromHaDec : %8.3f ms  %6.1f ns/sample\n", dBatched * 1e3, dBatched * 1e9 / nSamples);
+    printf("point by point    : %8.3f ms  %6.1f ns/sample  (x%.2f)\n", dPoint * 1e3, dPoint * 1e9 / nSamples, dPoint / dTrajectory);
+    // keep the loops
+    if(dSum == 0.123456)
+        printf(" ");
+    return 0;
+}
+
+// trapezoidal, or triangular when it never gets to full speed
+static double moveSeconds(double dDegrees, const FollowSimulation &sim)
+{
+    dDegrees = fabs(dDegrees);
+    if(dDegrees < sim.dSpeed * sim.dSpeed / sim.dAcceleration)
+        return 2.0 * sqrt(dDegrees / sim.dAcceleration);
+    return dDegrees / sim.dSpeed + sim.dSpeed / sim.dAcceleration;
+}
+
+// replays the moves against the path every second, the planner has no guard here
+static void scoreMoves(const CDomeFollowPlanner &beam, const std::vector<FollowMove> &moves, const std::vector<double> &dAz,
+                       const std::vector<double> &dAlt, double dDomeAz, const FollowSimulation &sim, FollowResult &result)
+{
+    std::vector<double> dDone(moves.size());
+    double dBusyUntil = 0;
+    size_t nMove = 0;
+    int i;
+
+    // a move can't start before the previous one is over
+    for(i = 0; i < int(moves.size()); i++) {
+        dDone[i] = std::max(moves[i].dTime, dBusyUntil) + moveSeconds(moves[i].dDistance, sim);
+        dBusyUntil = dDone[i];
+        result.dMotorSeconds += moveSeconds(moves[i].dDistance, sim);
+    }
+    result.nMoves += int(moves.size());
+    for(i = 0; i < int(dAz.size()); i++) {
+        while(nMove < moves.size() && dDone[nMove] <= i)
+            dDomeAz = moves[nMove++].dAz;
+        if(!beam.isCovered(dDomeAz, dAz[i], dAlt[i]))
+            result.dBlockedSeconds += 1.0;
+    }
+}
+
+static int follow(const CDomeGeometry &geometry, int nOtaSide, const FollowConfig &config, const FollowSimulation &sim)
+{
+    const double dDecs[] = {-20, 0, 20, 40, 60, 80};
+    CDomeFollowPlanner planner;
+    CDomeFollowPlanner beam;
+    FollowConfig beamConfig = config;
+    std::vector<double> dAz, dAlt, dCoarseAz, dCoarseAlt, dNaiveAz, dNaiveAlt;
+    std::vector<FollowMove> moves;
+    FollowMove move;
+    FollowResult planned, naive, totalPlanned, totalNaive;
+    double dLst = 0;
+    double dRa = sim.dHours * 15.0 / 2.0;    // starts at HA -h/2
+    double dDomeAz;
+    double dTotalHours = 0;
+    int nSeconds = int(sim.dHours * 3600.0);
+    int i, j;
+
+    planner.setConfig(config);
+    beamConfig.dGuard = 0;
+    beam.setConfig(beamConfig);
+    memset(&totalPlanned, 0, sizeof(FollowResult));
+    memset(&totalNaive, 0, sizeof(FollowResult));
+    dAz.resize(nSeconds);
+    dAlt.resize(nSeconds);
+    dCoarseAz.resize(int(nSeconds / sim.dStep) + 1);
+    dCoarseAlt.resize(dCoarseAz.size());
+    dNaiveAz.resize(int(nSeconds / sim.dNaiveUpdate) + 1);
+    dNaiveAlt.resize(dNaiveAz.size());
+
+    printf("slit %.3f aperture %.3f dead zone %.2f deg, half width %.2f deg at 30 deg, %.2f at 60 deg\n",
+           config.dSlitWidth, config.dAperture, config.dDeadZone, planner.halfWidth(30.0), planner.halfWidth(60.0));
+    printf("  dec |    planned : moves/h  motor s/h  blocked |      naive : moves/h  motor s/h  blocked\n");
+    for(i = 0; i < int(sizeof(dDecs) / sizeof(dDecs[0])); i++) {
+        memset(&planned, 0, sizeof(FollowResult));
+        memset(&naive, 0, sizeof(FollowResult));
+        geometry.trajectory(dRa, dDecs[i], nOtaSide, dLst, 1.0, nSeconds, &dAz[0], &dAlt[0]);
+        geometry.trajectory(dRa, dDecs[i], nOtaSide, dLst, sim.dStep, int(dCoarseAz.size()), &dCoarseAz[0], &dCoarseAlt[0]);
+        geometry.trajectory(dRa, dDecs[i], nOtaSide, dLst, sim.dNaiveUpdate, int(dNaiveAz.size()), &dNaiveAz[0], &dNaiveAlt[0]);
+
+        // both start with the dome on the target
+        planner.plan(&dCoarseAz[0], &dCoarseAlt[0], int(dCoarseAz.size()), sim.dStep, dAz[0], moves);
+        scoreMoves(beam, moves, dAz, dAlt, dAz[0], sim, planned);
+
+        moves.clear();
+        dDomeAz = dAz[0];
+        for(j = 0; j < int(dNaiveAz.size()); j++) {
+            move.dDistance = CDomeFollowPlanner::azDistance(dDomeAz, dNaiveAz[j]);
+            if(fabs(move.dDistance) <= config.dDeadZone)
+                continue;
+            move.dTime = j * sim.dNaiveUpdate;
+            move.dAz = dNaiveAz[j];
+            move.dSlitAlt = dNaiveAlt[j];
+            moves.push_back(move);
+            dDomeAz = dNaiveAz[j];
+        }
+        scoreMoves(beam, moves, dAz, dAlt, dAz[0], sim, naive);
+
+        printf("%5.0f |            %8.1f  %9.1f  %6.2f%% |            %8.1f  %9.1f  %6.2f%%\n", dDecs[i],
+               planned.nMoves / sim.dHours, planned.dMotorSeconds / sim.dHours, 100.0 * planned.dBlockedSeconds / nSeconds,
+               naive.nMoves / sim.dHours, naive.dMotorSeconds / sim.dHours, 100.0 * naive.dBlockedSeconds / nSeconds);
+        totalPlanned.nMoves += planned.nMoves;
+        totalPlanned.dMotorSeconds += planned.dMotorSeconds;
+        totalPlanned.dBlockedSeconds += planned.dBlockedSeconds;
+        totalNaive.nMoves += naive.nMoves;
+        totalNaive.dMotorSeconds += naive.dMotorSeconds;
+        totalNaive.dBlockedSeconds += naive.dBlockedSeconds;
+        dTotalHours += sim.dHours;
+    }
+    printf("  all |            %8.1f  %9.1f  %6.2f%% |            %8.1f  %9.1f  %6.2f%%\n",
+           totalPlanned.nMoves / dTotalHours, totalPlanned.dMotorSeconds / dTotalHours, 100.0 * totalPlanned.dBlockedSeconds / (dTotalHours * 3600.0),
+           totalNaive.nMoves / dTotalHours, totalNaive.dMotorSeconds / dTotalHours, 100.0 * totalNaive.dBlockedSeconds / (dTotalHours * 3600.0));
+    return 0;
+}
+
+static void usage(const char *pszName)
+{
+    fprintf(stderr, "usage : %s point [geometry] (-H hour angle -D declination | -A altitude -Z azimuth)\n"
+                    "        %s check [geometry]\n"
+                    "        %s bench [geometry] [-c samples]\n"
+                    "        %s follow [geometry] [-s slit width] [-a aperture] [-d dead zone] [-L lead seconds] [-t step seconds]\n"
+                    "                  [-U update seconds] [-V speed] [-C acceleration] [-h hours]\n"
+                    "geometry : [-l latitude] [-r dome radius] [-e mount east] [-n mount north] [-u mount up] [-o OTA offset] [-w OTA side]\n",
+                    pszName, pszName, pszName, pszName);
+}
+
+int main(int argc, char *argv[])
+{
+    DomeGeometryConfig config;
+    CDomeGeometry geometry;
+    FollowConfig followConfig;
+    FollowSimulation sim;
+    double dHa = NAN, dDec = NAN, dAlt = NAN, dAz = NAN;
+    double dDomeAz, dSlitAlt;
+    int nOtaSide = OTA_WEST_OF_PIER;
+    int nSamples = GEOM_DEFAULT_SAMPLES;
+    bool bOk;
+    int nOpt;
+
+    memset(&config, 0, sizeof(DomeGeometryConfig));
+    config.dLatitude = GEOM_DEFAULT_LATITUDE;
+    config.dDomeRadius = GEOM_DEFAULT_RADIUS;
+    followConfig = CDomeFollowPlanner().getConfig();
+    followConfig.dSlitWidth = FOLLOW_SLIT_WIDTH;
+    followConfig.dAperture = FOLLOW_APERTURE;
+    followConfig.dDeadZone = FOLLOW_DEAD_ZONE;
+    sim.dSpeed = FOLLOW_SPEED;
+    sim.dAcceleration = FOLLOW_ACCELERATION;
+    sim.dNaiveUpdate = FOLLOW_NAIVE_UPDATE;
+    sim.dStep = FOLLOW_PLAN_STEP;
+    sim.dHours = FOLLOW_HOURS;
+
+    if(argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    optind = 2;
+    while((nOpt = getopt(argc, argv, "l:r:e:n:u:o:w:H:D:A:Z:c:s:a:d:L:t:U:V:C:h:")) != -1) {
+        switch(nOpt) {
+            case 'l' : config.dLatitude = atof(optarg); break;
+            case 'r' : config.dDomeRadius = atof(optarg); break;
+            case 'e' : config.dMountEast = atof(optarg); break;
+            case 'n' : config.dMountNorth = atof(optarg); break;
+            case 'u' : config.dMountUp = atof(optarg); break;
+            case 'o' : config.dOtaOffset = atof(optarg); break;
+            case 'w' : nOtaSide = atoi(optarg); break;
+            case 'H' : dHa = atof(optarg); break;
+            case 'D' : dDec = atof(optarg); break;
+            case 'A' : dAlt = atof(optarg); break;
+            case 'Z' : dAz = atof(optarg); break;
+            case 'c' : nSamples = atoi(optarg); break;
+            case 's' : followConfig.dSlitWidth = atof(optarg); break;
+            case 'a' : followConfig.dAperture = atof(optarg); break;
+            case 'd' : followConfig.dDeadZone = atof(optarg); break;
+            case 'L' : followConfig.dLeadSeconds = atof(optarg); break;
+            case 't' : sim.dStep = atof(optarg); break;
+            case 'U' : sim.dNaiveUpdate = atof(optarg); break;
+            case 'V' : sim.dSpeed = atof(optarg); break;
+            case 'C' : sim.dAcceleration = atof(optarg); break;
+            case 'h' : sim.dHours = atof(optarg); break;
+            default :
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    geometry.setConfig(config);
+
+    if(!strcmp(argv[1], "point")) {
+        if(!isnan(dHa) && !isnan(dDec))
+            bOk = geometry.azimuthFromHaDec(dHa, dDec, nOtaSide, dDomeAz, dSlitAlt);
+        else if(!isnan(dAlt) && !isnan(dAz))
+            bOk = geometry.azimuthFromAltAz(dAlt, dAz, dDomeAz, dSlitAlt);
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+        if(!bOk) {
+            printf("telescope outside the dome\n");
+            return 1;
+        }
+        printf("dome az %.3f slit alt %.3f\n", dDomeAz, dSlitAlt);
+        return 0;
+    }
+    if(!strcmp(argv[1], "check"))
+        return check(geometry, nOtaSide);
+    if(!strcmp(argv[1], "bench") && nSamples > GEOM_BENCH_RUNS)
+        return bench(geometry, nOtaSide, nSamples);
+    if(!strcmp(argv[1], "follow") && sim.dStep > 0 && sim.dNaiveUpdate > 0 && sim.dHours > 0 && sim.dSpeed > 0 && sim.dAcceleration > 0) {
+        followConfig.dDomeRadius = config.dDomeRadius;
+        return follow(geometry, nOtaSide, followConfig, sim);
+    }
+    usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,1130 @@
+//
+//  ndv3hub.cpp
+//
+//  NexDome V3 tools (Linux only)
+//  Drives any number of controller links from a single thread. Every link is a non-blocking file
+//  descriptor on one epoll loop with its own small state machine (boot, identify, ready), so adding
+//  domes adds neither threads nor blocked reads, only a few bytes of state and a bit of parsing.
+//
+//  usage : ndv3hub [-s socket] [-T] serial_port [serial_port ...]
+//          ndv3hub -B max_domes [-t seconds per step]
+//
+//  -T publishes each dome in the shared memory segment /NexDomeV3.hub<n> (see DomeTelemetry.h).
+//  -B runs the scaling benchmark, emulated controllers on ptys all kept moving, for 1, 2, 4 ... max_domes.
+//
+//  Control protocol on the Unix socket, one line per request :
+//      LIST                    -> OK <number of domes>
+//      <n> STATE               -> OK <az> <moving> <volts> <link state>
+//      <n> GOTO <az> | ABORT | HOME
+//                              -> OK or ERR <reason>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+
+#include <atomic>
+#include <string>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include "../NexDomeV3.h"
+#include "../DomeTelemetry.h"
+
+#define HUB_DEFAULT_SOCKET      "/tmp/ndv3hub.sock"
+#define HUB_TICK_MS             10
+#define HUB_BOOT_DELAY_MS       2000    // the arduino reboots when the port is opened
+#define HUB_REPLY_TIMEOUT_MS    1000
+#define HUB_MAX_ATTEMPTS        3       // for the idempotent commands
+#define HUB_MAX_TIMEOUTS        5       // consecutive, before we reopen the port
+#define HUB_REOPEN_DELAY_MS     5000
+#define HUB_IDLE_POLL_MS        2000
+#define HUB_RX_BUFFER_SIZE      (SERIAL_BUFFER_SIZE * 4)
+#define HUB_MAX_EVENTS          64
+#define HUB_LATENCY_BUCKETS     1001    // 1 ms buckets, the last one is everything above 1 s
+
+#define EMU_STEPS_PER_REV       55080
+#define EMU_STEPS_PER_SEC       900     // about a minute per turn
+#define EMU_REPORT_MS           100     // P<pos> period while moving
+
+enum HubSessionStates {SESSION_CLOSED = 0, SESSION_BOOT, SESSION_IDENTIFY, SESSION_READY};
+enum HubEventSources {SRC_TIMER = 0, SRC_LISTEN, SRC_CLIENT, SRC_SESSION};
+
+static const char *kSessionStateNames[] = {"closed", "boot", "identify", "ready"};
+
+static volatile sig_atomic_t g_bQuit = 0;
+
+static void onSignal(int nSig)
+{
+    (void)nSig;
+    g_bQuit = 1;
+}
+
+static uint64_t eventTag(int nSource, uint32_t nIndex)
+{
+    return (uint64_t(nSource) << 32) | nIndex;
+}
+
+static int setNonBlocking(int fd)
+{
+    int nFlags = fcntl(fd, F_GETFL, 0);
+    if(nFlags < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, nFlags | O_NONBLOCK);
+}
+
+static void setRaw(int fd)
+{
+    struct termios tty;
+
+    if(tcgetattr(fd, &tty) != 0)
+        return;
+    cfmakeraw(&tty);
+    cfsetispeed(&tty, B115200);
+    cfsetospeed(&tty, B115200);
+    tty.c_cflag |= (CLOCAL | CREAD);
+    tty.c_cflag &= ~(PARENB | PARODD | CSTOPB);
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &tty);
+}
+
+typedef struct {
+    std::string sCmd;
+    char        szVerb[4];
+    bool        bIdempotent;
+} HubCommand;
+
+typedef struct {
+    uint64_t    nLines;
+    uint64_t    nCommands;
+    uint64_t    nTimeouts;
+    uint64_t    nReopens;
+    uint64_t    nLatency[HUB_LATENCY_BUCKETS];
+} HubSessionStats;
+
+///////////////////////////////////////////////////////////////////////////////
+// One controller link, everything in here is non-blocking and driven by onReadable and onTick.
+class CHubSession
+{
+public:
+    CHubSession(int nIndex, const std::string &sPort, int nBootDelayMs);
+    ~CHubSession() { close(); delete m_pTelemetry; }
+
+    int     open(void);
+    void    close(void);
+    int     fd(void) { return m_fd; }
+    bool    wantsReopen(void) { return m_nState == SESSION_CLOSED && m_reopenTimer.GetElapsedMilliseconds() >= m_nReopenDelayMs; }
+
+    void    onReadable(void);
+    void    onTick(void);
+    void    onHangup(void) { failed(); }
+
+    int     gotoAz(double dAz);
+    int     abort(void);
+    int     home(void);
+    bool    isReady(void) { return m_nState == SESSION_READY; }
+    bool    isIdle(void) { return m_nState == SESSION_READY && !m_bMoving && !m_bPending && m_Queue.empty(); }
+    void    formatState(char *pszOut, int nMaxLen);
+
+    void    enableTelemetry(void);
+    const HubSessionStats &getStats(void) { return m_Stats; }
+    void    resetStats(void) { memset(&m_Stats, 0, sizeof(m_Stats)); }
+
+protected:
+    void    queueCommand(const char *pszCmd, bool bIdempotent, bool bFront = false);
+    void    sendNext(void);
+    void    flushTx(void);
+    void    handleLine(const char *pszLine);
+    void    handleReply(const char *pszLine);
+    void    failed(void);
+    void    setAzFromSteps(int nSteps);
+    void    publish(void);
+
+    int                     m_nIndex;
+    std::string             m_sPort;
+    int                     m_fd;
+    int                     m_nState;
+    int                     m_nBootDelayMs;
+    int                     m_nReopenDelayMs;
+
+    CResponseParser         m_Parser;       // keeps the partial line between two wakeups
+    std::string             m_sTx;          // what the port didn't take yet
+    std::deque<HubCommand>  m_Queue;
+    HubCommand              m_Pending;
+    bool                    m_bPending;
+    int                     m_nAttempts;
+    int                     m_nTimeouts;    // consecutive
+
+    CStopWatch              m_stateTimer;
+    CStopWatch              m_replyTimer;
+    CStopWatch              m_txTimer;      // pacing, CMD_WAIT_INTERVAL between commands
+    CStopWatch              m_pollTimer;
+    CStopWatch              m_reopenTimer;
+
+    int                     m_nStepsPerRev;
+    int                     m_nRotatorPos;
+    double                  m_dAz;
+    bool                    m_bMoving;
+    double                  m_dVolts;
+    int                     m_nRain;
+    char                    m_szFirmware[SERIAL_BUFFER_SIZE];
+    float                   m_fFirmware;
+
+    CDomeTelemetry          *m_pTelemetry;
+    HubSessionStats         m_Stats;
+};
+
+CHubSession::CHubSession(int nIndex, const std::string &sPort, int nBootDelayMs)
+{
+    m_nIndex = nIndex;
+    m_sPort = sPort;
+    m_fd = -1;
+    m_nState = SESSION_CLOSED;
+    m_nBootDelayMs = nBootDelayMs;
+    m_nReopenDelayMs = 0;
+    m_bPending = false;
+    m_nAttempts = 0;
+    m_nTimeouts = 0;
+    m_nStepsPerRev = 0;
+    m_nRotatorPos = 0;
+    m_dAz = 0;
+    m_bMoving = false;
+    m_dVolts = -1;
+    m_nRain = NOT_RAINING;
+    memset(m_szFirmware, 0, SERIAL_BUFFER_SIZE);
+    m_fFirmware = 0;
+    m_pTelemetry = NULL;
+    resetStats();
+}
+
+int CHubSession::open()
+{
+    close();
+    m_fd = ::open(m_sPort.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if(m_fd < 0) {
+        m_reopenTimer.Reset();
+        m_nReopenDelayMs = HUB_REOPEN_DELAY_MS;
+        return -1;
+    }
+    setRaw(m_fd);
+    m_Parser.reset();
+    m_sTx.clear();
+    m_Queue.clear();
+    m_bPending = false;
+    m_nTimeouts = 0;
+    m_bMoving = false;
+    m_nState = SESSION_BOOT;
+    m_stateTimer.Reset();
+    m_Stats.nReopens++;
+    return m_fd;
+}
+
+void CHubSession::close()
+{
+    if(m_fd >= 0)
+        ::close(m_fd);  // also removes it from the epoll set
+    m_fd = -1;
+    m_nState = SESSION_CLOSED;
+    publish();
+}
+
+void CHubSession::failed()
+{
+    close();
+    m_reopenTimer.Reset();
+    m_nReopenDelayMs = HUB_REOPEN_DELAY_MS;
+}
+
+void CHubSession::enableTelemetry()
+{
+    char szName[64];
+
+    if(m_pTelemetry)
+        return;
+    snprintf(szName, sizeof(szName), "%shub%d", DOME_TELEMETRY_SHM_PREFIX, m_nIndex);
+    m_pTelemetry = new CDomeTelemetry();
+    if(m_pTelemetry->open(szName) != TELEMETRY_OK) {
+        fprintf(stderr, "Error opening the telemetry segment %s\n", szName);
+        delete m_pTelemetry;
+        m_pTelemetry = NULL;
+    }
+}
+
+void CHubSession::publish()
+{
+    DomeTelemetryData telemetryData;
+
+    if(!m_pTelemetry)
+        return;
+    memset(&telemetryData, 0, sizeof(DomeTelemetryData));
+    telemetryData.dUpdateTime = double(time(NULL));
+    telemetryData.dAz = m_dAz;
+    telemetryData.dShutterVolts = m_dVolts;
+    telemetryData.nRotatorPos = m_nRotatorPos;
+    telemetryData.nStepsPerRev = m_nStepsPerRev;
+    telemetryData.nRainStatus = m_nRain;
+    telemetryData.bConnected = m_nState == SESSION_READY;
+    telemetryData.bMoving = m_bMoving;
+    telemetryData.nBatteryCyclesLeft = -1;
+    telemetryData.fBatteryHoursLeft = -1;
+    m_pTelemetry->publish(telemetryData);
+}
+
+void CHubSession::queueCommand(const char *pszCmd, bool bIdempotent, bool bFront)
+{
+    HubCommand command;
+
+    command.sCmd.assign(pszCmd);
+    strncpy(command.szVerb, pszCmd[0] == '@' ? pszCmd + 1 : pszCmd, 3);
+    command.szVerb[3] = 0;
+    command.bIdempotent = bIdempotent;
+    if(bFront)
+        m_Queue.push_front(command);
+    else
+        m_Queue.push_back(command);
+}
+
+void CHubSession::flushTx()
+{
+    ssize_t nWritten;
+
+    if(m_fd < 0 || m_sTx.empty())
+        return;
+    nWritten = write(m_fd, m_sTx.data(), m_sTx.size());
+    if(nWritten > 0)
+        m_sTx.erase(0, size_t(nWritten));
+    else if(nWritten < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        failed();
+}
+
+void CHubSession::sendNext()
+{
+    if(m_bPending || m_Queue.empty() || m_txTimer.GetElapsedMilliseconds() < CMD_WAIT_INTERVAL)
+        return;
+    m_Pending = m_Queue.front();
+    m_Queue.pop_front();
+    m_bPending = true;
+    m_nAttempts = 1;
+    m_sTx += m_Pending.sCmd;
+    flushTx();
+    m_txTimer.Reset();
+    m_replyTimer.Reset();
+    m_Stats.nCommands++;
+}
+
+void CHubSession::onReadable()
+{
+    char szRx[HUB_RX_BUFFER_SIZE];
+    char szLine[SERIAL_BUFFER_SIZE];
+    ssize_t nRead;
+
+    while(m_fd >= 0) {
+        nRead = read(m_fd, szRx, sizeof(szRx));
+        if(nRead < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            failed();
+            return;
+        }
+        // with VMIN = VTIME = 0 an empty tty reads 0, a hangup comes as EPOLLHUP
+        if(nRead <= 0)
+            return;
+
+        // dispatch every complete line, the parser keeps the partial one
+        m_Parser.feed(szRx, int(nRead));
+        while(m_Parser.popMessage(szLine, sizeof(szLine))) {
+            handleLine(szLine);
+            if(m_fd < 0)
+                return;
+        }
+    }
+}
+
+void CHubSession::setAzFromSteps(int nSteps)
+{
+    m_nRotatorPos = nSteps;
+    if(!m_nStepsPerRev)
+        return;
+    m_dAz = (double(m_nRotatorPos) / m_nStepsPerRev) * 360.0;
+    while(m_dAz >= 360)
+        m_dAz -= 360;
+    while(m_dAz < 0)
+        m_dAz += 360;
+}
+
+void CHubSession::handleLine(const char *pszLine)
+{
+    const char *pszField;
+
+    m_Stats.nLines++;
+
+    // unsolicited reports first, same cases as CNexDomeV3::processResponse
+    if(pszLine[0] == 'P' && (isdigit(pszLine[1]) || pszLine[1] == '-')) {
+        setAzFromSteps(atoi(pszLine + 1));
+        publish();
+        return;
+    }
+    if(pszLine[0] == 'S' && isdigit(pszLine[1]))
+        return;
+    if(pszLine[0] == 'X' || pszLine[0] == 'o')
+        return;
+    if(!strncmp(pszLine, ":BV", 3)) {
+        m_dVolts = double(atoi(pszLine + 3)) * 3.0 * (5.0 / 1023.0);
+        publish();
+        return;
+    }
+    if(!strncmp(pszLine, ":RainStopped", 12)) {
+        m_nRain = NOT_RAINING;
+        publish();
+        return;
+    }
+    if(!strncmp(pszLine, ":Rain", 5)) {
+        m_nRain = RAINING;
+        publish();
+        return;
+    }
+    if(!strncmp(pszLine, ":SER", 4)) {
+        // :SER,<position>,<at home>,<steps per rev>,<home position>,<dead zone>#
+        pszField = strchr(pszLine, ',');
+        if(pszField)
+            setAzFromSteps(atoi(pszField + 1));
+        m_bMoving = false;
+        publish();
+        if(!m_bPending || strcmp(m_Pending.szVerb, "SER"))
+            return;
+    }
+    handleReply(pszLine);
+}
+
+void CHubSession::handleReply(const char *pszLine)
+{
+    int nLatencyMs;
+
+    if(!m_bPending || !strstr(pszLine, m_Pending.szVerb))
+        return; // stale reply from a command we gave up on
+    m_bPending = false;
+    m_nTimeouts = 0;
+    nLatencyMs = m_replyTimer.GetElapsedMilliseconds();
+    m_Stats.nLatency[nLatencyMs < HUB_LATENCY_BUCKETS - 1 ? nLatencyMs : HUB_LATENCY_BUCKETS - 1]++;
+
+    if(!strcmp(m_Pending.szVerb, "FRR")) {
+        // :FRR3.2.0#
+        strncpy(m_szFirmware, pszLine + 4, SERIAL_BUFFER_SIZE - 1);
+        m_szFirmware[strcspn(m_szFirmware, "#")] = 0;
+        m_fFirmware = float(atof(m_szFirmware));
+    }
+    else if(!strcmp(m_Pending.szVerb, "RRR")) {
+        m_nStepsPerRev = atoi(pszLine + 4);
+        if(m_nState == SESSION_IDENTIFY) {
+            m_nState = SESSION_READY;
+            m_pollTimer.Reset();
+            queueCommand("@PRR\r\n", true);
+        }
+    }
+    else if(!strcmp(m_Pending.szVerb, "PRR")) {
+        setAzFromSteps(atoi(pszLine + 4));
+        publish();
+    }
+}
+
+void CHubSession::onTick()
+{
+    switch(m_nState) {
+        case SESSION_CLOSED :
+            return;
+        case SESSION_BOOT :
+            if(m_stateTimer.GetElapsedMilliseconds() < m_nBootDelayMs)
+                return;
+            tcflush(m_fd, TCIOFLUSH);
+            m_Parser.reset();
+            queueCommand("@FRR\r\n", true);
+            queueCommand("@RRR\r\n", true);
+            m_nState = SESSION_IDENTIFY;
+            m_stateTimer.Reset();
+            break;
+        default :
+            break;
+    }
+
+    flushTx();
+    if(m_fd < 0)
+        return;
+
+    if(m_bPending && m_replyTimer.GetElapsedMilliseconds() >= HUB_REPLY_TIMEOUT_MS) {
+        m_Stats.nTimeouts++;
+        m_nTimeouts++;
+        if(m_nTimeouts >= HUB_MAX_TIMEOUTS || (m_nState == SESSION_IDENTIFY && m_nAttempts >= HUB_MAX_ATTEMPTS)) {
+            failed();
+            return;
+        }
+        if(m_Pending.bIdempotent && m_nAttempts < HUB_MAX_ATTEMPTS) {
+            m_nAttempts++;
+            m_sTx += m_Pending.sCmd;
+            flushTx();
+            m_txTimer.Reset();
+            m_replyTimer.Reset();
+            m_Stats.nCommands++;
+        }
+        else
+            m_bPending = false;
+    }
+
+    if(m_nState == SESSION_READY && !m_bPending && m_Queue.empty() && m_pollTimer.GetElapsedMilliseconds() >= HUB_IDLE_POLL_MS) {
+        queueCommand("@PRR\r\n", true);
+        m_pollTimer.Reset();
+    }
+    sendNext();
+}
+
+int CHubSession::gotoAz(double dAz)
+{
+    char szCmd[SERIAL_BUFFER_SIZE];
+    int nSteps;
+
+    if(m_nState != SESSION_READY || !m_nStepsPerRev)
+        return NOT_CONNECTED;
+    while(dAz >= 360)
+        dAz -= 360;
+    while(dAz < 0)
+        dAz += 360;
+    nSteps = int(round(dAz / 360.0 * m_nStepsPerRev));
+    if(m_fFirmware >= 3.2f)
+        snprintf(szCmd, SERIAL_BUFFER_SIZE, "@GSR,%d\r\n", nSteps);
+    else
+        snprintf(szCmd, SERIAL_BUFFER_SIZE, "@GAR,%d\r\n", int(round(dAz)));
+    queueCommand(szCmd, false);
+    m_bMoving = true;
+    return PLUGIN_OK;
+}
+
+int CHubSession::abort()
+{
+    if(m_nState != SESSION_READY)
+        return NOT_CONNECTED;
+    queueCommand("@SWR\r\n", false, true);
+    return PLUGIN_OK;
+}
+
+int CHubSession::home()
+{
+    if(m_nState != SESSION_READY)
+        return NOT_CONNECTED;
+    queueCommand("@GHR\r\n", false);
+    m_bMoving = true;
+    return PLUGIN_OK;
+}
+
+void CHubSession::formatState(char *pszOut, int nMaxLen)
+{
+    snprintf(pszOut, nMaxLen, "%.2f %d %.2f %s", m_dAz, m_bMoving ? 1 : 0, m_dVolts, kSessionStateNames[m_nState]);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Emulated controllers for the benchmark, all on one pty each and one thread for all of them.
+typedef struct {
+    int         fdMaster;
+    int         fdSlave;        // kept open so the master doesn't see a hangup between sessions
+    std::string sSlavePath;
+    char        szRx[SERIAL_BUFFER_SIZE];
+    int         nRxLen;
+    double      dPos;
+    int         nTarget;
+    bool        bMoving;
+    CStopWatch  reportTimer;
+} EmulatedController;
+
+class CEmulatorFarm
+{
+public:
+    CEmulatorFarm() : m_fdEpoll(-1), m_bRunning(false) {}
+    ~CEmulatorFarm() { stop(); }
+
+    int     start(int nControllers);
+    void    stop(void);
+    const std::string &port(int nIndex) { return m_Controllers[nIndex]->sSlavePath; }
+
+protected:
+    void    run(void);
+    void    onReadable(EmulatedController &controller);
+    void    onCommand(EmulatedController &controller, const char *pszCmd);
+    void    reply(EmulatedController &controller, const char *pszLine);
+
+    std::vector<EmulatedController *>   m_Controllers;
+    int                 m_fdEpoll;
+    std::atomic<bool>   m_bRunning;
+    std::thread         m_Thread;
+};
+
+int CEmulatorFarm::start(int nControllers)
+{
+    EmulatedController *pController;
+    struct epoll_event event;
+    int i;
+
+    m_fdEpoll = epoll_create1(EPOLL_CLOEXEC);
+    if(m_fdEpoll < 0)
+        return -1;
+    for(i = 0; i < nControllers; i++) {
+        pController = new EmulatedController;
+        pController->fdMaster = posix_openpt(O_RDWR | O_NOCTTY);
+        if(pController->fdMaster < 0 || grantpt(pController->fdMaster) || unlockpt(pController->fdMaster)) {
+            delete pController;
+            return -1;
+        }
+        pController->sSlavePath.assign(ptsname(pController->fdMaster));
+        pController->fdSlave = ::open(pController->sSlavePath.c_str(), O_RDWR | O_NOCTTY);
+        setRaw(pController->fdSlave);   // no echo of our own replies
+        setNonBlocking(pController->fdMaster);
+        pController->nRxLen = 0;
+        pController->dPos = 0;
+        pController->nTarget = 0;
+        pController->bMoving = false;
+        m_Controllers.push_back(pController);
+        event.events = EPOLLIN;
+        event.data.u64 = uint64_t(i);
+        epoll_ctl(m_fdEpoll, EPOLL_CTL_ADD, pController->fdMaster, &event);
+    }
+    m_bRunning = true;
+    m_Thread = std::thread(&CEmulatorFarm::run, this);
+    return 0;
+}
+
+void CEmulatorFarm::stop()
+{
+    size_t i;
+
+    if(m_bRunning) {
+        m_bRunning = false;
+        m_Thread.join();
+    }
+    for(i = 0; i < m_Controllers.size(); i++) {
+        ::close(m_Controllers[i]->fdMaster);
+        ::close(m_Controllers[i]->fdSlave);
+        delete m_Controllers[i];
+    }
+    m_Controllers.clear();
+    if(m_fdEpoll >= 0)
+        ::close(m_fdEpoll);
+    m_fdEpoll = -1;
+}
+
+void CEmulatorFarm::reply(EmulatedController &controller, const char *pszLine)
+{
+    ssize_t nWritten = write(controller.fdMaster, pszLine, strlen(pszLine));
+    (void)nWritten;
+}
+
+void CEmulatorFarm::onCommand(EmulatedController &controller, const char *pszCmd)
+{
+    char szLine[SERIAL_BUFFER_SIZE];
+
+    if(pszCmd[0] != '@' || strlen(pszCmd) < 4)
+        return;
+    if(!strncmp(pszCmd, "@FRR", 4))
+        reply(controller, ":FRR3.2.0#\n");
+    else if(!strncmp(pszCmd, "@RRR", 4)) {
+        snprintf(szLine, sizeof(szLine), ":RRR%d#\n", EMU_STEPS_PER_REV);
+        reply(controller, szLine);
+    }
+    else if(!strncmp(pszCmd, "@PRR", 4)) {
+        snprintf(szLine, sizeof(szLine), ":PRR%d#\n", int(controller.dPos));
+        reply(controller, szLine);
+    }
+    else if(!strncmp(pszCmd, "@GSR,", 5) || !strncmp(pszCmd, "@GHR", 4)) {
+        controller.nTarget = pszCmd[2] == 'S' ? atoi(pszCmd + 5) : 0;
+        controller.bMoving = true;
+        controller.reportTimer.Reset();
+        snprintf(szLine, sizeof(szLine), ":%.3s#\n", pszCmd + 1);
+        reply(controller, szLine);
+    }
+    else if(!strncmp(pszCmd, "@SWR", 4)) {
+        controller.nTarget = int(controller.dPos);
+        reply(controller, ":SWR#\n");
+    }
+    else {
+        snprintf(szLine, sizeof(szLine), ":%.3s#\n", pszCmd + 1);
+        reply(controller, szLine);
+    }
+}
+
+void CEmulatorFarm::onReadable(EmulatedController &controller)
+{
+    ssize_t nRead;
+    char *pszEnd;
+
+    while((nRead = read(controller.fdMaster, controller.szRx + controller.nRxLen, size_t(SERIAL_BUFFER_SIZE - 1 - controller.nRxLen))) > 0) {
+        controller.nRxLen += int(nRead);
+        controller.szRx[controller.nRxLen] = 0;
+        while((pszEnd = strchr(controller.szRx, '\n')) != NULL) {
+            *pszEnd = 0;
+            onCommand(controller, controller.szRx);
+            controller.nRxLen -= int(pszEnd + 1 - controller.szRx);
+            memmove(controller.szRx, pszEnd + 1, size_t(controller.nRxLen + 1));
+        }
+        if(controller.nRxLen >= SERIAL_BUFFER_SIZE - 1)
+            controller.nRxLen = 0;
+    }
+}
+
+void CEmulatorFarm::run()
+{
+    struct epoll_event events[HUB_MAX_EVENTS];
+    EmulatedController *pController;
+    char szLine[SERIAL_BUFFER_SIZE];
+    double dStep;
+    int nEvents;
+    int i;
+
+    while(m_bRunning) {
+        nEvents = epoll_wait(m_fdEpoll, events, HUB_MAX_EVENTS, HUB_TICK_MS);
+        for(i = 0; i < nEvents; i++)
+            onReadable(*m_Controllers[size_t(events[i].data.u64)]);
+
+        // move, report the position every EMU_REPORT_MS and the end of the move
+        for(i = 0; i < int(m_Controllers.size()); i++) {
+            pController = m_Controllers[i];
+            if(!pController->bMoving || pController->reportTimer.GetElapsedMilliseconds() < EMU_REPORT_MS)
+                continue;
+            dStep = pController->reportTimer.GetElapsedSeconds() * EMU_STEPS_PER_SEC;
+            pController->reportTimer.Reset();
+            if(fabs(pController->nTarget - pController->dPos) <= dStep) {
+                pController->dPos = pController->nTarget;
+                pController->bMoving = false;
+                snprintf(szLine, sizeof(szLine), ":SER,%d,0,%d,0,300#\n", int(pController->dPos), EMU_STEPS_PER_REV);
+            }
+            else {
+                pController->dPos += pController->nTarget > pController->dPos ? dStep : -dStep;
+                snprintf(szLine, sizeof(szLine), "P%d\n", int(pController->dPos));
+            }
+            reply(*pController, szLine);
+        }
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// The event loop, sessions, control socket and tick timer on one epoll set.
+typedef struct {
+    int         fd;
+    std::string sRxBuf;
+} HubClient;
+
+class CDomeHub
+{
+public:
+    CDomeHub();
+    ~CDomeHub();
+
+    int     addSession(const std::string &sPort, int nBootDelayMs = HUB_BOOT_DELAY_MS);
+    int     start(const char *pszSocket);
+    void    run(double dSeconds = 0);   // 0 : until SIGINT/SIGTERM
+    void    setExercise(bool bExercise) { m_bExercise = bExercise; }
+    void    enableTelemetry(void);
+
+    int     getSessionCount(void) { return int(m_Sessions.size()); }
+    CHubSession &getSession(int nIndex) { return *m_Sessions[nIndex]; }
+
+protected:
+    void    watchSession(int nIndex);
+    void    onTick(void);
+    void    acceptClient(void);
+    void    readClient(int nIndex);
+    void    handleRequest(HubClient &client, const std::string &sLine);
+
+    std::vector<CHubSession *>  m_Sessions;
+    std::vector<HubClient>      m_Clients;
+    int                 m_fdEpoll;
+    int                 m_fdTimer;
+    int                 m_fdListen;
+    std::string         m_sSocketPath;
+    bool                m_bExercise;    // benchmark, keep every dome moving
+};
+
+CDomeHub::CDomeHub()
+{
+    m_fdEpoll = epoll_create1(EPOLL_CLOEXEC);
+    m_fdTimer = -1;
+    m_fdListen = -1;
+    m_bExercise = false;
+}
+
+CDomeHub::~CDomeHub()
+{
+    size_t i;
+
+    for(i = 0; i < m_Sessions.size(); i++)
+        delete m_Sessions[i];
+    for(i = 0; i < m_Clients.size(); i++)
+        ::close(m_Clients[i].fd);
+    if(m_fdListen >= 0) {
+        ::close(m_fdListen);
+        unlink(m_sSocketPath.c_str());
+    }
+    if(m_fdTimer >= 0)
+        ::close(m_fdTimer);
+    if(m_fdEpoll >= 0)
+        ::close(m_fdEpoll);
+}
+
+int CDomeHub::addSession(const std::string &sPort, int nBootDelayMs)
+{
+    m_Sessions.push_back(new CHubSession(int(m_Sessions.size()), sPort, nBootDelayMs));
+    return int(m_Sessions.size()) - 1;
+}
+
+void CDomeHub::enableTelemetry()
+{
+    size_t i;
+
+    for(i = 0; i < m_Sessions.size(); i++)
+        m_Sessions[i]->enableTelemetry();
+}
+
+void CDomeHub::watchSession(int nIndex)
+{
+    struct epoll_event event;
+
+    if(m_Sessions[nIndex]->open() < 0)
+        return;
+    event.events = EPOLLIN;
+    event.data.u64 = eventTag(SRC_SESSION, uint32_t(nIndex));
+    epoll_ctl(m_fdEpoll, EPOLL_CTL_ADD, m_Sessions[nIndex]->fd(), &event);
+}
+
+int CDomeHub::start(const char *pszSocket)
+{
+    struct epoll_event event;
+    struct itimerspec tick;
+    struct sockaddr_un addr;
+    int i;
+
+    if(m_fdEpoll < 0)
+        return -1;
+
+    m_fdTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(m_fdTimer < 0)
+        return -1;
+    memset(&tick, 0, sizeof(tick));
+    tick.it_interval.tv_nsec = HUB_TICK_MS * 1000000L;
+    tick.it_value.tv_nsec = HUB_TICK_MS * 1000000L;
+    timerfd_settime(m_fdTimer, 0, &tick, NULL);
+    event.events = EPOLLIN;
+    event.data.u64 = eventTag(SRC_TIMER, 0);
+    epoll_ctl(m_fdEpoll, EPOLL_CTL_ADD, m_fdTimer, &event);
+
+    if(pszSocket) {
+        m_fdListen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(m_fdListen < 0)
+            return -1;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, pszSocket, sizeof(addr.sun_path) - 1);
+        unlink(pszSocket);
+        if(bind(m_fdListen, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(m_fdListen, 16) < 0) {
+            fprintf(stderr, "Error listening on %s : %s\n", pszSocket, strerror(errno));
+            ::close(m_fdListen);
+            m_fdListen = -1;
+            return -1;
+        }
+        m_sSocketPath.assign(pszSocket);
+        event.events = EPOLLIN;
+        event.data.u64 = eventTag(SRC_LISTEN, 0);
+        epoll_ctl(m_fdEpoll, EPOLL_CTL_ADD, m_fdListen, &event);
+    }
+
+    for(i = 0; i < int(m_Sessions.size()); i++)
+        watchSession(i);
+    return 0;
+}
+
+void CDomeHub::onTick()
+{
+    uint64_t nExpirations;
+    ssize_t nRead;
+    int i;
+
+    nRead = read(m_fdTimer, &nExpirations, sizeof(nExpirations));
+    (void)nRead;
+    for(i = 0; i < int(m_Sessions.size()); i++) {
+        if(m_Sessions[i]->wantsReopen())
+            watchSession(i);
+        m_Sessions[i]->onTick();
+        if(m_bExercise && m_Sessions[i]->isIdle())
+            m_Sessions[i]->gotoAz(double(rand() % 360));
+    }
+}
+
+void CDomeHub::run(double dSeconds)
+{
+    struct epoll_event events[HUB_MAX_EVENTS];
+    CStopWatch runTimer;
+    uint32_t nIndex;
+    int nEvents;
+    int i;
+
+    while(!g_bQuit && (dSeconds <= 0 || runTimer.GetElapsedSeconds() < dSeconds)) {
+        nEvents = epoll_wait(m_fdEpoll, events, HUB_MAX_EVENTS, -1);
+        for(i = 0; i < nEvents; i++) {
+            nIndex = uint32_t(events[i].data.u64 & 0xffffffff);
+            switch(int(events[i].data.u64 >> 32)) {
+                case SRC_TIMER :
+                    onTick();
+                    break;
+                case SRC_LISTEN :
+                    acceptClient();
+                    break;
+                case SRC_CLIENT :
+                    readClient(int(nIndex));
+                    break;
+                case SRC_SESSION :
+                    if(nIndex >= m_Sessions.size())
+                        break;
+                    if(events[i].events & EPOLLIN)
+                        m_Sessions[nIndex]->onReadable();
+                    if(events[i].events & (EPOLLHUP | EPOLLERR))
+                        m_Sessions[nIndex]->onHangup();
+                    break;
+            }
+        }
+    }
+}
+
+void CDomeHub::acceptClient()
+{
+    struct epoll_event event;
+    HubClient client;
+    size_t i;
+    int fd;
+
+    while((fd = accept4(m_fdListen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        // reuse a free slot so the epoll tags stay valid
+        for(i = 0; i < m_Clients.size(); i++)
+            if(m_Clients[i].fd < 0)
+                break;
+        client.fd = fd;
+        if(i == m_Clients.size())
+            m_Clients.push_back(client);
+        else
+            m_Clients[i] = client;
+        event.events = EPOLLIN;
+        event.data.u64 = eventTag(SRC_CLIENT, uint32_t(i));
+        epoll_ctl(m_fdEpoll, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+void CDomeHub::readClient(int nIndex)
+{
+    HubClient &client = m_Clients[nIndex];
+    char szBuf[256];
+    std::string sLine;
+    ssize_t nRead;
+    size_t nPos;
+
+    while((nRead = read(client.fd, szBuf, sizeof(szBuf))) > 0) {
+        client.sRxBuf.append(szBuf, size_t(nRead));
+        while((nPos = client.sRxBuf.find('\n')) != std::string::npos) {
+            sLine = client.sRxBuf.substr(0, nPos);
+            client.sRxBuf.erase(0, nPos + 1);
+            handleRequest(client, sLine);
+        }
+    }
+    if(nRead == 0 || (nRead < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        ::close(client.fd);
+        client.fd = -1;
+        client.sRxBuf.clear();
+    }
+}
+
+void CDomeHub::handleRequest(HubClient &client, const std::string &sLine)
+{
+    char szVerb[16];
+    char szOut[SERIAL_BUFFER_SIZE];
+    char szState[SERIAL_BUFFER_SIZE / 2];
+    int nDome = -1;
+    double dArg = 0;
+    int nErr = PLUGIN_OK;
+    ssize_t nWritten;
+
+    memset(szVerb, 0, sizeof(szVerb));
+    if(!strncmp(sLine.c_str(), "LIST", 4)) {
+        snprintf(szOut, sizeof(szOut), "OK %d\n", int(m_Sessions.size()));
+    }
+    else if(sscanf(sLine.c_str(), "%d %15s %lf", &nDome, szVerb, &dArg) < 2 || nDome < 0 || nDome >= int(m_Sessions.size())) {
+        snprintf(szOut, sizeof(szOut), "ERR bad request\n");
+    }
+    else {
+        if(!strcmp(szVerb, "STATE")) {
+            m_Sessions[nDome]->formatState(szState, sizeof(szState));
+            snprintf(szOut, sizeof(szOut), "OK %s\n", szState);
+        }
+        else {
+            if(!strcmp(szVerb, "GOTO"))
+                nErr = m_Sessions[nDome]->gotoAz(dArg);
+            else if(!strcmp(szVerb, "ABORT"))
+                nErr = m_Sessions[nDome]->abort();
+            else if(!strcmp(szVerb, "HOME"))
+                nErr = m_Sessions[nDome]->home();
+            else
+                nErr = COMMAND_FAILED;
+            snprintf(szOut, sizeof(szOut), nErr ? "ERR %d\n" : "OK\n", nErr);
+        }
+    }
+    nWritten = send(client.fd, szOut, strlen(szOut), MSG_NOSIGNAL);
+    (void)nWritten;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Scaling benchmark
+
+static int threadCount()
+{
+    char szLine[256];
+    int nThreads = -1;
+    FILE *pFile = fopen("/proc/self/status", "r");
+
+    if(!pFile)
+        return -1;
+    while(fgets(szLine, sizeof(szLine), pFile)) {
+        if(!strncmp(szLine, "Threads:", 8)) {
+            nThreads = atoi(szLine + 8);
+            break;
+        }
+    }
+    fclose(pFile);
+    return nThreads;
+}
+
+static double threadCpuSeconds()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return double(ts.tv_sec) + double(ts.tv_nsec) / 1e9;
+}
+
+static int benchmark(int nMaxDomes, int nSeconds)
+{
+    CEmulatorFarm *pFarm;
+    CDomeHub *pHub;
+    HubSessionStats totals;
+    uint64_t nCount, nTarget;
+    double dCpu;
+    int nDomes, nReady, nP99;
+    int i, j;
+
+    printf("domes threads  hub cpu %%  lines/s  cmds/s  timeouts  reply p99 ms\n");
+    for(nDomes = 1; nDomes <= nMaxDomes; nDomes *= 2) {
+        pFarm = new CEmulatorFarm();
+        if(pFarm->start(nDomes)) {
+            fprintf(stderr, "Error creating %d emulated controllers\n", nDomes);
+            delete pFarm;
+            return 1;
+        }
+        pHub = new CDomeHub();
+        for(i = 0; i < nDomes; i++)
+            pHub->addSession(pFarm->port(i), 0);
+        pHub->setExercise(true);
+        pHub->start(NULL);
+
+        // let every session identify itself before measuring
+        pHub->run(1.0);
+        for(i = 0, nReady = 0; i < nDomes; i++) {
+            if(pHub->getSession(i).isReady())
+                nReady++;
+            pHub->getSession(i).resetStats();
+        }
+
+        dCpu = threadCpuSeconds();
+        pHub->run(double(nSeconds));
+        dCpu = threadCpuSeconds() - dCpu;
+
+        memset(&totals, 0, sizeof(totals));
+        for(i = 0; i < nDomes; i++) {
+            const HubSessionStats &stats = pHub->getSession(i).getStats();
+            totals.nLines += stats.nLines;
+            totals.nCommands += stats.nCommands;
+            totals.nTimeouts += stats.nTimeouts;
+            for(j = 0; j < HUB_LATENCY_BUCKETS; j++)
+                totals.nLatency[j] += stats.nLatency[j];
+        }
+        for(j = 0, nCount = 0; j < HUB_LATENCY_BUCKETS; j++)
+            nCount += totals.nLatency[j];
+        nTarget = nCount - nCount / 100;
+        for(j = 0, nCount = 0, nP99 = 0; j < HUB_LATENCY_BUCKETS; j++) {
+            nCount += totals.nLatency[j];
+            if(nCount >= nTarget) {
+                nP99 = j;
+                break;
+            }
+        }
+
+        printf("%5d %7d %10.2f %8.0f %7.0f %9llu %13d%s\n", nDomes, threadCount(), dCpu / nSeconds * 100.0,
+               totals.nLines / double(nSeconds), totals.nCommands / double(nSeconds),
+               (unsigned long long)totals.nTimeouts, nP99, nReady < nDomes ? "  (not all ready)" : "");
+        fflush(stdout);
+        delete pHub;
+        delete pFarm;
+        if(g_bQuit)
+            break;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *pszSocket = HUB_DEFAULT_SOCKET;
+    bool bTelemetry = false;
+    int nBenchDomes = 0;
+    int nBenchSeconds = 5;
+    int nOpt;
+    int i;
+    CDomeHub *pHub;
+
+    while((nOpt = getopt(argc, argv, "s:TB:t:")) != -1) {
+        switch(nOpt) {
+            case 's' : pszSocket = optarg; break;
+            case 'T' : bTelemetry = true; break;
+            case 'B' : nBenchDomes = atoi(optarg); break;
+            case 't' : nBenchSeconds = atoi(optarg); break;
+            default :
+                fprintf(stderr, "usage : %s [-s socket] [-T] serial_port [serial_port ...]\n        %s -B max_domes [-t seconds per step]\n", argv[0], argv[0]);
+                return 1;
+        }
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    if(nBenchDomes > 0)
+        return benchmark(nBenchDomes, nBenchSeconds > 0 ? nBenchSeconds : 5);
+
+    if(optind >= argc) {
+        fprintf(stderr, "usage : %s [-s socket] [-T] serial_port [serial_port ...]\n        %s -B max_domes [-t seconds per step]\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    pHub = new CDomeHub();
+    for(i = optind; i < argc; i++)
+        pHub->addSession(argv[i]);
+    if(bTelemetry)
+        pHub->enableTelemetry();
+    if(pHub->start(pszSocket)) {
+        delete pHub;
+        return 1;
+    }
+    pHub->run();
+    delete pHub;
+    return 0;
+}
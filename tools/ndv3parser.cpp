@@ -0,0 +1,324 @@
+//
+//  ndv3parser.cpp
+//
+//  NexDome V3 tools
+//  Fuzzer and benchmark for CResponseParser, no controller needed.
+//
+//  fuzz  : random streams (protocol lines, noise, over-length lines, every terminator mix) cut in random
+//          chunks. The decoded lines and the error counts have to match a byte at a time reference
+//          decoder whatever the chunking, and every decoded line has to be printable and fit.
+//          Both the vector and the scalar terminator scans are checked.
+//  bench : feeds a recorded-like movement stream (P/S positions, :SER, replies) with different chunk sizes,
+//          with the vector scan and with the byte loop, and times the raw terminator scan of both.
+//
+//  usage : ndv3parser fuzz [-n iterations] [-s seed]
+//          ndv3parser bench [-m megabytes]
+//
+//  Built with -DNDV3_LIBFUZZER it's a libFuzzer target instead (make ndv3parser-fuzz, needs clang).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "../ResponseParser.h"
+#include "../StopWatch.h"
+
+#define FUZZ_DEFAULT_ITERATIONS 20000
+#define FUZZ_MAX_CHUNK          255     // CNexDomeV3::readResponse never feeds more than this
+#define BENCH_DEFAULT_MB        16
+
+// what the parser is supposed to do, written the obvious way
+typedef struct {
+    std::vector<std::string> lines;
+    uint64_t    nOverLength;
+    uint64_t    nGarbage;
+} ReferenceResult;
+
+static void referenceDecode(const unsigned char *pData, size_t nLen, ReferenceResult &result)
+{
+    std::string sLine;
+    bool bGarbage = false;
+    size_t i;
+
+    result.lines.clear();
+    result.nOverLength = 0;
+    result.nGarbage = 0;
+    for(i = 0; i < nLen; i++) {
+        if(pData[i] == '\n' || pData[i] == '\r' || pData[i] == '#') {
+            if(sLine.size() > PARSER_MAX_LINE - 1)
+                result.nOverLength++;
+            else if(bGarbage)
+                result.nGarbage++;
+            else if(!sLine.empty())
+                result.lines.push_back(sLine);
+            sLine.clear();
+            bGarbage = false;
+            continue;
+        }
+        if(pData[i] < 0x20 || pData[i] > 0x7e)
+            bGarbage = true;
+        sLine += char(pData[i]);
+    }
+}
+
+// feed in the chunk sizes given by the chunking generator, pop after every feed like readResponse does.
+// returns the first broken invariant, NULL if none.
+static const char *checkStream(const unsigned char *pData, size_t nLen, unsigned int nChunkSeed, bool bVector)
+{
+    static CResponseParser parser;   // 32KB, keep it off the stack
+    ReferenceResult reference;
+    std::vector<std::string> lines;
+    char szLine[PARSER_MAX_LINE];
+    size_t nPos = 0;
+    size_t nChunk;
+    size_t i;
+
+    parser.reset();
+    parser.resetStats();
+    parser.setVectorScan(bVector);
+    while(nPos < nLen) {
+        nChunkSeed = nChunkSeed * 1103515245 + 12345;
+        nChunk = 1 + (nChunkSeed >> 16) % FUZZ_MAX_CHUNK;
+        if(nChunk > nLen - nPos)
+            nChunk = nLen - nPos;
+        parser.feed((const char *)pData + nPos, int(nChunk));
+        nPos += nChunk;
+        while(parser.popMessage(szLine, sizeof(szLine)))
+            lines.push_back(szLine);
+    }
+
+    for(i = 0; i < lines.size(); i++) {
+        if(lines[i].empty())
+            return "empty line decoded";
+        if(lines[i].size() > PARSER_MAX_LINE - 1)
+            return "line too long";
+        if(lines[i].find_first_of("\r\n#") != std::string::npos)
+            return "terminator in a decoded line";
+    }
+    if(parser.getStats().nBytes != nLen)
+        return "byte count";
+    if(parser.getStats().nDropped)
+        return "lines dropped with a pop after every feed";
+
+    referenceDecode(pData, nLen, reference);
+    if(lines != reference.lines)
+        return "decoded lines differ from the reference";
+    if(parser.getStats().nMessages != reference.lines.size())
+        return "message count";
+    if(parser.getStats().nOverLength != reference.nOverLength)
+        return "over-length count";
+    if(parser.getStats().nGarbage != reference.nGarbage)
+        return "garbage count";
+    return NULL;
+}
+
+#ifdef NDV3_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *pData, size_t nSize)
+{
+    const char *pszFailure;
+    unsigned int nChunkSeed;
+
+    // first 4 bytes pick the chunking, the rest is the stream
+    if(nSize < 4)
+        return 0;
+    memcpy(&nChunkSeed, pData, sizeof(nChunkSeed));
+    pszFailure = checkStream(pData + 4, nSize - 4, nChunkSeed, true);
+    if(!pszFailure)
+        pszFailure = checkStream(pData + 4, nSize - 4, nChunkSeed, false);
+    if(pszFailure) {
+        fprintf(stderr, "ndv3parser : %s\n", pszFailure);
+        abort();
+    }
+    return 0;
+}
+
+#else
+
+static void appendRandomPiece(std::string &sStream)
+{
+    static const char *pszLines[] = { ":PRR1234#\n", "P2345\n", "S-12\r\n", ":SER,1200,1,55080,0,300#\n",
+                                      ":BV623#\n", ":Rain#\n", ":RainStopped#\n", "XB->Online\n", ":FRR3.2.0#\n",
+                                      ":GAR#\r\n", "#", "\r\n", "\n\n", "\r" };
+    static const char szNoise[] = "\x00\x01\x7f\x80\xff\x1b\t";
+    int nKind = rand() % 10;
+    int i, nLen;
+
+    if(nKind < 6)
+        sStream += pszLines[rand() % (sizeof(pszLines) / sizeof(pszLines[0]))];
+    else if(nKind < 8) {
+        // noise, the arduino rebooting or a bad baud rate
+        nLen = 1 + rand() % 8;
+        for(i = 0; i < nLen; i++)
+            sStream += szNoise[rand() % (sizeof(szNoise) - 1)];
+    }
+    else if(nKind < 9) {
+        // around the length limit
+        nLen = PARSER_MAX_LINE - 4 + rand() % 8;
+        if(rand() % 4 == 0)
+            nLen += rand() % 1000;
+        sStream += 'P';
+        for(i = 1; i < nLen; i++)
+            sStream += char('0' + rand() % 10);
+        sStream += "\n";
+    }
+    else {
+        nLen = 1 + rand() % 16;
+        for(i = 0; i < nLen; i++)
+            sStream += char(rand() % 256);
+    }
+}
+
+static int fuzz(int nIterations, unsigned int nSeed)
+{
+    std::string sStream;
+    const char *pszFailure;
+    unsigned int nChunkSeed;
+    int nIteration, nPieces, i;
+    uint64_t nBytes = 0;
+
+    srand(nSeed);
+    for(nIteration = 0; nIteration < nIterations; nIteration++) {
+        sStream.clear();
+        nPieces = 1 + rand() % 200;
+        for(i = 0; i < nPieces; i++)
+            appendRandomPiece(sStream);
+        nBytes += sStream.size();
+        nChunkSeed = (unsigned int)rand();
+        pszFailure = checkStream((const unsigned char *)sStream.data(), sStream.size(), nChunkSeed, true);
+        if(!pszFailure)
+            pszFailure = checkStream((const unsigned char *)sStream.data(), sStream.size(), nChunkSeed, false);
+        if(pszFailure) {
+            printf("FAILED iteration %d seed %u : %s\n", nIteration, nSeed, pszFailure);
+            return 1;
+        }
+    }
+    printf("fuzz ok : %d streams, %llu bytes, seed %u, %s scan\n", nIterations, (unsigned long long)nBytes, nSeed, CResponseParser::getScanKernel());
+    return 0;
+}
+
+static double benchFeed(CResponseParser &parser, const std::string &sStream, int nChunkSize, bool bVector, uint64_t &nLines)
+{
+    char szLine[PARSER_MAX_LINE];
+    CStopWatch benchTimer;
+    size_t nPos, nChunk;
+
+    parser.reset();
+    parser.resetStats();
+    parser.setVectorScan(bVector);
+    nLines = 0;
+    for(nPos = 0; nPos < sStream.size(); nPos += nChunk) {
+        nChunk = std::min(size_t(nChunkSize), sStream.size() - nPos);
+        parser.feed(sStream.data() + nPos, int(nChunk));
+        while(parser.popMessage(szLine, sizeof(szLine)))
+            nLines++;
+    }
+    return benchTimer.GetElapsedSeconds();
+}
+
+// terminators only, no copies
+static double benchScan(const std::string &sStream, bool bVector, uint64_t &nFound)
+{
+    const unsigned char *pByte = (const unsigned char *)sStream.data();
+    const unsigned char *pEnd = pByte + sStream.size();
+    CStopWatch benchTimer;
+
+    nFound = 0;
+    while(pByte < pEnd) {
+        pByte = bVector ? CResponseParser::findSpecial(pByte, pEnd) : CResponseParser::findSpecialScalar(pByte, pEnd);
+        if(pByte < pEnd) {
+            nFound++;
+            pByte++;
+        }
+    }
+    return benchTimer.GetElapsedSeconds();
+}
+
+static int bench(int nMegaBytes)
+{
+    static CResponseParser parser;
+    static const int nChunkSizes[] = { 1, 7, 64, 255 };   // readResponse reads at most SERIAL_BUFFER_SIZE - 1
+    std::string sStream, sLong;
+    char szTmp[64];
+    double dVector, dScalar;
+    double dMB;
+    uint64_t nLines, nScalarLines;
+    int i, nStep = 0;
+
+    // a dome turning, a position every 100 steps and the odd status line
+    while(sStream.size() < size_t(nMegaBytes) * 1024 * 1024) {
+        snprintf(szTmp, sizeof(szTmp), "P%d\n", nStep);
+        sStream += szTmp;
+        nStep = (nStep + 100) % 55080;
+        if(nStep % 5000 == 0) {
+            snprintf(szTmp, sizeof(szTmp), ":SER,%d,0,55080,0,300#\n", nStep);
+            sStream += szTmp;
+            sStream += ":PRR1234#\n:BV623#\n";
+        }
+    }
+    dMB = double(sStream.size()) / 1048576.0;
+
+    printf("%.0f MB, %s scan, MB/s\n", dMB, CResponseParser::getScanKernel());
+    dVector = benchScan(sStream, true, nLines);
+    dScalar = benchScan(sStream, false, nScalarLines);
+    printf("scan only  : vector %8.1f  byte loop %8.1f  x%.2f\n", dMB / dVector, dMB / dScalar, dScalar / dVector);
+    // the ceiling, when the lines are long enough for the vector kernel to matter
+    sLong.assign(sStream.size(), 'P');
+    for(i = 200; i < int(sLong.size()); i += 200)
+        sLong[size_t(i)] = '\n';
+    dVector = benchScan(sLong, true, nLines);
+    dScalar = benchScan(sLong, false, nScalarLines);
+    printf("scan 200 B : vector %8.1f  byte loop %8.1f  x%.2f\n", dMB / dVector, dMB / dScalar, dScalar / dVector);
+    for(i = 0; i < int(sizeof(nChunkSizes) / sizeof(nChunkSizes[0])); i++) {
+        dVector = benchFeed(parser, sStream, nChunkSizes[i], true, nLines);
+        dScalar = benchFeed(parser, sStream, nChunkSizes[i], false, nScalarLines);
+        printf("chunk %4d : vector %8.1f  byte loop %8.1f  x%.2f  %llu lines  %llu dropped\n", nChunkSizes[i],
+               dMB / dVector, dMB / dScalar, dScalar / dVector, (unsigned long long)nLines, (unsigned long long)parser.getStats().nDropped);
+        if(nLines != nScalarLines)
+            printf("line count mismatch : %llu vs %llu\n", (unsigned long long)nLines, (unsigned long long)nScalarLines);
+    }
+    return 0;
+}
+
+static void usage(const char *pszName)
+{
+    fprintf(stderr, "usage : %s fuzz [-n iterations] [-s seed]\n        %s bench [-m megabytes]\n", pszName, pszName);
+}
+
+int main(int argc, char *argv[])
+{
+    int nIterations = FUZZ_DEFAULT_ITERATIONS;
+    unsigned int nSeed = (unsigned int)time(NULL);
+    int nMegaBytes = BENCH_DEFAULT_MB;
+    int nOpt;
+
+    if(argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    optind = 2;
+    while((nOpt = getopt(argc, argv, "n:s:m:")) != -1) {
+        switch(nOpt) {
+            case 'n' : nIterations = atoi(optarg); break;
+            case 's' : nSeed = (unsigned int)strtoul(optarg, NULL, 10); break;
+            case 'm' : nMegaBytes = atoi(optarg); break;
+            default :
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if(!strcmp(argv[1], "fuzz"))
+        return fuzz(nIterations, nSeed);
+    if(!strcmp(argv[1], "bench"))
+        return bench(nMegaBytes);
+    usage(argv[0]);
+    return 1;
+}
+
+#endif
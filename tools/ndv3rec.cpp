@@ -0,0 +1,202 @@
+//
+//  ndv3rec.cpp
+//
+//  NexDome V3 tools
+//  Reader for the telemetry recorder file (NDV3_Telemetry.<index>.rec, see DomeRecorder.h).
+//
+//  ndv3rec [-f file | -i instance] [-s start] [-e end] [-H hours] [-c]
+//      -i      : plugin instance index, default 0 (file in the home directory)
+//      -s / -e : range in unix time, default is the whole file
+//      -H      : only the last <hours> of data
+//      -c      : dump the samples as CSV instead of the summary
+//  ndv3rec -G <samples> [-f file]
+//      fill the file with synthetic samples (1 per second), to check the scan speed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <string>
+
+#include "../DomeRecorder.h"
+
+typedef struct {
+    uint64_t    nSamples;
+    double      dFirstTime;
+    double      dLastTime;
+    uint64_t    nAzMoves;           // samples where the rotator position changed
+    uint64_t    nShutterCycles;     // transitions to the opened state
+    uint64_t    nRainEvents;        // transitions to raining
+    float       fMinVolts;
+    float       fMaxVolts;
+    uint64_t    nLatencySamples;
+    double      dLatencySum;
+    float       fMaxLatency;
+    int32_t     nLastAz;
+    uint8_t     nLastShutterState;
+    uint8_t     nLastRain;
+} RecordSummary;
+
+static double nowSeconds()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return double(tv.tv_sec) + double(tv.tv_usec) * 0.000001;
+}
+
+static void summaryVisitor(const DomeRecordSample &sample, void *pContext)
+{
+    RecordSummary *pSummary = (RecordSummary *)pContext;
+
+    if(!pSummary->nSamples) {
+        pSummary->dFirstTime = sample.dTime;
+        pSummary->nLastAz = sample.nAzSteps;
+        pSummary->nLastShutterState = sample.nShutterState;
+        pSummary->nLastRain = sample.nRain;
+    }
+    pSummary->nSamples++;
+    pSummary->dLastTime = sample.dTime;
+
+    if(sample.nAzSteps != pSummary->nLastAz)
+        pSummary->nAzMoves++;
+    if(sample.nShutterState == 0 && pSummary->nLastShutterState != 0)    // OPEN
+        pSummary->nShutterCycles++;
+    if(sample.nRain == 0 && pSummary->nLastRain != 0)                    // RAINING
+        pSummary->nRainEvents++;
+    pSummary->nLastAz = sample.nAzSteps;
+    pSummary->nLastShutterState = sample.nShutterState;
+    pSummary->nLastRain = sample.nRain;
+
+    if(sample.fVolts >= 0) {
+        if(sample.fVolts < pSummary->fMinVolts)
+            pSummary->fMinVolts = sample.fVolts;
+        if(sample.fVolts > pSummary->fMaxVolts)
+            pSummary->fMaxVolts = sample.fVolts;
+    }
+    if(sample.fCmdLatencyMs > 0) {
+        pSummary->nLatencySamples++;
+        pSummary->dLatencySum += sample.fCmdLatencyMs;
+        if(sample.fCmdLatencyMs > pSummary->fMaxLatency)
+            pSummary->fMaxLatency = sample.fCmdLatencyMs;
+    }
+}
+
+static void csvVisitor(const DomeRecordSample &sample, void *pContext)
+{
+    (void)pContext;
+    printf("%.3f,%d,%d,%.2f,%.1f,%u,%u\n", sample.dTime, sample.nAzSteps, sample.nElSteps,
+           sample.fVolts, sample.fCmdLatencyMs, sample.nShutterState, sample.nRain);
+}
+
+static int generate(const char *pszFile, uint64_t nSamples)
+{
+    CDomeRecorder recorder;
+    DomeRecordSample sample;
+    double dStart;
+    uint64_t i;
+
+    if(recorder.open(pszFile) != RECORDER_OK) {
+        fprintf(stderr, "Error opening %s\n", pszFile);
+        return 1;
+    }
+    dStart = floor(nowSeconds()) - double(nSamples);
+    memset(&sample, 0, sizeof(DomeRecordSample));
+    for(i = 0; i < nSamples; i++) {
+        sample.dTime = dStart + double(i);
+        sample.nAzSteps = int32_t((i * 37) % 55080);
+        sample.nElSteps = (i / 3600) % 2 ? 46000 : 0;
+        sample.fVolts = 12.6f - float(i % 86400) * 0.00001f;
+        sample.fCmdLatencyMs = (i % 10) ? 0.0f : 12.5f;
+        sample.nShutterState = (i / 3600) % 2 ? 0 : 1;
+        sample.nRain = (i % 50000) < 100 ? 0 : 1;
+        recorder.append(sample);
+    }
+    recorder.close();
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    std::string sFile;
+    CDomeRecordReader reader;
+    RecordSummary summary;
+    double dStart = -1e300;
+    double dEnd = 1e300;
+    double dHours = 0;
+    double dScanStart, dScanTime;
+    uint64_t nGenerate = 0;
+    bool bCsv = false;
+    int nInstance = 0;
+    int nOpt;
+
+    while((nOpt = getopt(argc, argv, "f:i:s:e:H:cG:")) != -1) {
+        switch(nOpt) {
+            case 'f' : sFile = optarg; break;
+            case 'i' : nInstance = atoi(optarg); break;
+            case 's' : dStart = atof(optarg); break;
+            case 'e' : dEnd = atof(optarg); break;
+            case 'H' : dHours = atof(optarg); break;
+            case 'c' : bCsv = true; break;
+            case 'G' : nGenerate = strtoull(optarg, NULL, 10); break;
+            default :
+                fprintf(stderr, "usage : %s [-f file | -i instance] [-s start] [-e end] [-H hours] [-c (csv)] | -G samples [-f file]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    // default is the recorder file of the plugin instance, in the home directory
+    if(sFile.empty()) {
+        if(getenv("HOME")) {
+            sFile = getenv("HOME");
+            sFile += "/";
+        }
+        sFile += "NDV3_Telemetry." + std::to_string(nInstance) + ".rec";
+    }
+
+    if(nGenerate)
+        return generate(sFile.c_str(), nGenerate);
+
+    if(reader.open(sFile.c_str()) != RECORDER_OK) {
+        fprintf(stderr, "Error opening %s\n", sFile.c_str());
+        return 1;
+    }
+
+    if(dHours > 0) {
+        DomeRecordBlockView view;
+        uint32_t nBlocks = reader.getBlockCount();
+        if(nBlocks && reader.getBlock(nBlocks - 1, view))
+            dStart = view.pHeader->dLastTime - dHours * 3600.0;
+    }
+
+    if(bCsv) {
+        printf("time,az_steps,el_steps,volts,cmd_latency_ms,shutter_state,rain\n");
+        reader.scan(dStart, dEnd, csvVisitor, NULL);
+        return 0;
+    }
+
+    memset(&summary, 0, sizeof(RecordSummary));
+    summary.fMinVolts = 1e9f;
+    summary.fMaxVolts = -1e9f;
+    dScanStart = nowSeconds();
+    reader.scan(dStart, dEnd, summaryVisitor, &summary);
+    dScanTime = nowSeconds() - dScanStart;
+
+    printf("samples        : %llu (%u blocks in file)\n", (unsigned long long)summary.nSamples, reader.getBlockCount());
+    if(summary.nSamples) {
+        printf("range          : %.3f -> %.3f (%.2f h)\n", summary.dFirstTime, summary.dLastTime, (summary.dLastTime - summary.dFirstTime) / 3600.0);
+        printf("rotator moves  : %llu samples\n", (unsigned long long)summary.nAzMoves);
+        printf("shutter opened : %llu times\n", (unsigned long long)summary.nShutterCycles);
+        printf("rain events    : %llu\n", (unsigned long long)summary.nRainEvents);
+        if(summary.fMaxVolts >= 0)
+            printf("battery        : %.2f V -> %.2f V\n", summary.fMinVolts, summary.fMaxVolts);
+        if(summary.nLatencySamples)
+            printf("cmd latency    : avg %.1f ms, max %.1f ms (%llu commands)\n", summary.dLatencySum / double(summary.nLatencySamples),
+                   summary.fMaxLatency, (unsigned long long)summary.nLatencySamples);
+    }
+    printf("scan time      : %.3f ms\n", dScanTime * 1000.0);
+    return 0;
+}
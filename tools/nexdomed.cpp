@@ -0,0 +1,782 @@
+//
+//  nexdomed.cpp
+//
+//  NexDome V3 tools
+//  Daemon owning the controller serial link and serving any number of local clients over a Unix
+//  domain socket, so auxiliary tools don't have to fight over the serial port.
+//
+//  Protocol, one ASCII line per message, '\n' terminated :
+//
+//  client -> daemon : <tag> <verb> [arg]
+//      tag is any token chosen by the client, it's echoed in the reply.
+//      queries  : STATE AZ EL SHUTTER VOLTS RAIN BATTERY
+//      commands : GOTO <az> [slit altitude] SYNC <az> OPEN CLOSE PARK UNPARK HOME ABORT
+//                 CALIBRATE [revolutions] (steps per rev from home sensor passes, nothing written to the controller)
+//                 CALIBRATION (result of the last one)
+//                 TUNE [1 to keep the best settings] (rotation speed and acceleration from timed test slews)
+//                 TUNING (result of the last one)
+//                 HOMEDRIFT (step count drift seen at the home sensor crossings, in steps)
+//                 SERIAL (RX backlog, truncated lines and gaps in the position stream)
+//                 LINKSTATS (watchdog state, 0 up 1 down 2 reopened, outages and their durations in seconds)
+//                 FOLLOW <ra> <dec> [OTA side] (keeps the RA/Dec in the slit, degrees, needs -g and -b) UNFOLLOW
+//      events   : SUB UNSUB
+//  daemon -> client : <tag> OK [values] or <tag> ERR <code>
+//  events           : ! <name> <value>  with name in AZ EL MOVING SHUTTER VOLTS RAIN LINK
+//
+//  Queries are served from a cache. When several clients ask for the same value while the cache is
+//  stale, the controller is only queried once and all the pending requests get the same answer.
+//  State changes are sent once per subscribed client, so adding clients doesn't add serial traffic.
+//  With -l the learned slew durations are kept in a file, and a goto about to end is polled sooner than the tick.
+//  With -b and a slit altitude, a GOTO is complete as soon as the telescope beam clears the slit.
+//  -g gives the site and the mount position in the dome, for FOLLOW.
+//  When the serial link dies the port is reopened in the background, LINK goes to 0 until it's back.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../NexDomeV3.h"
+#include "PosixSerX.h"
+
+#define DAEMON_DEFAULT_SOCKET   "/tmp/nexdomev3.sock"
+#define DAEMON_TICK_MS          100     // motion polling and event fan-out period
+#define DAEMON_CACHE_MAX_AGE    0.5     // seconds, a query younger than this is answered from the cache
+#define DAEMON_MAX_LINE         256
+#define DAEMON_MAX_CLIENTS      64
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0  // macOS, SIGPIPE is ignored instead
+#endif
+
+enum DaemonQueries {Q_AZ = 0, Q_EL, Q_SHUTTER, Q_VOLTS, Q_RAIN, Q_BATTERY, Q_COUNT};
+enum DaemonActions {ACT_NONE = 0, ACT_GOTO, ACT_OPEN, ACT_CLOSE, ACT_PARK, ACT_UNPARK, ACT_HOME, ACT_CALIBRATE, ACT_TUNE, ACT_FOLLOW};
+
+typedef struct {
+    int         fd;
+    bool        bSubscribed;
+    std::string sRxBuf;
+} DaemonClient;
+
+typedef struct {
+    int         fd;
+    std::string sTag;
+    bool        bFullState;
+    int         nQuery;
+} PendingQuery;
+
+typedef struct {
+    double  dAz;
+    double  dEl;
+    int     nShutterState;
+    double  dVolts;
+    int     nRain;
+    BatteryStats battery;
+    bool    bMoving;
+    bool    bLinked;
+} DaemonState;
+
+static volatile sig_atomic_t g_bQuit = 0;
+
+static void onSignal(int nSig)
+{
+    (void)nSig;
+    g_bQuit = 1;
+}
+
+class CDomeDaemon
+{
+public:
+    CDomeDaemon();
+    ~CDomeDaemon();
+
+    int     start(const char *pszPort, const char *pszSocket, bool bShutterPresent);
+    void    setMetricsFile(const char *pszPath) { m_NexDome.setMetricsFile(pszPath); }
+    void    setTraceFile(const char *pszPath) { m_NexDome.setTraceFile(pszPath); }
+    void    setSlewModelFile(const char *pszPath);
+    void    setBeam(double dSlitWidth, double dAperture, double dDomeRadius);
+    void    setSite(const DomeGeometryConfig &site);
+    void    run();
+
+protected:
+    void    acceptClient();
+    void    readClient(size_t nIndex);
+    void    dropClient(size_t nIndex);
+    void    handleLine(DaemonClient &client, const std::string &sLine);
+    void    sendTo(int fd, const char *pszLine);
+
+    void    serviceQueries();
+    void    refresh(int nQuery);
+    void    answer(const PendingQuery &query);
+    void    pollMotion();
+    void    fanOutEvents();
+    int     pollTimeout();
+    void    saveSlewModel();
+
+    CPosixSerX          m_SerX;
+    CPosixSleeper       m_Sleeper;
+    CNexDomeV3          m_NexDome;
+
+    int                 m_nListenFd;
+    std::string         m_sSocketPath;
+    std::vector<DaemonClient>   m_Clients;
+    std::vector<PendingQuery>   m_PendingQueries;
+
+    DaemonState         m_State;
+    DaemonState         m_LastSentState;
+    CStopWatch          m_CacheTimer[Q_COUNT];
+    bool                m_bCacheValid[Q_COUNT];
+    int                 m_nAction;
+    std::string         m_sSlewModelFile;
+    int                 m_nSavedSlewSamples;
+
+    unsigned long       m_nQueriesReceived;
+    unsigned long       m_nControllerQueries;
+};
+
+CDomeDaemon::CDomeDaemon()
+{
+    int i;
+
+    m_nListenFd = -1;
+    m_nAction = ACT_NONE;
+    m_nSavedSlewSamples = 0;
+    m_nQueriesReceived = 0;
+    m_nControllerQueries = 0;
+    memset(&m_State, 0, sizeof(DaemonState));
+    m_State.dVolts = -1.0;
+    m_State.nShutterState = IDLE;
+    m_State.nRain = NOT_RAINING;
+    m_LastSentState = m_State;
+    for(i = 0; i < Q_COUNT; i++)
+        m_bCacheValid[i] = false;
+
+    m_NexDome.setSerxPointer(&m_SerX);
+    m_NexDome.setSleeprPinter(&m_Sleeper);
+}
+
+CDomeDaemon::~CDomeDaemon()
+{
+    size_t i;
+
+    for(i = 0; i < m_Clients.size(); i++)
+        close(m_Clients[i].fd);
+    if(m_nListenFd >= 0) {
+        close(m_nListenFd);
+        unlink(m_sSocketPath.c_str());
+    }
+    if(m_NexDome.IsConnected())
+        m_NexDome.Disconnect();
+    saveSlewModel();
+}
+
+void CDomeDaemon::setSlewModelFile(const char *pszPath)
+{
+    std::ifstream modelFile(pszPath);
+    std::string sModel;
+
+    m_sSlewModelFile.assign(pszPath);
+    if(std::getline(modelFile, sModel) && m_NexDome.setSlewModel(sModel))
+        m_nSavedSlewSamples = m_NexDome.getSlewModelSamples();
+}
+
+void CDomeDaemon::setBeam(double dSlitWidth, double dAperture, double dDomeRadius)
+{
+    DomeGeometryConfig geometry = m_NexDome.getGeometry().getConfig();
+
+    geometry.dDomeRadius = dDomeRadius;
+    m_NexDome.setGeometry(geometry);
+    m_NexDome.setSlit(dSlitWidth, dAperture);
+}
+
+void CDomeDaemon::setSite(const DomeGeometryConfig &site)
+{
+    DomeGeometryConfig geometry = m_NexDome.getGeometry().getConfig();
+
+    geometry.dLatitude = site.dLatitude;
+    geometry.dLongitude = site.dLongitude;
+    geometry.dMountEast = site.dMountEast;
+    geometry.dMountNorth = site.dMountNorth;
+    geometry.dMountUp = site.dMountUp;
+    geometry.dOtaOffset = site.dOtaOffset;
+    m_NexDome.setGeometry(geometry);
+}
+
+void CDomeDaemon::saveSlewModel()
+{
+    if(m_sSlewModelFile.empty() || m_NexDome.getSlewModelSamples() == m_nSavedSlewSamples)
+        return;
+    std::ofstream modelFile(m_sSlewModelFile.c_str(), std::ios::trunc);
+    modelFile << m_NexDome.getSlewModel() << "\n";
+    m_nSavedSlewSamples = m_NexDome.getSlewModelSamples();
+}
+
+// the tick, or sooner when the goto in progress should be over before it
+int CDomeDaemon::pollTimeout()
+{
+    int nHintMs;
+
+    if(m_nAction != ACT_GOTO && m_nAction != ACT_PARK)
+        return DAEMON_TICK_MS;
+    nHintMs = m_NexDome.getSlewPollHint();
+    if(nHintMs > 0 && nHintMs < DAEMON_TICK_MS)
+        return nHintMs;
+    return DAEMON_TICK_MS;
+}
+
+int CDomeDaemon::start(const char *pszPort, const char *pszSocket, bool bShutterPresent)
+{
+    int nErr;
+    struct sockaddr_un addr;
+
+    m_NexDome.setShutterPresent(bShutterPresent);
+    nErr = m_NexDome.Connect(pszPort);
+    if(nErr) {
+        fprintf(stderr, "nexdomed : can't connect to controller on %s (error %d)\n", pszPort, nErr);
+        return nErr;
+    }
+    m_State.bLinked = true;
+
+    m_sSocketPath.assign(pszSocket);
+    m_nListenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(m_nListenFd < 0)
+        return ERR_COMMOPENING;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, pszSocket, sizeof(addr.sun_path) - 1);
+    unlink(pszSocket);
+    if(bind(m_nListenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(m_nListenFd, 16) != 0) {
+        fprintf(stderr, "nexdomed : can't listen on %s : %s\n", pszSocket, strerror(errno));
+        return ERR_COMMOPENING;
+    }
+    chmod(pszSocket, 0660);
+    fcntl(m_nListenFd, F_SETFL, O_NONBLOCK);
+    return SB_OK;
+}
+
+void CDomeDaemon::run()
+{
+    std::vector<struct pollfd> pfds;
+    struct pollfd pfd;
+    size_t i;
+    int nRet;
+
+    while(!g_bQuit) {
+        pfds.clear();
+        pfd.fd = m_nListenFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        pfds.push_back(pfd);
+        for(i = 0; i < m_Clients.size(); i++) {
+            pfd.fd = m_Clients[i].fd;
+            pfds.push_back(pfd);
+        }
+
+        nRet = poll(&pfds[0], pfds.size(), pollTimeout());
+        if(nRet < 0 && errno != EINTR)
+            break;
+
+        if(nRet > 0) {
+            // walk backward so dropping a client doesn't shift the ones we haven't looked at yet
+            for(i = pfds.size() - 1; i >= 1; i--) {
+                if(pfds[i].revents & (POLLIN | POLLHUP | POLLERR))
+                    readClient(i - 1);
+            }
+            if(pfds[0].revents & POLLIN)
+                acceptClient();
+        }
+
+        // unsolicited lines are handled every tick, so the replies to the queries aren't behind a backlog
+        m_NexDome.drainAsync();
+        m_State.bLinked = !m_NexDome.isLinkRecovering();
+        serviceQueries();
+        pollMotion();
+        fanOutEvents();
+    }
+}
+
+void CDomeDaemon::acceptClient()
+{
+    DaemonClient client;
+    int fd;
+
+    while((fd = accept(m_nListenFd, NULL, NULL)) >= 0) {
+        if(m_Clients.size() >= DAEMON_MAX_CLIENTS) {
+            close(fd);
+            continue;
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        client.fd = fd;
+        client.bSubscribed = false;
+        client.sRxBuf.clear();
+        m_Clients.push_back(client);
+    }
+}
+
+void CDomeDaemon::readClient(size_t nIndex)
+{
+    char szBuf[DAEMON_MAX_LINE];
+    ssize_t nRead;
+    size_t nPos;
+    std::string sLine;
+
+    bool bClosed = false;
+
+    while(true) {
+        nRead = read(m_Clients[nIndex].fd, szBuf, sizeof(szBuf));
+        if(nRead < 0 && errno == EAGAIN)
+            break;
+        if(nRead <= 0) {
+            bClosed = true;
+            break;
+        }
+        m_Clients[nIndex].sRxBuf.append(szBuf, (size_t)nRead);
+    }
+
+    while((nPos = m_Clients[nIndex].sRxBuf.find('\n')) != std::string::npos) {
+        sLine = m_Clients[nIndex].sRxBuf.substr(0, nPos);
+        m_Clients[nIndex].sRxBuf.erase(0, nPos + 1);
+        if(sLine.size() && sLine[sLine.size()-1] == '\r')
+            sLine.erase(sLine.size()-1);
+        if(sLine.size())
+            handleLine(m_Clients[nIndex], sLine);
+    }
+    // a client sending garbage without new lines gets dropped
+    if(bClosed || m_Clients[nIndex].sRxBuf.size() > DAEMON_MAX_LINE)
+        dropClient(nIndex);
+}
+
+void CDomeDaemon::dropClient(size_t nIndex)
+{
+    size_t i;
+    int fd = m_Clients[nIndex].fd;
+
+    for(i = m_PendingQueries.size(); i > 0; i--) {
+        if(m_PendingQueries[i-1].fd == fd)
+            m_PendingQueries.erase(m_PendingQueries.begin() + (i-1));
+    }
+    close(fd);
+    m_Clients.erase(m_Clients.begin() + nIndex);
+}
+
+void CDomeDaemon::sendTo(int fd, const char *pszLine)
+{
+    // replies are short, if the client doesn't read its socket it loses them.
+    (void)send(fd, pszLine, strlen(pszLine), MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+void CDomeDaemon::handleLine(DaemonClient &client, const std::string &sLine)
+{
+    char szTag[DAEMON_MAX_LINE];
+    char szVerb[DAEMON_MAX_LINE];
+    char szReply[DAEMON_MAX_LINE];
+    double dArg = 0.0;
+    double dArg2 = 0.0;
+    double dArg3 = 0.0;
+    double dLst;
+    int nFields;
+    int nErr = PLUGIN_OK;
+    PendingQuery query;
+    std::string sVerb;
+    StepsPerRevCalibration calibration;
+    RotationTuning tuning;
+    HomeDriftStats homeDrift;
+    MetricsCounters counters;
+    LinkStats linkStats;
+    int nLen;
+    int i;
+
+    nFields = sscanf(sLine.c_str(), "%255s %255s %lf %lf %lf", szTag, szVerb, &dArg, &dArg2, &dArg3);
+    if(nFields < 2) {
+        sendTo(client.fd, "? ERR syntax\n");
+        return;
+    }
+    sVerb.assign(szVerb);
+
+    query.fd = client.fd;
+    query.sTag.assign(szTag);
+    query.bFullState = false;
+    query.nQuery = -1;
+
+    if(sVerb == "STATE")
+        query.bFullState = true;
+    else if(sVerb == "AZ")
+        query.nQuery = Q_AZ;
+    else if(sVerb == "EL")
+        query.nQuery = Q_EL;
+    else if(sVerb == "SHUTTER")
+        query.nQuery = Q_SHUTTER;
+    else if(sVerb == "VOLTS")
+        query.nQuery = Q_VOLTS;
+    else if(sVerb == "RAIN")
+        query.nQuery = Q_RAIN;
+    else if(sVerb == "BATTERY")
+        query.nQuery = Q_BATTERY;
+
+    if(query.bFullState || query.nQuery >= 0) {
+        m_nQueriesReceived++;
+        m_PendingQueries.push_back(query);
+        return;
+    }
+
+    if(sVerb == "SUB") {
+        client.bSubscribed = true;
+    }
+    else if(sVerb == "UNSUB") {
+        client.bSubscribed = false;
+    }
+    else if(sVerb == "GOTO" && nFields >= 3) {
+        m_NexDome.stopFollowing();
+        nErr = m_NexDome.gotoAzimuth(dArg, nFields == 4 ? dArg2 : NAN);
+        if(!nErr)
+            m_nAction = ACT_GOTO;
+    }
+    else if(sVerb == "SYNC" && nFields == 3) {
+        nErr = m_NexDome.syncDome(dArg, m_State.dEl);
+        m_bCacheValid[Q_AZ] = false;
+    }
+    else if(sVerb == "OPEN") {
+        nErr = m_NexDome.openShutter();
+        if(!nErr)
+            m_nAction = ACT_OPEN;
+    }
+    else if(sVerb == "CLOSE") {
+        nErr = m_NexDome.closeShutter();
+        if(!nErr)
+            m_nAction = ACT_CLOSE;
+    }
+    else if(sVerb == "PARK") {
+        nErr = m_NexDome.parkDome();
+        if(!nErr)
+            m_nAction = ACT_PARK;
+    }
+    else if(sVerb == "UNPARK") {
+        nErr = m_NexDome.unparkDome();
+        if(!nErr)
+            m_nAction = ACT_UNPARK;
+    }
+    else if(sVerb == "HOME") {
+        nErr = m_NexDome.goHome();
+        if(!nErr)
+            m_nAction = ACT_HOME;
+    }
+    else if(sVerb == "ABORT") {
+        if(m_nAction == ACT_CALIBRATE)
+            m_NexDome.abortStepsPerRevCalibration();
+        else if(m_nAction == ACT_TUNE)
+            m_NexDome.abortRotationTuning();
+        else
+            nErr = m_NexDome.abortCurrentCommand();
+        m_nAction = ACT_NONE;
+    }
+    else if(sVerb == "FOLLOW" && nFields >= 4) {
+        dLst = CDomeGeometry::localSiderealTime(double(time(NULL)), m_NexDome.getGeometry().getConfig().dLongitude);
+        // OTA side from the hour angle (counterweights down) when not given
+        if(nFields < 5)
+            dArg3 = m_NexDome.getGeometry().getConfig().dOtaOffset == 0 ? OTA_NO_OFFSET : (CDomeFollowPlanner::azDistance(dArg, dLst) < 0 ? OTA_WEST_OF_PIER : OTA_EAST_OF_PIER);
+        nErr = m_NexDome.startFollowing(dArg, dArg2, int(dArg3), dLst);
+        if(!nErr)
+            m_nAction = ACT_FOLLOW;
+    }
+    else if(sVerb == "UNFOLLOW") {
+        m_NexDome.stopFollowing();
+        if(m_nAction == ACT_FOLLOW)
+            m_nAction = ACT_NONE;
+    }
+    else if(sVerb == "CALIBRATE") {
+        nErr = m_NexDome.startStepsPerRevCalibration(nFields == 3 ? int(dArg) : CALIBRATION_REVOLUTIONS);
+        if(!nErr)
+            m_nAction = ACT_CALIBRATE;
+    }
+    else if(sVerb == "CALIBRATION") {
+        // kept by the plugin, no controller query
+        m_NexDome.getStepsPerRevCalibration(calibration);
+        snprintf(szReply, DAEMON_MAX_LINE, "%s OK state=%d steps=%d uncertainty=%3.1f stddev=%3.1f revolutions=%d hysteresis=%d\n",
+                 szTag, calibration.nState, calibration.nStepsPerRev, calibration.dUncertainty, calibration.dStdDev, calibration.nSamples, calibration.nHysteresis);
+        sendTo(client.fd, szReply);
+        return;
+    }
+    else if(sVerb == "SERIAL") {
+        m_NexDome.getMetrics().getCounters(counters);
+        snprintf(szReply, DAEMON_MAX_LINE, "%s OK backlog_max=%llu backlog_mean=%3.1f samples=%llu truncated=%llu gaps=%llu dropped=%llu garbage=%llu\n",
+                 szTag, (unsigned long long)counters.nRxBacklogMax, counters.nRxBacklogSamples ? double(counters.nRxBacklogSum) / counters.nRxBacklogSamples : 0.0,
+                 (unsigned long long)counters.nRxBacklogSamples, (unsigned long long)counters.nParserTruncated, (unsigned long long)counters.nSequenceGaps,
+                 (unsigned long long)counters.nParserDropped, (unsigned long long)counters.nParserGarbage);
+        sendTo(client.fd, szReply);
+        return;
+    }
+    else if(sVerb == "LINKSTATS") {
+        m_NexDome.getLinkStats(linkStats);
+        snprintf(szReply, DAEMON_MAX_LINE, "%s OK state=%d outages=%d reopens=%d last=%3.1f total=%3.1f current=%3.1f\n",
+                 szTag, linkStats.nState, linkStats.nOutages, linkStats.nReopens, linkStats.dLastOutage, linkStats.dTotalOutage, linkStats.dCurrentOutage);
+        sendTo(client.fd, szReply);
+        return;
+    }
+    else if(sVerb == "HOMEDRIFT") {
+        m_NexDome.getHomeDriftStats(homeDrift);
+        snprintf(szReply, DAEMON_MAX_LINE, "%s OK crossings=%d measured=%d resyncs=%d rejected=%d last=%d max=%d mean=%3.1f\n",
+                 szTag, homeDrift.nCrossings, homeDrift.nMeasured, homeDrift.nResyncs, homeDrift.nRejected, homeDrift.nLastDrift, homeDrift.nMaxDrift, homeDrift.dMeanAbsDrift);
+        sendTo(client.fd, szReply);
+        return;
+    }
+    else if(sVerb == "TUNE") {
+        nErr = m_NexDome.startRotationTuning(nFields == 3 && dArg != 0.0);
+        if(!nErr)
+            m_nAction = ACT_TUNE;
+    }
+    else if(sVerb == "TUNING") {
+        // one line, the best candidate first then speed/acceleration:seconds for the stable ones
+        m_NexDome.getRotationTuning(tuning);
+        nLen = snprintf(szReply, DAEMON_MAX_LINE, "%s OK state=%d tested=%d best=%d/%d applied=%d", szTag, tuning.nState, tuning.nCurrent,
+                        tuning.nBest >= 0 ? tuning.candidates[tuning.nBest].nSpeed : 0, tuning.nBest >= 0 ? tuning.candidates[tuning.nBest].nAcceleration : 0, tuning.bApplied?1:0);
+        for(i = 0; i < tuning.nCandidates && nLen < DAEMON_MAX_LINE - 32; i++) {
+            if(tuning.candidates[i].bStable)
+                nLen += snprintf(szReply + nLen, DAEMON_MAX_LINE - nLen, " %d/%d:%3.1f", tuning.candidates[i].nSpeed, tuning.candidates[i].nAcceleration, tuning.candidates[i].dSlewSeconds);
+        }
+        snprintf(szReply + nLen, DAEMON_MAX_LINE - nLen, "\n");
+        sendTo(client.fd, szReply);
+        return;
+    }
+    else {
+        snprintf(szReply, DAEMON_MAX_LINE, "%s ERR unknown\n", szTag);
+        sendTo(client.fd, szReply);
+        return;
+    }
+
+    if(nErr)
+        snprintf(szReply, DAEMON_MAX_LINE, "%s ERR %d\n", szTag, nErr);
+    else
+        snprintf(szReply, DAEMON_MAX_LINE, "%s OK\n", szTag);
+    sendTo(client.fd, szReply);
+}
+
+void CDomeDaemon::serviceQueries()
+{
+    bool bNeeded[Q_COUNT];
+    size_t i;
+    int q;
+
+    if(m_PendingQueries.empty())
+        return;
+
+    // collect what the pending queries need, each stale value is read from the controller once.
+    for(q = 0; q < Q_COUNT; q++)
+        bNeeded[q] = false;
+    for(i = 0; i < m_PendingQueries.size(); i++) {
+        if(m_PendingQueries[i].bFullState) {
+            for(q = 0; q < Q_COUNT; q++)
+                bNeeded[q] = true;
+        }
+        else
+            bNeeded[m_PendingQueries[i].nQuery] = true;
+    }
+
+    for(q = 0; q < Q_COUNT; q++) {
+        if(bNeeded[q] && (!m_bCacheValid[q] || m_CacheTimer[q].GetElapsedSeconds() > DAEMON_CACHE_MAX_AGE))
+            refresh(q);
+    }
+
+    for(i = 0; i < m_PendingQueries.size(); i++)
+        answer(m_PendingQueries[i]);
+    m_PendingQueries.clear();
+}
+
+void CDomeDaemon::refresh(int nQuery)
+{
+    m_nControllerQueries++;
+    switch(nQuery) {
+        case Q_AZ :
+            m_State.dAz = m_NexDome.getCurrentAz();
+            break;
+        case Q_EL :
+            m_State.dEl = m_NexDome.getCurrentEl();
+            break;
+        case Q_SHUTTER :
+            m_State.nShutterState = m_NexDome.getCurrentShutterState();
+            break;
+        case Q_VOLTS :
+            m_NexDome.getShutterVolts(m_State.dVolts);
+            break;
+        case Q_RAIN :
+            m_NexDome.getRainSensorStatus(m_State.nRain);
+            break;
+        case Q_BATTERY :
+            m_NexDome.getBatteryStats(m_State.battery);
+            break;
+        default :
+            return;
+    }
+    m_bCacheValid[nQuery] = true;
+    m_CacheTimer[nQuery].Reset();
+}
+
+void CDomeDaemon::answer(const PendingQuery &query)
+{
+    char szReply[DAEMON_MAX_LINE];
+    const char *pszTag = query.sTag.c_str();
+
+    if(query.bFullState) {
+        snprintf(szReply, DAEMON_MAX_LINE, "%s OK az=%3.2f el=%3.2f shutter=%d volts=%3.2f rain=%d moving=%d\n",
+                 pszTag, m_State.dAz, m_State.dEl, m_State.nShutterState, m_State.dVolts, m_State.nRain, m_State.bMoving?1:0);
+    }
+    else {
+        switch(query.nQuery) {
+            case Q_AZ :         snprintf(szReply, DAEMON_MAX_LINE, "%s OK %3.2f\n", pszTag, m_State.dAz); break;
+            case Q_EL :         snprintf(szReply, DAEMON_MAX_LINE, "%s OK %3.2f\n", pszTag, m_State.dEl); break;
+            case Q_SHUTTER :    snprintf(szReply, DAEMON_MAX_LINE, "%s OK %d\n", pszTag, m_State.nShutterState); break;
+            case Q_VOLTS :      snprintf(szReply, DAEMON_MAX_LINE, "%s OK %3.2f\n", pszTag, m_State.dVolts); break;
+            case Q_RAIN :       snprintf(szReply, DAEMON_MAX_LINE, "%s OK %d\n", pszTag, m_State.nRain); break;
+            case Q_BATTERY :
+                snprintf(szReply, DAEMON_MAX_LINE, "%s OK volts=%3.2f idle_rate=%3.3f move_drop=%3.3f move_sag=%3.3f cycles_left=%d hours_left=%3.1f\n",
+                         pszTag, m_State.battery.dVolts, m_State.battery.dIdleRate, m_State.battery.dMoveDrop, m_State.battery.dMoveSag,
+                         m_State.battery.nCyclesLeft, m_State.battery.dHoursToCutoff);
+                break;
+            default :           snprintf(szReply, DAEMON_MAX_LINE, "%s ERR query\n", pszTag); break;
+        }
+    }
+    sendTo(query.fd, szReply);
+}
+
+void CDomeDaemon::pollMotion()
+{
+    bool bComplete = false;
+    bool bFollowing = false;
+    int nErr = PLUGIN_OK;
+
+    if(m_nAction == ACT_NONE) {
+        m_State.bMoving = false;
+        return;
+    }
+
+    switch(m_nAction) {
+        case ACT_GOTO :     nErr = m_NexDome.isGoToComplete(bComplete); break;
+        case ACT_OPEN :     nErr = m_NexDome.isOpenComplete(bComplete); break;
+        case ACT_CLOSE :    nErr = m_NexDome.isCloseComplete(bComplete); break;
+        case ACT_PARK :     nErr = m_NexDome.isParkComplete(bComplete); break;
+        case ACT_UNPARK :   nErr = m_NexDome.isUnparkComplete(bComplete); break;
+        case ACT_HOME :     nErr = m_NexDome.isFindHomeComplete(bComplete); break;
+        case ACT_CALIBRATE : nErr = m_NexDome.updateStepsPerRevCalibration(bComplete); break;
+        case ACT_TUNE :     nErr = m_NexDome.updateRotationTuning(bComplete); break;
+        case ACT_FOLLOW :
+            nErr = m_NexDome.updateFollowing(bFollowing);
+            bComplete = !bFollowing;
+            break;
+    }
+
+    // positions are streamed by the controller during the move, no extra query needed.
+    m_State.dAz = m_NexDome.getCurrentAz();
+    m_bCacheValid[Q_AZ] = true;
+    m_CacheTimer[Q_AZ].Reset();
+    m_State.bMoving = !bComplete;
+    if(bComplete && (m_nAction == ACT_GOTO || m_nAction == ACT_PARK))
+        saveSlewModel();
+    if(bComplete || nErr)
+        m_nAction = ACT_NONE;
+}
+
+void CDomeDaemon::fanOutEvents()
+{
+    char szEvents[DAEMON_MAX_LINE * 4];
+    size_t nLen = 0;
+    size_t i;
+
+    szEvents[0] = 0;
+    if(int(m_State.dAz * 10) != int(m_LastSentState.dAz * 10))
+        nLen += snprintf(szEvents + nLen, sizeof(szEvents) - nLen, "! AZ %3.2f\n", m_State.dAz);
+    if(int(m_State.dEl * 10) != int(m_LastSentState.dEl * 10))
+        nLen += snprintf(szEvents + nLen, sizeof(szEvents) - nLen, "! EL %3.2f\n", m_State.dEl);
+    if(m_State.bMoving != m_LastSentState.bMoving)
+        nLen += snprintf(szEvents + nLen, sizeof(szEvents) - nLen, "! MOVING %d\n", m_State.bMoving?1:0);
+    if(m_State.nShutterState != m_LastSentState.nShutterState)
+        nLen += snprintf(szEvents + nLen, sizeof(szEvents) - nLen, "! SHUTTER %d\n", m_State.nShutterState);
+    if(int(m_State.dVolts * 100) != int(m_LastSentState.dVolts * 100))
+        nLen += snprintf(szEvents + nLen, sizeof(szEvents) - nLen, "! VOLTS %3.2f\n", m_State.dVolts);
+    if(m_State.nRain != m_LastSentState.nRain)
+        nLen += snprintf(szEvents + nLen, sizeof(szEvents) - nLen, "! RAIN %d\n", m_State.nRain);
+    if(m_State.bLinked != m_LastSentState.bLinked)
+        nLen += snprintf(szEvents + nLen, sizeof(szEvents) - nLen, "! LINK %d\n", m_State.bLinked?1:0);
+
+    m_LastSentState = m_State;
+    if(!nLen)
+        return;
+
+    for(i = 0; i < m_Clients.size(); i++) {
+        if(m_Clients[i].bSubscribed)
+            sendTo(m_Clients[i].fd, szEvents);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *pszSocket = DAEMON_DEFAULT_SOCKET;
+    const char *pszPort = NULL;
+    const char *pszMetrics = NULL;
+    const char *pszTrace = NULL;
+    const char *pszSlewModel = NULL;
+    double dSlitWidth = 0, dAperture = 0, dDomeRadius = 0;
+    DomeGeometryConfig site;
+    bool bSite = false;
+    bool bShutterPresent = false;
+    int nOpt;
+    CDomeDaemon *pDaemon;
+
+    memset(&site, 0, sizeof(DomeGeometryConfig));
+    while((nOpt = getopt(argc, argv, "s:Sm:t:l:b:g:")) != -1) {
+        switch(nOpt) {
+            case 's' : pszSocket = optarg; break;
+            case 'S' : bShutterPresent = true; break;
+            case 'm' : pszMetrics = optarg; break;
+            case 't' : pszTrace = optarg; break;
+            case 'l' : pszSlewModel = optarg; break;
+            case 'b' : sscanf(optarg, "%lf,%lf,%lf", &dSlitWidth, &dAperture, &dDomeRadius); break;
+            case 'g' :
+                bSite = sscanf(optarg, "%lf,%lf,%lf,%lf,%lf,%lf", &site.dLatitude, &site.dLongitude, &site.dMountEast, &site.dMountNorth, &site.dMountUp, &site.dOtaOffset) >= 2;
+                break;
+            default :
+                fprintf(stderr, "usage : %s [-s socket] [-S (shutter present)] [-m metrics.prom] [-t trace.json] [-l slew model file] [-b slit width,aperture,dome radius] [-g latitude,longitude[,mount east,north,up[,OTA offset]]] serial_port\n", argv[0]);
+                return 1;
+        }
+    }
+    if(optind >= argc) {
+        fprintf(stderr, "usage : %s [-s socket] [-S (shutter present)] [-m metrics.prom] [-t trace.json] [-l slew model file] [-b slit width,aperture,dome radius] [-g latitude,longitude[,mount east,north,up[,OTA offset]]] serial_port\n", argv[0]);
+        return 1;
+    }
+    pszPort = argv[optind];
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    pDaemon = new CDomeDaemon();
+    if(pszMetrics)
+        pDaemon->setMetricsFile(pszMetrics);
+    if(pszTrace)
+        pDaemon->setTraceFile(pszTrace);
+    if(pszSlewModel)
+        pDaemon->setSlewModelFile(pszSlewModel);
+    if(dDomeRadius > 0)
+        pDaemon->setBeam(dSlitWidth, dAperture, dDomeRadius);
+    if(bSite)
+        pDaemon->setSite(site);
+    if(pDaemon->start(pszPort, pszSocket, bShutterPresent)) {
+        delete pDaemon;
+        return 1;
+    }
+    pDaemon->run();
+    delete pDaemon;
+    return 0;
+}
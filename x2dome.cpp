@@ -22,6 +22,11 @@ X2Dome::X2Dome(const char* pszSelection,
 	m_pTickCount					= pTickCount;
 
 	m_bLinked = false;
+    m_bShmTelemetry = false;
+    m_bRecordTelemetry = false;
+    m_bUseGeometry = false;
+    m_nSavedSlewSamples = 0;
+    m_bDrainRunning = false;
 
     m_NexDome.setSerxPointer(pSerX);
     m_NexDome.setSleeprPinter(pSleeper);
@@ -37,12 +42,60 @@ X2Dome::X2Dome(const char* pszSelection,
         m_NexDome.setHomeOnUnpark(m_bHomeOnUnpark);
         m_NexDome.setShutterPresent(m_bHasShutterControl);
         m_NexDome.enableRainStatusFile(m_bLogRainStatus);
+        // on by default, other local processes can read the dome state from /NexDomeV3.<index>
+        m_bShmTelemetry = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_SHM_TELEMETRY, true);
+        // off by default, samples go to NDV3_Telemetry.<index>.rec in the home directory (bounded size)
+        m_bRecordTelemetry = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_RECORD_TELEMETRY, false);
+        // Prometheus textfile, empty (default) disables the export
+        char szMetricsFile[LOG_BUFFER_SIZE];
+        m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_METRICS_FILE, "", szMetricsFile, LOG_BUFFER_SIZE);
+        m_NexDome.setMetricsInstance(m_nPrivateISIndex);
+        m_NexDome.setMetricsFile(szMetricsFile);
+        // Chrome trace-event JSON written on disconnect, empty (default) disables tracing
+        char szTraceFile[LOG_BUFFER_SIZE];
+        m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_TRACE_FILE, "", szTraceFile, LOG_BUFFER_SIZE);
+        m_NexDome.setTraceFile(szTraceFile);
+        // slew durations learned in the previous sessions
+        char szSlewModel[SLEW_MODEL_BUFFER_SIZE];
+        m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_SLEW_MODEL, "", szSlewModel, SLEW_MODEL_BUFFER_SIZE);
+        if(m_NexDome.setSlewModel(szSlewModel))
+            m_nSavedSlewSamples = m_NexDome.getSlewModelSamples();
+        DomeGeometryConfig geometry = m_NexDome.getGeometry().getConfig();
+        geometry.dDomeRadius = m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_DOME_RADIUS, geometry.dDomeRadius);
+        // off by default, TheSkyX computes the dome azimuth. When on, the TheSkyX dome geometry has to be
+        // all 0 so we get the telescope alt/az and do the offsets ourselves, in the dome radius unit.
+        m_bUseGeometry = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_USE_GEOMETRY, false);
+        geometry.dLatitude = m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_LATITUDE, 0);
+        geometry.dLongitude = m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_LONGITUDE, 0);
+        geometry.dMountEast = m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_MOUNT_EAST, 0);
+        geometry.dMountNorth = m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_MOUNT_NORTH, 0);
+        geometry.dMountUp = m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_MOUNT_UP, 0);
+        geometry.dOtaOffset = m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_OTA_OFFSET, 0);
+        m_NexDome.setGeometry(geometry);
+        // slit width and telescope aperture in the dome radius unit, a goto is then complete as soon as the
+        // telescope sees out of the slit. Not set (default), gotos end within GOTO_TOLERANCE of the target.
+        m_NexDome.setSlit(m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_SLIT_WIDTH, 0), m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_APERTURE, 0));
+        // on by default, the step count is corrected when a goto crosses the home sensor
+        m_NexDome.setHomeResync(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_HOME_RESYNC, true));
+        // where the sensor fires in each direction, learned in a previous session
+        m_NexDome.setHomeEdges(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_HOME_EDGE_UP, HOME_EDGE_UNKNOWN), m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_HOME_EDGE_DOWN, HOME_EDGE_UNKNOWN));
+        // on by default, a dead link is reopened in the background and the goto or shutter move done again
+        m_NexDome.enableWatchdog(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_LINK_WATCHDOG, true));
     }
+
+    if(m_bShmTelemetry) {
+        char szShmName[LOG_BUFFER_SIZE];
+        snprintf(szShmName, LOG_BUFFER_SIZE, "%s%d", DOME_TELEMETRY_SHM_PREFIX, m_nPrivateISIndex);
+        m_NexDome.enableTelemetry(true, szShmName);
+    }
+    if(m_bRecordTelemetry)
+        m_NexDome.enableRecorder(true);
 }
 
 
 X2Dome::~X2Dome()
 {
+    stopDrain();
 	if (m_pSerX)
 		delete m_pSerX;
 	if (m_pTheSkyXForMounts)
@@ -66,7 +119,7 @@ int X2Dome::establishLink(void)
     int nErr;
     char szPort[SERIAL_BUFFER_SIZE];
 
-    X2MutexLocker ml(GetMutex());
+    CTracedMutexLocker ml(GetMutex(), m_NexDome, __func__);
 
     // get serial port device name
     portNameOnToCharPtr(szPort,SERIAL_BUFFER_SIZE);
@@ -75,18 +128,25 @@ int X2Dome::establishLink(void)
         m_bLinked = false;
         // nErr = ERR_COMMOPENING;
     }
-    else
+    else {
         m_bLinked = true;
+        startDrain();
+    }
 
 	return nErr;
 }
 
 int X2Dome::terminateLink(void)					
 {
-    X2MutexLocker ml(GetMutex());
+    // before taking the mutex, the drain thread may be waiting on it
+    stopDrain();
+
+    CTracedMutexLocker ml(GetMutex(), m_NexDome, __func__);
 
     m_NexDome.Disconnect();
 	m_bLinked = false;
+    saveSlewModel();
+    saveHomeEdges();
 
     return SB_OK;
 }
@@ -97,6 +157,37 @@ int X2Dome::terminateLink(void)
 }
 
 
+void X2Dome::startDrain()
+{
+    if(m_bDrainRunning)
+        return;
+    m_bDrainRunning = true;
+    m_drainThread = std::thread(&X2Dome::drainLoop, this);
+}
+
+void X2Dome::stopDrain()
+{
+    m_bDrainRunning = false;
+    if(m_drainThread.joinable())
+        m_drainThread.join();
+}
+
+void X2Dome::drainLoop()
+{
+    bool bFollowing;
+
+    while(m_bDrainRunning) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(ASYNC_DRAIN_INTERVAL));
+        // plain lock, the mutex wait metric and trace are about the TheSkyX calls
+        X2MutexLocker ml(GetMutex());
+        if(m_bDrainRunning && m_bLinked) {
+            m_NexDome.drainAsync();
+            // slaving, the planned moves start from here
+            m_NexDome.updateFollowing(bFollowing);
+        }
+    }
+}
+
 int X2Dome::queryAbstraction(const char* pszName, void** ppVal)
 {
     *ppVal = NULL;
@@ -136,6 +227,9 @@ int X2Dome::execModalSettingsDialog()
     int nSAcc = 0;
     int nStepPos = 0;
     int nDeadZoneSteps;
+    DomeGeometryConfig geometry;
+    double dSlitWidth;
+    double dAperture;
     
     if (NULL == ui)
         return ERR_POINTER;
@@ -146,7 +240,7 @@ int X2Dome::execModalSettingsDialog()
     if (NULL == (dx = uiutil.X2DX()))
         return ERR_POINTER;
 
-    X2MutexLocker ml(GetMutex());
+    CTracedMutexLocker ml(GetMutex(), m_NexDome, __func__);
 
     memset(szTmpBuf,0,SERIAL_BUFFER_SIZE);
     // set controls state depending on the connection state
@@ -186,6 +280,8 @@ int X2Dome::execModalSettingsDialog()
     
     if(m_bLinked) {
 		dx->setEnabled("pushButton",true);	 // reset to factory
+        dx->setEnabled("calibrateButton",true);
+        dx->setEnabled("tuneButton",true);
         dx->setEnabled("homePosition",true);
         dx->setPropertyDouble("homePosition","value", m_NexDome.getHomeAz());
         // read values from dome controller
@@ -257,14 +353,38 @@ int X2Dome::execModalSettingsDialog()
         dx->setPropertyString("currentStepPos","text", "--");
         dx->setPropertyString("shutterBatteryLevel","text", "--");
         dx->setEnabled("pushButton",false);
+        dx->setEnabled("calibrateButton",false);
+        dx->setEnabled("tuneButton",false);
         dx->setPropertyString("rainStatus","text", "--");
     }
     dx->setPropertyDouble("parkPosition","value", m_NexDome.getParkAz());
 
+    geometry = m_NexDome.getGeometry().getConfig();
+    dx->setChecked("useGeometry", m_bUseGeometry);
+    dx->setPropertyDouble("latitude","value", geometry.dLatitude);
+    dx->setPropertyDouble("longitude","value", geometry.dLongitude);
+    dx->setPropertyDouble("domeRadius","value", geometry.dDomeRadius);
+    dx->setPropertyDouble("mountEast","value", geometry.dMountEast);
+    dx->setPropertyDouble("mountNorth","value", geometry.dMountNorth);
+    dx->setPropertyDouble("mountUp","value", geometry.dMountUp);
+    dx->setPropertyDouble("otaOffset","value", geometry.dOtaOffset);
+    m_NexDome.getSlit(dSlitWidth, dAperture);
+    dx->setPropertyDouble("slitWidth","value", dSlitWidth);
+    dx->setPropertyDouble("aperture","value", dAperture);
+
+    // don't hold the port while the user looks at the dialog, on_timer takes it when it needs it
+    ml.unlock();
+
     //Display the user interface
     if ((nErr = ui->exec(bPressedOK)))
         return nErr;
 
+    ml.lock();
+
+    // closing the dialog stops a calibration that's still going
+    m_NexDome.abortStepsPerRevCalibration();
+    m_NexDome.abortRotationTuning();
+
     //Retreive values from the user interface
     if (bPressedOK) {
         dx->propertyInt("ticksPerRev", "value", n_nbStepPerRev);
@@ -280,7 +400,19 @@ int X2Dome::execModalSettingsDialog()
         m_bHomeOnPark = dx->isChecked("homeOnPark");
         m_bHomeOnUnpark = dx->isChecked("homeOnUnpark");
         m_bLogRainStatus = dx->isChecked("checkBox");
-
+        m_bUseGeometry = dx->isChecked("useGeometry");
+        dx->propertyDouble("latitude", "value", geometry.dLatitude);
+        dx->propertyDouble("longitude", "value", geometry.dLongitude);
+        dx->propertyDouble("domeRadius", "value", geometry.dDomeRadius);
+        dx->propertyDouble("mountEast", "value", geometry.dMountEast);
+        dx->propertyDouble("mountNorth", "value", geometry.dMountNorth);
+        dx->propertyDouble("mountUp", "value", geometry.dMountUp);
+        dx->propertyDouble("otaOffset", "value", geometry.dOtaOffset);
+        dx->propertyDouble("slitWidth", "value", dSlitWidth);
+        dx->propertyDouble("aperture", "value", dAperture);
+
+        m_NexDome.setGeometry(geometry);
+        m_NexDome.setSlit(dSlitWidth, dAperture);
         m_NexDome.setShutterPresent(m_bHasShutterControl);
         m_NexDome.setHomeOnPark(m_bHomeOnPark);
         m_NexDome.setHomeOnUnpark(m_bHomeOnUnpark);
@@ -315,6 +447,16 @@ int X2Dome::execModalSettingsDialog()
         nErr |= m_pIniUtil->writeInt(PARENT_KEY, CHILD_KEY_HOME_ON_PARK, m_bHomeOnPark);
         nErr |= m_pIniUtil->writeInt(PARENT_KEY, CHILD_KEY_HOME_ON_UNPARK, m_bHomeOnUnpark);
         nErr |= m_pIniUtil->writeInt(PARENT_KEY, CHILD_KEY_LOG_RAIN_STATUS, m_bLogRainStatus);
+        nErr |= m_pIniUtil->writeInt(PARENT_KEY, CHILD_KEY_USE_GEOMETRY, m_bUseGeometry);
+        nErr |= m_pIniUtil->writeDouble(PARENT_KEY, CHILD_KEY_LATITUDE, geometry.dLatitude);
+        nErr |= m_pIniUtil->writeDouble(PARENT_KEY, CHILD_KEY_LONGITUDE, geometry.dLongitude);
+        nErr |= m_pIniUtil->writeDouble(PARENT_KEY, CHILD_KEY_DOME_RADIUS, geometry.dDomeRadius);
+        nErr |= m_pIniUtil->writeDouble(PARENT_KEY, CHILD_KEY_MOUNT_EAST, geometry.dMountEast);
+        nErr |= m_pIniUtil->writeDouble(PARENT_KEY, CHILD_KEY_MOUNT_NORTH, geometry.dMountNorth);
+        nErr |= m_pIniUtil->writeDouble(PARENT_KEY, CHILD_KEY_MOUNT_UP, geometry.dMountUp);
+        nErr |= m_pIniUtil->writeDouble(PARENT_KEY, CHILD_KEY_OTA_OFFSET, geometry.dOtaOffset);
+        nErr |= m_pIniUtil->writeDouble(PARENT_KEY, CHILD_KEY_SLIT_WIDTH, dSlitWidth);
+        nErr |= m_pIniUtil->writeDouble(PARENT_KEY, CHILD_KEY_APERTURE, dAperture);
     }
     return nErr;
 
@@ -334,11 +476,15 @@ void X2Dome::uiEvent(X2GUIExchangeInterface* uiex, const char* pszEvent)
     int nSSpeed = 0;
     int nSAcc = 0;
     int nStepPos = 0;
-    
+    bool bComplete;
+    StepsPerRevCalibration calibration;
+    RotationTuning tuning;
+
     if (!strcmp(pszEvent, "on_timer"))
     {
         m_bHasShutterControl = uiex->isChecked("hasShutterCtrl");
         if(m_bLinked) {
+            CTracedMutexLocker ml(GetMutex(), m_NexDome, "uiEvent on_timer");
             if(m_bHasShutterControl) {
 				m_NexDome.getShutterVolts(dShutterBattery);
 				if(dShutterBattery>=0.0f)
@@ -357,12 +503,98 @@ void X2Dome::uiEvent(X2GUIExchangeInterface* uiex, const char* pszEvent)
 				snprintf(szTmpBuf, 16, nRainSensorStatus==NOT_RAINING ? "Not raining" : "Raining");
 				uiex->setPropertyString("rainStatus","text", szTmpBuf);
 			}
+            m_NexDome.getStepsPerRevCalibration(calibration);
+            if(calibration.nState == CALIBRATION_RUNNING) {
+                m_NexDome.updateStepsPerRevCalibration(bComplete);
+                m_NexDome.getStepsPerRevCalibration(calibration);
+                switch(calibration.nState) {
+                    case CALIBRATION_RUNNING :
+                        snprintf(szTmpBuf, SERIAL_BUFFER_SIZE, "Calibrating, %d home detections", calibration.nDetections);
+                        break;
+                    case CALIBRATION_DONE :
+                        // written to the controller with the other settings when OK is pressed
+                        uiex->setPropertyInt("ticksPerRev","value", calibration.nStepsPerRev);
+                        snprintf(szTmpBuf, SERIAL_BUFFER_SIZE, "%d steps per rev +/- %3.1f, hysteresis %d steps", calibration.nStepsPerRev, calibration.dUncertainty, calibration.nHysteresis);
+                        break;
+                    default :
+                        snprintf(szTmpBuf, SERIAL_BUFFER_SIZE, "Calibration failed, home sensor not seen");
+                        break;
+                }
+                uiex->setPropertyString("calibrationStatus","text", szTmpBuf);
+                if(bComplete) {
+                    uiex->setEnabled("calibrateButton",true);
+                    uiex->setEnabled("tuneButton",true);
+                    uiex->setEnabled("pushButton",true);
+                }
+            }
+            m_NexDome.getRotationTuning(tuning);
+            if(tuning.nState == TUNING_RUNNING) {
+                m_NexDome.updateRotationTuning(bComplete);
+                m_NexDome.getRotationTuning(tuning);
+                switch(tuning.nState) {
+                    case TUNING_RUNNING :
+                        snprintf(szTmpBuf, SERIAL_BUFFER_SIZE, "Tuning, testing %d of %d", tuning.nCurrent + 1, tuning.nCandidates);
+                        break;
+                    case TUNING_DONE :
+                        // the controller is back on the original settings, OK writes these
+                        uiex->setPropertyInt("rotationSpeed","value", tuning.candidates[tuning.nBest].nSpeed);
+                        uiex->setPropertyInt("rotationAcceletation","value", tuning.candidates[tuning.nBest].nAcceleration);
+                        snprintf(szTmpBuf, SERIAL_BUFFER_SIZE, "Speed %d, acceleration %d : %3.1f s of test slews", tuning.candidates[tuning.nBest].nSpeed,
+                                 tuning.candidates[tuning.nBest].nAcceleration, tuning.candidates[tuning.nBest].dSlewSeconds);
+                        break;
+                    case TUNING_FAILED :
+                        snprintf(szTmpBuf, SERIAL_BUFFER_SIZE, "Tuning failed, even the current settings aren't stable");
+                        break;
+                    default :
+                        snprintf(szTmpBuf, SERIAL_BUFFER_SIZE, "Tuning aborted");
+                        break;
+                }
+                uiex->setPropertyString("calibrationStatus","text", szTmpBuf);
+                if(bComplete) {
+                    uiex->setEnabled("calibrateButton",true);
+                    uiex->setEnabled("tuneButton",true);
+                    uiex->setEnabled("pushButton",true);
+                }
+            }
+        }
+    }
+
+    if (!strcmp(pszEvent, "on_calibrateButton_clicked"))
+    {
+        if(m_bLinked) {
+            CTracedMutexLocker ml(GetMutex(), m_NexDome, "uiEvent on_calibrateButton");
+            nErr = m_NexDome.startStepsPerRevCalibration();
+            if(nErr)
+                uiex->setPropertyString("calibrationStatus","text", "Can't calibrate while the dome is moving");
+            else {
+                uiex->setPropertyString("calibrationStatus","text", "Calibrating, 0 home detections");
+                uiex->setEnabled("calibrateButton",false);
+                uiex->setEnabled("tuneButton",false);
+                uiex->setEnabled("pushButton",false);
+            }
+        }
+    }
+
+    if (!strcmp(pszEvent, "on_tuneButton_clicked"))
+    {
+        if(m_bLinked) {
+            CTracedMutexLocker ml(GetMutex(), m_NexDome, "uiEvent on_tuneButton");
+            nErr = m_NexDome.startRotationTuning();
+            if(nErr)
+                uiex->setPropertyString("calibrationStatus","text", "Can't tune while the dome is moving");
+            else {
+                uiex->setPropertyString("calibrationStatus","text", "Tuning, testing 1");
+                uiex->setEnabled("calibrateButton",false);
+                uiex->setEnabled("tuneButton",false);
+                uiex->setEnabled("pushButton",false);
+            }
         }
     }
 
     if (!strcmp(pszEvent, "on_pushButton_clicked"))
     {
         if(m_bLinked) {
+            CTracedMutexLocker ml(GetMutex(), m_NexDome, "uiEvent on_pushButton");
             m_NexDome.resetToFactoryDefault();
             n_nbStepPerRev = m_NexDome.getNbTicksPerRev();
             uiex->setPropertyInt("ticksPerRev","value", n_nbStepPerRev);
@@ -419,8 +651,11 @@ void X2Dome::deviceInfoDetailedDescription(BasicStringInterface& str) const
 
     if(m_bLinked) {
         char cFirmware[SERIAL_BUFFER_SIZE];
-		X2MutexLocker ml(GetMutex());
-        m_NexDome.getFirmwareVersion(cFirmware, SERIAL_BUFFER_SIZE);
+        // read at connection time, no need to wait for the port
+        if(!m_NexDome.getCachedFirmwareVersion(cFirmware, SERIAL_BUFFER_SIZE)) {
+            CTracedMutexLocker ml(GetMutex(), m_NexDome, __func__);
+            m_NexDome.getFirmwareVersion(cFirmware, SERIAL_BUFFER_SIZE);
+        }
         str = cFirmware;
 
     }
@@ -455,10 +690,16 @@ double	X2Dome::driverInfoVersion(void) const
 
 int X2Dome::dapiGetAzEl(double* pdAz, double* pdEl)
 {
+    CTraceSpan dapiSpan(m_NexDome.getTrace(), TRACE_DAPI, __func__);
+
     if(!m_bLinked)
         return ERR_NOLINK;
 
-	X2MutexLocker ml(GetMutex());
+    // the position is refreshed by every response, only ask the controller when it's getting old
+    if(m_NexDome.getCachedAzEl(*pdAz, *pdEl))
+        return SB_OK;
+
+	CTracedMutexLocker ml(GetMutex(), m_NexDome, __func__);
 
     *pdAz = m_NexDome.getCurrentAz();
     *pdEl = m_NexDome.getCurrentEl();
@@ -468,13 +709,20 @@ int X2Dome::dapiGetAzEl(double* pdAz, double* pdEl)
 int X2Dome::dapiGotoAzEl(double dAz, double dEl)
 {
     int nErr;
+    CTraceSpan dapiSpan(m_NexDome.getTrace(), TRACE_DAPI, __func__);
 
     if(!m_bLinked)
         return ERR_NOLINK;
 
-	X2MutexLocker ml(GetMutex());
+	CTracedMutexLocker ml(GetMutex(), m_NexDome, __func__);
 
-    nErr = m_NexDome.gotoAzimuth(dAz);
+    // with our own geometry dAz/dEl is where the telescope points, not the dome azimuth
+    if(m_bUseGeometry)
+        nErr = m_NexDome.slaveToAltAz(dEl, dAz);
+    else {
+        m_NexDome.stopFollowing();
+        nErr = m_NexDome.gotoAzimuth(dAz, dEl);
+    }
     if(nErr)
         return ERR_CMDFAILED;
 
@@ -484,10 +732,12 @@ int X2Dome::dapiGotoAzEl(double dAz, double dEl)
 
 int X2Dome::dapiAbort(void)
 {
+    CTraceSpan dapiSpan(m_NexDome.getTrace(), TRACE_DAPI, __func__);
+
     if(!m_bLinked)
         return ERR_NOLINK;
 
-	X2MutexLocker ml(GetMutex());
+	CTracedMutexLocker ml(GetMutex(), m_NexDome, __func__);
 
     m_NexDome.abortCurrentCommand();
 
@@ -497,6 +747,7 @@ int X2Dome::dapiAbort(void)
 int X2Dome::dapiOpen(void)
 {
     int nErr;
+    CTraceSpan dapiSpan(m_NexDome.getTrace(), TRACE_DAPI, __func__);
 
     if(!m_bLinked)
         return ERR_NOLINK;
@@ -504,7 +755,7 @@ int X2Dome::dapiOpen(void)
 	if(!m_bHasShutterControl)
         return SB_OK;
 
-	X2MutexLocker ml(GetMutex());
+	CTracedMutexLocker ml(GetMutex(), m_NexDome, __func__);
 
     nErr = m_NexDome.openShutter();
     if(nErr)
@@ -516,6 +767,7 @@ int X2Dome::dapiOpen(void)
 int X2Dome::dapiClose(void)
 {
     int nErr;
+    CTraceSpan dapiSpan(m_NexDome.getTrace(), TRACE_DAPI, __func__);
 
     if(!m_bLinked)
         return ERR_NOLINK;
@@ -523,7 +775,7 @@ int X2Dome::dapiClose(void)
     if(!m_bHasShutterControl)
         return SB_OK;
 
-	X2MutexLocker ml(GetMutex());
+	CTracedMutexLocker ml(GetMutex(), m_NexDome, __func__);
 
     nErr = m_NexDome.closeShutter();
     if(nErr)
@@ -535,11 +787,12 @@ int X2Dome::dapiClose(void)
 int X2Dome::dapiPark(void)
 {
     int nErr;
+    CTraceSpan dapiSpan(m_NexDome.getTrace(), TRACE_DAPI, __func__);
 
     if(!m_bLinked)
         return ERR_NOLINK;
 
-	X2MutexLocker ml(GetMutex());
+	CTracedMutexLocker ml(GetMutex(), m_NexDome, __func__);
 
     nErr = m_NexDome.parkDome();
     if(nErr)
@@ -551,11 +804,12 @@ int X2Dome::dapiPark(void)
 int X2Dome::dapiUnpark(void)
 {
     int nErr;
+    CTraceSpan dapiSpan(m_NexDome.getTrace(), TRACE_DAPI, __func__);
 
     if(!m_bLinked)
         return ERR_NOLINK;
 
-	X2MutexLocker ml(GetMutex());
+	CTracedMutexLocker ml(GetMutex(), m_NexDome, __func__);
 
     nErr = m_NexDome.unparkDome();
     if(nErr)
@@ -567,11 +821,12 @@ int X2Dome::dapiUnpark(void)
 int X2Dome::dapiFindHome(void)
 {
     int nErr;
+    CTraceSpan dapiSpan(m_NexDome.getTrace(), TRACE_DAPI, __func__);
 
     if(!m_bLinked)
         return ERR_NOLINK;
 
-	X2MutexLocker ml(GetMutex());
+	CTracedMutexLocker ml(GetMutex(), m_NexDome, __func__);
 
 	nErr = m_NexDome.goHome();
     if(nErr)
@@ -583,21 +838,34 @@ int X2Dome::dapiFindHome(void)
 int X2Dome::dapiIsGotoComplete(bool* pbComplete)
 {
     int nErr;
+    int nHintMs;
+    CTraceSpan dapiSpan(m_NexDome.getTrace(), TRACE_DAPI, __func__);
 
     if(!m_bLinked)
         return ERR_NOLINK;
 
-	X2MutexLocker ml(GetMutex());
+	CTracedMutexLocker ml(GetMutex(), m_NexDome, __func__);
+
+    // the goto should be over soon, wait for it here rather than have TheSkyX come back a full poll later
+    nHintMs = m_NexDome.getSlewPollHint();
+    if(m_pSleeper && nHintMs > 0 && nHintMs <= GOTO_HINT_MAX_SLEEP_MS) {
+        ml.unlock();
+        m_pSleeper->sleep(nHintMs);
+        ml.lock();
+    }
 
 	nErr = m_NexDome.isGoToComplete(*pbComplete);
     if(nErr)
         return ERR_CMDFAILED;
+    if(*pbComplete)
+        saveSlewModel();
     return SB_OK;
 }
 
 int X2Dome::dapiIsOpenComplete(bool* pbComplete)
 {
     int nErr;
+    CTraceSpan dapiSpan(m_NexDome.getTrace(), TRACE_DAPI, __func__);
 
     if(!m_bLinked)
         return ERR_NOLINK;
@@ -608,7 +876,7 @@ int X2Dome::dapiIsOpenComplete(bool* pbComplete)
         return SB_OK;
     }
 
-	X2MutexLocker ml(GetMutex());
+	CTracedMutexLocker ml(GetMutex(), m_NexDome, __func__);
 
 	nErr = m_NexDome.isOpenComplete(*pbComplete);
     if(nErr)
@@ -620,6 +888,7 @@ int X2Dome::dapiIsOpenComplete(bool* pbComplete)
 int	X2Dome::dapiIsCloseComplete(bool* pbComplete)
 {
     int nErr;
+    CTraceSpan dapiSpan(m_NexDome.getTrace(), TRACE_DAPI, __func__);
 
     if(!m_bLinked)
         return ERR_NOLINK;
@@ -630,7 +899,7 @@ int	X2Dome::dapiIsCloseComplete(bool* pbComplete)
         return SB_OK;
     }
 
-	X2MutexLocker ml(GetMutex());
+	CTracedMutexLocker ml(GetMutex(), m_NexDome, __func__);
 
 	nErr = m_NexDome.isCloseComplete(*pbComplete);
     if(nErr)
@@ -642,11 +911,12 @@ int	X2Dome::dapiIsCloseComplete(bool* pbComplete)
 int X2Dome::dapiIsParkComplete(bool* pbComplete)
 {
     int nErr;
+    CTraceSpan dapiSpan(m_NexDome.getTrace(), TRACE_DAPI, __func__);
 
     if(!m_bLinked)
         return ERR_NOLINK;
 
-	X2MutexLocker ml(GetMutex());
+	CTracedMutexLocker ml(GetMutex(), m_NexDome, __func__);
 
 	nErr = m_NexDome.isParkComplete(*pbComplete);
     if(nErr)
@@ -658,11 +928,12 @@ int X2Dome::dapiIsParkComplete(bool* pbComplete)
 int X2Dome::dapiIsUnparkComplete(bool* pbComplete)
 {
     int nErr;
+    CTraceSpan dapiSpan(m_NexDome.getTrace(), TRACE_DAPI, __func__);
 
     if(!m_bLinked)
         return ERR_NOLINK;
 
-	X2MutexLocker ml(GetMutex());
+	CTracedMutexLocker ml(GetMutex(), m_NexDome, __func__);
 
 	nErr = m_NexDome.isUnparkComplete(*pbComplete);
     if(nErr)
@@ -674,11 +945,12 @@ int X2Dome::dapiIsUnparkComplete(bool* pbComplete)
 int X2Dome::dapiIsFindHomeComplete(bool* pbComplete)
 {
     int nErr;
+    CTraceSpan dapiSpan(m_NexDome.getTrace(), TRACE_DAPI, __func__);
 
     if(!m_bLinked)
         return ERR_NOLINK;
 
-	X2MutexLocker ml(GetMutex());
+	CTracedMutexLocker ml(GetMutex(), m_NexDome, __func__);
 
 	nErr = m_NexDome.isFindHomeComplete(*pbComplete);
     if(nErr)
@@ -690,11 +962,12 @@ int X2Dome::dapiIsFindHomeComplete(bool* pbComplete)
 int X2Dome::dapiSync(double dAz, double dEl)
 {
     int nErr;
+    CTraceSpan dapiSpan(m_NexDome.getTrace(), TRACE_DAPI, __func__);
 
     if(!m_bLinked)
         return ERR_NOLINK;
 
-	X2MutexLocker ml(GetMutex());
+	CTracedMutexLocker ml(GetMutex(), m_NexDome, __func__);
 
 	nErr = m_NexDome.syncDome(dAz, dEl);
     if(nErr)
@@ -737,5 +1010,22 @@ void X2Dome::portNameOnToCharPtr(char* pszPort, const int& nMaxSize) const
     
 }
 
+// only when a slew was learned since the last save, the ini file isn't rewritten on every poll
+void X2Dome::saveSlewModel()
+{
+    if(!m_pIniUtil || m_NexDome.getSlewModelSamples() == m_nSavedSlewSamples)
+        return;
+    m_pIniUtil->writeString(PARENT_KEY, CHILD_KEY_SLEW_MODEL, m_NexDome.getSlewModel().c_str());
+    m_nSavedSlewSamples = m_NexDome.getSlewModelSamples();
+}
 
+void X2Dome::saveHomeEdges()
+{
+    int nUp, nDown;
 
+    if(!m_pIniUtil)
+        return;
+    m_NexDome.getHomeEdges(nUp, nDown);
+    m_pIniUtil->writeInt(PARENT_KEY, CHILD_KEY_HOME_EDGE_UP, nUp);
+    m_pIniUtil->writeInt(PARENT_KEY, CHILD_KEY_HOME_EDGE_DOWN, nDown);
+}
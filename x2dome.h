@@ -1,6 +1,10 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+
 #include "../../licensedinterfaces/domedriverinterface.h"
 #include "../../licensedinterfaces/serialportparams2interface.h"
 #include "../../licensedinterfaces/modalsettingsdialoginterface.h"
@@ -37,6 +41,25 @@ class TickCountInterface;
 #define CHILD_KEY_HOME_ON_PARK "HomeOnPark"
 #define CHILD_KEY_HOME_ON_UNPARK "HomeOnUnpark"
 #define CHILD_KEY_LOG_RAIN_STATUS "LogRainStatus"
+#define CHILD_KEY_SHM_TELEMETRY "ShmTelemetry"
+#define CHILD_KEY_RECORD_TELEMETRY "RecordTelemetry"
+#define CHILD_KEY_METRICS_FILE "MetricsFile"
+#define CHILD_KEY_TRACE_FILE "TraceFile"
+#define CHILD_KEY_SLEW_MODEL "SlewModel"
+#define CHILD_KEY_DOME_RADIUS "DomeRadius"
+#define CHILD_KEY_SLIT_WIDTH "SlitWidth"
+#define CHILD_KEY_APERTURE "TelescopeAperture"
+#define CHILD_KEY_HOME_RESYNC "HomeResync"
+#define CHILD_KEY_HOME_EDGE_UP "HomeEdgeUp"
+#define CHILD_KEY_HOME_EDGE_DOWN "HomeEdgeDown"
+#define CHILD_KEY_LINK_WATCHDOG "LinkWatchdog"
+#define CHILD_KEY_USE_GEOMETRY "UseGeometry"
+#define CHILD_KEY_LATITUDE "Latitude"
+#define CHILD_KEY_LONGITUDE "Longitude"
+#define CHILD_KEY_MOUNT_EAST "MountEast"
+#define CHILD_KEY_MOUNT_NORTH "MountNorth"
+#define CHILD_KEY_MOUNT_UP "MountUp"
+#define CHILD_KEY_OTA_OFFSET "OtaOffset"
 
 #if defined(SB_WIN_BUILD)
 #define DEF_PORT_NAME					"COM1"
@@ -47,6 +70,68 @@ class TickCountInterface;
 #endif
 
 #define LOG_BUFFER_SIZE 256
+#define SLEW_MODEL_BUFFER_SIZE  1024
+#define GOTO_HINT_MAX_SLEEP_MS  500     // dapiIsGotoComplete waits for a goto ending sooner than this
+
+// X2MutexLocker that records how long we waited for the mutex in the metrics,
+// and when tracing, the wait and the time it was held as spans.
+// unlock()/lock() let a long call (the settings dialog) give the port back while it waits on the user.
+class CTracedMutexLocker
+{
+public:
+    CTracedMutexLocker(MutexInterface *pMutex, CNexDomeV3 &dome, const char *pszCaller)
+        : m_pMutex(pMutex), m_dome(dome), m_pszCaller(pszCaller), m_bLocked(false)
+        {
+        lock();
+        }
+
+    ~CTracedMutexLocker()
+        {
+        unlock();
+        }
+
+    void lock()
+        {
+        CStopWatch waitTimer;
+        CDomeTrace &trace = m_dome.getTrace();
+        int64_t nWaitStart;
+
+        if(m_bLocked)
+            return;
+        nWaitStart = trace.isEnabled() ? trace.now() : 0;
+        if(m_pMutex)
+            m_pMutex->lock();
+        m_bLocked = true;
+        m_dome.getMetrics().observeMutexWait(waitTimer.GetElapsedSeconds());
+        if(trace.isEnabled()) {
+            m_nLockedAt = trace.now();
+            trace.addSpan(TRACE_MUTEX, "wait", m_pszCaller, nWaitStart, m_nLockedAt);
+        }
+        }
+
+    void unlock()
+        {
+        CDomeTrace &trace = m_dome.getTrace();
+
+        if(!m_bLocked)
+            return;
+        if(trace.isEnabled())
+            trace.addSpan(TRACE_MUTEX, "held", m_pszCaller, m_nLockedAt, trace.now());
+        m_bLocked = false;
+        if(m_pMutex)
+            m_pMutex->unlock();
+        }
+
+private:
+    CTracedMutexLocker(const CTracedMutexLocker &);
+    CTracedMutexLocker &operator=(const CTracedMutexLocker &);
+
+    MutexInterface  *m_pMutex;
+    CNexDomeV3      &m_dome;
+    const char      *m_pszCaller;
+    bool            m_bLocked;
+    int64_t         m_nLockedAt;
+};
 /*!
 \brief The X2Dome example.
 
@@ -156,6 +241,11 @@ private:
 	TickCountInterface								*	m_pTickCount;
 
     void portNameOnToCharPtr(char* pszPort, const int& nMaxSize) const;
+    void saveSlewModel();
+    void saveHomeEdges();
+    void startDrain();
+    void stopDrain();
+    void drainLoop();
 
 
 	int         m_nPrivateISIndex;
@@ -167,4 +257,11 @@ private:
     char        m_szLogBuffer[LOG_BUFFER_SIZE];
 	int			m_nSavedTicksPerRev;
     bool        m_bLogRainStatus;
+    bool        m_bShmTelemetry;
+    bool        m_bRecordTelemetry;
+    bool        m_bUseGeometry;
+    int         m_nSavedSlewSamples;
+    // drains the controller's unsolicited traffic while linked, TheSkyX calls or not
+    std::thread         m_drainThread;
+    std::atomic<bool>   m_bDrainRunning;
 };